@@ -9,12 +9,19 @@
  *
  */
 
+#include "heap.h"
+#include "heap_lifetime.h"
+#include "heap_map.h"
+#include "heap_tags.h"
 #include "memory.h"
 #include <cjson/cJSON.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -38,6 +45,54 @@
  */
 #define JSON_PATH getenv("JSON_PATH")
 
+/**
+ * @brief Address space reserved for the heap of each policy
+ *
+ */
+#define POLICY_HEAP_SIZE (64 * 1024 * 1024)
+
+/**
+ * @brief Number of policies evaluated in every sampling cycle
+ *
+ */
+#define NUM_POLICIES 3
+
+/**
+ * @brief Rounds of the long-running churn workload
+ *
+ */
+#define CHURN_ROUNDS 20000
+
+/**
+ * @brief Most temporaries allocated and freed within a churn round
+ *
+ */
+#define CHURN_TEMPORARIES 8
+
+/**
+ * @brief Messages queued at once in the churn workload; each lives this many rounds
+ *
+ */
+#define CHURN_QUEUE 64
+
+/**
+ * @brief Session slots of the churn workload; one is replaced every 8 rounds on average
+ *
+ */
+#define CHURN_SESSIONS 512
+
+/**
+ * @brief Age in allocated bytes that makes an object long-lived for the churn predictor
+ *
+ */
+#define CHURN_THRESHOLD (256 * 1024)
+
+/**
+ * @brief Soft budget of the tag of each policy: the policy test stays under it, the churn sessions go over it
+ *
+ */
+#define POLICY_TAG_BUDGET (512 * 1024)
+
 /**
  * @brief Structure to store the statistics of a policy
  *
@@ -48,6 +103,34 @@ typedef struct
     double fragmentation; /**< Fragmentation percentage */
 } PolicyStats;
 
+/**
+ * @brief Structure to store the state of the heap after the churn workload
+ *
+ */
+typedef struct
+{
+    double fragmentation; /**< Fragmentation percentage over every heap used */
+    size_t footprint;     /**< Bytes between the start and the top of every heap used */
+    size_t rss;           /**< Resident bytes of every heap used */
+} ChurnStats;
+
+/**
+ * @brief A policy evaluated on its own thread and heap
+ *
+ */
+typedef struct
+{
+    int policy;               /**< Policy to test */
+    const char* name;         /**< Name of the policy in the JSON file */
+    unsigned seed;            /**< Seed of the request sequence, the same for every policy */
+    int cpu;                  /**< Core the thread is pinned to */
+    pthread_t thread;         /**< Thread running the policy */
+    PolicyStats stats;        /**< Result of the run */
+    ChurnStats churn[2];      /**< Churn workload without and with lifetime segregation */
+    int tag;                  /**< Tag every allocation of the run is charged to */
+    unsigned budget_exceeded; /**< Times the tag went over its budget in the last run */
+} PolicyRun;
+
 /**
  * @brief Calculate the fragmentation of the memory
  *
@@ -60,9 +143,50 @@ typedef struct
 double calculate_fragmentation(size_t total_free, size_t total_memory, int num_free_blocks, int total_blocks);
 
 /**
- * @brief Test a memory allocation policy
+ * @brief Test a memory allocation policy on an empty, isolated heap
  *
+ * @param heap Heap to run the requests on
  * @param policy Policy to test
- * @param policy_name Name of the policy
+ * @param seed Seed of the request sequence
+ * @return PolicyStats Time and fragmentation of the run
+ */
+PolicyStats test_policy(heap_t* heap, int policy, unsigned seed);
+
+/**
+ * @brief Run a long-running churn of temporaries, queued messages and sessions on a policy
+ *
+ * The same sequence runs with segregation off, on the heap alone, and on, where a lifetime
+ * predictor moves the sites it learns to be long-lived to a heap of their own.
+ *
+ * @param heap Heap to run the requests on
+ * @param policy Policy to test
+ * @param seed Seed of the request sequence
+ * @param segregate 1 to place predicted long-lived objects in a separate heap
+ * @return ChurnStats Fragmentation, footprint and resident memory at the end of the churn
+ */
+ChurnStats test_churn(heap_t* heap, int policy, unsigned seed, int segregate);
+
+/**
+ * @brief Budget callback of the policy tags: counts the crossings of the run
+ *
+ * @param tag Tag of the policy
+ * @param live Live bytes of the tag
+ * @param budget Budget of the tag
+ * @param arg PolicyRun of the policy
+ */
+void policy_over_budget(int tag, size_t live, size_t budget, void* arg);
+
+/**
+ * @brief Export every allocation tag, with its live bytes, operations and budget
+ *
+ * @return cJSON* Object with one entry per tag name
+ */
+cJSON* export_tags(void);
+
+/**
+ * @brief Thread body that tests one policy on a heap of its own
+ *
+ * @param arg PolicyRun describing the policy
+ * @return void* Always NULL
  */
-PolicyStats test_policy(int policy, const char* policy_name);
+void* run_policy(void* arg);
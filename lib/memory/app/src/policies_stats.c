@@ -2,6 +2,18 @@
 
 int main(void)
 {
+    PolicyRun runs[NUM_POLICIES] = {
+        {FIRST_FIT, "FIRST_FIT", 0, 0, 0, {0, 0}, {{0, 0, 0}, {0, 0, 0}}, 0, 0},
+        {BEST_FIT, "BEST_FIT", 0, 0, 0, {0, 0}, {{0, 0, 0}, {0, 0, 0}}, 0, 0},
+        {WORST_FIT, "WORST_FIT", 0, 0, 0, {0, 0}, {{0, 0, 0}, {0, 0, 0}}, 0, 0},
+    };
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned cycle = 0;
+
+    // Cada política cuenta lo que asigna en su propia etiqueta
+    for (int i = 0; i < NUM_POLICIES; i++)
+        runs[i].tag = heap_tag_create(runs[i].name, POLICY_TAG_BUDGET, policy_over_budget, &runs[i]);
+
     while (1)
     {
         // Crear el objeto JSON
@@ -15,26 +27,59 @@ int main(void)
             return 1;
         }
 
-        // Test FIRST_FIT policy
-        PolicyStats first_fit_stats = test_policy(FIRST_FIT, "FIRST FIT");
-        cJSON* first_fit_obj = cJSON_CreateObject();
-        cJSON_AddItemToObject(first_fit_obj, "time", cJSON_CreateNumber(first_fit_stats.time));
-        cJSON_AddItemToObject(first_fit_obj, "fragmentation", cJSON_CreateNumber(first_fit_stats.fragmentation));
-        cJSON_AddItemToObject(json_obj, "FIRST_FIT", first_fit_obj);
-
-        // Test BEST_FIT policy
-        PolicyStats best_fit_stats = test_policy(BEST_FIT, "BEST FIT");
-        cJSON* best_fit_obj = cJSON_CreateObject();
-        cJSON_AddItemToObject(best_fit_obj, "time", cJSON_CreateNumber(best_fit_stats.time));
-        cJSON_AddItemToObject(best_fit_obj, "fragmentation", cJSON_CreateNumber(best_fit_stats.fragmentation));
-        cJSON_AddItemToObject(json_obj, "BEST_FIT", best_fit_obj);
-
-        // Test WORST_FIT policy
-        PolicyStats worst_fit_stats = test_policy(WORST_FIT, "WORST FIT");
-        cJSON* worst_fit_obj = cJSON_CreateObject();
-        cJSON_AddItemToObject(worst_fit_obj, "time", cJSON_CreateNumber(worst_fit_stats.time));
-        cJSON_AddItemToObject(worst_fit_obj, "fragmentation", cJSON_CreateNumber(worst_fit_stats.fragmentation));
-        cJSON_AddItemToObject(json_obj, "WORST_FIT", worst_fit_obj);
+        // Todas las políticas corren a la vez, cada una en su núcleo y con la misma secuencia de pedidos
+        struct timespec start, end;
+        unsigned seed = (unsigned)time(NULL) ^ cycle;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < NUM_POLICIES; i++)
+        {
+            runs[i].seed = seed;
+            runs[i].cpu = cpus > 0 ? (int)(i % cpus) : 0;
+            if (pthread_create(&runs[i].thread, NULL, run_policy, &runs[i]) != 0)
+            {
+                runs[i].thread = 0;
+                run_policy(&runs[i]);
+            }
+        }
+        for (int i = 0; i < NUM_POLICIES; i++)
+        {
+            if (runs[i].thread)
+                pthread_join(runs[i].thread, NULL);
+            runs[i].thread = 0;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        cycle++;
+
+        for (int i = 0; i < NUM_POLICIES; i++)
+        {
+            printf("%s - TIME: %f seconds, FRAGMENTATION: %f\n", runs[i].name, runs[i].stats.time,
+                   runs[i].stats.fragmentation);
+            cJSON* policy_obj = cJSON_CreateObject();
+            cJSON_AddItemToObject(policy_obj, "time", cJSON_CreateNumber(runs[i].stats.time));
+            cJSON_AddItemToObject(policy_obj, "fragmentation", cJSON_CreateNumber(runs[i].stats.fragmentation));
+
+            // La misma carga de larga duración sin y con segregación por tiempo de vida
+            cJSON* lifetime_obj = cJSON_CreateObject();
+            for (int on = 0; on < 2; on++)
+            {
+                ChurnStats* churn = &runs[i].churn[on];
+                printf("%s - CHURN (segregation %s): FRAGMENTATION: %f, FOOTPRINT: %zu KB, RSS: %zu KB\n",
+                       runs[i].name, on ? "on" : "off", churn->fragmentation, churn->footprint / 1024,
+                       churn->rss / 1024);
+                cJSON* churn_obj = cJSON_CreateObject();
+                cJSON_AddItemToObject(churn_obj, "fragmentation", cJSON_CreateNumber(churn->fragmentation));
+                cJSON_AddItemToObject(churn_obj, "footprint", cJSON_CreateNumber((double)churn->footprint));
+                cJSON_AddItemToObject(churn_obj, "rss", cJSON_CreateNumber((double)churn->rss));
+                cJSON_AddItemToObject(lifetime_obj, on ? "on" : "off", churn_obj);
+            }
+            cJSON_AddItemToObject(policy_obj, "lifetime_segregation", lifetime_obj);
+            printf("%s - TAG: %u budget crossings\n", runs[i].name, runs[i].budget_exceeded);
+            cJSON_AddItemToObject(policy_obj, "budget_exceeded", cJSON_CreateNumber(runs[i].budget_exceeded));
+            cJSON_AddItemToObject(json_obj, runs[i].name, policy_obj);
+        }
+        cJSON_AddItemToObject(json_obj, "tags", export_tags());
+        printf("Sampling cycle: %f seconds\n\n",
+               (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9);
 
         // Escribir el objeto JSON en el archivo
         char* json_string = cJSON_Print(json_obj);
@@ -53,21 +98,87 @@ int main(void)
     return 0;
 }
 
-PolicyStats test_policy(int policy, const char* policy_name)
+void* run_policy(void* arg)
+{
+    PolicyRun* run = arg;
+    heap_t heap;
+
+    /* El hilo solo usa su propio heap: el heap por defecto no es seguro entre hilos */
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(run->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    run->budget_exceeded = 0;
+    heap_tag_set(run->tag > 0 ? run->tag : 0);
+
+    if (heap_init(&heap, NULL, POLICY_HEAP_SIZE) != 0)
+    {
+        run->stats.time = 0;
+        run->stats.fragmentation = 0;
+        return NULL;
+    }
+    run->stats = test_policy(&heap, run->policy, run->seed);
+    heap_destroy(&heap);
+
+    // Cada corrida de la carga de larga duración empieza con un heap vacío
+    for (int on = 0; on < 2; on++)
+    {
+        memset(&run->churn[on], 0, sizeof(run->churn[on]));
+        if (heap_init(&heap, NULL, POLICY_HEAP_SIZE) != 0)
+            continue;
+        run->churn[on] = test_churn(&heap, run->policy, run->seed, on);
+        heap_destroy(&heap);
+    }
+    return NULL;
+}
+
+void policy_over_budget(int tag, size_t live, size_t budget, void* arg)
+{
+    PolicyRun* run = arg;
+
+    (void)tag;
+    (void)live;
+    (void)budget;
+    // Llamado desde el hilo de la corrida, que es el único que escribe el contador
+    run->budget_exceeded++;
+}
+
+cJSON* export_tags(void)
+{
+    cJSON* tags_obj = cJSON_CreateObject();
+    heap_tag_stats_t stats;
+
+    for (int tag = 1; tag <= heap_tag_count(); tag++)
+    {
+        if (heap_tag_stats(tag, &stats) != 0)
+            continue;
+        cJSON* tag_obj = cJSON_CreateObject();
+        cJSON_AddItemToObject(tag_obj, "live", cJSON_CreateNumber((double)stats.live));
+        cJSON_AddItemToObject(tag_obj, "allocs", cJSON_CreateNumber((double)stats.allocs));
+        cJSON_AddItemToObject(tag_obj, "frees", cJSON_CreateNumber((double)stats.frees));
+        cJSON_AddItemToObject(tag_obj, "budget", cJSON_CreateNumber((double)stats.budget));
+        cJSON_AddItemToObject(tag_obj, "over", cJSON_CreateBool(stats.over));
+        cJSON_AddItemToObject(tags_obj, stats.name, tag_obj);
+    }
+    return tags_obj;
+}
+
+PolicyStats test_policy(heap_t* heap, int policy, unsigned seed)
 {
-    malloc_control(policy);
+    heap_control(heap, policy);
 
     void* allocations[NUM_ALLOCATIONS] = {0};
     size_t allocated = 0, total_free = 0, total_memory = 0;
     int num_free_blocks = 0, total_blocks = 0;
-    clock_t start, end;
+    struct timespec start, end;
     double cpu_time_used;
 
-    start = clock();
+    // Tiempo de CPU del hilo: las otras políticas corren al mismo tiempo
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
     for (int i = 0; i < NUM_ALLOCATIONS; i++)
     {
-        size_t size = rand() % MAX_ALLOCATION_SIZE + 1;
-        allocations[i] = malloc(size);
+        size_t size = rand_r(&seed) % MAX_ALLOCATION_SIZE + 1;
+        allocations[i] = heap_malloc(heap, size);
         if (allocations[i])
         {
             allocated += size;
@@ -76,10 +187,10 @@ PolicyStats test_policy(int policy, const char* policy_name)
 
     for (int i = 0; i < NUM_ALLOCATIONS / 2; i++)
     {
-        int index = rand() % NUM_ALLOCATIONS;
+        int index = rand_r(&seed) % NUM_ALLOCATIONS;
         if (allocations[index])
         {
-            free(allocations[index]);
+            heap_free(heap, allocations[index]);
             allocations[index] = NULL;
         }
     }
@@ -88,8 +199,8 @@ PolicyStats test_policy(int policy, const char* policy_name)
     {
         if (allocations[i] == NULL)
         {
-            size_t size = rand() % MAX_ALLOCATION_SIZE + 1;
-            allocations[i] = malloc(size);
+            size_t size = rand_r(&seed) % MAX_ALLOCATION_SIZE + 1;
+            allocations[i] = heap_malloc(heap, size);
             if (allocations[i])
             {
                 allocated += size;
@@ -97,38 +208,157 @@ PolicyStats test_policy(int policy, const char* policy_name)
         }
     }
 
-    end = clock();
-    cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC;
-
-    memory_usage(&allocated, &total_free);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    cpu_time_used = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
 
     // Calculate the number of free blocks and total blocks
-    t_block b = base;
-    while (b)
+    heap_blocks_t blocks;
+    heap_blocks(heap, &blocks);
+    total_blocks = (int)blocks.blocks;
+    num_free_blocks = (int)blocks.free_blocks;
+    total_free = blocks.free_bytes;
+    total_memory = blocks.used_bytes + blocks.free_bytes;
+
+    double fragmentation = calculate_fragmentation(total_free, total_memory, num_free_blocks, total_blocks);
+
+    for (int i = 0; i < NUM_ALLOCATIONS; i++)
     {
-        total_blocks++;
-        if (b->free)
+        if (allocations[i])
         {
-            num_free_blocks++;
-            total_free += b->size;
+            heap_free(heap, allocations[i]);
         }
-        total_memory += b->size;
-        b = b->next;
     }
 
-    double fragmentation = calculate_fragmentation(total_free, total_memory, num_free_blocks, total_blocks);
+    PolicyStats stats = {cpu_time_used, fragmentation};
+    return stats;
+}
 
-    printf("%s - TIME: %f seconds, FRAGMENTATION: %f\n\n", policy_name, cpu_time_used, fragmentation);
+/**
+ * @brief Allocate from the lifetime predictor, or from the heap alone when there is none
+ *
+ * Never inlined, so the return address tells apart the call sites of the churn workload.
+ *
+ * @param heap Heap used without segregation
+ * @param lt Lifetime predictor, NULL without segregation
+ * @param size Size of the request
+ * @return void* Allocated memory, or NULL
+ */
+__attribute__((noinline)) static void* churn_malloc(heap_t* heap, heap_lifetime_t* lt, size_t size)
+{
+    if (lt)
+        return heap_lifetime_malloc(lt, size, __builtin_return_address(0));
+    return heap_malloc(heap, size);
+}
 
-    for (int i = 0; i < NUM_ALLOCATIONS; i++)
+/**
+ * @brief Free memory allocated by churn_malloc
+ *
+ * @param heap Heap used without segregation
+ * @param lt Lifetime predictor, NULL without segregation
+ * @param p Memory to free
+ */
+static void churn_free(heap_t* heap, heap_lifetime_t* lt, void* p)
+{
+    if (lt)
+        heap_lifetime_free(lt, p);
+    else
+        heap_free(heap, p);
+}
+
+/**
+ * @brief Add the blocks, footprint and resident pages of a heap to the churn totals
+ *
+ * @param heap Heap to measure
+ * @param stats Footprint and resident bytes are added here
+ * @param total_free Free bytes are added here
+ * @param total_memory Bytes of every block are added here
+ * @param num_free_blocks Free blocks are added here
+ * @param total_blocks Blocks are added here
+ */
+static void measure_heap(heap_t* heap, ChurnStats* stats, size_t* total_free, size_t* total_memory,
+                         int* num_free_blocks, int* total_blocks)
+{
+    size_t free_bytes, allocated;
+    heap_usage(heap, &allocated, &free_bytes);
+    *total_free += free_bytes;
+    *total_memory += free_bytes + allocated;
+    heap_blocks_t blocks;
+    heap_blocks(heap, &blocks);
+    *total_blocks += (int)blocks.blocks;
+    *num_free_blocks += (int)blocks.free_blocks;
+
+    stats->footprint += (size_t)(heap->region.top - heap->region.start);
+
+    // Páginas presentes de la parte habilitada de la región
+    long page = sysconf(_SC_PAGESIZE);
+    size_t pages = (size_t)(heap->region.committed - heap->region.start) / (size_t)page;
+    unsigned char vec[4096];
+    for (size_t done = 0; done < pages; done += sizeof(vec))
     {
-        if (allocations[i])
+        size_t n = pages - done < sizeof(vec) ? pages - done : sizeof(vec);
+        if (mincore(heap->region.start + done * (size_t)page, n * (size_t)page, vec) != 0)
+            break;
+        for (size_t i = 0; i < n; i++)
+            stats->rss += (vec[i] & 1) ? (size_t)page : 0;
+    }
+}
+
+ChurnStats test_churn(heap_t* heap, int policy, unsigned seed, int segregate)
+{
+    ChurnStats stats = {0, 0, 0};
+    heap_lifetime_t lifetime;
+    heap_lifetime_t* lt = NULL;
+
+    heap_control(heap, policy);
+    if (segregate && heap_lifetime_init(&lifetime, heap, 0, CHURN_THRESHOLD) == 0)
+        lt = &lifetime;
+
+    void* temporaries[CHURN_TEMPORARIES];
+    void* queue[CHURN_QUEUE] = {0};
+    void* sessions[CHURN_SESSIONS] = {0};
+
+    for (int round = 0; round < CHURN_ROUNDS; round++)
+    {
+        // Temporales que se liberan al terminar la vuelta
+        int n = rand_r(&seed) % CHURN_TEMPORARIES + 1;
+        for (int i = 0; i < n; i++)
+            temporaries[i] = churn_malloc(heap, lt, (size_t)(rand_r(&seed) % 497 + 16));
+
+        // Mensajes que viven CHURN_QUEUE vueltas
+        int slot = round % CHURN_QUEUE;
+        if (queue[slot])
+            churn_free(heap, lt, queue[slot]);
+        queue[slot] = churn_malloc(heap, lt, (size_t)(rand_r(&seed) % 961 + 64));
+
+        // Sesiones que se reemplazan de a una, mucho más tarde
+        if (rand_r(&seed) % 8 == 0)
         {
-            free(allocations[i]);
+            int s = rand_r(&seed) % CHURN_SESSIONS;
+            if (sessions[s])
+                churn_free(heap, lt, sessions[s]);
+            sessions[s] = churn_malloc(heap, lt, (size_t)(rand_r(&seed) % 1921 + 128));
         }
+
+        for (int i = n - 1; i >= 0; i--)
+            churn_free(heap, lt, temporaries[i]);
     }
 
-    PolicyStats stats = {cpu_time_used, fragmentation};
+    size_t total_free = 0, total_memory = 0;
+    int num_free_blocks = 0, total_blocks = 0;
+    measure_heap(heap, &stats, &total_free, &total_memory, &num_free_blocks, &total_blocks);
+    if (lt)
+        measure_heap(&lt->long_heap, &stats, &total_free, &total_memory, &num_free_blocks, &total_blocks);
+    if (total_blocks)
+        stats.fragmentation = calculate_fragmentation(total_free, total_memory, num_free_blocks, total_blocks);
+
+    for (int i = 0; i < CHURN_QUEUE; i++)
+        if (queue[i])
+            churn_free(heap, lt, queue[i]);
+    for (int i = 0; i < CHURN_SESSIONS; i++)
+        if (sessions[i])
+            churn_free(heap, lt, sessions[i]);
+    if (lt)
+        heap_lifetime_destroy(lt);
     return stats;
 }
 
@@ -0,0 +1,267 @@
+/**
+ * @file memory_bench.h
+ * @brief Allocator benchmark suite
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Seeded, reproducible workloads that drive malloc/free/realloc and report
+ * throughput, latency percentiles, heap footprint, RSS and fragmentation as
+ * JSON. The same sources are built twice: linked against my_memory
+ * (memory_bench) and against the C library allocator (memory_bench_glibc),
+ * which the former runs as a child process to report both side by side.
+ * memory_bench_<variant> links a single-policy build of my_memory, such as
+ * my_memory_tlsf, so --variants can compare specialized and generic builds,
+ * and memory_bench_noprobes links my_memory without its USDT probes so
+ * --probe-overhead can show what they cost when no tracer is attached.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Default seed for the workload generators
+ *
+ */
+#define BENCH_DEFAULT_SEED 42
+
+/**
+ * @brief Default tolerance for the regression mode (10% slowdown)
+ *
+ */
+#define BENCH_DEFAULT_TOLERANCE 0.10
+
+/**
+ * @brief Exact latency buckets (one per nanosecond) before the log-linear part
+ *
+ */
+#define BENCH_HIST_LINEAR 128
+
+/**
+ * @brief Sub-buckets per power of two in the log-linear part of the histogram
+ *
+ */
+#define BENCH_HIST_SUB 64
+
+/**
+ * @brief Total number of latency histogram buckets (covers up to 2^63 ns)
+ *
+ */
+#define BENCH_HIST_BUCKETS (BENCH_HIST_LINEAR + (64 - 7) * BENCH_HIST_SUB)
+
+/**
+ * @brief Heap footprint is sampled every this many operations
+ *
+ */
+#define BENCH_HEAP_SAMPLE 256
+
+/**
+ * @brief RSS is sampled every this many heap samples
+ *
+ */
+#define BENCH_RSS_SAMPLE 16
+
+/**
+ * @brief Maximum number of workload specific counters in a result
+ *
+ */
+#define BENCH_MAX_EXTRA 16
+
+/**
+ * @brief Name of the allocator the binary was linked against
+ *
+ */
+#ifdef BENCH_GLIBC
+#define BENCH_ALLOCATOR "glibc"
+#elif defined(BENCH_VARIANT)
+#define BENCH_ALLOCATOR "my_memory_" BENCH_VARIANT
+#elif defined(BENCH_NOPROBES)
+#define BENCH_ALLOCATOR "my_memory_noprobes"
+#else
+#define BENCH_ALLOCATOR "my_memory"
+#endif
+
+/**
+ * @brief Workload specific counter reported next to the standard metrics
+ *
+ */
+typedef struct
+{
+    const char* name; /**< JSON key of the counter */
+    double value;     /**< Counter value */
+} BenchExtra;
+
+/**
+ * @brief Measurements collected while a workload runs
+ *
+ */
+typedef struct
+{
+    uint64_t rng;                      /**< xorshift64* state, seeded per workload */
+    double scale;                      /**< Multiplier applied to every workload's operation count */
+    uint64_t ops;                      /**< Allocator calls performed */
+    uint64_t op_ns;                    /**< Nanoseconds spent inside the allocator */
+    uint64_t max_ns;                   /**< Slowest single allocator call */
+    uint64_t hist[BENCH_HIST_BUCKETS]; /**< Latency histogram */
+    size_t live;                       /**< Bytes currently requested and not freed */
+    size_t peak_live;                  /**< Maximum of live */
+    size_t heap_start;                 /**< Heap footprint when the workload started */
+    size_t peak_heap;                  /**< Maximum heap footprint above heap_start */
+    size_t peak_rss;                   /**< Maximum sampled resident set size */
+    unsigned samples;                  /**< Heap samples taken, drives RSS sampling */
+    uint64_t moves;                    /**< Reallocs that returned a different address */
+    uint64_t moved_bytes;              /**< Bytes those reallocs had to copy */
+    BenchExtra extra[BENCH_MAX_EXTRA]; /**< Workload specific counters */
+    int num_extra;                     /**< Entries used in extra */
+} BenchContext;
+
+/**
+ * @brief A benchmark workload
+ *
+ */
+typedef struct
+{
+    const char* name;               /**< Name used on the command line and in the report */
+    const char* description;        /**< One line description */
+    void (*run)(BenchContext* ctx); /**< Runs the workload, all allocations must be freed on return */
+} Workload;
+
+/**
+ * @brief Table of available workloads, terminated by an entry with a NULL name
+ *
+ */
+extern const Workload bench_workloads[];
+
+/**
+ * @brief Resets a context and seeds its generator
+ *
+ * @param ctx Context to reset
+ * @param seed Seed for the workload generator
+ * @param scale Operation count multiplier
+ */
+void bench_init(BenchContext* ctx, uint64_t seed, double scale);
+
+/**
+ * @brief Returns the next pseudo random number of the context generator
+ *
+ * @param ctx Benchmark context
+ * @return uint64_t Pseudo random number
+ */
+uint64_t bench_rand(BenchContext* ctx);
+
+/**
+ * @brief Returns a uniformly distributed number in [lo, hi]
+ *
+ * @param ctx Benchmark context
+ * @param lo Lower bound
+ * @param hi Upper bound
+ * @return size_t Pseudo random number
+ */
+size_t bench_range(BenchContext* ctx, size_t lo, size_t hi);
+
+/**
+ * @brief Returns a size drawn from a bounded Pareto distribution
+ *
+ * @param ctx Benchmark context
+ * @param lo Smallest size
+ * @param hi Largest size
+ * @param alpha Shape of the distribution, smaller values give heavier tails
+ * @return size_t Pseudo random size
+ */
+size_t bench_power_law(BenchContext* ctx, size_t lo, size_t hi, double alpha);
+
+/**
+ * @brief Scales an operation count by the context scale
+ *
+ * @param ctx Benchmark context
+ * @param n Operation count at scale 1
+ * @return size_t Scaled operation count, at least 1
+ */
+size_t bench_scaled(const BenchContext* ctx, size_t n);
+
+/**
+ * @brief Timed malloc that updates the context counters
+ *
+ * @param ctx Benchmark context
+ * @param size Bytes to allocate
+ * @return void* Allocated memory
+ */
+void* bench_malloc(BenchContext* ctx, size_t size);
+
+/**
+ * @brief Timed free that updates the context counters
+ *
+ * @param ctx Benchmark context
+ * @param ptr Memory to free
+ * @param size Size that was requested for ptr
+ */
+void bench_free(BenchContext* ctx, void* ptr, size_t size);
+
+/**
+ * @brief Timed realloc that updates the context counters
+ *
+ * @param ctx Benchmark context
+ * @param ptr Memory to resize
+ * @param old_size Size that was requested for ptr
+ * @param size New size
+ * @return void* Resized memory
+ */
+void* bench_realloc(BenchContext* ctx, void* ptr, size_t old_size, size_t size);
+
+/**
+ * @brief Allocates bookkeeping memory outside the heap under test
+ *
+ * @param size Bytes to allocate, zero filled
+ * @return void* Mapped memory, NULL on failure
+ */
+void* bench_scratch(size_t size);
+
+/**
+ * @brief Releases memory returned by bench_scratch
+ *
+ * @param ptr Mapped memory
+ * @param size Size passed to bench_scratch
+ */
+void bench_scratch_free(void* ptr, size_t size);
+
+/**
+ * @brief Records a workload specific counter in the result
+ *
+ * @param ctx Benchmark context
+ * @param name JSON key, must be a string literal
+ * @param value Counter value
+ */
+void bench_extra(BenchContext* ctx, const char* name, double value);
+
+/**
+ * @brief Current heap footprint of the allocator under test
+ *
+ * @return size_t Bytes obtained from the operating system for the heap
+ */
+size_t bench_heap_bytes(void);
+
+/**
+ * @brief Current resident set size of the process
+ *
+ * @return size_t Resident bytes
+ */
+size_t bench_rss_bytes(void);
+
+/**
+ * @brief Latency percentile from the context histogram
+ *
+ * @param ctx Benchmark context
+ * @param percentile Percentile in [0, 100]
+ * @return uint64_t Latency in nanoseconds
+ */
+uint64_t bench_percentile(const BenchContext* ctx, double percentile);
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ *
+ * @return uint64_t Nanoseconds
+ */
+uint64_t bench_now_ns(void);
@@ -0,0 +1,229 @@
+#include "heap_check.h"
+#include "heap_map.h"
+#include <cjson/cJSON.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Largest request of the heaps built for the benchmark */
+#define MAX_REQUEST 256
+
+/** Address space reserved per block, enough for the largest request and its header */
+#define BYTES_PER_BLOCK (MAX_REQUEST + 64)
+
+/**
+ * @brief Command line options of the heap check benchmark
+ *
+ */
+typedef struct
+{
+    size_t blocks;      /**< Blocks of the heap */
+    int threads;        /**< Threads of the parallel check */
+    int reps;           /**< Repetitions of every measure, the best one is reported */
+    const char* output; /**< Report path, stdout when NULL */
+} CheckOptions;
+
+/**
+ * @brief Nanoseconds of the monotonic clock
+ *
+ * @return uint64_t Current time
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Fills a heap with random blocks and frees one in three, so free blocks are spread over all of it
+ *
+ * @param h Heap
+ * @param blocks Blocks to allocate
+ * @return int 0 if every block fit
+ */
+static int build_heap(heap_t* h, size_t blocks)
+{
+    void** p = malloc(blocks * sizeof(*p));
+    unsigned seed = 11;
+
+    if (!p)
+        return -1;
+    // Without the map every first fit would walk all the blocks allocated so far
+    heap_map(h, 1);
+    for (size_t i = 0; i < blocks; i++)
+    {
+        if (!(p[i] = heap_malloc(h, (size_t)(rand_r(&seed) % MAX_REQUEST) + 1)))
+        {
+            free(p);
+            return -1;
+        }
+    }
+    // The last block stays in use: a free tail would be given back
+    for (size_t i = 0; i + 1 < blocks; i += 3)
+        heap_free(h, p[i]);
+    free(p);
+    return 0;
+}
+
+/**
+ * @brief Best time of a full check, serial with one thread or parallel with more
+ *
+ * @param h Heap
+ * @param threads Threads of the check
+ * @param reps Repetitions
+ * @param report Receives the report of the last check
+ * @return double Seconds of the fastest check
+ */
+static double time_check(heap_t* h, int threads, int reps, heap_report_t* report)
+{
+    double best = 0;
+
+    for (int r = 0; r < reps; r++)
+    {
+        uint64_t start = now_ns();
+        if (threads > 1)
+            heap_check_heap_parallel(h, report, threads);
+        else
+            heap_check_heap(h, report);
+        double seconds = (double)(now_ns() - start) / 1e9;
+        if (!r || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+/**
+ * @brief Checks the heap serially and in parallel and asserts the parallel check divides the work
+ *
+ * The steps are the blocks walked by the busiest thread. Splitting by address
+ * has to leave every thread close to its share; a serial walk on the calling
+ * thread before the workers start, or a range redone after them, shows up
+ * there. Wall time can only drop with as many CPUs as threads, so the time
+ * assertion is skipped on smaller machines.
+ *
+ * @param h Heap
+ * @param opts Options
+ * @param failed Set to 1 when an assertion fails
+ * @return cJSON* Times, steps and the outcome of the assertions
+ */
+static cJSON* run_layout(heap_t* h, const CheckOptions* opts, int* failed)
+{
+    heap_report_t serial, parallel;
+    double serial_s = time_check(h, 1, opts->reps, &serial);
+    double parallel_s = time_check(h, opts->threads, opts->reps, &parallel);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    // Equal address ranges hold about the same blocks: the busiest one gets at most twice its share
+    int steps_ok = parallel.longest * (size_t)opts->threads <= 2 * parallel.blocks;
+    int same = !serial.errors && !parallel.errors && serial.blocks == parallel.blocks &&
+               serial.free_bytes == parallel.free_bytes && serial.used_bytes == parallel.used_bytes;
+    int timed = cpus >= opts->threads;
+    int time_ok = !timed || parallel_s < serial_s;
+    cJSON* result = cJSON_CreateObject();
+
+    if (!steps_ok || !same || !time_ok)
+        *failed = 1;
+    cJSON_AddNumberToObject(result, "blocks", (double)serial.blocks);
+    cJSON_AddNumberToObject(result, "serial_seconds", serial_s);
+    cJSON_AddNumberToObject(result, "parallel_seconds", parallel_s);
+    cJSON_AddNumberToObject(result, "serial_steps", (double)serial.longest);
+    cJSON_AddNumberToObject(result, "parallel_steps", (double)parallel.longest);
+    cJSON_AddBoolToObject(result, "reports_match", same);
+    cJSON_AddBoolToObject(result, "steps_speedup", steps_ok);
+    if (timed)
+        cJSON_AddBoolToObject(result, "time_speedup", time_ok);
+    fprintf(stderr, "%-12s %12zu %12zu %8.1fx %12.3f %12.3f %8.1fx%s\n", h->map.starts ? "block_map" : "headers",
+            serial.longest, parallel.longest, parallel.longest ? (double)serial.longest / (double)parallel.longest : 0,
+            serial_s * 1e3, parallel_s * 1e3, parallel_s > 0 ? serial_s / parallel_s : 0,
+            timed ? "" : " (fewer CPUs than threads, time not asserted)");
+    return result;
+}
+
+/**
+ * @brief Prints the command line help
+ *
+ * @param prog Program name
+ */
+static void usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  --blocks N      blocks of the heap (default 1048576)\n");
+    printf("  --threads N     threads of the parallel check, at most %d (default 4)\n", HEAP_CHECK_MAX_THREADS);
+    printf("  --reps N        repetitions of every measure, the fastest is reported (default 5)\n");
+    printf("  --output FILE   write the JSON report to FILE instead of stdout\n");
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option long_opts[] = {
+        {"blocks", required_argument, NULL, 'b'}, {"threads", required_argument, NULL, 't'},
+        {"reps", required_argument, NULL, 'r'},   {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},         {NULL, 0, NULL, 0},
+    };
+    CheckOptions opts = {1 << 20, 4, 5, NULL};
+    heap_t h;
+    int failed = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'b':
+            opts.blocks = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            opts.threads = atoi(optarg);
+            break;
+        case 'r':
+            opts.reps = atoi(optarg);
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.blocks < 2 || opts.threads < 2 || opts.threads > HEAP_CHECK_MAX_THREADS || opts.reps < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (heap_init(&h, NULL, opts.blocks * BYTES_PER_BLOCK) != 0 || build_heap(&h, opts.blocks) != 0)
+    {
+        fprintf(stderr, "heap could not be built\n");
+        return 1;
+    }
+
+    cJSON* report = cJSON_CreateObject();
+    cJSON_AddNumberToObject(report, "threads", opts.threads);
+    cJSON_AddNumberToObject(report, "cpus", (double)sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(stderr, "%-12s %12s %12s %9s %12s %12s %9s\n", "layout", "serial steps", "par. steps", "speedup",
+            "serial ms", "parallel ms", "speedup");
+    // Same blocks in both layouts: the parallel check finds its cut points through the map or by scanning
+    cJSON_AddItemToObject(report, "block_map", run_layout(&h, &opts, &failed));
+    heap_map(&h, 0);
+    cJSON_AddItemToObject(report, "inline_headers", run_layout(&h, &opts, &failed));
+    cJSON_AddBoolToObject(report, "passed", !failed);
+    heap_destroy(&h);
+
+    char* json_string = cJSON_Print(report);
+    FILE* file = opts.output ? fopen(opts.output, "w") : stdout;
+    if (file == NULL)
+    {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(file, "%s\n", json_string);
+    if (file != stdout)
+        fclose(file);
+    free(json_string);
+    cJSON_Delete(report);
+    return failed;
+}
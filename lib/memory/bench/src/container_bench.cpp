@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <chrono>
+#include <cjson/cJSON.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <list>
+#include <memory_resource>
+#include <random>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#ifndef BENCH_GLIBC
+#include "memory_resource.hpp"
+#endif
+
+/** Name of the allocator under test in the report */
+#ifdef BENCH_GLIBC
+#define BENCH_ALLOCATOR "glibc"
+#else
+#define BENCH_ALLOCATOR "my_memory"
+#endif
+
+/** Elements pushed into each vector */
+#define VECTOR_ELEMENTS (1 << 16)
+
+/** Keys inserted into each unordered_map */
+#define MAP_KEYS (1 << 15)
+
+/** Pushes and pops on each list */
+#define LIST_OPS (1 << 16)
+
+/** Containers built and destroyed per measurement, released in bulk after each one */
+#define ROUNDS 8
+
+/**
+ * @brief Command line options of the container benchmark
+ *
+ */
+struct Options
+{
+    uint64_t seed = 42;           /**< Seed of the key and length sequences */
+    double scale = 1.0;           /**< Operation count multiplier */
+    const char* output = nullptr; /**< Report path, stdout when null */
+    bool glibc = true;            /**< Run the glibc build side by side */
+    size_t fastbins = 0;          /**< Largest block size parked in fast bins, 0 when disabled */
+};
+
+/**
+ * @brief A memory resource under test, with the bulk release done between rounds
+ *
+ */
+struct Resource
+{
+    const char* name;                            /**< Name in the report */
+    std::pmr::memory_resource* mr;               /**< Resource the containers allocate from */
+    void (*release)(std::pmr::memory_resource*); /**< Bulk release after each round, or null */
+};
+
+/**
+ * @brief Nanoseconds of the steady clock
+ *
+ * @return uint64_t Current time
+ */
+static uint64_t now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Grows vectors one push_back at a time, as a parser filling a buffer would
+ *
+ * @param mr Resource of the vectors
+ * @param n Elements per vector
+ * @return uint64_t Operations performed
+ */
+static uint64_t run_vector(std::pmr::memory_resource* mr, size_t n, std::mt19937_64&)
+{
+    std::pmr::vector<uint64_t> v(mr);
+    for (size_t i = 0; i < n; i++)
+        v.push_back(i);
+    return n;
+}
+
+/**
+ * @brief Inserts random keys, then erases half of them in another random order
+ *
+ * @param mr Resource of the map
+ * @param n Keys inserted
+ * @param rng Key generator
+ * @return uint64_t Operations performed
+ */
+static uint64_t run_map(std::pmr::memory_resource* mr, size_t n, std::mt19937_64& rng)
+{
+    std::pmr::unordered_map<uint64_t, uint64_t> m(mr);
+    std::vector<uint64_t> keys(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        keys[i] = rng();
+        m.emplace(keys[i], i);
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (size_t i = 0; i < n / 2; i++)
+        m.erase(keys[i]);
+    return n + n / 2;
+}
+
+/**
+ * @brief Keeps a queue of list nodes, pushing at the back and popping at the front in random bursts
+ *
+ * @param mr Resource of the list
+ * @param n Pushes performed
+ * @param rng Burst generator
+ * @return uint64_t Operations performed
+ */
+static uint64_t run_list(std::pmr::memory_resource* mr, size_t n, std::mt19937_64& rng)
+{
+    std::pmr::list<uint64_t> l(mr);
+    uint64_t ops = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        l.push_back(i);
+        ops++;
+        if (rng() % 4 == 0)
+        {
+            for (size_t burst = rng() % 8; burst && !l.empty(); burst--, ops++)
+                l.pop_front();
+        }
+    }
+    return ops;
+}
+
+/**
+ * @brief A container workload
+ *
+ */
+struct Workload
+{
+    const char* name;                                                      /**< Name in the report */
+    size_t n;                                                              /**< Operations per round at scale 1 */
+    uint64_t (*run)(std::pmr::memory_resource*, size_t, std::mt19937_64&); /**< Body of one round */
+};
+
+/** Workloads of the container benchmark */
+static const Workload workloads[] = {
+    {"vector", VECTOR_ELEMENTS, run_vector},
+    {"unordered_map", MAP_KEYS, run_map},
+    {"list", LIST_OPS, run_list},
+};
+
+/**
+ * @brief Runs every workload on every resource
+ *
+ * @param opts Options
+ * @param resources Resources under test
+ * @param count Entries in resources
+ * @return cJSON* Results by workload and resource
+ */
+static cJSON* run_all(const Options& opts, const Resource* resources, size_t count)
+{
+    cJSON* results = cJSON_CreateObject();
+    for (const Workload& w : workloads)
+    {
+        cJSON* by_resource = cJSON_AddObjectToObject(results, w.name);
+        size_t n = (size_t)((double)w.n * opts.scale);
+        for (size_t r = 0; r < count; r++)
+        {
+            // Every resource sees the same sequence
+            std::mt19937_64 rng(opts.seed);
+            uint64_t ops = 0;
+            uint64_t start = now_ns();
+            for (int round = 0; round < ROUNDS; round++)
+            {
+                ops += w.run(resources[r].mr, n, rng);
+                if (resources[r].release)
+                    resources[r].release(resources[r].mr);
+            }
+            double seconds = (double)(now_ns() - start) / 1e9;
+
+            cJSON* result = cJSON_AddObjectToObject(by_resource, resources[r].name);
+            cJSON_AddNumberToObject(result, "ops", (double)ops);
+            cJSON_AddNumberToObject(result, "seconds", seconds);
+            cJSON_AddNumberToObject(result, "ops_per_sec", seconds > 0 ? (double)ops / seconds : 0);
+        }
+    }
+    return results;
+}
+
+#ifndef BENCH_GLIBC
+/**
+ * @brief Runs the glibc build of the benchmark in its own process
+ *
+ * @param opts Options
+ * @return cJSON* Results of the glibc build, null if it failed
+ */
+static cJSON* run_glibc(const Options& opts)
+{
+    char out[] = "/tmp/memory_bench_containers_XXXXXX";
+    char seed[32], scale[32];
+    int fd = mkstemp(out);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return nullptr;
+    }
+    close(fd);
+
+    snprintf(seed, sizeof(seed), "%llu", (unsigned long long)opts.seed);
+    snprintf(scale, sizeof(scale), "%g", opts.scale);
+    const char* args[] = {BENCH_GLIBC_PATH, "--seed", seed, "--scale", scale, "--output", out, nullptr};
+
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execv(args[0], (char* const*)args);
+        perror("execv");
+        _exit(127);
+    }
+
+    int status = 0;
+    cJSON* report = nullptr;
+    if (pid > 0 && waitpid(pid, &status, 0) >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        FILE* file = fopen(out, "r");
+        if (file)
+        {
+            std::vector<char> text;
+            char buf[4096];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+                text.insert(text.end(), buf, buf + n);
+            text.push_back('\0');
+            fclose(file);
+            report = cJSON_Parse(text.data());
+        }
+    }
+    else
+        fprintf(stderr, "glibc run failed, see %s\n", BENCH_GLIBC_PATH);
+    unlink(out);
+
+    cJSON* results = cJSON_DetachItemFromObject(report, "glibc");
+    cJSON_Delete(report);
+    return results;
+}
+
+/**
+ * @brief Prints a results table, with the throughput relative to the glibc default resource when available
+ *
+ * @param report Report with the results of every build
+ */
+static void print_table(const cJSON* report)
+{
+    const cJSON* glibc = cJSON_GetObjectItem(report, "glibc");
+    const cJSON* build = nullptr;
+
+    fprintf(stderr, "%-10s %-14s %-10s %14s %10s\n", "build", "container", "resource", "ops/s", "vs glibc");
+    cJSON_ArrayForEach(build, report)
+    {
+        const cJSON* w = nullptr;
+        cJSON_ArrayForEach(w, build)
+        {
+            const cJSON* base = cJSON_GetObjectItem(cJSON_GetObjectItem(cJSON_GetObjectItem(glibc, w->string),
+                                                                        "default"),
+                                                    "ops_per_sec");
+            const cJSON* r = nullptr;
+            cJSON_ArrayForEach(r, w)
+            {
+                double ops = cJSON_GetNumberValue(cJSON_GetObjectItem(r, "ops_per_sec"));
+                if (cJSON_IsNumber(base) && cJSON_GetNumberValue(base) > 0)
+                    fprintf(stderr, "%-10s %-14s %-10s %14.0f %9.2fx\n", build->string, w->string, r->string, ops,
+                            ops / cJSON_GetNumberValue(base));
+                else
+                    fprintf(stderr, "%-10s %-14s %-10s %14.0f %10s\n", build->string, w->string, r->string, ops, "-");
+            }
+        }
+    }
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    static const struct option long_options[] = {
+        {"seed", required_argument, nullptr, 's'},     {"scale", required_argument, nullptr, 'x'},
+        {"output", required_argument, nullptr, 'o'},   {"no-glibc", no_argument, nullptr, 'g'},
+        {"fastbins", required_argument, nullptr, 'f'}, {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    Options opts;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_options, nullptr)) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            opts.seed = strtoull(optarg, nullptr, 0);
+            break;
+        case 'x':
+            opts.scale = strtod(optarg, nullptr);
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        case 'g':
+            opts.glibc = false;
+            break;
+        case 'f':
+            opts.fastbins = strtoul(optarg, nullptr, 0);
+            break;
+        default:
+            printf("Usage: %s [--seed N] [--scale F] [--output FILE] [--no-glibc] [--fastbins N]\n", argv[0]);
+            printf("Builds vectors, unordered_maps and lists on each memory resource and reports ops/s\n");
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    // The default resource goes through the global operator new, which is the library's in this build
+#ifdef BENCH_GLIBC
+    std::pmr::monotonic_buffer_resource monotonic;
+    Resource resources[] = {
+        {"default", std::pmr::new_delete_resource(), nullptr},
+        {"monotonic", &monotonic,
+         [](std::pmr::memory_resource* mr) { static_cast<std::pmr::monotonic_buffer_resource*>(mr)->release(); }},
+    };
+#else
+    my_memory::heap_resource heap(std::size_t(1) << 30);
+    my_memory::monotonic_resource monotonic;
+    if (opts.fastbins && (malloc_fastbins(opts.fastbins) != 0 || heap_fastbins(heap.heap(), opts.fastbins) != 0))
+    {
+        fprintf(stderr, "Invalid fast bin size %zu\n", opts.fastbins);
+        return 1;
+    }
+    Resource resources[] = {
+        {"default", std::pmr::new_delete_resource(), nullptr},
+        {"heap", &heap, nullptr},
+        {"monotonic", &monotonic,
+         [](std::pmr::memory_resource* mr) { static_cast<my_memory::monotonic_resource*>(mr)->release(); }},
+    };
+#endif
+
+    cJSON* report = cJSON_CreateObject();
+    cJSON_AddItemToObject(report, BENCH_ALLOCATOR, run_all(opts, resources, sizeof(resources) / sizeof(*resources)));
+#ifndef BENCH_GLIBC
+    cJSON* glibc = opts.glibc ? run_glibc(opts) : nullptr;
+    if (glibc)
+        cJSON_AddItemToObject(report, "glibc", glibc);
+    print_table(report);
+#endif
+
+    char* text = cJSON_Print(report);
+    FILE* file = opts.output ? fopen(opts.output, "w") : stdout;
+    if (file == nullptr)
+    {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(file, "%s\n", text);
+    if (file != stdout)
+        fclose(file);
+    cJSON_free(text);
+    cJSON_Delete(report);
+    return 0;
+}
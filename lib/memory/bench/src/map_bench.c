@@ -0,0 +1,278 @@
+#include "heap_map.h"
+#include <cjson/cJSON.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** Largest request of the heaps built for the benchmark */
+#define MAX_REQUEST 256
+
+/** Address space reserved per block, enough for the largest request and its header */
+#define BYTES_PER_BLOCK (MAX_REQUEST + 64)
+
+/**
+ * @brief Command line options of the block map benchmark
+ *
+ */
+typedef struct
+{
+    size_t min_blocks;  /**< Smallest heap, in blocks */
+    size_t max_blocks;  /**< Largest heap, in blocks; counts double from min_blocks */
+    int reps;           /**< Repetitions of every measure, the best one is reported */
+    const char* output; /**< Report path, stdout when NULL */
+} MapOptions;
+
+/**
+ * @brief Nanoseconds of the monotonic clock
+ *
+ * @return uint64_t Current time
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Fills a heap with random blocks and frees one in three, so free blocks are spread over all of it
+ *
+ * @param h Heap
+ * @param blocks Blocks to allocate
+ * @return int 0 if every block fit
+ */
+static int build_heap(heap_t* h, size_t blocks)
+{
+    void** p = malloc(blocks * sizeof(*p));
+    unsigned seed = 7;
+
+    if (!p)
+        return -1;
+    // Without the map every first fit would walk all the blocks allocated so far
+    heap_map(h, 1);
+    for (size_t i = 0; i < blocks; i++)
+    {
+        if (!(p[i] = heap_malloc(h, (size_t)(rand_r(&seed) % MAX_REQUEST) + 1)))
+        {
+            free(p);
+            return -1;
+        }
+    }
+    // The last block stays in use: a free tail would be given back
+    for (size_t i = 0; i + 1 < blocks; i += 3)
+        heap_free(h, p[i]);
+    free(p);
+    return heap_map(h, 0);
+}
+
+/**
+ * @brief Best time of a full walk counting blocks and bytes
+ *
+ * @param h Heap
+ * @param reps Repetitions
+ * @param counted Receives the blocks counted, to check both walks agree
+ * @return double Seconds of the fastest walk
+ */
+static double time_walk(heap_t* h, int reps, heap_blocks_t* counted)
+{
+    double best = 0;
+
+    for (int r = 0; r < reps; r++)
+    {
+        uint64_t start = now_ns();
+        heap_blocks(h, counted);
+        double seconds = (double)(now_ns() - start) / 1e9;
+        if (!r || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+/**
+ * @brief Best time of a search that has to look at every free block
+ *
+ * With a request larger than any free block first fit misses after the whole
+ * heap and extends it, and the free right after gives the tail back. Worst
+ * fit always visits every free block; the free fuses the part it took back
+ * into the rest. Either way the heap is left as it was.
+ *
+ * @param h Heap
+ * @param policy FIRST_FIT or WORST_FIT
+ * @param size Request
+ * @param reps Repetitions
+ * @return double Seconds of the fastest malloc and free pair
+ */
+static double time_search(heap_t* h, int policy, size_t size, int reps)
+{
+    double best = 0;
+
+    heap_control(h, policy);
+    for (int r = 0; r < reps; r++)
+    {
+        uint64_t start = now_ns();
+        void* p = heap_malloc(h, size);
+        heap_free(h, p);
+        double seconds = (double)(now_ns() - start) / 1e9;
+        if (!r || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+/**
+ * @brief Measures one heap walked through the headers and then through the map
+ *
+ * @param blocks Blocks of the heap
+ * @param reps Repetitions of every measure
+ * @return cJSON* Times by layout, or NULL if the heap could not be built
+ */
+static cJSON* run_size(size_t blocks, int reps)
+{
+    heap_t h;
+    heap_blocks_t by_list, by_map;
+    cJSON* result = NULL;
+
+    if (heap_init(&h, NULL, blocks * BYTES_PER_BLOCK) != 0)
+        return NULL;
+    if (build_heap(&h, blocks) == 0)
+    {
+        // Same blocks in both layouts: the map is built again over the finished heap
+        double walk_list = time_walk(&h, reps, &by_list);
+        double first_list = time_search(&h, FIRST_FIT, MAX_REQUEST * 4, reps);
+        double worst_list = time_search(&h, WORST_FIT, MAX_REQUEST / 4, reps);
+        uint64_t start = now_ns();
+        heap_map(&h, 1);
+        double build_map = (double)(now_ns() - start) / 1e9;
+        double walk_map = time_walk(&h, reps, &by_map);
+        double first_map = time_search(&h, FIRST_FIT, MAX_REQUEST * 4, reps);
+        double worst_map = time_search(&h, WORST_FIT, MAX_REQUEST / 4, reps);
+
+        result = cJSON_CreateObject();
+        cJSON_AddNumberToObject(result, "blocks", (double)by_list.blocks);
+        cJSON_AddNumberToObject(result, "free_blocks", (double)by_list.free_blocks);
+        cJSON_AddNumberToObject(result, "heap_bytes", (double)(h.region.top - h.region.start));
+        cJSON_AddNumberToObject(result, "map_bytes", (double)(2 * h.map.words * sizeof(uint64_t)));
+        cJSON_AddBoolToObject(result, "counts_match",
+                              by_list.blocks == by_map.blocks && by_list.free_bytes == by_map.free_bytes);
+        cJSON_AddNumberToObject(result, "map_build_seconds", build_map);
+        cJSON* list = cJSON_AddObjectToObject(result, "inline_headers");
+        cJSON_AddNumberToObject(list, "walk_seconds", walk_list);
+        cJSON_AddNumberToObject(list, "first_fit_miss_seconds", first_list);
+        cJSON_AddNumberToObject(list, "worst_fit_seconds", worst_list);
+        cJSON* map = cJSON_AddObjectToObject(result, "block_map");
+        cJSON_AddNumberToObject(map, "walk_seconds", walk_map);
+        cJSON_AddNumberToObject(map, "first_fit_miss_seconds", first_map);
+        cJSON_AddNumberToObject(map, "worst_fit_seconds", worst_map);
+    }
+    heap_destroy(&h);
+    return result;
+}
+
+/**
+ * @brief Prints the times of both layouts and the speedup of the map
+ *
+ * @param sizes Results by heap size
+ */
+static void print_table(const cJSON* sizes)
+{
+    static const char* measures[] = {"walk_seconds", "first_fit_miss_seconds", "worst_fit_seconds"};
+    const cJSON* r = NULL;
+
+    fprintf(stderr, "%-10s %-24s %12s %12s %9s\n", "blocks", "measure", "headers ms", "map ms", "speedup");
+    cJSON_ArrayForEach(r, sizes)
+    {
+        for (size_t i = 0; i < sizeof(measures) / sizeof(*measures); i++)
+        {
+            const cJSON* list_item = cJSON_GetObjectItem(cJSON_GetObjectItem(r, "inline_headers"), measures[i]);
+            const cJSON* map_item = cJSON_GetObjectItem(cJSON_GetObjectItem(r, "block_map"), measures[i]);
+            double list = cJSON_GetNumberValue(list_item);
+            double map = cJSON_GetNumberValue(map_item);
+            fprintf(stderr, "%-10s %-24s %12.3f %12.3f %8.1fx\n", r->string, measures[i], list * 1e3, map * 1e3,
+                    map > 0 ? list / map : 0);
+        }
+    }
+}
+
+/**
+ * @brief Prints the command line help
+ *
+ * @param prog Program name
+ */
+static void usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  --min-blocks N  smallest heap in blocks (default 1048576)\n");
+    printf("  --max-blocks N  largest heap in blocks, counts double from --min-blocks (default 4194304)\n");
+    printf("  --reps N        repetitions of every measure, the fastest is reported (default 5)\n");
+    printf("  --output FILE   write the JSON report to FILE instead of stdout\n");
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option long_opts[] = {
+        {"min-blocks", required_argument, NULL, 'm'}, {"max-blocks", required_argument, NULL, 'M'},
+        {"reps", required_argument, NULL, 'r'},       {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},             {NULL, 0, NULL, 0},
+    };
+    MapOptions opts = {1 << 20, 4 << 20, 5, NULL};
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'm':
+            opts.min_blocks = strtoul(optarg, NULL, 0);
+            break;
+        case 'M':
+            opts.max_blocks = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            opts.reps = atoi(optarg);
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.min_blocks < 2 || opts.max_blocks < opts.min_blocks || opts.reps < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cJSON* report = cJSON_CreateObject();
+    cJSON_AddNumberToObject(report, "granule", HEAP_MAP_GRANULE);
+    cJSON_AddNumberToObject(report, "block_header", BLOCK_SIZE);
+    cJSON* sizes = cJSON_AddObjectToObject(report, "sizes");
+    for (size_t blocks = opts.min_blocks; blocks <= opts.max_blocks; blocks *= 2)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%zu", blocks);
+        cJSON* result = run_size(blocks, opts.reps);
+        if (result)
+            cJSON_AddItemToObject(sizes, name, result);
+        else
+            cJSON_AddStringToObject(report, name, "heap could not be built");
+    }
+    print_table(sizes);
+
+    char* json_string = cJSON_Print(report);
+    FILE* file = opts.output ? fopen(opts.output, "w") : stdout;
+    if (file == NULL)
+    {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(file, "%s\n", json_string);
+    if (file != stdout)
+        fclose(file);
+    free(json_string);
+    cJSON_Delete(report);
+    return 0;
+}
@@ -0,0 +1,558 @@
+#include "memory_bench.h"
+#include <cjson/cJSON.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifndef BENCH_GLIBC
+#include "heap.h"
+#include "heap_probes.h"
+#include "heap_profile.h"
+#endif
+
+/**
+ * @brief Command line options of the benchmark
+ *
+ */
+typedef struct
+{
+    uint64_t seed;        /**< Base seed, each workload derives its own from it */
+    double scale;         /**< Operation count multiplier */
+    const char* only[16]; /**< Workloads selected with --workload, all when empty */
+    int num_only;         /**< Entries used in only */
+    const char* policy;   /**< Allocation policy of my_memory */
+    const char* output;   /**< Report path, stdout when NULL */
+    const char* baseline; /**< Stored report to compare against */
+    double tolerance;     /**< Accepted slowdown relative to the baseline */
+    int glibc;            /**< Run the glibc baseline side by side */
+    size_t profile_rate;  /**< Sampling interval of the heap profiler, 0 when disabled */
+    unsigned growth_hint; /**< Geometric over-reservation of realloc in percent */
+    int hugepages;        /**< Back the heap with transparent huge pages */
+    int variants;         /**< Also run the single-policy builds of my_memory */
+    int probe_overhead;   /**< Also run my_memory built without USDT probes */
+    size_t fastbins;      /**< Largest block size parked in fast bins, 0 when disabled */
+} BenchOptions;
+
+/** Global benchmark context, too large for the stack. */
+static BenchContext ctx;
+
+/**
+ * @brief Prints the command line help
+ *
+ * @param prog Program name
+ */
+static void usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  --seed N              workload seed (default %d)\n", BENCH_DEFAULT_SEED);
+    printf("  --scale F             operation count multiplier (default 1.0)\n");
+    printf("  --workload NAME       run only NAME, may be repeated\n");
+    printf("  --policy P            first, best or worst (default first)\n");
+    printf("  --no-glibc            do not run the glibc baseline\n");
+    printf("  --output FILE         write the JSON report to FILE instead of stdout\n");
+    printf("  --baseline FILE       compare throughput against a stored report\n");
+    printf("  --tolerance F         accepted slowdown against the baseline (default %.2f)\n", BENCH_DEFAULT_TOLERANCE);
+    printf("  --heap-profile N      sample one allocation every N bytes with the heap profiler\n");
+    printf("  --realloc-growth N    over-reserve N%% when realloc grows a block\n");
+    printf("  --hugepages           back the heap with 2 MB transparent huge pages\n");
+    printf("  --fastbins N          park freed blocks of up to N bytes in fast bins, coalescing later\n");
+    printf("  --variants            also run the single-policy builds and compare them with this one\n");
+    printf("  --probe-overhead      also run the build without USDT probes and compare it with this one\n");
+    printf("  --list                list the workloads\n");
+    printf("\nWorkloads:\n");
+    for (const Workload* w = bench_workloads; w->name; w++)
+        printf("  %-20s %s\n", w->name, w->description);
+}
+
+/**
+ * @brief Checks whether a workload was selected on the command line
+ *
+ * @param opts Options
+ * @param name Workload name
+ * @return int 1 if the workload must run
+ */
+static int selected(const BenchOptions* opts, const char* name)
+{
+    if (!opts->num_only)
+        return 1;
+    for (int i = 0; i < opts->num_only; i++)
+    {
+        if (strcmp(opts->only[i], name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Converts the measurements of a finished workload to JSON
+ *
+ * @param seconds Wall time of the workload
+ * @return cJSON* Result object
+ */
+static cJSON* result_to_json(double seconds)
+{
+    cJSON* obj = cJSON_CreateObject();
+    double alloc_seconds = (double)ctx.op_ns / 1e9;
+
+    cJSON_AddNumberToObject(obj, "ops", (double)ctx.ops);
+    cJSON_AddNumberToObject(obj, "seconds", seconds);
+    cJSON_AddNumberToObject(obj, "ops_per_sec", alloc_seconds > 0 ? (double)ctx.ops / alloc_seconds : 0);
+
+    cJSON* latency = cJSON_AddObjectToObject(obj, "latency_ns");
+    cJSON_AddNumberToObject(latency, "p50", (double)bench_percentile(&ctx, 50));
+    cJSON_AddNumberToObject(latency, "p90", (double)bench_percentile(&ctx, 90));
+    cJSON_AddNumberToObject(latency, "p99", (double)bench_percentile(&ctx, 99));
+    cJSON_AddNumberToObject(latency, "p999", (double)bench_percentile(&ctx, 99.9));
+    cJSON_AddNumberToObject(latency, "max", (double)bench_percentile(&ctx, 100));
+
+    cJSON_AddNumberToObject(obj, "peak_live_bytes", (double)ctx.peak_live);
+    cJSON_AddNumberToObject(obj, "peak_heap_bytes", (double)ctx.peak_heap);
+    cJSON_AddNumberToObject(obj, "rss_bytes", (double)bench_rss_bytes());
+    cJSON_AddNumberToObject(obj, "peak_rss_bytes", (double)ctx.peak_rss);
+    /* Share of the peak heap not holding requested bytes: metadata, alignment and holes */
+    cJSON_AddNumberToObject(obj, "fragmentation",
+                            ctx.peak_heap > ctx.peak_live ? 1.0 - (double)ctx.peak_live / (double)ctx.peak_heap : 0.0);
+
+    if (ctx.moves)
+    {
+        cJSON_AddNumberToObject(obj, "realloc_moves", (double)ctx.moves);
+        cJSON_AddNumberToObject(obj, "realloc_moved_bytes", (double)ctx.moved_bytes);
+    }
+    for (int i = 0; i < ctx.num_extra; i++)
+        cJSON_AddNumberToObject(obj, ctx.extra[i].name, ctx.extra[i].value);
+    return obj;
+}
+
+/**
+ * @brief Runs the selected workloads against the linked allocator
+ *
+ * @param opts Options
+ * @return cJSON* Object mapping workload names to results
+ */
+static cJSON* run_workloads(const BenchOptions* opts)
+{
+    cJSON* results = cJSON_CreateObject();
+    uint64_t index = 0;
+
+    for (const Workload* w = bench_workloads; w->name; w++, index++)
+    {
+        if (!selected(opts, w->name))
+            continue;
+
+        /* Seeds depend on the table position only, so selecting a subset keeps results comparable */
+        bench_init(&ctx, opts->seed ^ ((index + 1) * 0x9E3779B97F4A7C15ull), opts->scale);
+        fprintf(stderr, "[%s] %s...\n", BENCH_ALLOCATOR, w->name);
+#ifndef BENCH_GLIBC
+        heap_counters_t counters = heap_default()->counters;
+#endif
+
+        uint64_t start = bench_now_ns();
+        w->run(&ctx);
+        double seconds = (double)(bench_now_ns() - start) / 1e9;
+
+#ifndef BENCH_GLIBC
+        /* What the heap did behind the calls: fast bins trade these for reuse */
+        heap_counters_t* now = &heap_default()->counters;
+        bench_extra(&ctx, "fusions", (double)(now->fusions - counters.fusions));
+        bench_extra(&ctx, "heap_extends", (double)(now->extends - counters.extends));
+        bench_extra(&ctx, "heap_shrinks", (double)(now->shrinks - counters.shrinks));
+        bench_extra(&ctx, "consolidations", (double)(now->consolidations - counters.consolidations));
+#endif
+
+        cJSON_AddItemToObject(results, w->name, result_to_json(seconds));
+    }
+    return results;
+}
+
+/**
+ * @brief Reads a whole file into memory
+ *
+ * @param path File path
+ * @return char* NUL terminated contents, NULL on error
+ */
+static char* read_file(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* buf = len >= 0 ? malloc((size_t)len + 1) : NULL;
+    if (buf)
+    {
+        size_t n = fread(buf, 1, (size_t)len, file);
+        buf[n] = '\0';
+    }
+    fclose(file);
+    return buf;
+}
+
+#if !defined(BENCH_GLIBC) && defined(BENCH_GLIBC_PATH)
+/**
+ * @brief Runs the same workloads in another build of the benchmark
+ *
+ * Every build needs its own process: all the allocators move the program
+ * break, so they cannot share an address space.
+ *
+ * @param opts Options
+ * @param path Benchmark binary to run
+ * @param key Allocator name the child reports its results under
+ * @return cJSON* Object mapping workload names to results, NULL on error
+ */
+static cJSON* run_child(const BenchOptions* opts, const char* path, const char* key)
+{
+    char out[] = "/tmp/memory_bench_XXXXXX";
+    char seed[32], scale[32], growth[32], fastbins[32];
+    const char* args[48];
+    int n = 0;
+
+    int fd = mkstemp(out);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return NULL;
+    }
+    close(fd);
+
+    snprintf(seed, sizeof(seed), "%llu", (unsigned long long)opts->seed);
+    snprintf(scale, sizeof(scale), "%g", opts->scale);
+    snprintf(growth, sizeof(growth), "%u", opts->growth_hint);
+    snprintf(fastbins, sizeof(fastbins), "%zu", opts->fastbins);
+    args[n++] = path;
+    args[n++] = "--seed";
+    args[n++] = seed;
+    args[n++] = "--scale";
+    args[n++] = scale;
+    args[n++] = "--realloc-growth";
+    args[n++] = growth;
+    args[n++] = "--policy";
+    args[n++] = opts->policy;
+    args[n++] = "--fastbins";
+    args[n++] = fastbins;
+    args[n++] = "--output";
+    args[n++] = out;
+    if (opts->hugepages)
+        args[n++] = "--hugepages";
+    for (int i = 0; i < opts->num_only; i++)
+    {
+        args[n++] = "--workload";
+        args[n++] = opts->only[i];
+    }
+    args[n] = NULL;
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execv(path, (char* const*)args);
+        perror("execv");
+        _exit(127);
+    }
+
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "%s run failed, see %s\n", key, path);
+        unlink(out);
+        return NULL;
+    }
+
+    char* text = read_file(out);
+    unlink(out);
+    cJSON* report = text ? cJSON_Parse(text) : NULL;
+    free(text);
+    if (report == NULL)
+        return NULL;
+
+    cJSON* results = cJSON_DetachItemFromObject(report, key);
+    cJSON_Delete(report);
+    return results;
+}
+
+/**
+ * @brief Adds the throughput ratio of every workload between two result sets
+ *
+ * @param ratio Object receiving one ratio per workload
+ * @param mine Results in the numerator
+ * @param other Results in the denominator
+ */
+static void add_comparison(cJSON* ratio, const cJSON* mine, const cJSON* other)
+{
+    cJSON* w = NULL;
+
+    cJSON_ArrayForEach(w, mine)
+    {
+        cJSON* theirs = cJSON_GetObjectItem(cJSON_GetObjectItem(other, w->string), "ops_per_sec");
+        double ours = cJSON_GetNumberValue(cJSON_GetObjectItem(w, "ops_per_sec"));
+        if (cJSON_IsNumber(theirs) && cJSON_GetNumberValue(theirs) > 0)
+            cJSON_AddNumberToObject(ratio, w->string, ours / cJSON_GetNumberValue(theirs));
+    }
+}
+
+/**
+ * @brief Runs every single-policy build and compares its throughput with this generic one
+ *
+ * A variant with the same policy as --policy isolates the cost of the runtime
+ * dispatch; the others show what each policy costs against the generic build.
+ *
+ * @param opts Options
+ * @param report Report holding the generic results, receives the variant results
+ */
+static void run_variants(const BenchOptions* opts, cJSON* report)
+{
+    char names[] = BENCH_VARIANTS;
+    char path[4096];
+    cJSON* ratios = cJSON_CreateObject();
+
+    for (char* name = strtok(names, ","); name; name = strtok(NULL, ","))
+    {
+        char key[64];
+        snprintf(path, sizeof(path), "%s/memory_bench_%s", BENCH_BIN_DIR, name);
+        snprintf(key, sizeof(key), "my_memory_%s", name);
+
+        cJSON* results = run_child(opts, path, key);
+        if (results == NULL)
+            continue;
+        add_comparison(cJSON_AddObjectToObject(ratios, key), results, cJSON_GetObjectItem(report, "my_memory"));
+        cJSON_AddItemToObject(report, key, results);
+    }
+    cJSON_AddItemToObject(report, "throughput_vs_generic", ratios);
+}
+
+/**
+ * @brief Runs the build without USDT probes and compares its throughput with this one
+ *
+ * With no tracer attached a probe is a nop, so every ratio should stay
+ * within the run to run noise of 1.0.
+ *
+ * @param opts Options
+ * @param report Report holding the results of this build, receives the probe-free results
+ */
+static void run_noprobes(const BenchOptions* opts, cJSON* report)
+{
+    cJSON* results = run_child(opts, BENCH_BIN_DIR "/memory_bench_noprobes", "my_memory_noprobes");
+
+    if (results == NULL)
+        return;
+    add_comparison(cJSON_AddObjectToObject(report, "throughput_vs_noprobes"), cJSON_GetObjectItem(report, "my_memory"),
+                   results);
+    cJSON_AddItemToObject(report, "my_memory_noprobes", results);
+}
+#endif
+
+/**
+ * @brief Compares the throughput of this run against a stored report
+ *
+ * @param report Current report
+ * @param path Stored report
+ * @param tolerance Accepted relative slowdown
+ * @return int Number of workloads that regressed, -1 if the baseline cannot be read
+ */
+static int compare_baseline(const cJSON* report, const char* path, double tolerance)
+{
+    char* text = read_file(path);
+    cJSON* stored = text ? cJSON_Parse(text) : NULL;
+    free(text);
+    if (stored == NULL)
+    {
+        fprintf(stderr, "Cannot read baseline %s\n", path);
+        return -1;
+    }
+
+    int regressions = 0;
+    cJSON* current = cJSON_GetObjectItem(report, BENCH_ALLOCATOR);
+    cJSON* previous = cJSON_GetObjectItem(stored, BENCH_ALLOCATOR);
+    cJSON* w = NULL;
+
+    cJSON_ArrayForEach(w, current)
+    {
+        cJSON* old = cJSON_GetObjectItem(cJSON_GetObjectItem(previous, w->string), "ops_per_sec");
+        if (!cJSON_IsNumber(old) || cJSON_GetNumberValue(old) <= 0)
+            continue;
+
+        double now = cJSON_GetNumberValue(cJSON_GetObjectItem(w, "ops_per_sec"));
+        double change = now / cJSON_GetNumberValue(old) - 1.0;
+        int regressed = change < -tolerance;
+        regressions += regressed;
+        fprintf(stderr, "%-20s %12.0f ops/s  %+7.2f%%  %s\n", w->string, now, change * 100,
+                regressed ? "REGRESSION" : "ok");
+    }
+    cJSON_Delete(stored);
+    return regressions;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions opts = {BENCH_DEFAULT_SEED, 1.0, {0}, 0, "first", NULL, NULL, BENCH_DEFAULT_TOLERANCE, 1, 0, 0, 0, 0, 0,
+                         0};
+    static const struct option long_opts[] = {
+        {"seed", required_argument, NULL, 's'},      {"scale", required_argument, NULL, 'x'},
+        {"workload", required_argument, NULL, 'w'},  {"policy", required_argument, NULL, 'p'},
+        {"no-glibc", no_argument, NULL, 'n'},        {"output", required_argument, NULL, 'o'},
+        {"baseline", required_argument, NULL, 'b'},  {"tolerance", required_argument, NULL, 't'},
+        {"list", no_argument, NULL, 'l'},            {"help", no_argument, NULL, 'h'},
+        {"heap-profile", required_argument, NULL, 'r'},  {"realloc-growth", required_argument, NULL, 'g'},
+        {"hugepages", no_argument, NULL, 'H'},       {"variants", no_argument, NULL, 'V'},
+        {"probe-overhead", no_argument, NULL, 'P'},  {"fastbins", required_argument, NULL, 'f'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            opts.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'x':
+            opts.scale = strtod(optarg, NULL);
+            break;
+        case 'w':
+            if (opts.num_only < (int)(sizeof(opts.only) / sizeof(opts.only[0])))
+                opts.only[opts.num_only++] = optarg;
+            break;
+        case 'p':
+            opts.policy = optarg;
+            break;
+        case 'n':
+            opts.glibc = 0;
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        case 'b':
+            opts.baseline = optarg;
+            break;
+        case 't':
+            opts.tolerance = strtod(optarg, NULL);
+            break;
+        case 'r':
+            opts.profile_rate = strtoull(optarg, NULL, 0);
+            break;
+        case 'g':
+            opts.growth_hint = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            opts.hugepages = 1;
+            break;
+        case 'V':
+            opts.variants = 1;
+            break;
+        case 'P':
+            opts.probe_overhead = 1;
+            break;
+        case 'f':
+            opts.fastbins = strtoull(optarg, NULL, 0);
+            break;
+        case 'l':
+            for (const Workload* w = bench_workloads; w->name; w++)
+                printf("%s\n", w->name);
+            return 0;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+#ifdef BENCH_GLIBC
+    /* glibc reads its tunables at startup, so the process restarts itself with them */
+    if (opts.hugepages && !getenv("GLIBC_TUNABLES"))
+    {
+        setenv("GLIBC_TUNABLES", "glibc.malloc.hugetlb=1", 1);
+        execv("/proc/self/exe", argv);
+        perror("execv");
+    }
+#else
+    /* Nothing has been allocated yet, which is when the heap backend can change */
+    if (opts.hugepages && malloc_hugepages(1) < 0)
+    {
+        fprintf(stderr, "Cannot reserve the huge page heap\n");
+        return 1;
+    }
+#ifdef BENCH_VARIANT
+    // The policy is compiled into the library
+    opts.policy = BENCH_VARIANT;
+#else
+    if (strcmp(opts.policy, "first") == 0)
+        malloc_control(FIRST_FIT);
+    else if (strcmp(opts.policy, "best") == 0)
+        malloc_control(BEST_FIT);
+    else if (strcmp(opts.policy, "worst") == 0)
+        malloc_control(WORST_FIT);
+    else
+    {
+        usage(argv[0]);
+        return 1;
+    }
+#endif
+    realloc_growth_hint(opts.growth_hint);
+    if (malloc_fastbins(opts.fastbins) != 0)
+    {
+        fprintf(stderr, "Fast bins hold blocks of up to %d bytes\n", HEAP_FASTBIN_MAX);
+        return 1;
+    }
+    if (opts.profile_rate && heap_profile_start(opts.profile_rate) != 0)
+    {
+        fprintf(stderr, "Cannot start the heap profiler\n");
+        return 1;
+    }
+#endif
+
+    cJSON* report = cJSON_CreateObject();
+    cJSON_AddNumberToObject(report, "seed", (double)opts.seed);
+    cJSON_AddNumberToObject(report, "scale", opts.scale);
+    cJSON_AddStringToObject(report, "policy", opts.policy);
+    cJSON_AddNumberToObject(report, "heap_profile_rate", (double)opts.profile_rate);
+    cJSON_AddNumberToObject(report, "realloc_growth", opts.growth_hint);
+    cJSON_AddBoolToObject(report, "hugepages", opts.hugepages);
+    cJSON_AddNumberToObject(report, "fastbins", (double)opts.fastbins);
+#ifndef BENCH_GLIBC
+    cJSON_AddBoolToObject(report, "usdt_probes", HEAP_PROBES);
+#endif
+    cJSON_AddItemToObject(report, BENCH_ALLOCATOR, run_workloads(&opts));
+
+#if !defined(BENCH_GLIBC) && defined(BENCH_GLIBC_PATH)
+    if (opts.glibc)
+    {
+        cJSON* glibc = run_child(&opts, BENCH_GLIBC_PATH, "glibc");
+        if (glibc)
+        {
+            cJSON_AddItemToObject(report, "glibc", glibc);
+            add_comparison(cJSON_AddObjectToObject(report, "throughput_vs_glibc"),
+                           cJSON_GetObjectItem(report, "my_memory"), glibc);
+        }
+    }
+    if (opts.variants)
+        run_variants(&opts, report);
+    if (opts.probe_overhead)
+        run_noprobes(&opts, report);
+#endif
+
+    char* json_string = cJSON_Print(report);
+    FILE* file = opts.output ? fopen(opts.output, "w") : stdout;
+    if (file == NULL)
+    {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(file, "%s\n", json_string);
+    if (file != stdout)
+        fclose(file);
+    free(json_string);
+
+    int status = 0;
+    if (opts.baseline)
+    {
+        int regressions = compare_baseline(report, opts.baseline, opts.tolerance);
+        status = regressions != 0 ? 2 : 0;
+    }
+
+    cJSON_Delete(report);
+    return status;
+}
@@ -0,0 +1,500 @@
+#include "heap_map.h"
+#include "heap_percpu.h"
+#include <cjson/cJSON.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Space reserved for the backing heap of every run */
+#define HEAP_SPACE (1UL << 30)
+
+/** Largest number of oversubscription ratios on the command line */
+#define MAX_RATIOS 8
+
+/**
+ * @brief Command line options of the per-CPU cache benchmark
+ *
+ */
+typedef struct
+{
+    int ratios[MAX_RATIOS]; /**< Threads per CPU of every run */
+    int nratios;            /**< Ratios given */
+    long ops;               /**< Mallocs of a whole run, split among its threads */
+    int burst;              /**< Blocks a thread allocates and frees per request */
+    int reps;               /**< Repetitions of every run, the fastest is reported */
+    const char* output;     /**< Report path, stdout when NULL */
+} PercpuOptions;
+
+/**
+ * @brief Caches of one thread, the layout the per-CPU caches replace: same stacks, one set per thread
+ *
+ */
+typedef struct
+{
+    intptr_t count[HEAP_PERCPU_CLASSES];                 /**< Blocks in each stack */
+    void* slots[HEAP_PERCPU_CLASSES][HEAP_PERCPU_DEPTH]; /**< Stacks by size class */
+} ThreadCache;
+
+/** Allocators compared */
+enum
+{
+    PERCPU_RSEQ,   /**< heap_percpu with rseq */
+    PERCPU_LOCKED, /**< heap_percpu with a mutex per cache */
+    PER_THREAD,    /**< Stacks of every thread over a heap behind one mutex */
+    GLOBAL_LOCK,   /**< No caches, every operation takes the heap mutex */
+    ALLOCATORS
+};
+
+/** Names of the allocators in the report */
+static const char* allocator_names[ALLOCATORS] = {"percpu_rseq", "percpu_locked", "per_thread", "global_lock"};
+
+/**
+ * @brief State shared by the threads of a run
+ *
+ */
+typedef struct
+{
+    int allocator;             /**< Allocator under test */
+    heap_percpu_t percpu;      /**< Per-CPU caches and their heap; also the heap of the other allocators */
+    ThreadCache* caches;       /**< Stacks of every thread, for PER_THREAD */
+    long ops;                  /**< Mallocs of each thread */
+    int burst;                 /**< Blocks per request */
+    pthread_barrier_t start;   /**< Releases the threads together */
+    pthread_barrier_t done;    /**< Every thread finished its requests and sits idle on its caches */
+    pthread_barrier_t release; /**< The footprint was measured: threads may exit */
+} Run;
+
+/**
+ * @brief A thread of a run with its index
+ *
+ */
+typedef struct
+{
+    Run* run;  /**< Run */
+    int index; /**< Thread index, also the seed of its sizes */
+} Worker;
+
+/**
+ * @brief Nanoseconds of the monotonic clock
+ *
+ * @return uint64_t Current time
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Malloc from the stacks of the thread, refilled from the heap in batches like the per-CPU ones
+ *
+ * @param run Run
+ * @param cache Stacks of the thread
+ * @param size Request, at most HEAP_PERCPU_MAX
+ * @return void* Block, or NULL if the heap is full
+ */
+static void* thread_malloc(Run* run, ThreadCache* cache, size_t size)
+{
+    int c = (int)((size - 1) / HEAP_PERCPU_QUANTUM);
+    void* batch[HEAP_PERCPU_BATCH];
+    int n = 0;
+
+    if (cache->count[c])
+        return cache->slots[c][--cache->count[c]];
+    pthread_mutex_lock(&run->percpu.lock);
+    while (n < HEAP_PERCPU_BATCH && (batch[n] = heap_malloc(&run->percpu.heap, (size_t)(c + 1) * HEAP_PERCPU_QUANTUM)))
+        n++;
+    pthread_mutex_unlock(&run->percpu.lock);
+    for (int i = n - 1; i > 0; i--)
+        cache->slots[c][cache->count[c]++] = batch[i];
+    return n ? batch[0] : NULL;
+}
+
+/**
+ * @brief Free to the stacks of the thread; a full stack gives a batch back to the heap
+ *
+ * @param run Run
+ * @param cache Stacks of the thread
+ * @param p Block
+ */
+static void thread_free(Run* run, ThreadCache* cache, void* p)
+{
+    size_t c = get_block(p)->size / HEAP_PERCPU_QUANTUM;
+
+    c = (c < HEAP_PERCPU_CLASSES ? c : HEAP_PERCPU_CLASSES) - 1;
+    if (cache->count[c] == HEAP_PERCPU_DEPTH)
+    {
+        pthread_mutex_lock(&run->percpu.lock);
+        for (int i = 0; i < HEAP_PERCPU_BATCH; i++)
+            heap_free(&run->percpu.heap, cache->slots[c][--cache->count[c]]);
+        pthread_mutex_unlock(&run->percpu.lock);
+    }
+    cache->slots[c][cache->count[c]++] = p;
+}
+
+/**
+ * @brief Malloc with the allocator of the run
+ *
+ * @param run Run
+ * @param cache Stacks of the thread, for PER_THREAD
+ * @param size Request
+ * @return void* Block
+ */
+static void* run_malloc(Run* run, ThreadCache* cache, size_t size)
+{
+    void* p;
+
+    switch (run->allocator)
+    {
+    case PER_THREAD:
+        return thread_malloc(run, cache, size);
+    case GLOBAL_LOCK:
+        pthread_mutex_lock(&run->percpu.lock);
+        p = heap_malloc(&run->percpu.heap, size);
+        pthread_mutex_unlock(&run->percpu.lock);
+        return p;
+    default:
+        return heap_percpu_malloc(&run->percpu, size);
+    }
+}
+
+/**
+ * @brief Free with the allocator of the run
+ *
+ * @param run Run
+ * @param cache Stacks of the thread, for PER_THREAD
+ * @param p Block
+ */
+static void run_free(Run* run, ThreadCache* cache, void* p)
+{
+    switch (run->allocator)
+    {
+    case PER_THREAD:
+        thread_free(run, cache, p);
+        break;
+    case GLOBAL_LOCK:
+        pthread_mutex_lock(&run->percpu.lock);
+        heap_free(&run->percpu.heap, p);
+        pthread_mutex_unlock(&run->percpu.lock);
+        break;
+    default:
+        heap_percpu_free(&run->percpu, p);
+    }
+}
+
+/**
+ * @brief A thread of a thread pool: requests that allocate a burst of small blocks, touch them and free them,
+ * then idle on its caches until the footprint is measured
+ *
+ * @param arg Worker
+ * @return void* NULL, or non-NULL if a request was not served
+ */
+static void* worker(void* arg)
+{
+    Worker* w = arg;
+    Run* run = w->run;
+    ThreadCache* cache = &run->caches[w->index];
+    unsigned seed = (unsigned)w->index + 1;
+    void* burst[64];
+    void* failed = NULL;
+
+    pthread_barrier_wait(&run->start);
+    for (long done = 0; done < run->ops; done += run->burst)
+    {
+        for (int i = 0; i < run->burst; i++)
+        {
+            size_t size = (size_t)(rand_r(&seed) % HEAP_PERCPU_MAX) + 1;
+            if (!(burst[i] = run_malloc(run, cache, size)))
+            {
+                failed = (void*)1;
+                break;
+            }
+            *(volatile char*)burst[i] = (char)i;
+        }
+        for (int i = 0; i < run->burst && burst[i]; i++)
+            run_free(run, cache, burst[i]);
+        if (failed)
+            break;
+    }
+    pthread_barrier_wait(&run->done);
+    pthread_barrier_wait(&run->release);
+    return failed;
+}
+
+/**
+ * @brief Bytes held in the stacks of every thread
+ *
+ * @param caches Stacks
+ * @param threads Threads
+ * @return size_t Bytes of data of the cached blocks
+ */
+static size_t thread_cached_bytes(ThreadCache* caches, int threads)
+{
+    size_t bytes = 0;
+
+    for (int t = 0; t < threads; t++)
+        for (int c = 0; c < HEAP_PERCPU_CLASSES; c++)
+            for (intptr_t i = 0; i < caches[t].count[c]; i++)
+                bytes += get_block(caches[t].slots[c][i])->size;
+    return bytes;
+}
+
+/**
+ * @brief Runs one allocator with a number of threads
+ *
+ * @param allocator Allocator
+ * @param threads Threads
+ * @param opts Options
+ * @return cJSON* Throughput and footprint, or NULL if the run could not start
+ */
+static cJSON* run_allocator(int allocator, int threads, const PercpuOptions* opts)
+{
+    Run run;
+    pthread_t* tids = malloc((size_t)threads * sizeof(*tids));
+    Worker* workers = malloc((size_t)threads * sizeof(*workers));
+    heap_percpu_stats_t stats;
+    int started = 0, failed = 0;
+
+    memset(&run, 0, sizeof(run));
+    run.allocator = allocator;
+    run.ops = opts->ops / threads;
+    run.burst = opts->burst;
+    run.caches = calloc((size_t)threads, sizeof(*run.caches));
+    if (!tids || !workers || !run.caches ||
+        heap_percpu_init(&run.percpu, HEAP_SPACE, allocator == PERCPU_LOCKED ? HEAP_PERCPU_LOCKED : 0) != 0)
+    {
+        free(tids);
+        free(workers);
+        free(run.caches);
+        return NULL;
+    }
+    // Without the map every refill of a cold cache would walk all the blocks cached so far
+    heap_map(&run.percpu.heap, 1);
+    pthread_barrier_init(&run.start, NULL, (unsigned)threads + 1);
+    pthread_barrier_init(&run.done, NULL, (unsigned)threads + 1);
+    pthread_barrier_init(&run.release, NULL, (unsigned)threads + 1);
+    for (; started < threads; started++)
+    {
+        workers[started].run = &run;
+        workers[started].index = started;
+        if (pthread_create(&tids[started], NULL, worker, &workers[started]) != 0)
+            break;
+    }
+    if (started < threads)
+    {
+        // Barriers that can no longer fill: the process cannot continue
+        fprintf(stderr, "could not start %d threads\n", threads);
+        exit(1);
+    }
+
+    pthread_barrier_wait(&run.start);
+    uint64_t start = now_ns();
+    pthread_barrier_wait(&run.done);
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    // Every thread is idle now: what the caches hold is what a thread pool would sit on
+    heap_percpu_stats(&run.percpu, &stats);
+    size_t cached = allocator == PER_THREAD ? thread_cached_bytes(run.caches, threads) : stats.cached_bytes;
+    pthread_barrier_wait(&run.release);
+    for (int t = 0; t < threads; t++)
+    {
+        void* rc;
+        pthread_join(tids[t], &rc);
+        failed |= rc != NULL;
+    }
+
+    cJSON* result = cJSON_CreateObject();
+    cJSON_AddNumberToObject(result, "seconds", seconds);
+    cJSON_AddNumberToObject(result, "mops_per_second", (double)run.ops * threads / seconds / 1e6);
+    cJSON_AddNumberToObject(result, "cached_bytes", (double)cached);
+    cJSON_AddNumberToObject(result, "heap_bytes", (double)stats.heap_bytes);
+    cJSON_AddBoolToObject(result, "all_served", !failed);
+
+    pthread_barrier_destroy(&run.start);
+    pthread_barrier_destroy(&run.done);
+    pthread_barrier_destroy(&run.release);
+    heap_percpu_destroy(&run.percpu);
+    free(run.caches);
+    free(workers);
+    free(tids);
+    return result;
+}
+
+/**
+ * @brief Prints throughput and footprint of every allocator by ratio
+ *
+ * @param ratios Results by ratio
+ */
+static void print_table(const cJSON* ratios)
+{
+    const cJSON* r = NULL;
+
+    fprintf(stderr, "%-7s %-8s %-14s %10s %14s %14s\n", "ratio", "threads", "allocator", "Mops/s", "cached KB",
+            "heap KB");
+    cJSON_ArrayForEach(r, ratios)
+    {
+        int threads = (int)cJSON_GetNumberValue(cJSON_GetObjectItem(r, "threads"));
+        for (int a = 0; a < ALLOCATORS; a++)
+        {
+            const cJSON* item = cJSON_GetObjectItem(r, allocator_names[a]);
+            if (!item)
+                continue;
+            fprintf(stderr, "%-7s %-8d %-14s %10.2f %14.1f %14.1f\n", r->string, threads, allocator_names[a],
+                    cJSON_GetNumberValue(cJSON_GetObjectItem(item, "mops_per_second")),
+                    cJSON_GetNumberValue(cJSON_GetObjectItem(item, "cached_bytes")) / 1024,
+                    cJSON_GetNumberValue(cJSON_GetObjectItem(item, "heap_bytes")) / 1024);
+        }
+    }
+}
+
+/**
+ * @brief Prints the command line help
+ *
+ * @param prog Program name
+ */
+static void usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  --ratios LIST   threads per CPU of every run, comma separated (default 8,32,128)\n");
+    printf("  --ops N         mallocs of every run, split among its threads (default 8000000)\n");
+    printf("  --burst N       blocks allocated and freed per request, up to 64 (default 16)\n");
+    printf("  --reps N        repetitions of every run, the fastest is reported (default 3)\n");
+    printf("  --output FILE   write the JSON report to FILE instead of stdout\n");
+}
+
+/**
+ * @brief Parses a comma separated list of ratios
+ *
+ * @param list List
+ * @param opts Receives the ratios
+ * @return int 0 if every ratio is positive and they fit
+ */
+static int parse_ratios(const char* list, PercpuOptions* opts)
+{
+    char* end;
+
+    opts->nratios = 0;
+    while (*list)
+    {
+        long ratio = strtol(list, &end, 10);
+        if (end == list || ratio < 1 || opts->nratios == MAX_RATIOS)
+            return -1;
+        opts->ratios[opts->nratios++] = (int)ratio;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return opts->nratios ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option long_opts[] = {
+        {"ratios", required_argument, NULL, 'r'}, {"ops", required_argument, NULL, 'n'},
+        {"burst", required_argument, NULL, 'b'},  {"reps", required_argument, NULL, 'p'},
+        {"output", required_argument, NULL, 'o'}, {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    PercpuOptions opts = {{8, 32, 128}, 3, 8000000, 16, 3, NULL};
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'r':
+            if (parse_ratios(optarg, &opts) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            opts.ops = atol(optarg);
+            break;
+        case 'b':
+            opts.burst = atoi(optarg);
+            break;
+        case 'p':
+            opts.reps = atoi(optarg);
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.ops < 1 || opts.burst < 1 || opts.burst > 64 || opts.reps < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (cpus < 1)
+        cpus = 1;
+
+    heap_percpu_t probe;
+    heap_percpu_stats_t stats;
+    heap_percpu_init(&probe, HEAP_CHUNK, 0);
+    heap_percpu_stats(&probe, &stats);
+    heap_percpu_destroy(&probe);
+
+    cJSON* report = cJSON_CreateObject();
+    cJSON_AddNumberToObject(report, "cpus", (double)cpus);
+    cJSON_AddBoolToObject(report, "rseq", stats.rseq);
+    cJSON_AddNumberToObject(report, "depth", HEAP_PERCPU_DEPTH);
+    cJSON_AddNumberToObject(report, "batch", HEAP_PERCPU_BATCH);
+    cJSON_AddNumberToObject(report, "ops", (double)opts.ops);
+    cJSON_AddNumberToObject(report, "reps", opts.reps);
+    cJSON* ratios = cJSON_AddObjectToObject(report, "ratios");
+    for (int i = 0; i < opts.nratios; i++)
+    {
+        char name[16];
+        int threads = opts.ratios[i] * (int)cpus;
+        snprintf(name, sizeof(name), "%dx", opts.ratios[i]);
+        cJSON* ratio = cJSON_AddObjectToObject(ratios, name);
+        cJSON_AddNumberToObject(ratio, "threads", threads);
+        for (int a = 0; a < ALLOCATORS; a++)
+        {
+            // Without rseq both per-CPU runs would measure the fallback
+            if (a == PERCPU_RSEQ && !stats.rseq)
+                continue;
+            cJSON* result = NULL;
+            for (int r = 0; r < opts.reps; r++)
+            {
+                cJSON* rep = run_allocator(a, threads, &opts);
+                if (!result || (rep && cJSON_GetNumberValue(cJSON_GetObjectItem(rep, "seconds")) <
+                                           cJSON_GetNumberValue(cJSON_GetObjectItem(result, "seconds"))))
+                {
+                    cJSON_Delete(result);
+                    result = rep;
+                }
+                else
+                    cJSON_Delete(rep);
+            }
+            if (result)
+                cJSON_AddItemToObject(ratio, allocator_names[a], result);
+        }
+    }
+    print_table(ratios);
+
+    char* json_string = cJSON_Print(report);
+    FILE* file = opts.output ? fopen(opts.output, "w") : stdout;
+    if (file == NULL)
+    {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(file, "%s\n", json_string);
+    if (file != stdout)
+        fclose(file);
+    free(json_string);
+    cJSON_Delete(report);
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include "heap_populate.h"
+#include "memory.h"
+#include <cjson/cJSON.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+/** One gigabyte */
+#define GB (1UL << 30)
+
+/** Largest share of physical memory a buffer may take; larger sizes are skipped rather than swapped or killed */
+#define MAX_MEMORY_SHARE 0.75
+
+/**
+ * @brief Command line options of the time-to-ready benchmark
+ *
+ */
+typedef struct
+{
+    size_t min_gb;      /**< Smallest buffer, in GB */
+    size_t max_gb;      /**< Largest buffer, in GB; sizes double from min_gb */
+    unsigned threads;   /**< Threads of the parallel modes, 0 for one per CPU */
+    const char* output; /**< Report path, stdout when NULL */
+} PopulateOptions;
+
+/**
+ * @brief A way to get a buffer ready for use
+ *
+ */
+typedef struct
+{
+    const char* name;                            /**< Name in the report */
+    void* (*get)(size_t size, unsigned threads); /**< Allocates the buffer, backed or not */
+    const char* description;                     /**< What the mode does */
+} PopulateMode;
+
+/**
+ * @brief Nanoseconds of the monotonic clock
+ *
+ * @return uint64_t Current time
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Minor page faults taken by the process so far
+ *
+ * @return long Minor faults
+ */
+static long minor_faults(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+/**
+ * @brief Plain malloc: pages are faulted in by the first pass
+ */
+static void* get_lazy(size_t size, unsigned threads)
+{
+    (void)threads;
+    return malloc(size);
+}
+
+/**
+ * @brief malloc_populate on the calling thread only
+ */
+static void* get_populate(size_t size, unsigned threads)
+{
+    (void)threads;
+    return malloc_populate(size, 1);
+}
+
+/**
+ * @brief malloc_populate split across threads
+ */
+static void* get_populate_parallel(size_t size, unsigned threads)
+{
+    return malloc_populate(size, threads);
+}
+
+/**
+ * @brief malloc, then touch threads writing one address per page
+ */
+static void* get_touch_parallel(size_t size, unsigned threads)
+{
+    void* p = malloc(size);
+    if (p)
+        heap_populate(p, size, threads, HEAP_POPULATE_TOUCH);
+    return p;
+}
+
+/**
+ * @brief Plain calloc, zeroed by the calling thread
+ */
+static void* get_calloc(size_t size, unsigned threads)
+{
+    (void)threads;
+    calloc_populate(0, 0);
+    return calloc(size / 8, 8);
+}
+
+/**
+ * @brief calloc with calloc_populate, zeroed by several threads
+ */
+static void* get_calloc_parallel(size_t size, unsigned threads)
+{
+    calloc_populate(1, threads);
+    void* p = calloc(size / 8, 8);
+    calloc_populate(0, 0);
+    return p;
+}
+
+/** Modes compared for every buffer size; lazy is the baseline */
+static const PopulateMode modes[] = {
+    {"lazy", get_lazy, "malloc, pages faulted by the first pass"},
+    {"populate", get_populate, "malloc_populate with one thread"},
+    {"populate_parallel", get_populate_parallel, "malloc_populate with --threads threads"},
+    {"touch_parallel", get_touch_parallel, "malloc, then --threads threads touching every page"},
+    {"calloc", get_calloc, "calloc zeroed by one thread"},
+    {"calloc_parallel", get_calloc_parallel, "calloc with calloc_populate and --threads threads"},
+};
+
+/**
+ * @brief Gets a buffer ready with a mode and makes the first pass over it, as a loader filling it would
+ *
+ * @param mode Mode under test
+ * @param size Buffer size
+ * @param threads Threads of the parallel modes
+ * @return cJSON* Times and page faults, or NULL if the buffer could not be allocated
+ */
+static cJSON* run_mode(const PopulateMode* mode, size_t size, unsigned threads)
+{
+    long faults = minor_faults();
+    uint64_t start = now_ns();
+    char* p = mode->get(size, threads);
+    if (!p)
+        return NULL;
+    uint64_t ready = now_ns();
+    long ready_faults = minor_faults();
+
+    // One write per cache line: the faults of the lazy mode land here
+    for (size_t i = 0; i < size; i += 64)
+        p[i] = (char)i;
+    uint64_t done = now_ns();
+    long pass_faults = minor_faults();
+    free(p);
+
+    cJSON* result = cJSON_CreateObject();
+    cJSON_AddNumberToObject(result, "allocate_seconds", (double)(ready - start) / 1e9);
+    cJSON_AddNumberToObject(result, "first_pass_seconds", (double)(done - ready) / 1e9);
+    cJSON_AddNumberToObject(result, "time_to_ready_seconds", (double)(done - start) / 1e9);
+    cJSON_AddNumberToObject(result, "allocate_faults", (double)(ready_faults - faults));
+    cJSON_AddNumberToObject(result, "first_pass_faults", (double)(pass_faults - ready_faults));
+    return result;
+}
+
+/**
+ * @brief Prints the time to ready of every mode relative to lazy faulting
+ *
+ * @param sizes Results by size and mode
+ */
+static void print_table(const cJSON* sizes)
+{
+    const cJSON* by_size = NULL;
+
+    fprintf(stderr, "%-6s %-18s %10s %10s %10s %10s\n", "size", "mode", "alloc s", "pass s", "ready s", "vs lazy");
+    cJSON_ArrayForEach(by_size, sizes)
+    {
+        const cJSON* lazy = cJSON_GetObjectItem(cJSON_GetObjectItem(by_size, "lazy"), "time_to_ready_seconds");
+        const cJSON* r = NULL;
+        cJSON_ArrayForEach(r, by_size)
+        {
+            if (!cJSON_IsObject(r))
+                continue;
+            double ready = cJSON_GetNumberValue(cJSON_GetObjectItem(r, "time_to_ready_seconds"));
+            fprintf(stderr, "%-6s %-18s %10.3f %10.3f %10.3f %9.2fx\n", by_size->string, r->string,
+                    cJSON_GetNumberValue(cJSON_GetObjectItem(r, "allocate_seconds")),
+                    cJSON_GetNumberValue(cJSON_GetObjectItem(r, "first_pass_seconds")), ready,
+                    cJSON_IsNumber(lazy) && ready > 0 ? cJSON_GetNumberValue(lazy) / ready : 0);
+        }
+    }
+}
+
+/**
+ * @brief Prints the command line help
+ *
+ * @param prog Program name
+ */
+static void usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  --min-gb N      smallest buffer in GB (default 1)\n");
+    printf("  --max-gb N      largest buffer in GB, sizes double from --min-gb (default 16)\n");
+    printf("  --threads N     threads of the parallel modes, 0 for one per CPU (default 0)\n");
+    printf("  --output FILE   write the JSON report to FILE instead of stdout\n");
+    printf("\nModes:\n");
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++)
+        printf("  %-18s %s\n", modes[i].name, modes[i].description);
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option long_opts[] = {
+        {"min-gb", required_argument, NULL, 'm'}, {"max-gb", required_argument, NULL, 'M'},
+        {"threads", required_argument, NULL, 't'}, {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},          {NULL, 0, NULL, 0},
+    };
+    PopulateOptions opts = {1, 16, 0, NULL};
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'm':
+            opts.min_gb = strtoul(optarg, NULL, 0);
+            break;
+        case 'M':
+            opts.max_gb = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            opts.threads = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (!opts.min_gb || opts.max_gb < opts.min_gb)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!opts.threads)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+
+    double memory = (double)sysconf(_SC_PHYS_PAGES) * (double)sysconf(_SC_PAGESIZE);
+    cJSON* report = cJSON_CreateObject();
+    cJSON_AddNumberToObject(report, "threads", opts.threads);
+    cJSON_AddNumberToObject(report, "physical_memory", memory);
+    cJSON* sizes = cJSON_AddObjectToObject(report, "sizes");
+    for (size_t gb = opts.min_gb; gb <= opts.max_gb; gb *= 2)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%zuG", gb);
+        cJSON* by_mode = cJSON_AddObjectToObject(sizes, name);
+        if ((double)(gb * GB) > memory * MAX_MEMORY_SHARE)
+        {
+            cJSON_AddStringToObject(by_mode, "skipped", "not enough physical memory");
+            continue;
+        }
+        for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++)
+        {
+            cJSON* result = run_mode(&modes[i], gb * GB, opts.threads);
+            if (result)
+                cJSON_AddItemToObject(by_mode, modes[i].name, result);
+            else
+                cJSON_AddStringToObject(by_mode, modes[i].name, "allocation failed");
+        }
+    }
+    print_table(sizes);
+
+    char* json_string = cJSON_Print(report);
+    FILE* file = opts.output ? fopen(opts.output, "w") : stdout;
+    if (file == NULL)
+    {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(file, "%s\n", json_string);
+    if (file != stdout)
+        fclose(file);
+    free(json_string);
+    cJSON_Delete(report);
+    return 0;
+}
@@ -0,0 +1,361 @@
+#include "heap.h"
+#include "shm_heap.h"
+#include <cjson/cJSON.h>
+#include <getopt.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Blocks each process keeps live in the throughput test */
+#define WINDOW 64
+
+/** Largest request of the throughput test */
+#define MAX_REQUEST 4096
+
+/** Bytes handed from the producer to the consumer for every buffer size */
+#define HANDOFF_BYTES (256UL << 20)
+
+/** Buffers in flight between the producer and the consumer, like the slots of a ring */
+#define HANDOFF_DEPTH 8
+
+/** Buffer sizes of the handoff test */
+static const size_t handoff_sizes[] = {4096, 64 * 1024, 1024 * 1024};
+
+/**
+ * @brief Command line options of the shared heap benchmark
+ *
+ */
+typedef struct
+{
+    int procs;          /**< Largest number of processes; counts double from 1 */
+    long ops;           /**< Operations per process in the throughput test */
+    size_t heap_mb;     /**< Size of the shared heap, and of each private heap, in MB */
+    const char* output; /**< Report path, stdout when NULL */
+} ShmOptions;
+
+/**
+ * @brief Nanoseconds of the monotonic clock
+ *
+ * @return uint64_t Current time
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Random allocations and frees over a window of live blocks, in the shared heap or in a private one
+ *
+ * @param shared Shared heap, or NULL to use a private heap of heap_size bytes
+ * @param heap_size Size of the private heap
+ * @param ops Operations to perform
+ * @param seed Seed of the sizes and slots
+ * @return int 0 if every request was served
+ */
+static int churn(shm_heap_t* shared, size_t heap_size, long ops, unsigned seed)
+{
+    void* live[WINDOW] = {0};
+    heap_t heap;
+    int failed = 0;
+
+    if (!shared && heap_init(&heap, NULL, heap_size) != 0)
+        return 1;
+    for (long i = 0; i < ops; i++)
+    {
+        int slot = rand_r(&seed) % WINDOW;
+        size_t size = (size_t)(rand_r(&seed) % MAX_REQUEST) + 16;
+        if (live[slot])
+        {
+            if (shared)
+                shm_heap_free(shared, live[slot]);
+            else
+                heap_free(&heap, live[slot]);
+        }
+        live[slot] = shared ? shm_heap_malloc(shared, size) : heap_malloc(&heap, size);
+        if (!live[slot])
+            failed = 1;
+        else
+            *(char*)live[slot] = (char)i;
+    }
+    for (int slot = 0; slot < WINDOW; slot++)
+    {
+        if (shared)
+            shm_heap_free(shared, live[slot]);
+    }
+    if (!shared)
+        heap_destroy(&heap);
+    return failed;
+}
+
+/**
+ * @brief Runs the churn in several processes at once and measures the aggregate throughput
+ *
+ * @param opts Options
+ * @param procs Processes
+ * @param shared 1 for one shared heap, 0 for a private heap per process
+ * @return double Operations per second over all the processes, 0 if a process failed
+ */
+static double run_throughput(const ShmOptions* opts, int procs, int shared)
+{
+    shm_heap_t* h = shared ? shm_heap_open(NULL, opts->heap_mb << 20, NULL) : NULL;
+    pid_t pids[64];
+    int start[2];
+    int ok = 1;
+
+    if ((shared && !h) || pipe(start) != 0)
+        return 0;
+    for (int i = 0; i < procs; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == 0)
+        {
+            // Everyone starts when the parent closes its end of the pipe
+            char c;
+            close(start[1]);
+            if (read(start[0], &c, 1) < 0)
+                _exit(1);
+            _exit(churn(h, opts->heap_mb << 20, opts->ops, (unsigned)i + 1));
+        }
+    }
+    close(start[0]);
+    uint64_t begin = now_ns();
+    close(start[1]);
+    for (int i = 0; i < procs; i++)
+    {
+        int status = 0;
+        if (pids[i] < 0 || waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ok = 0;
+    }
+    double seconds = (double)(now_ns() - begin) / 1e9;
+    if (h)
+        shm_heap_close(h);
+    return ok && seconds > 0 ? (double)opts->ops * procs / seconds : 0;
+}
+
+/**
+ * @brief Reads or writes a whole buffer through a pipe
+ *
+ * @param fd Pipe end
+ * @param buf Buffer
+ * @param len Bytes
+ * @param writing 1 to write, 0 to read
+ * @return int 0 if every byte went through
+ */
+static int transfer(int fd, void* buf, size_t len, int writing)
+{
+    char* p = buf;
+    while (len)
+    {
+        ssize_t n = writing ? write(fd, p, len) : read(fd, p, len);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Consumer side: reads every word of a buffer, as a reader of a shared table would
+ *
+ * @param p Buffer
+ * @param size Bytes
+ * @return uint64_t Sum of the words
+ */
+static uint64_t consume(const void* p, size_t size)
+{
+    const uint64_t* words = p;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+        sum += words[i];
+    return sum;
+}
+
+/**
+ * @brief A producer process fills buffers and hands them to this one, which reads and releases them
+ *
+ * With zero_copy the buffers live in the shared heap and only their offsets
+ * go through the pipe; otherwise the bytes themselves are copied through it.
+ * A second pipe returns a credit per consumed buffer, so at most
+ * HANDOFF_DEPTH buffers are in flight in either mode.
+ *
+ * @param opts Options
+ * @param size Bytes of each buffer
+ * @param zero_copy 1 to hand off offsets in the shared heap, 0 to copy through the pipe
+ * @return double Bytes per second received, 0 on failure
+ */
+static double run_handoff(const ShmOptions* opts, size_t size, int zero_copy)
+{
+    shm_heap_t* h = zero_copy ? shm_heap_open(NULL, opts->heap_mb << 20, NULL) : NULL;
+    size_t count = HANDOFF_BYTES / size;
+    char* local = zero_copy ? NULL : malloc(size);
+    int fds[2];
+    int credits[2];
+    uint64_t sum = 0;
+    char credit = 0;
+
+    if ((zero_copy && !h) || (!zero_copy && !local) || pipe(fds) != 0 || pipe(credits) != 0)
+        return 0;
+    uint64_t begin = now_ns();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        close(credits[1]);
+        for (size_t i = 0; i < count; i++)
+        {
+            char* p = local;
+            if (i >= HANDOFF_DEPTH && transfer(credits[0], &credit, 1, 0))
+                _exit(1);
+            if (zero_copy)
+            {
+                // With the heap full the consumer is behind: wait for it to free
+                while (!(p = shm_heap_malloc(h, size)))
+                    sched_yield();
+            }
+            memset(p, (int)i, size);
+            uint64_t off = zero_copy ? shm_heap_offset(h, p) : 0;
+            if (zero_copy ? transfer(fds[1], &off, sizeof(off), 1) : transfer(fds[1], p, size, 1))
+                _exit(1);
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    close(credits[0]);
+    for (size_t i = 0; pid > 0 && i < count; i++)
+    {
+        uint64_t off;
+        if (zero_copy)
+        {
+            if (transfer(fds[0], &off, sizeof(off), 0))
+                break;
+            void* p = shm_heap_pointer(h, off);
+            sum += consume(p, size);
+            shm_heap_free(h, p);
+        }
+        else
+        {
+            if (transfer(fds[0], local, size, 0))
+                break;
+            sum += consume(local, size);
+        }
+        // The producer takes no credit for the last buffers and may be gone already
+        if (i + HANDOFF_DEPTH < count && transfer(credits[1], &credit, 1, 1))
+            break;
+    }
+    close(fds[0]);
+    close(credits[1]);
+    int status = 0;
+    int ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    double seconds = (double)(now_ns() - begin) / 1e9;
+    if (h)
+        shm_heap_close(h);
+    free(local);
+    // The sum keeps the reads from being optimized away
+    return ok && sum != 1 && seconds > 0 ? (double)(count * size) / seconds : 0;
+}
+
+/**
+ * @brief Prints the command line help
+ *
+ * @param prog Program name
+ */
+static void usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  --procs N      largest number of processes, counts double from 1 (default 8)\n");
+    printf("  --ops N        operations per process in the throughput test (default 200000)\n");
+    printf("  --heap-mb N    size of the shared heap and of each private heap in MB (default 256)\n");
+    printf("  --output FILE  write the JSON report to FILE instead of stdout\n");
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option long_opts[] = {
+        {"procs", required_argument, NULL, 'p'},   {"ops", required_argument, NULL, 'n'},
+        {"heap-mb", required_argument, NULL, 'm'}, {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},          {NULL, 0, NULL, 0},
+    };
+    ShmOptions opts = {8, 200000, 256, NULL};
+    int c;
+
+    while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'p':
+            opts.procs = atoi(optarg);
+            break;
+        case 'n':
+            opts.ops = atol(optarg);
+            break;
+        case 'm':
+            opts.heap_mb = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.procs < 1 || opts.procs > 64 || opts.ops < 1 || !opts.heap_mb)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cJSON* report = cJSON_CreateObject();
+    cJSON_AddNumberToObject(report, "ops_per_process", (double)opts.ops);
+    cJSON* throughput = cJSON_AddObjectToObject(report, "throughput");
+    fprintf(stderr, "%-8s %16s %16s %10s\n", "procs", "shared ops/s", "private ops/s", "ratio");
+    for (int procs = 1; procs <= opts.procs; procs *= 2)
+    {
+        char key[16];
+        double shared = run_throughput(&opts, procs, 1);
+        double private_heap = run_throughput(&opts, procs, 0);
+        snprintf(key, sizeof(key), "%d", procs);
+        cJSON* result = cJSON_AddObjectToObject(throughput, key);
+        cJSON_AddNumberToObject(result, "shared_ops_per_sec", shared);
+        cJSON_AddNumberToObject(result, "private_ops_per_sec", private_heap);
+        fprintf(stderr, "%-8d %16.0f %16.0f %9.2fx\n", procs, shared, private_heap,
+                private_heap > 0 ? shared / private_heap : 0);
+    }
+
+    cJSON* handoff = cJSON_AddObjectToObject(report, "handoff");
+    fprintf(stderr, "\n%-8s %16s %16s %10s\n", "buffer", "zero-copy MB/s", "pipe copy MB/s", "ratio");
+    for (size_t i = 0; i < sizeof(handoff_sizes) / sizeof(*handoff_sizes); i++)
+    {
+        char key[16];
+        double zero_copy = run_handoff(&opts, handoff_sizes[i], 1);
+        double copy = run_handoff(&opts, handoff_sizes[i], 0);
+        snprintf(key, sizeof(key), "%zu", handoff_sizes[i]);
+        cJSON* result = cJSON_AddObjectToObject(handoff, key);
+        cJSON_AddNumberToObject(result, "zero_copy_bytes_per_sec", zero_copy);
+        cJSON_AddNumberToObject(result, "pipe_copy_bytes_per_sec", copy);
+        fprintf(stderr, "%-8zu %16.0f %16.0f %9.2fx\n", handoff_sizes[i], zero_copy / 1e6, copy / 1e6,
+                copy > 0 ? zero_copy / copy : 0);
+    }
+
+    char* json_string = cJSON_Print(report);
+    FILE* file = opts.output ? fopen(opts.output, "w") : stdout;
+    if (file == NULL)
+    {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(file, "%s\n", json_string);
+    if (file != stdout)
+        fclose(file);
+    free(json_string);
+    cJSON_Delete(report);
+    return 0;
+}
@@ -0,0 +1,1195 @@
+#include "memory_bench.h"
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef BENCH_GLIBC
+#include <malloc.h>
+#else
+#include "heap.h"
+#include "pheap.h"
+#include "size_classes.h"
+#endif
+
+/** Working set of the fixed-size churn workload. */
+#define CHURN_SLOTS 1024
+/** Block size of the fixed-size churn workload. */
+#define CHURN_SIZE 64
+/** Working set of the power-law workload. */
+#define POWER_SLOTS 2048
+/** Capacity of the producer/consumer queue. */
+#define QUEUE_SLOTS 4096
+/** Buffers grown concurrently by the realloc workload. */
+#define GROWTH_BUFFERS 32
+/** Size at which a growing buffer is released and restarted. */
+#define GROWTH_LIMIT (256 * 1024)
+/** Vectors grown side by side by the vector workload. */
+#define VECTOR_COUNT 8
+/** Element size of the vector workload. */
+#define VECTOR_ELEM 8
+/** Elements pushed into a vector before it is released and restarted. */
+#define VECTOR_LIMIT (64 * 1024)
+/** Size at which the appended string is released and restarted. */
+#define APPEND_LIMIT (1024 * 1024)
+/** Simulated threads of the larson workload. */
+#define LARSON_THREADS 8
+/** Slots owned by each simulated larson thread. */
+#define LARSON_SLOTS 512
+/** Maximum live objects of the fragmentation soak. */
+#define SOAK_SLOTS 16384
+/** Bytes held by the random access cache at scale 1. */
+#define CACHE_BYTES (128 * 1024 * 1024)
+/** Smallest value stored in the random access cache. */
+#define CACHE_MIN_VALUE (16 * 1024)
+/** Largest value stored in the random access cache. */
+#define CACHE_MAX_VALUE (128 * 1024)
+/** Keys of the persistent lookup table at scale 1. */
+#define STARTUP_KEYS 1000000
+/** Entries allocated together by the lookup table, like a node pool. */
+#define STARTUP_CHUNK 256
+/** Lookups that prove a reloaded table is usable. */
+#define STARTUP_LOOKUPS 10000
+/** Working set of the size class workload. */
+#define CLASS_SLOTS 1024
+/** Classes of the generic and of the generated table. */
+#define CLASS_COUNT 32
+/** Long lived blocks between which the fast bin workload churns. */
+#define FAST_SLOTS 256
+/** Most temporaries allocated and freed together by the fast bin workload. */
+#define FAST_BURST 32
+
+/**
+ * @brief Live allocation tracked by a workload
+ *
+ */
+typedef struct
+{
+    void* ptr;       /**< Allocated memory */
+    size_t size;     /**< Requested size */
+    uint64_t expiry; /**< Operation at which the soak frees it */
+} Slot;
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void bench_init(BenchContext* ctx, uint64_t seed, double scale)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    /* xorshift must never hold a zero state */
+    ctx->rng = seed ? seed : 0x9E3779B97F4A7C15ull;
+    ctx->scale = scale;
+    ctx->heap_start = bench_heap_bytes();
+}
+
+uint64_t bench_rand(BenchContext* ctx)
+{
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return ctx->rng * 0x2545F4914F6CDD1Dull;
+}
+
+size_t bench_range(BenchContext* ctx, size_t lo, size_t hi)
+{
+    return lo + (size_t)(bench_rand(ctx) % (hi - lo + 1));
+}
+
+size_t bench_power_law(BenchContext* ctx, size_t lo, size_t hi, double alpha)
+{
+    /* Inverse transform sampling of a Pareto distribution truncated to [lo, hi] */
+    double u = (double)(bench_rand(ctx) >> 11) / (double)(1ull << 53);
+    double l = pow((double)lo, alpha);
+    double h = pow((double)hi, alpha);
+    double x = pow(-(u * h - u * l - h) / (h * l), -1.0 / alpha);
+    size_t s = (size_t)x;
+    return s < lo ? lo : (s > hi ? hi : s);
+}
+
+size_t bench_scaled(const BenchContext* ctx, size_t n)
+{
+    size_t s = (size_t)((double)n * ctx->scale);
+    return s ? s : 1;
+}
+
+void* bench_scratch(size_t size)
+{
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void bench_scratch_free(void* ptr, size_t size)
+{
+    if (ptr)
+        munmap(ptr, size);
+}
+
+void bench_extra(BenchContext* ctx, const char* name, double value)
+{
+    for (int i = 0; i < ctx->num_extra; i++)
+    {
+        if (strcmp(ctx->extra[i].name, name) == 0)
+        {
+            ctx->extra[i].value = value;
+            return;
+        }
+    }
+    if (ctx->num_extra < BENCH_MAX_EXTRA)
+    {
+        ctx->extra[ctx->num_extra].name = name;
+        ctx->extra[ctx->num_extra].value = value;
+        ctx->num_extra++;
+    }
+}
+
+size_t bench_heap_bytes(void)
+{
+#ifdef BENCH_GLIBC
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd;
+#else
+    /* The heap may live in a huge page region instead of behind the program
+       break, so measure it from the first block to the end of the last one */
+    t_block b = base;
+
+    if (!b)
+        return 0;
+    while (b->next)
+        b = b->next;
+    return (size_t)(b->data + b->size - (char*)base);
+#endif
+}
+
+size_t bench_rss_bytes(void)
+{
+    /* Read with raw syscalls so that sampling never allocates from the heap under test */
+    char buf[128];
+    unsigned long pages = 0, resident = 0;
+    int fd = open("/proc/self/statm", O_RDONLY);
+
+    if (fd < 0)
+        return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+    if (sscanf(buf, "%lu %lu", &pages, &resident) != 2)
+        return 0;
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief Maps a latency to its histogram bucket
+ *
+ * @param ns Latency in nanoseconds
+ * @return int Bucket index
+ */
+static int hist_bucket(uint64_t ns)
+{
+    if (ns < BENCH_HIST_LINEAR)
+        return (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (e - 6)) & (BENCH_HIST_SUB - 1));
+    return BENCH_HIST_LINEAR + (e - 7) * BENCH_HIST_SUB + sub;
+}
+
+/**
+ * @brief Lower bound of a histogram bucket
+ *
+ * @param bucket Bucket index
+ * @return uint64_t Latency in nanoseconds
+ */
+static uint64_t hist_value(int bucket)
+{
+    if (bucket < BENCH_HIST_LINEAR)
+        return (uint64_t)bucket;
+    int e = 7 + (bucket - BENCH_HIST_LINEAR) / BENCH_HIST_SUB;
+    uint64_t sub = (uint64_t)((bucket - BENCH_HIST_LINEAR) % BENCH_HIST_SUB);
+    return (BENCH_HIST_SUB + sub) << (e - 6);
+}
+
+uint64_t bench_percentile(const BenchContext* ctx, double percentile)
+{
+    if (!ctx->ops)
+        return 0;
+    if (percentile >= 100.0)
+        return ctx->max_ns;
+
+    uint64_t target = (uint64_t)ceil(percentile / 100.0 * (double)ctx->ops);
+    uint64_t seen = 0;
+    for (int i = 0; i < BENCH_HIST_BUCKETS; i++)
+    {
+        seen += ctx->hist[i];
+        if (seen >= target && seen)
+            return hist_value(i);
+    }
+    return ctx->max_ns;
+}
+
+/**
+ * @brief Accounts one allocator call and periodically samples the heap
+ *
+ * @param ctx Benchmark context
+ * @param ns Duration of the call
+ */
+static void record(BenchContext* ctx, uint64_t ns)
+{
+    ctx->ops++;
+    ctx->op_ns += ns;
+    ctx->hist[hist_bucket(ns)]++;
+    if (ns > ctx->max_ns)
+        ctx->max_ns = ns;
+    if (ctx->live > ctx->peak_live)
+        ctx->peak_live = ctx->live;
+
+    if (ctx->ops % BENCH_HEAP_SAMPLE)
+        return;
+
+    size_t now = bench_heap_bytes();
+    size_t heap = now > ctx->heap_start ? now - ctx->heap_start : 0;
+    if (heap > ctx->peak_heap)
+        ctx->peak_heap = heap;
+    if (++ctx->samples % BENCH_RSS_SAMPLE == 0)
+    {
+        size_t rss = bench_rss_bytes();
+        if (rss > ctx->peak_rss)
+            ctx->peak_rss = rss;
+    }
+}
+
+void* bench_malloc(BenchContext* ctx, size_t size)
+{
+    uint64_t start = bench_now_ns();
+    void* p = malloc(size);
+    uint64_t ns = bench_now_ns() - start;
+
+    if (p)
+    {
+        /* Touch the block like a real caller would, outside the timed region */
+        memset(p, 0xA5, size < 64 ? size : 64);
+        ctx->live += size;
+    }
+    record(ctx, ns);
+    return p;
+}
+
+void bench_free(BenchContext* ctx, void* ptr, size_t size)
+{
+    uint64_t start = bench_now_ns();
+    free(ptr);
+    uint64_t ns = bench_now_ns() - start;
+
+    if (ptr)
+        ctx->live -= size;
+    record(ctx, ns);
+}
+
+void* bench_realloc(BenchContext* ctx, void* ptr, size_t old_size, size_t size)
+{
+    uint64_t start = bench_now_ns();
+    void* p = realloc(ptr, size);
+    uint64_t ns = bench_now_ns() - start;
+
+    if (p)
+    {
+        ctx->live += size;
+        ctx->live -= ptr ? old_size : 0;
+    }
+    record(ctx, ns);
+    return p;
+}
+
+/**
+ * @brief Frees every live slot of a workload
+ *
+ * @param ctx Benchmark context
+ * @param slots Slots to release
+ * @param n Number of slots
+ */
+static void release_slots(BenchContext* ctx, Slot* slots, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (slots[i].ptr)
+        {
+            bench_free(ctx, slots[i].ptr, slots[i].size);
+            slots[i].ptr = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Random replacement of same-sized blocks in a fixed working set
+ *
+ * @param ctx Benchmark context
+ */
+static void run_fixed_churn(BenchContext* ctx)
+{
+    Slot* slots = bench_scratch(CHURN_SLOTS * sizeof(Slot));
+    size_t ops = bench_scaled(ctx, 200000);
+
+    if (!slots)
+        return;
+    for (size_t i = 0; i < CHURN_SLOTS; i++)
+    {
+        slots[i].size = CHURN_SIZE;
+        slots[i].ptr = bench_malloc(ctx, CHURN_SIZE);
+    }
+    for (size_t i = 0; i < ops; i++)
+    {
+        Slot* s = &slots[bench_range(ctx, 0, CHURN_SLOTS - 1)];
+        bench_free(ctx, s->ptr, s->size);
+        s->ptr = bench_malloc(ctx, CHURN_SIZE);
+    }
+    release_slots(ctx, slots, CHURN_SLOTS);
+    bench_scratch_free(slots, CHURN_SLOTS * sizeof(Slot));
+}
+
+/**
+ * @brief Random replacement with heavy tailed request sizes
+ *
+ * @param ctx Benchmark context
+ */
+static void run_power_law(BenchContext* ctx)
+{
+    Slot* slots = bench_scratch(POWER_SLOTS * sizeof(Slot));
+    size_t ops = bench_scaled(ctx, 100000);
+
+    if (!slots)
+        return;
+    for (size_t i = 0; i < POWER_SLOTS; i++)
+    {
+        slots[i].size = bench_power_law(ctx, 16, 65536, 1.1);
+        slots[i].ptr = bench_malloc(ctx, slots[i].size);
+    }
+    for (size_t i = 0; i < ops; i++)
+    {
+        Slot* s = &slots[bench_range(ctx, 0, POWER_SLOTS - 1)];
+        bench_free(ctx, s->ptr, s->size);
+        s->size = bench_power_law(ctx, 16, 65536, 1.1);
+        s->ptr = bench_malloc(ctx, s->size);
+    }
+    release_slots(ctx, slots, POWER_SLOTS);
+    bench_scratch_free(slots, POWER_SLOTS * sizeof(Slot));
+}
+
+/**
+ * @brief Messages produced in bursts and consumed in FIFO order
+ *
+ * The allocator is not thread safe, so producer and consumer alternate on
+ * one thread; the FIFO lifetime pattern is what matters to the heap.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_producer_consumer(BenchContext* ctx)
+{
+    Slot* queue = bench_scratch(QUEUE_SLOTS * sizeof(Slot));
+    size_t messages = bench_scaled(ctx, 200000);
+    size_t head = 0, tail = 0, produced = 0;
+
+    if (!queue)
+        return;
+    while (produced < messages || head != tail)
+    {
+        size_t burst = bench_range(ctx, 1, 64);
+        for (size_t i = 0; i < burst && produced < messages && tail - head < QUEUE_SLOTS; i++, produced++)
+        {
+            Slot* s = &queue[tail++ % QUEUE_SLOTS];
+            s->size = bench_range(ctx, 32, 2048);
+            s->ptr = bench_malloc(ctx, s->size);
+        }
+        burst = bench_range(ctx, 1, 64);
+        for (size_t i = 0; i < burst && head != tail; i++)
+        {
+            Slot* s = &queue[head++ % QUEUE_SLOTS];
+            bench_free(ctx, s->ptr, s->size);
+            s->ptr = NULL;
+        }
+    }
+    bench_scratch_free(queue, QUEUE_SLOTS * sizeof(Slot));
+}
+
+/**
+ * @brief Tracks how much data realloc had to copy to move a block
+ *
+ * @param ctx Benchmark context
+ * @param old Pointer before realloc
+ * @param p Pointer returned by realloc
+ * @param size Bytes held by the block before realloc
+ */
+static void count_move(BenchContext* ctx, const void* old, const void* p, size_t size)
+{
+    if (old && p && p != old)
+    {
+        ctx->moves++;
+        ctx->moved_bytes += size;
+    }
+}
+
+/**
+ * @brief Interleaved buffers grown geometrically with realloc
+ *
+ * @param ctx Benchmark context
+ */
+static void run_realloc_growth(BenchContext* ctx)
+{
+    Slot bufs[GROWTH_BUFFERS] = {0};
+    size_t ops = bench_scaled(ctx, 50000);
+
+    for (size_t i = 0; i < ops; i++)
+    {
+        Slot* s = &bufs[bench_range(ctx, 0, GROWTH_BUFFERS - 1)];
+        if (s->size >= GROWTH_LIMIT)
+        {
+            bench_free(ctx, s->ptr, s->size);
+            s->ptr = NULL;
+            s->size = 0;
+            continue;
+        }
+        size_t size = s->size ? s->size + s->size / 2 + bench_range(ctx, 0, 64) : 16;
+        void* p = bench_realloc(ctx, s->ptr, s->size, size);
+        if (!p)
+            continue;
+        count_move(ctx, s->ptr, p, s->size);
+        s->ptr = p;
+        s->size = size;
+    }
+    release_slots(ctx, bufs, GROWTH_BUFFERS);
+}
+
+/**
+ * @brief std::vector style push_back with capacity doubling
+ *
+ * Several vectors grow at the same time and short lived temporaries are
+ * allocated between pushes, so a growing vector is rarely the last block.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_vector_growth(BenchContext* ctx)
+{
+    Slot vecs[VECTOR_COUNT] = {0};
+    size_t len[VECTOR_COUNT] = {0};
+    size_t pushes = bench_scaled(ctx, 400000);
+
+    for (size_t i = 0; i < pushes; i++)
+    {
+        size_t v = bench_range(ctx, 0, VECTOR_COUNT - 1);
+        Slot* s = &vecs[v];
+        if (len[v] == VECTOR_LIMIT)
+        {
+            bench_free(ctx, s->ptr, s->size);
+            s->ptr = NULL;
+            s->size = 0;
+            len[v] = 0;
+        }
+        if ((len[v] + 1) * VECTOR_ELEM > s->size)
+        {
+            size_t size = s->size ? s->size * 2 : 4 * VECTOR_ELEM;
+            void* p = bench_realloc(ctx, s->ptr, s->size, size);
+            if (!p)
+                continue;
+            count_move(ctx, s->ptr, p, len[v] * VECTOR_ELEM);
+            s->ptr = p;
+            s->size = size;
+        }
+        ((uint64_t*)s->ptr)[len[v]++] = i;
+
+        if (i % 16 == 0)
+        {
+            size_t tmp_size = bench_range(ctx, 16, 256);
+            bench_free(ctx, bench_malloc(ctx, tmp_size), tmp_size);
+        }
+    }
+    release_slots(ctx, vecs, VECTOR_COUNT);
+}
+
+/**
+ * @brief String built by appending small chunks with an exact-size realloc each time
+ *
+ * A small long lived allocation every few appends keeps the string away
+ * from the end of the heap, which is the case geometric reservation helps.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_append_growth(BenchContext* ctx)
+{
+    Slot str = {0};
+    Slot* pins = bench_scratch(APPEND_LIMIT / 64 * sizeof(Slot));
+    size_t appends = bench_scaled(ctx, 100000);
+    size_t num_pins = 0;
+
+    if (!pins)
+        return;
+    for (size_t i = 0; i < appends; i++)
+    {
+        size_t size = str.size + bench_range(ctx, 1, 64);
+        if (size > APPEND_LIMIT)
+        {
+            bench_free(ctx, str.ptr, str.size);
+            str.ptr = NULL;
+            str.size = 0;
+            release_slots(ctx, pins, num_pins);
+            num_pins = 0;
+            continue;
+        }
+        void* p = bench_realloc(ctx, str.ptr, str.size, size);
+        if (!p)
+            continue;
+        count_move(ctx, str.ptr, p, str.size);
+        str.ptr = p;
+        str.size = size;
+
+        if (i % 8 == 0 && num_pins < APPEND_LIMIT / 64)
+        {
+            pins[num_pins].size = bench_range(ctx, 16, 64);
+            pins[num_pins].ptr = bench_malloc(ctx, pins[num_pins].size);
+            num_pins++;
+        }
+    }
+    release_slots(ctx, &str, 1);
+    release_slots(ctx, pins, num_pins);
+    bench_scratch_free(pins, APPEND_LIMIT / 64 * sizeof(Slot));
+}
+
+/**
+ * @brief Larson style server simulation
+ *
+ * Each simulated thread replaces random objects in its own working set and
+ * then hands the whole set to the next thread, so objects are always freed
+ * by a different owner than the one that allocated them. The owners run
+ * round-robin on one thread because the allocator is not thread safe.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_larson(BenchContext* ctx)
+{
+    size_t n = LARSON_THREADS * LARSON_SLOTS;
+    Slot* slots = bench_scratch(n * sizeof(Slot));
+    size_t ops = bench_scaled(ctx, 200000);
+    size_t round = 1000;
+
+    if (!slots)
+        return;
+    for (size_t i = 0; i < n; i++)
+    {
+        slots[i].size = bench_range(ctx, 16, 512);
+        slots[i].ptr = bench_malloc(ctx, slots[i].size);
+    }
+    for (size_t done = 0, owner = 0; done < ops; owner = (owner + 1) % LARSON_THREADS)
+    {
+        /* The working set of thread "owner" is the window starting at its rotated position */
+        size_t window = ((owner + done / (round * LARSON_THREADS)) % LARSON_THREADS) * LARSON_SLOTS;
+        for (size_t i = 0; i < round && done < ops; i++, done++)
+        {
+            Slot* s = &slots[window + bench_range(ctx, 0, LARSON_SLOTS - 1)];
+            bench_free(ctx, s->ptr, s->size);
+            s->size = bench_range(ctx, 16, 512);
+            s->ptr = bench_malloc(ctx, s->size);
+        }
+    }
+    release_slots(ctx, slots, n);
+    bench_scratch_free(slots, n * sizeof(Slot));
+}
+
+/**
+ * @brief Restores the min-heap order of the soak expiry queue upwards
+ *
+ * @param q Queue
+ * @param i Index of the entry that moved
+ */
+static void soak_up(Slot* q, size_t i)
+{
+    while (i && q[(i - 1) / 2].expiry > q[i].expiry)
+    {
+        Slot t = q[i];
+        q[i] = q[(i - 1) / 2];
+        q[(i - 1) / 2] = t;
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+ * @brief Restores the min-heap order of the soak expiry queue downwards
+ *
+ * @param q Queue
+ * @param n Entries in the queue
+ */
+static void soak_down(Slot* q, size_t n)
+{
+    size_t i = 0;
+    for (;;)
+    {
+        size_t m = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && q[l].expiry < q[m].expiry)
+            m = l;
+        if (r < n && q[r].expiry < q[m].expiry)
+            m = r;
+        if (m == i)
+            return;
+        Slot t = q[i];
+        q[i] = q[m];
+        q[m] = t;
+        i = m;
+    }
+}
+
+/**
+ * @brief Long running mix of sizes and lifetimes
+ *
+ * Most objects are short lived, some survive thousands of operations and a
+ * few live for most of the run, which is what fragments a heap over time.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_fragmentation_soak(BenchContext* ctx)
+{
+    Slot* q = bench_scratch(SOAK_SLOTS * sizeof(Slot));
+    size_t ops = bench_scaled(ctx, 100000);
+    size_t n = 0;
+
+    if (!q)
+        return;
+    for (uint64_t now = 0; now < ops; now++)
+    {
+        while (n && (q[0].expiry <= now || n == SOAK_SLOTS))
+        {
+            bench_free(ctx, q[0].ptr, q[0].size);
+            q[0] = q[--n];
+            soak_down(q, n);
+        }
+
+        uint64_t r = bench_rand(ctx) % 100;
+        size_t size = r < 70   ? bench_range(ctx, 16, 256)
+                      : r < 95 ? bench_range(ctx, 256, 4096)
+                               : bench_range(ctx, 4096, 65536);
+        r = bench_rand(ctx) % 100;
+        uint64_t life = r < 80 ? bench_range(ctx, 1, 200) : r < 98 ? bench_range(ctx, 1000, 20000) : ops;
+
+        void* p = bench_malloc(ctx, size);
+        if (!p)
+            continue;
+        q[n].ptr = p;
+        q[n].size = size;
+        q[n].expiry = now + life;
+        soak_up(q, n++);
+    }
+
+    size_t heap = bench_heap_bytes();
+    heap = heap > ctx->heap_start ? heap - ctx->heap_start : 0;
+    bench_extra(ctx, "final_fragmentation", heap > ctx->live ? 1.0 - (double)ctx->live / (double)heap : 0.0);
+
+    release_slots(ctx, q, n);
+    bench_scratch_free(q, SOAK_SLOTS * sizeof(Slot));
+}
+
+/**
+ * @brief Opens a counter of data TLB read misses of this thread in user space
+ *
+ * @return int Counter descriptor, disabled, or -1 when the machine or the
+ * perf_event_paranoid setting does not expose it
+ */
+static int open_dtlb_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * @brief Anonymous memory of the process backed by transparent huge pages
+ *
+ * @return size_t Bytes, 0 when the kernel does not report it
+ */
+static size_t anon_huge_bytes(void)
+{
+    /* Raw syscalls, like bench_rss_bytes, so that reading never allocates */
+    char buf[4096];
+    int fd = open("/proc/self/smaps_rollup", O_RDONLY);
+
+    if (fd < 0)
+        return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    buf[n] = '\0';
+
+    char* line = strstr(buf, "AnonHugePages:");
+    unsigned long kb = 0;
+    if (line && sscanf(line, "AnonHugePages: %lu kB", &kb) != 1)
+        return 0;
+    return (size_t)kb * 1024;
+}
+
+/**
+ * @brief In-memory cache of large values read and written at random
+ *
+ * Allocation is cheap here; what the workload measures is how the heap
+ * layout affects accesses spread over a working set far larger than the
+ * TLB reach of 4 KB pages. Reports access throughput and, when the CPU
+ * exposes the counter, data TLB misses per thousand accesses.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_random_access(BenchContext* ctx)
+{
+    size_t bytes = bench_scaled(ctx, CACHE_BYTES);
+    size_t max_slots = bytes / CACHE_MIN_VALUE + 1;
+    Slot* slots = bench_scratch(max_slots * sizeof(Slot));
+    size_t n = 0, total = 0;
+
+    if (!slots)
+        return;
+    while (total < bytes && n < max_slots)
+    {
+        size_t size = bench_range(ctx, CACHE_MIN_VALUE, CACHE_MAX_VALUE);
+        void* p = bench_malloc(ctx, size);
+        if (!p)
+            break;
+        memset(p, (int)n, size);
+        slots[n].ptr = p;
+        slots[n].size = size;
+        total += size;
+        n++;
+    }
+    if (!n)
+    {
+        bench_scratch_free(slots, max_slots * sizeof(Slot));
+        return;
+    }
+
+    size_t accesses = bench_scaled(ctx, 4000000);
+    uint64_t sum = 0, misses = 0;
+    int counter = open_dtlb_counter();
+
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < accesses; i++)
+    {
+        Slot* s = &slots[bench_range(ctx, 0, n - 1)];
+        uint64_t* word = (uint64_t*)s->ptr + bench_range(ctx, 0, s->size / sizeof(uint64_t) - 1);
+        sum += *word;
+        *word = sum;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) == (ssize_t)sizeof(misses))
+            bench_extra(ctx, "dtlb_misses_per_kaccess", (double)misses * 1000.0 / (double)accesses);
+        close(counter);
+    }
+
+    bench_extra(ctx, "accesses_per_sec", elapsed ? (double)accesses * 1e9 / (double)elapsed : 0);
+    bench_extra(ctx, "anon_huge_bytes", (double)anon_huge_bytes());
+
+    release_slots(ctx, slots, n);
+    bench_scratch_free(slots, max_slots * sizeof(Slot));
+}
+
+#ifndef BENCH_GLIBC
+/**
+ * @brief Entry of the lookup table stored in the persistent heap, linked by offsets
+ *
+ */
+typedef struct
+{
+    uint64_t next;  /**< Offset of the next entry of the bucket, 0 for the last one */
+    uint64_t key;   /**< Key */
+    uint64_t value; /**< Value */
+} StartupEntry;
+
+/**
+ * @brief Root object of the persistent lookup table
+ *
+ */
+typedef struct
+{
+    uint64_t buckets; /**< Offset of the bucket array */
+    uint64_t mask;    /**< Number of buckets minus one, a power of two minus one */
+    uint64_t count;   /**< Entries stored */
+} StartupTable;
+
+/**
+ * @brief Bucket of a key
+ *
+ * @param key Key
+ * @param mask Number of buckets minus one
+ * @return uint64_t Bucket index
+ */
+static uint64_t startup_bucket(uint64_t key, uint64_t mask)
+{
+    return (key * 0x9E3779B97F4A7C15ull >> 17) & mask;
+}
+
+/**
+ * @brief Looks keys up in a table reopened from the persistent heap
+ *
+ * @param h Persistent heap
+ * @param seed Seed the keys were generated with
+ * @param keys Number of keys in the table
+ * @return int 1 if every key was found with its value
+ */
+static int startup_lookups(heap_t* h, uint64_t seed, size_t keys)
+{
+    StartupTable* t = pheap_root(h);
+    BenchContext probe;
+
+    if (!t || t->count != keys)
+        return 0;
+    uint64_t* buckets = pheap_pointer(h, t->buckets);
+    bench_init(&probe, seed, 1.0);
+    for (size_t i = 0; i < STARTUP_LOOKUPS && i < keys; i++)
+    {
+        // Keys are regenerated in insertion order, the value is the insertion index
+        uint64_t key = bench_rand(&probe);
+        StartupEntry* e = pheap_pointer(h, buckets[startup_bucket(key, t->mask)]);
+        while (e && e->key != key)
+            e = pheap_pointer(h, e->next);
+        if (!e || e->value != i)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Startup cost of a large lookup table: rebuilt from scratch or reloaded from a persistent heap
+ *
+ * Rebuilding inserts every key into a fresh file-backed heap, which is what
+ * a process without persistence does on every start. Reloading reopens the
+ * closed file and only pays for the pages the first lookups touch.
+ * Recovering reopens a heap whose process died without closing it, which
+ * walks every block once.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_persistent_startup(BenchContext* ctx)
+{
+    char path[] = "/tmp/memory_bench_pheap_XXXXXX";
+    size_t keys = bench_scaled(ctx, STARTUP_KEYS);
+    size_t nbuckets = 1;
+    uint64_t seed = bench_rand(ctx);
+    int fd = mkstemp(path);
+
+    if (fd < 0)
+        return;
+    close(fd);
+    while (nbuckets < keys)
+        nbuckets <<= 1;
+
+    size_t size = keys * sizeof(StartupEntry) + (keys / STARTUP_CHUNK + 1) * BLOCK_SIZE + nbuckets * sizeof(uint64_t) +
+                  (1 << 20);
+    uint64_t start = bench_now_ns();
+    heap_t* h = pheap_open(path, size, NULL);
+    if (!h)
+    {
+        unlink(path);
+        return;
+    }
+
+    StartupTable* t = heap_calloc(h, 1, sizeof(StartupTable));
+    uint64_t* buckets = heap_calloc(h, nbuckets, sizeof(uint64_t));
+    StartupEntry* pool = NULL;
+    BenchContext gen;
+    bench_init(&gen, seed, 1.0);
+    for (size_t i = 0; i < keys && t && buckets; i++)
+    {
+        if (i % STARTUP_CHUNK == 0)
+        {
+            uint64_t begin = bench_now_ns();
+            pool = heap_malloc(h, STARTUP_CHUNK * sizeof(StartupEntry));
+            record(ctx, bench_now_ns() - begin);
+            if (!pool)
+                break;
+            ctx->live += STARTUP_CHUNK * sizeof(StartupEntry);
+        }
+
+        StartupEntry* e = &pool[i % STARTUP_CHUNK];
+        e->key = bench_rand(&gen);
+        e->value = i;
+        uint64_t* head = &buckets[startup_bucket(e->key, nbuckets - 1)];
+        e->next = *head;
+        *head = pheap_offset(h, e);
+        t->count++;
+    }
+    if (t && buckets)
+    {
+        t->buckets = pheap_offset(h, buckets);
+        t->mask = nbuckets - 1;
+        // Published last: a crash before this leaves no table rather than half of one
+        pheap_set_root(h, t);
+    }
+    double rebuild = (double)(bench_now_ns() - start) / 1e6;
+
+    start = bench_now_ns();
+    pheap_close(h);
+    double checkpoint = (double)(bench_now_ns() - start) / 1e6;
+
+    start = bench_now_ns();
+    h = pheap_open(path, 0, NULL);
+    int ok = h && startup_lookups(h, seed, keys);
+    double reload = (double)(bench_now_ns() - start) / 1e6;
+    if (h)
+        pheap_close(h);
+
+    /* A child opens the heap and dies with it open, the next open has to recover it */
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(pheap_open(path, 0, NULL) ? 0 : 1);
+    int status = 0;
+    double recover = 0;
+    if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        unsigned flags = 0;
+        start = bench_now_ns();
+        h = pheap_open(path, 0, &flags);
+        ok = ok && h && (flags & PHEAP_RECOVERED) && startup_lookups(h, seed, keys);
+        recover = (double)(bench_now_ns() - start) / 1e6;
+        if (h)
+            pheap_close(h);
+    }
+
+    struct stat st;
+    bench_extra(ctx, "rebuild_ms", rebuild);
+    bench_extra(ctx, "checkpoint_ms", checkpoint);
+    bench_extra(ctx, "reload_ms", reload);
+    bench_extra(ctx, "recover_ms", recover);
+    bench_extra(ctx, "reload_speedup", reload > 0 ? rebuild / reload : 0);
+    bench_extra(ctx, "file_bytes", stat(path, &st) == 0 ? (double)st.st_blocks * 512 : 0);
+    bench_extra(ctx, "lookups_ok", ok);
+    ctx->live = 0;
+    unlink(path);
+}
+/** Request sizes of the size class workload, like the structs and strings of a real program. */
+static const size_t class_sizes[] = {20, 36, 44, 72, 100, 136, 200, 264, 340, 520, 760, 1100, 1500, 2100, 3000};
+
+/**
+ * @brief One pass of the size class workload with the size class table currently installed
+ *
+ * @param ctx Benchmark context
+ * @param seed Seed of the pass, the same for every table
+ * @param slots CLASS_SLOTS slots, empty
+ * @return double Peak heap over peak live bytes during the pass, minus one
+ */
+static double size_class_pass(BenchContext* ctx, uint64_t seed, Slot* slots)
+{
+    size_t ops = bench_scaled(ctx, 50000);
+    size_t nsizes = sizeof(class_sizes) / sizeof(class_sizes[0]);
+    size_t peak_heap = ctx->peak_heap, peak_live = ctx->peak_live;
+    BenchContext gen;
+
+    bench_init(&gen, seed, 1.0);
+    ctx->peak_heap = 0;
+    ctx->peak_live = 0;
+    for (size_t i = 0; i < CLASS_SLOTS + ops; i++)
+    {
+        Slot* s = &slots[i < CLASS_SLOTS ? i : bench_range(&gen, 0, CLASS_SLOTS - 1)];
+        if (s->ptr)
+            bench_free(ctx, s->ptr, s->size);
+        // Mostly a handful of fixed sizes, with some arbitrary ones mixed in
+        s->size = bench_range(&gen, 0, 9) ? class_sizes[bench_power_law(&gen, 1, nsizes, 0.8) - 1]
+                                          : bench_range(&gen, 1, SIZE_HIST_MAX);
+        s->ptr = bench_malloc(ctx, s->size);
+    }
+    release_slots(ctx, slots, CLASS_SLOTS);
+
+    double overhead = ctx->peak_live ? (double)ctx->peak_heap / (double)ctx->peak_live - 1.0 : 0;
+    ctx->peak_heap = ctx->peak_heap > peak_heap ? ctx->peak_heap : peak_heap;
+    ctx->peak_live = ctx->peak_live > peak_live ? ctx->peak_live : peak_live;
+    return overhead;
+}
+
+/**
+ * @brief Memory overhead of the same request stream with 8 byte alignment, generic classes and generated classes
+ *
+ * The first pass records the request size histogram, which
+ * size_classes_optimize turns into a table of CLASS_COUNT classes. The
+ * generic table has the same number of classes, spaced four per power of
+ * two, so both tables get the same budget.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_size_classes(BenchContext* ctx)
+{
+    size_t bytes = SIZE_HIST_BUCKETS * sizeof(uint64_t);
+    Slot* slots = bench_scratch(CLASS_SLOTS * sizeof(Slot));
+    uint64_t* before = bench_scratch(bytes);
+    uint64_t* counts = bench_scratch(bytes);
+    size_t saved[SIZE_CLASSES_MAX], generic[SIZE_CLASSES_MAX], generated[SIZE_CLASSES_MAX];
+    uint64_t seed = bench_rand(ctx);
+    int active = size_hist_active;
+    int nsaved = size_classes_get(saved);
+
+    if (!slots || !before || !counts)
+    {
+        bench_scratch_free(slots, CLASS_SLOTS * sizeof(Slot));
+        bench_scratch_free(before, bytes);
+        bench_scratch_free(counts, bytes);
+        return;
+    }
+
+    // Only this pass is counted, on top of whatever SIZE_HIST_PATH is recording
+    size_classes_set(NULL, 0);
+    memcpy(before, size_hist_counts(), bytes);
+    size_hist_start();
+    double align8 = size_class_pass(ctx, seed, slots);
+    if (!active)
+        size_hist_stop();
+    for (size_t i = 0; i < SIZE_HIST_BUCKETS; i++)
+        counts[i] = size_hist_counts()[i] - before[i];
+
+    int ngeneric = size_classes_generic(generic, CLASS_COUNT);
+    size_classes_set(generic, ngeneric);
+    double classic = size_class_pass(ctx, seed, slots);
+
+    int ngenerated = size_classes_optimize(counts, CLASS_COUNT, generated);
+    size_classes_set(generated, ngenerated > 0 ? ngenerated : 0);
+    double tuned = size_class_pass(ctx, seed, slots);
+    size_classes_set(saved, nsaved);
+
+    bench_extra(ctx, "overhead_align8", align8);
+    bench_extra(ctx, "overhead_generic", classic);
+    bench_extra(ctx, "overhead_generated", tuned);
+    bench_extra(ctx, "waste_align8", (double)size_classes_waste(counts, NULL, 0));
+    bench_extra(ctx, "waste_generic", (double)size_classes_waste(counts, generic, ngeneric));
+    bench_extra(ctx, "waste_generated", (double)size_classes_waste(counts, generated, ngenerated));
+    bench_extra(ctx, "generated_classes", ngenerated);
+
+    bench_scratch_free(slots, CLASS_SLOTS * sizeof(Slot));
+    bench_scratch_free(before, bytes);
+    bench_scratch_free(counts, bytes);
+}
+/**
+ * @brief One pass of the fast bin workload with the fast bins currently configured
+ *
+ * @param ctx Benchmark context
+ * @param seed Seed of the pass, the same with and without fast bins
+ * @param slots FAST_SLOTS slots, empty
+ * @param burst FAST_BURST pointers for the temporaries
+ * @return double Allocator calls per second during the pass
+ */
+static double fastbin_pass(BenchContext* ctx, uint64_t seed, Slot* slots, void** burst)
+{
+    static const size_t sizes[] = {16, 24, 32, 48, 64, 96, 128};
+    size_t rounds = bench_scaled(ctx, 20000);
+    uint64_t ops = ctx->ops, op_ns = ctx->op_ns;
+    BenchContext gen;
+
+    bench_init(&gen, seed, 1.0);
+    for (size_t i = 0; i < FAST_SLOTS; i++)
+    {
+        slots[i].size = bench_range(&gen, 16, 256);
+        slots[i].ptr = bench_malloc(ctx, slots[i].size);
+    }
+    for (size_t r = 0; r < rounds; r++)
+    {
+        // A burst of same-sized temporaries, freed newest first like a call stack unwinding
+        size_t size = sizes[bench_range(&gen, 0, sizeof(sizes) / sizeof(sizes[0]) - 1)];
+        size_t n = bench_range(&gen, 1, FAST_BURST);
+        for (size_t i = 0; i < n; i++)
+            burst[i] = bench_malloc(ctx, size);
+        while (n--)
+            bench_free(ctx, burst[n], size);
+
+        if (r % 8 == 0)
+        {
+            Slot* s = &slots[bench_range(&gen, 0, FAST_SLOTS - 1)];
+            bench_free(ctx, s->ptr, s->size);
+            s->size = bench_range(&gen, 16, 256);
+            s->ptr = bench_malloc(ctx, s->size);
+        }
+    }
+    release_slots(ctx, slots, FAST_SLOTS);
+
+    uint64_t ns = ctx->op_ns - op_ns;
+    return ns ? (double)(ctx->ops - ops) * 1e9 / (double)ns : 0;
+}
+
+/**
+ * @brief Same-size churn with immediate coalescing and with fast bins, side by side
+ *
+ * Bursts of temporaries at the top of the heap are what makes free fuse and
+ * give the tail back to the system, only for the next burst to extend the
+ * heap and split again. The pass with fast bins parks them instead.
+ *
+ * @param ctx Benchmark context
+ */
+static void run_fastbin_churn(BenchContext* ctx)
+{
+    heap_t* h = heap_default();
+    Slot* slots = bench_scratch(FAST_SLOTS * sizeof(Slot));
+    void* burst[FAST_BURST];
+    uint64_t seed = bench_rand(ctx);
+    size_t fast_max = h->fast_max;
+
+    if (!slots)
+        return;
+
+    heap_fastbins(h, 0);
+    heap_counters_t start = h->counters;
+    double slow = fastbin_pass(ctx, seed, slots, burst);
+    heap_counters_t coalescing = h->counters;
+
+    heap_fastbins(h, HEAP_FASTBIN_MAX);
+    double fast = fastbin_pass(ctx, seed, slots, burst);
+    heap_fastbins(h, 0);
+    heap_counters_t deferred = h->counters;
+    heap_fastbins(h, fast_max);
+
+    bench_extra(ctx, "fusions_immediate", (double)(coalescing.fusions - start.fusions));
+    bench_extra(ctx, "fusions_fastbins", (double)(deferred.fusions - coalescing.fusions));
+    bench_extra(ctx, "brk_immediate",
+                (double)(coalescing.extends + coalescing.shrinks - start.extends - start.shrinks));
+    bench_extra(ctx, "brk_fastbins",
+                (double)(deferred.extends + deferred.shrinks - coalescing.extends - coalescing.shrinks));
+    bench_extra(ctx, "ops_per_sec_immediate", slow);
+    bench_extra(ctx, "ops_per_sec_fastbins", fast);
+    bench_extra(ctx, "fastbin_speedup", slow > 0 ? fast / slow : 0);
+
+    bench_scratch_free(slots, FAST_SLOTS * sizeof(Slot));
+}
+#endif
+
+const Workload bench_workloads[] = {
+    {"fixed_churn", "random replacement of 64 byte blocks", run_fixed_churn},
+    {"power_law", "random replacement with Pareto distributed sizes", run_power_law},
+    {"producer_consumer", "bursty FIFO message queue", run_producer_consumer},
+    {"realloc_growth", "interleaved buffers grown geometrically", run_realloc_growth},
+    {"vector_growth", "push_back with capacity doubling amid temporaries", run_vector_growth},
+    {"append_growth", "string appended with an exact-size realloc per chunk", run_append_growth},
+    {"larson", "objects freed by a different owner than their allocator", run_larson},
+    {"fragmentation_soak", "long running mix of sizes and lifetimes", run_fragmentation_soak},
+    {"random_access", "random reads and writes over a large cache of values", run_random_access},
+#ifndef BENCH_GLIBC
+    {"persistent_startup", "lookup table rebuilt versus reloaded from a persistent heap", run_persistent_startup},
+    {"size_classes", "memory overhead with 8 byte alignment, generic and generated size classes", run_size_classes},
+    {"fastbin_churn", "bursts of same-sized blocks with immediate coalescing and with fast bins", run_fastbin_churn},
+#endif
+    {NULL, NULL, NULL},
+};
@@ -0,0 +1,166 @@
+/**
+ * @file memory_resource.hpp
+ * @brief Capa C++ sobre la biblioteca: recursos de std::pmr sobre un heap o una región.
+ *
+ * Al enlazar my_memory_cpp, los operator new y delete globales, incluidas las
+ * variantes con tamaño y con alineación, asignan con malloc y liberan con
+ * free de la biblioteca. Sin ellos, el new alineado de libstdc++ pediría la
+ * memoria a aligned_alloc de la biblioteca de C, que esta biblioteca no
+ * reemplaza, y después la liberaría con free de este heap.
+ *
+ * heap_resource asigna en un heap, propio o de quien llama, para dirigir
+ * contenedores de std::pmr a un heap determinado. monotonic_resource asigna
+ * avanzando el tope de una región y libera todo de una vez bajándolo, lo que
+ * devuelve las páginas al sistema. Como los heaps, ninguno de los dos es
+ * seguro entre hilos.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+extern "C"
+{
+#include "heap.h"
+#include "region.h"
+}
+
+// La macro de alineación de memory.h tapa std::align de <memory>
+#undef align
+
+namespace my_memory
+{
+
+/** Alineación que garantizan malloc y heap_malloc. */
+constexpr std::size_t malloc_alignment = 8;
+
+/** Espacio virtual reservado por defecto para un monotonic_resource. */
+constexpr std::size_t monotonic_reserve = std::size_t(1) << 30;
+
+/**
+ * @brief Asigna en un heap con una alineación mayor que la de malloc.
+ *
+ * Se piden alignment - 8 bytes de más. Si el área ya está alineada se devuelve
+ * tal cual; si no, la dirección original se guarda en la palabra anterior a la
+ * alineada, que cae dentro del mismo bloque.
+ *
+ * @param heap Heap, o nullptr para malloc.
+ * @param size Tamaño en bytes.
+ * @param alignment Potencia de dos.
+ * @return void* Área alineada, o nullptr si no hubo lugar.
+ */
+void* allocate(heap_t* heap, std::size_t size, std::size_t alignment) noexcept;
+
+/**
+ * @brief Libera un área de allocate, alineada o no.
+ *
+ * La palabra anterior a los datos de un bloque es su campo ptr, que apunta a
+ * los datos mismos; si apunta a otro lado, el área se alineó y esa palabra es
+ * la dirección original.
+ *
+ * @param heap Heap donde se asignó, o nullptr para free.
+ * @param p Área a liberar, puede ser nullptr.
+ */
+void deallocate(heap_t* heap, void* p) noexcept;
+
+/**
+ * @brief Recurso de std::pmr que asigna en un heap de la biblioteca.
+ */
+class heap_resource : public std::pmr::memory_resource
+{
+  public:
+    /**
+     * @brief Recurso sobre malloc y free, es decir sobre el heap por defecto.
+     */
+    heap_resource() noexcept;
+
+    /**
+     * @brief Recurso sobre un heap de quien llama, que debe vivir más que el recurso.
+     *
+     * @param heap Heap ya inicializado.
+     */
+    explicit heap_resource(heap_t* heap) noexcept;
+
+    /**
+     * @brief Recurso con un heap propio sobre una región reservada con mmap.
+     *
+     * @param reserve Espacio virtual a reservar para el heap.
+     * @throw std::bad_alloc Si no se pudo reservar.
+     */
+    explicit heap_resource(std::size_t reserve);
+
+    heap_resource(const heap_resource&) = delete;
+    heap_resource& operator=(const heap_resource&) = delete;
+
+    /**
+     * @brief Destruye el heap propio, si lo hay; sus bloques dejan de ser válidos.
+     */
+    ~heap_resource() override;
+
+    /**
+     * @brief Heap en el que asigna el recurso.
+     *
+     * @return heap_t* Heap, el por defecto si el recurso usa malloc.
+     */
+    heap_t* heap() const noexcept;
+
+  protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+  private:
+    heap_t* heap_; /**< Heap de los pedidos, nullptr para malloc y free. */
+    heap_t own_;   /**< Heap propio, si el recurso lo creó. */
+    bool owned_;   /**< true si heap_ apunta a own_. */
+};
+
+/**
+ * @brief Recurso de std::pmr que solo avanza el tope de una región y libera todo junto.
+ *
+ * deallocate no hace nada; release baja el tope al comienzo y la región
+ * devuelve sus chunks al sistema, dejando uno habilitado para la próxima
+ * tanda.
+ */
+class monotonic_resource : public std::pmr::memory_resource
+{
+  public:
+    /**
+     * @brief Reserva la región del recurso sin habilitarla.
+     *
+     * @param reserve Espacio virtual a reservar.
+     * @throw std::bad_alloc Si no se pudo reservar.
+     */
+    explicit monotonic_resource(std::size_t reserve = monotonic_reserve);
+
+    monotonic_resource(const monotonic_resource&) = delete;
+    monotonic_resource& operator=(const monotonic_resource&) = delete;
+
+    /**
+     * @brief Libera la región; todo lo asignado deja de ser válido.
+     */
+    ~monotonic_resource() override;
+
+    /**
+     * @brief Libera todo lo asignado de una vez.
+     */
+    void release() noexcept;
+
+    /**
+     * @brief Bytes entre el comienzo de la región y el tope, incluidos los de alineación.
+     *
+     * @return std::size_t Bytes usados.
+     */
+    std::size_t used() const noexcept;
+
+  protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+  private:
+    region_t region_; /**< Región de la que se asigna. */
+};
+
+} // namespace my_memory
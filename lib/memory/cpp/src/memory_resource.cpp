@@ -0,0 +1,139 @@
+#include "memory_resource.hpp"
+#include <cstdint>
+#include <new>
+
+namespace my_memory
+{
+
+/**
+ * @brief Asigna en un heap, o con malloc si no hay heap.
+ *
+ * @param heap Heap, o nullptr.
+ * @param size Tamaño en bytes.
+ * @return void* Área de datos, o nullptr.
+ */
+static void* heap_or_malloc(heap_t* heap, std::size_t size) noexcept
+{
+    return heap ? heap_malloc(heap, size) : malloc(size);
+}
+
+void* allocate(heap_t* heap, std::size_t size, std::size_t alignment) noexcept
+{
+    if (alignment <= malloc_alignment)
+        return heap_or_malloc(heap, size);
+    if (size > SIZE_MAX - alignment)
+        return nullptr;
+
+    char* raw = static_cast<char*>(heap_or_malloc(heap, size + alignment - malloc_alignment));
+    if (!raw)
+        return nullptr;
+
+    // Si hay que correrse, el corrimiento es de al menos 8 bytes: entra la dirección original
+    auto aligned = (reinterpret_cast<std::uintptr_t>(raw) + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+    char* p = reinterpret_cast<char*>(aligned);
+    if (p != raw)
+        reinterpret_cast<void**>(p)[-1] = raw;
+    return p;
+}
+
+void deallocate(heap_t* heap, void* p) noexcept
+{
+    if (!p)
+        return;
+
+    void* raw = static_cast<void**>(p)[-1];
+    if (raw != p)
+        p = raw;
+    if (heap)
+        heap_free(heap, p);
+    else
+        free(p);
+}
+
+heap_resource::heap_resource() noexcept : heap_(nullptr), own_(), owned_(false)
+{
+}
+
+heap_resource::heap_resource(heap_t* heap) noexcept : heap_(heap), own_(), owned_(false)
+{
+}
+
+heap_resource::heap_resource(std::size_t reserve) : heap_(&own_), own_(), owned_(true)
+{
+    if (heap_init(&own_, nullptr, reserve) != 0)
+        throw std::bad_alloc();
+}
+
+heap_resource::~heap_resource()
+{
+    if (owned_)
+        heap_destroy(&own_);
+}
+
+heap_t* heap_resource::heap() const noexcept
+{
+    return heap_ ? heap_ : heap_default();
+}
+
+void* heap_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    void* p = my_memory::allocate(heap_, bytes, alignment);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void heap_resource::do_deallocate(void* p, std::size_t, std::size_t)
+{
+    my_memory::deallocate(heap_, p);
+}
+
+bool heap_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    // Dos recursos sobre el mismo heap pueden liberar lo que asignó el otro
+    auto* o = dynamic_cast<const heap_resource*>(&other);
+    return o && o->heap_ == heap_;
+}
+
+monotonic_resource::monotonic_resource(std::size_t reserve) : region_()
+{
+    if (region_reserve(&region_, reserve, HEAP_CHUNK, 0) != 0)
+        throw std::bad_alloc();
+}
+
+monotonic_resource::~monotonic_resource()
+{
+    region_unmap(&region_);
+}
+
+void monotonic_resource::release() noexcept
+{
+    region_brk(&region_, region_.start);
+}
+
+std::size_t monotonic_resource::used() const noexcept
+{
+    return static_cast<std::size_t>(region_.top - region_.start);
+}
+
+void* monotonic_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    auto top = reinterpret_cast<std::uintptr_t>(region_.top);
+    auto aligned = (top + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+
+    if (bytes > static_cast<std::size_t>(region_.end - region_.top) ||
+        region_sbrk(&region_, static_cast<intptr_t>(aligned - top + bytes)) == reinterpret_cast<void*>(-1))
+        throw std::bad_alloc();
+    return reinterpret_cast<void*>(aligned);
+}
+
+void monotonic_resource::do_deallocate(void*, std::size_t, std::size_t)
+{
+}
+
+bool monotonic_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
+
+} // namespace my_memory
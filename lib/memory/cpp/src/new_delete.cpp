@@ -0,0 +1,162 @@
+#include "memory_resource.hpp"
+#include <new>
+
+/**
+ * @brief Alineación de un pedido de operator new sin alineación explícita.
+ *
+ * El compilador da por hecho __STDCPP_DEFAULT_NEW_ALIGNMENT__ (16 en x86-64),
+ * pero un objeto nunca está más alineado que su tamaño: los pedidos chicos
+ * salen directo de malloc, sin los bytes extra de allocate.
+ *
+ * @param size Tamaño del pedido.
+ * @return std::size_t Alineación a pedir.
+ */
+static std::size_t default_alignment(std::size_t size) noexcept
+{
+    return size < __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? my_memory::malloc_alignment : __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+}
+
+/**
+ * @brief Asigna como operator new: reintenta con el new_handler instalado o lanza std::bad_alloc.
+ *
+ * @param size Tamaño del pedido.
+ * @param alignment Alineación del pedido.
+ * @return void* Área alineada, nunca nullptr.
+ */
+static void* new_impl(std::size_t size, std::size_t alignment)
+{
+    // new de 0 bytes tiene que devolver una dirección distinta cada vez
+    if (size == 0)
+        size = 1;
+    for (;;)
+    {
+        void* p = my_memory::allocate(nullptr, size, alignment);
+        if (p)
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+/**
+ * @brief Asigna como operator new sin excepciones.
+ *
+ * @param size Tamaño del pedido.
+ * @param alignment Alineación del pedido.
+ * @return void* Área alineada, o nullptr.
+ */
+static void* new_nothrow(std::size_t size, std::size_t alignment) noexcept
+{
+    try
+    {
+        return new_impl(size, alignment);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    return new_impl(size, default_alignment(size));
+}
+
+void* operator new[](std::size_t size)
+{
+    return new_impl(size, default_alignment(size));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return new_nothrow(size, default_alignment(size));
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return new_nothrow(size, default_alignment(size));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    return new_impl(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return new_impl(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return new_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return new_nothrow(size, static_cast<std::size_t>(alignment));
+}
+
+// deallocate distingue solo las áreas alineadas, así que todas las variantes de delete terminan igual
+
+void operator delete(void* p) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    my_memory::deallocate(nullptr, p);
+}
@@ -0,0 +1,290 @@
+/**
+ * @file heap.h
+ * @brief Heaps independientes, cada uno con su lista de bloques, política y memoria.
+ *
+ * malloc, free, calloc y realloc operan sobre un heap por defecto que vive
+ * en el program break. Con heap_init se crean otros heaps sobre un buffer
+ * de quien llama o sobre una región propia reservada con mmap; no comparten
+ * estado entre sí, así que hilos distintos pueden usar heaps distintos sin
+ * sincronizarse. Un mismo heap no es seguro entre hilos.
+ *
+ * La biblioteca genérica elige la política en ejecución con heap_control.
+ * Las variantes my_memory_firstfit, my_memory_bestfit, my_memory_worstfit y
+ * my_memory_tlsf se compilan con MEMORY_POLICY definida: la búsqueda de esa
+ * política queda fija en malloc, sin despacho, y heap_control solo acepta esa.
+ */
+
+#pragma once
+
+#include "memory.h"
+#include "region.h"
+
+/** Granularidad con la que crece la región de un heap creado sin buffer. */
+#define HEAP_CHUNK (64 * 1024)
+
+/** 1 si los bloques libres se indexan en las listas segregadas de TLSF. */
+#if defined(MEMORY_POLICY) && MEMORY_POLICY == TLSF
+#define HEAP_FREE_INDEX 1
+#else
+#define HEAP_FREE_INDEX 0
+#endif
+
+/** Bits de segundo nivel de TLSF: cada potencia de dos se divide en 2^TLSF_SL_LOG listas. */
+#define TLSF_SL_LOG 4
+/** Listas de segundo nivel por cada primer nivel. */
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG)
+/** Primeros niveles de TLSF; el último también recibe los bloques de 2^38 bytes o más. */
+#define TLSF_FL_COUNT 32
+/** Tamaño desde el que las listas dejan de ser lineales (de a 8 bytes) y pasan a ser logarítmicas. */
+#define TLSF_SMALL (TLSF_SL_COUNT * 8)
+
+/**
+ * @struct tlsf
+ * @brief Índice de bloques libres por clase de tamaño de la política TLSF.
+ *
+ * Los enlaces de cada lista se guardan en el área de datos del bloque libre,
+ * por eso en la variante TLSF ningún bloque mide menos de 16 bytes. Los
+ * mapas de bits permiten encontrar la primera lista no vacía de una clase
+ * suficiente en tiempo constante.
+ */
+struct tlsf
+{
+    unsigned fl_bitmap;                                  /**< Primeros niveles con alguna lista no vacía. */
+    unsigned sl_bitmap[TLSF_FL_COUNT];                   /**< Listas no vacías de cada primer nivel. */
+    struct s_block* lists[TLSF_FL_COUNT][TLSF_SL_COUNT]; /**< Bloques libres de cada clase. */
+    struct s_block* last;                                /**< Último bloque del heap, para extenderlo. */
+};
+
+/** Tipo del índice de TLSF. */
+typedef struct tlsf tlsf_t;
+
+/**
+ * @struct tlsf_links
+ * @brief Enlaces de un bloque libre en su lista de TLSF, guardados en su área de datos.
+ */
+struct tlsf_links
+{
+    struct s_block* next; /**< Siguiente bloque libre de la misma clase. */
+    struct s_block* prev; /**< Bloque libre anterior de la misma clase, NULL para la cabeza. */
+};
+
+/** Tipo de los enlaces de TLSF. */
+typedef struct tlsf_links tlsf_links;
+
+/** Enlaces de TLSF de un bloque libre. */
+#define links_of(b) ((tlsf_links*)(b)->data)
+
+/** Tamaño más grande de bloque que free puede estacionar en un fast bin. */
+#define HEAP_FASTBIN_MAX 256
+/** Fast bins de un heap: uno por cada tamaño alineado hasta HEAP_FASTBIN_MAX. */
+#define HEAP_FASTBIN_COUNT (HEAP_FASTBIN_MAX / 8 + 1)
+/** Bytes estacionados en los fast bins a partir de los que free los consolida. */
+#define HEAP_FASTBIN_THRESHOLD (64 * 1024)
+
+/** Siguiente bloque de un fast bin, guardado en el área de datos del bloque estacionado. */
+#define fast_next(b) (*(struct s_block**)(b)->data)
+
+/**
+ * @struct heap_counters
+ * @brief Operaciones internas de un heap desde que se creó, para medir cuánto trabajo ahorran los fast bins.
+ */
+struct heap_counters
+{
+    uint64_t fusions;        /**< Bloques libres absorbidos por su anterior. */
+    uint64_t extends;        /**< Veces que el heap creció con sbrk. */
+    uint64_t shrinks;        /**< Veces que free devolvió la cola libre con brk. */
+    uint64_t consolidations; /**< Pasadas que vaciaron los fast bins. */
+};
+
+/** Tipo de los contadores de un heap. */
+typedef struct heap_counters heap_counters_t;
+
+/** Bytes del heap que representa cada bit del mapa de bloques: la alineación de los encabezados. */
+#define HEAP_MAP_GRANULE 8
+
+/**
+ * @struct heap_map
+ * @brief Copia densa de los límites y el estado de los bloques, fuera de los datos (ver heap_map.h).
+ */
+struct heap_map
+{
+    uint64_t* starts; /**< Un bit por gránulo de la región: 1 donde empieza un encabezado. NULL si está apagado. */
+    uint64_t* frees;  /**< Un bit por gránulo: 1 en el comienzo de un bloque libre. */
+    size_t words;     /**< Palabras de cada mapa, suficientes para toda la reserva de la región. */
+    size_t free;      /**< Bits en 1 de frees: con 0 una búsqueda no recorre el mapa. */
+};
+
+/** Tipo del mapa de bloques. */
+typedef struct heap_map heap_map_t;
+
+/**
+ * @struct heap
+ * @brief Estado completo de un heap.
+ */
+struct heap
+{
+    void* base;                           /**< Primer bloque, NULL si el heap está vacío. */
+    int method;                           /**< Política de asignación (FIRST_FIT, BEST_FIT, WORST_FIT o TLSF). */
+    unsigned growth_hint;                 /**< Sobre-reserva de realloc en porcentaje. */
+    int in_region;                        /**< 1 si el heap vive en region, 0 si usa el program break. */
+    region_t region;                      /**< Memoria del heap cuando in_region vale 1. */
+    tlsf_t tlsf;                          /**< Índice de bloques libres, solo se usa en la variante TLSF. */
+    size_t fast_max;                      /**< Mayor tamaño que se estaciona en los fast bins, 0 si están apagados. */
+    size_t fast_bytes;                    /**< Bytes de datos estacionados en los fast bins. */
+    t_block fastbins[HEAP_FASTBIN_COUNT]; /**< Bloques liberados sin fusionar, una pila por tamaño / 8. */
+    heap_counters_t counters;             /**< Operaciones internas del heap. */
+    heap_map_t map;                       /**< Mapa de bloques, solo si se activó con heap_map. */
+};
+
+/** Tipo de un heap. */
+typedef struct heap heap_t;
+
+/**
+ * @brief Inicializa un heap vacío con política FIRST_FIT, o con la de la variante si es fija.
+ *
+ * @param h Heap a inicializar.
+ * @param buffer Memoria donde vive el heap, o NULL para reservar una región propia con mmap.
+ * @param size Tamaño del buffer, o espacio máximo a reservar si buffer es NULL.
+ * @return int 0 si el heap quedó listo, -1 si el buffer es demasiado chico o falló la reserva.
+ */
+int heap_init(heap_t* h, void* buffer, size_t size);
+
+/**
+ * @brief Libera la región de un heap creado con heap_init. Sus bloques dejan de ser válidos.
+ *
+ * Los bloques que seguían ocupados se descuentan de sus etiquetas y el mapa
+ * de bloques, si lo tenía, se libera.
+ *
+ * @param h Heap a destruir; el heap por defecto se ignora.
+ */
+void heap_destroy(heap_t* h);
+
+/**
+ * @brief Devuelve el heap por defecto, el que usan malloc, free, calloc y realloc.
+ *
+ * @return heap_t* Heap por defecto.
+ */
+heap_t* heap_default(void);
+
+/**
+ * @brief Cambia la política de asignación de un heap.
+ *
+ * @param h Heap.
+ * @param policy FIRST_FIT, BEST_FIT o WORST_FIT; en una variante, solo su política.
+ * @return int 0 si se cambió, -1 si la política no existe o no está compilada.
+ */
+int heap_control(heap_t* h, int policy);
+
+/**
+ * @brief Asigna un bloque en un heap, como malloc().
+ *
+ * @param h Heap.
+ * @param size Tamaño en bytes.
+ * @return void* Área de datos, o NULL si el heap no tiene lugar.
+ */
+void* heap_malloc(heap_t* h, size_t size);
+
+/**
+ * @brief Asigna un bloque en un heap a nombre de un sitio de llamada.
+ *
+ * Cada punto de entrada pasa su propia dirección de retorno: el perfilador
+ * atribuye la muestra a ese sitio sin contar cuántos marcos propios hay en
+ * el medio, que cambian con el inlining y las llamadas de cola.
+ *
+ * @param h Heap.
+ * @param size Tamaño en bytes.
+ * @param site Dirección de retorno del llamador del punto de entrada.
+ * @return void* Área de datos, o NULL si el heap no tiene lugar.
+ */
+void* heap_malloc_from(heap_t* h, size_t size, const void* site);
+
+/**
+ * @brief Libera un bloque de un heap, como free(). Ignora direcciones que no son del heap.
+ *
+ * @param h Heap.
+ * @param p Área de datos a liberar.
+ */
+void heap_free(heap_t* h, void* p);
+
+/**
+ * @brief Asigna un bloque inicializado en cero en un heap, como calloc().
+ *
+ * @param h Heap.
+ * @param number Número de elementos.
+ * @param size Tamaño de cada elemento.
+ * @return void* Área de datos, o NULL si el heap no tiene lugar.
+ */
+void* heap_calloc(heap_t* h, size_t number, size_t size);
+
+/**
+ * @brief Cambia el tamaño de un bloque de un heap, como realloc().
+ *
+ * @param h Heap.
+ * @param p Área de datos a redimensionar, o NULL para asignar.
+ * @param size Nuevo tamaño en bytes; 0 libera p.
+ * @return void* Área de datos redimensionada, o NULL si no hubo lugar o size es 0.
+ */
+void* heap_realloc(heap_t* h, void* p, size_t size);
+
+/**
+ * @brief Cambia el tamaño de un bloque de un heap a nombre de un sitio de llamada, como heap_malloc_from().
+ *
+ * @param h Heap.
+ * @param p Área de datos a redimensionar, o NULL para asignar.
+ * @param size Nuevo tamaño en bytes; 0 libera p.
+ * @param site Dirección de retorno del llamador del punto de entrada.
+ * @return void* Área de datos redimensionada, o NULL si no hubo lugar o size es 0.
+ */
+void* heap_realloc_from(heap_t* h, void* p, size_t size, const void* site);
+
+/**
+ * @brief Activa los fast bins de un heap: free estaciona los bloques chicos sin fusionarlos.
+ *
+ * Un bloque de hasta max bytes liberado queda ocupado para el resto del heap
+ * y se apila en el bin de su tamaño; el próximo pedido de ese tamaño lo saca
+ * sin buscar ni partir, y sus vecinos no se fusionan ni el heap se achica. Lo
+ * estacionado se consolida, es decir se libera y fusiona como lo haría free,
+ * cuando un pedido más grande que max no encuentra lugar, cuando el heap no
+ * puede crecer y cuando los bins superan HEAP_FASTBIN_THRESHOLD bytes.
+ *
+ * pheap_close consolida antes de cerrar; si el proceso cae, la próxima
+ * apertura los libera al reconstruir el heap con heap_rebuild.
+ *
+ * @param h Heap.
+ * @param max Tamaño más grande a estacionar, hasta HEAP_FASTBIN_MAX; 0 consolida y los apaga.
+ * @return int 0 si se configuró, -1 si max es demasiado grande.
+ */
+int heap_fastbins(heap_t* h, size_t max);
+
+/**
+ * @brief Libera y fusiona todos los bloques estacionados en los fast bins de un heap.
+ *
+ * @param h Heap.
+ */
+void heap_consolidate(heap_t* h);
+
+/**
+ * @brief Reconstruye la lista, los enlaces y el índice de libres de un heap a partir de los tamaños.
+ *
+ * Sirve para retomar un heap cuya memoria sobrevivió al proceso: recorre los
+ * bloques por tamaño desde el comienzo de la región, descarta desde el primer
+ * encabezado inválido (una extensión interrumpida), fusiona libres contiguos
+ * (un free interrumpido) y devuelve la cola libre. Los bloques estacionados
+ * en los fast bins se liberan siguiendo sus pilas, reubicadas en moved.
+ *
+ * @param h Heap sobre una región.
+ * @param moved Bytes que se movió la región, ya actualizada, desde que se escribieron los encabezados.
+ * @return int 0 si el heap estaba intacto, 1 si hubo que repararlo, -1 si el heap no está en una región.
+ */
+int heap_rebuild(heap_t* h, ptrdiff_t moved);
+
+/**
+ * @brief Calcula los bytes asignados y libres de un heap.
+ *
+ * Los bloques estacionados en los fast bins cuentan como libres.
+ *
+ * @param h Heap.
+ * @param allocated Bytes en bloques ocupados.
+ * @param free Bytes en bloques libres.
+ */
+void heap_usage(heap_t* h, size_t* allocated, size_t* free);
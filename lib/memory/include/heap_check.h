@@ -0,0 +1,157 @@
+/**
+ * @file heap_check.h
+ * @brief Verificador de consistencia del heap, completo, incremental o paralelo.
+ *
+ * Valida toda la estructura del heap: simetría de los enlaces prev/next,
+ * adyacencia física entre bloques según su tamaño, alineación, cookies de
+ * los encabezados, estado libre y fusión de los bloques libres, y que la
+ * suma de los bloques cubra exactamente el heap. El resultado es un reporte
+ * estructurado, sin salida por pantalla.
+ *
+ * En la variante TLSF también verifica que el índice de libres contenga
+ * exactamente los bloques libres, con sus enlaces y mapas de bits coherentes.
+ *
+ * El modo incremental recorre a lo sumo N bloques por llamada a partir de un
+ * cursor, así se puede correr continuamente con un costo acotado.
+ *
+ * Las variantes heap_check_heap* verifican cualquier heap_t; las demás, el
+ * heap por defecto.
+ */
+
+#pragma once
+
+#include "heap.h"
+#include "memory.h"
+
+/** Enlaces prev/next que no se corresponden, o un next que no avanza. */
+#define HEAP_CHECK_LINKS 0x01
+/** El siguiente bloque no empieza donde termina el anterior. */
+#define HEAP_CHECK_ADJACENCY 0x02
+/** Bloque o datos fuera de los límites del heap. */
+#define HEAP_CHECK_BOUNDS 0x04
+/** Encabezado o tamaño sin la alineación de align(). */
+#define HEAP_CHECK_ALIGNMENT 0x08
+/** Cookie o puntero a datos del encabezado corruptos. */
+#define HEAP_CHECK_COOKIE 0x10
+/** Indicador free inválido o bloques libres adyacentes sin fusionar. */
+#define HEAP_CHECK_FREE 0x20
+/** Los bloques recorridos no suman el tamaño del heap. */
+#define HEAP_CHECK_TOTALS 0x40
+/** El índice de libres de TLSF no contiene exactamente los bloques libres del heap. */
+#define HEAP_CHECK_INDEX 0x80
+/** Hilos máximos de heap_check_parallel(). */
+#define HEAP_CHECK_MAX_THREADS 64
+
+/**
+ * @struct heap_report
+ * @brief Resultado de una verificación del heap.
+ */
+struct heap_report
+{
+    size_t blocks;       /**< Bloques verificados. */
+    size_t free_blocks;  /**< Bloques libres verificados. */
+    size_t used_bytes;   /**< Bytes de datos en bloques ocupados. */
+    size_t free_bytes;   /**< Bytes de datos en bloques libres. */
+    size_t errors;       /**< Inconsistencias encontradas. */
+    unsigned kinds;      /**< Combinación de HEAP_CHECK_* encontrados. */
+    void* first_bad;     /**< Primer bloque inconsistente, NULL si no hubo. */
+    unsigned first_kind; /**< HEAP_CHECK_* del primer error. */
+    size_t restarts;     /**< Pasadas incrementales reiniciadas porque el heap cambió bajo el cursor. */
+    size_t longest;      /**< Bloques que recorrió el hilo más cargado, todos si fue en serie. */
+};
+
+/** Tipo del reporte de verificación. */
+typedef struct heap_report heap_report_t;
+
+/**
+ * @struct heap_cursor
+ * @brief Estado de una verificación incremental.
+ */
+struct heap_cursor
+{
+    heap_t* heap;         /**< Heap que se verifica, NULL para el heap por defecto. */
+    t_block block;        /**< Próximo bloque a verificar, NULL al comenzar una pasada. */
+    heap_report_t report; /**< Reporte de la pasada en curso. */
+    size_t passes;        /**< Pasadas completadas. */
+};
+
+/** Tipo del cursor de verificación incremental. */
+typedef struct heap_cursor heap_cursor_t;
+
+/**
+ * @brief Verifica todo un heap.
+ *
+ * @param h Heap a verificar.
+ * @param report Reporte a completar.
+ * @return int 0 si el heap es consistente, -1 si se encontraron errores.
+ */
+int heap_check_heap(heap_t* h, heap_report_t* report);
+
+/**
+ * @brief Verifica todo el heap por defecto, como heap_check_heap().
+ *
+ * @param report Reporte a completar.
+ * @return int 0 si el heap es consistente, -1 si se encontraron errores.
+ */
+int heap_check(heap_report_t* report);
+
+/**
+ * @brief Prepara un cursor para verificar un heap de a partes.
+ *
+ * @param cursor Cursor a inicializar.
+ * @param h Heap a verificar.
+ */
+void heap_check_heap_begin(heap_cursor_t* cursor, heap_t* h);
+
+/**
+ * @brief Prepara un cursor para verificar el heap por defecto de a partes.
+ *
+ * Un cursor en cero también verifica el heap por defecto.
+ *
+ * @param cursor Cursor a inicializar.
+ */
+void heap_check_begin(heap_cursor_t* cursor);
+
+/**
+ * @brief Verifica a lo sumo n bloques a partir del cursor.
+ *
+ * El heap puede modificarse entre llamadas. Si el bloque del cursor dejó de
+ * existir (por ejemplo, se fusionó con su anterior) la pasada vuelve a
+ * empezar desde el primer bloque. La cobertura total solo se verifica cuando
+ * una pasada se completa en una sola llamada, porque entre llamadas el heap
+ * cambia de tamaño.
+ *
+ * @param cursor Cursor iniciado con heap_check_heap_begin() o heap_check_begin().
+ * @param n Bloques a verificar en esta llamada.
+ * @return int 1 si la pasada terminó y cursor->report tiene su resultado,
+ * 0 si todavía quedan bloques. La siguiente llamada empieza una pasada nueva.
+ */
+int heap_check_step(heap_cursor_t* cursor, size_t n);
+
+/**
+ * @brief Verifica todo un heap repartiéndolo en segmentos entre varios hilos.
+ *
+ * Cada hilo recibe una parte igual de las direcciones del heap y busca su
+ * primer bloque con el mapa de bloques si está activo, o probando las
+ * direcciones alineadas del rango. Al final los segmentos se cosen en orden
+ * y el rango de un hilo que no empezó donde terminó el anterior se verifica
+ * de nuevo en el hilo que llama.
+ *
+ * El heap no debe modificarse hasta que la función retorne. Si no se pueden
+ * crear los hilos se verifica en el hilo que llama.
+ *
+ * @param h Heap a verificar.
+ * @param report Reporte a completar.
+ * @param nthreads Hilos a usar, a lo sumo HEAP_CHECK_MAX_THREADS.
+ * @return int 0 si el heap es consistente, -1 si se encontraron errores.
+ */
+int heap_check_heap_parallel(heap_t* h, heap_report_t* report, int nthreads);
+
+/**
+ * @brief Verifica todo el heap por defecto con varios hilos, como heap_check_heap_parallel().
+ *
+ * @param report Reporte a completar.
+ * @param nthreads Hilos a usar, a lo sumo HEAP_CHECK_MAX_THREADS.
+ * @return int 0 si el heap es consistente, -1 si se encontraron errores.
+ */
+int heap_check_parallel(heap_report_t* report, int nthreads);
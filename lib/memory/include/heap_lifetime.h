@@ -0,0 +1,192 @@
+/**
+ * @file heap_lifetime.h
+ * @brief Segregación por tiempo de vida: los objetos que se predicen longevos van a un heap aparte.
+ *
+ * Cada pedido se identifica por su sitio, la dirección de retorno de quien
+ * pidió la memoria. Una de cada period asignaciones se muestrea: se anota
+ * cuándo nació, medido en bytes asignados, y al liberarse se cuenta como de
+ * vida corta o larga según haya vivido menos o más de threshold bytes. Las muestras que siguen vivas se
+ * revisan de a poco, así un sitio cuyos objetos nunca se liberan también
+ * aprende que son de vida larga.
+ *
+ * Los pedidos de un sitio con mayoría de muestras largas van a un heap propio
+ * sobre una región; los demás, y los de sitios sin datos, al heap de vida
+ * corta. Los objetos longevos dejan de quedar salpicados entre los
+ * temporales: los huecos que dejan estos vuelven a fusionarse y el tope del
+ * heap de vida corta queda libre más seguido, así que free puede devolverlo.
+ *
+ * El heap de vida larga es una región reservada con mmap donde la ubique el
+ * sistema, no al lado del heap de vida corta: es otro espacio de direcciones
+ * que comprometer y el heap de vida corta no puede crecer sobre él.
+ *
+ * Con malloc_lifetime, o con HEAP_LIFETIME en el entorno, malloc, free,
+ * calloc y realloc segregan sobre el heap por defecto; sin eso está apagada.
+ * El perfilador, el histograma de tamaños y valid_addr() cubren los dos
+ * heaps. Las tablas se reservan con mmap, como las del perfilador.
+ *
+ * No conviene activarla sin medir la carga propia. En el churn de
+ * policies_stats (20000 rondas, umbral de 256 KB, promedio de 250 ciclos)
+ * no mejora ninguna política y empeora BEST_FIT: la huella pasa de 670 KB
+ * a 1429 KB y la fragmentación de 14,4 a 39,7, porque find_best_fit
+ * descarta el gran libre fusionado del heap de vida corta y lo hace crecer.
+ * Con FIRST_FIT la huella sube de 689 KB a 761 KB y con WORST_FIT queda
+ * igual (926 KB a 935 KB), pero en las dos el RSS sube unos 80 KB por el
+ * bloque comprometido de más de la región aparte.
+ */
+
+#pragma once
+
+#include "heap.h"
+
+/** Asignaciones entre muestras; si está definida, malloc segrega desde el arranque. */
+#define HEAP_LIFETIME getenv("HEAP_LIFETIME")
+/** Asignaciones entre muestras por defecto. */
+#define LIFETIME_DEFAULT_PERIOD 16
+/** Bytes asignados a partir de los que un objeto vivo se considera de vida larga. */
+#define LIFETIME_DEFAULT_THRESHOLD (1024 * 1024)
+/** Sitios distintos que se pueden aprender (potencia de 2). */
+#define LIFETIME_MAX_SITES 1024
+/** Muestras vivas a la vez (potencia de 2). */
+#define LIFETIME_MAX_SAMPLES 4096
+/** Muestras de un sitio necesarias para predecir. */
+#define LIFETIME_MIN_SAMPLES 4
+/** Al llegar a estas muestras las cuentas de un sitio se dividen por dos, para seguir cambios de comportamiento. */
+#define LIFETIME_DECAY 64
+/** Muestras vivas que revisa cada muestra nueva buscando las que pasaron el umbral. */
+#define LIFETIME_SWEEP 4
+/** Espacio virtual reservado para el heap de vida larga. */
+#define LIFETIME_RESERVE ((size_t)1 << 30)
+/** Sitio sin muestras suficientes: sus pedidos van al heap de vida corta. */
+#define LIFETIME_UNKNOWN 0
+/** Sitio cuyos objetos se liberan antes del umbral. */
+#define LIFETIME_SHORT 1
+/** Sitio cuyos objetos sobreviven al umbral. */
+#define LIFETIME_LONG 2
+
+/**
+ * @struct lifetime_site
+ * @brief Tiempos de vida observados en un sitio de asignación.
+ */
+struct lifetime_site
+{
+    const void* site; /**< Dirección de retorno del sitio, NULL si la entrada está vacía. */
+    uint32_t shorts;  /**< Muestras liberadas antes del umbral. */
+    uint32_t longs;   /**< Muestras que pasaron el umbral. */
+};
+
+/**
+ * @struct lifetime_sample
+ * @brief Objeto muestreado que sigue vivo.
+ */
+struct lifetime_sample
+{
+    void* ptr;      /**< Dirección de datos, NULL si la entrada está vacía. */
+    uint32_t site;  /**< Índice del sitio en la tabla de sitios. */
+    int counted;    /**< 1 si el barrido ya lo contó como de vida larga. */
+    uint64_t birth; /**< Reloj de bytes asignados cuando nació. */
+};
+
+/**
+ * @struct heap_lifetime
+ * @brief Predictor de tiempos de vida y los dos heaps entre los que reparte los pedidos.
+ */
+struct heap_lifetime
+{
+    heap_t* short_heap;              /**< Heap de los objetos de vida corta y de los sitios sin datos. */
+    heap_t long_heap;                /**< Heap de los objetos de vida larga, sobre una región propia. */
+    int predicting;                  /**< 1 mientras se muestrea y se segrega; con 0 los pedidos van a short_heap. */
+    size_t period;                   /**< Asignaciones entre muestras. */
+    uint64_t threshold;              /**< Edad en bytes asignados que separa vida corta de larga. */
+    uint64_t clock;                  /**< Bytes asignados desde heap_lifetime_init. */
+    size_t countdown;                /**< Asignaciones hasta la próxima muestra. */
+    size_t sweep;                    /**< Próxima entrada de samples que revisa el barrido. */
+    size_t live;                     /**< Muestras vivas. */
+    size_t num_sites;                /**< Sitios ocupados. */
+    struct lifetime_site* sites;     /**< Tabla de sitios, direccionamiento abierto por dirección de retorno. */
+    struct lifetime_sample* samples; /**< Muestras vivas, direccionamiento abierto por dirección. */
+    uint64_t placed_long;            /**< Pedidos ubicados en long_heap. */
+    uint64_t placed_short;           /**< Pedidos ubicados en short_heap mientras se predecía. */
+};
+
+/** Tipo de un predictor de tiempos de vida. */
+typedef struct heap_lifetime heap_lifetime_t;
+
+/** Predictor de malloc(), NULL mientras la segregación del heap por defecto nunca se activó. */
+extern heap_lifetime_t* heap_lifetime_default;
+
+/**
+ * @brief Prepara un predictor vacío y reserva su heap de vida larga.
+ *
+ * @param lt Predictor.
+ * @param short_heap Heap de vida corta, ya inicializado.
+ * @param period Asignaciones entre muestras, 0 para LIFETIME_DEFAULT_PERIOD.
+ * @param threshold Edad de vida larga en bytes asignados, 0 para LIFETIME_DEFAULT_THRESHOLD.
+ * @return int 0 si quedó listo, -1 si no se pudo reservar memoria.
+ */
+int heap_lifetime_init(heap_lifetime_t* lt, heap_t* short_heap, size_t period, uint64_t threshold);
+
+/**
+ * @brief Libera las tablas y el heap de vida larga; sus bloques dejan de ser válidos.
+ *
+ * @param lt Predictor.
+ */
+void heap_lifetime_destroy(heap_lifetime_t* lt);
+
+/**
+ * @brief Predicción para los pedidos de un sitio.
+ *
+ * @param lt Predictor.
+ * @param site Sitio del pedido.
+ * @return int LIFETIME_UNKNOWN, LIFETIME_SHORT o LIFETIME_LONG.
+ */
+int heap_lifetime_predict(const heap_lifetime_t* lt, const void* site);
+
+/**
+ * @brief Asigna en el heap que corresponde a la predicción del sitio, y a veces toma una muestra.
+ *
+ * @param lt Predictor.
+ * @param size Tamaño en bytes.
+ * @param site Sitio del pedido, normalmente __builtin_return_address(0) de quien asigna.
+ * @return void* Área de datos, o NULL si ningún heap tiene lugar.
+ */
+void* heap_lifetime_malloc(heap_lifetime_t* lt, size_t size, const void* site);
+
+/**
+ * @brief Libera un bloque de cualquiera de los dos heaps y, si era una muestra, anota su tiempo de vida.
+ *
+ * @param lt Predictor.
+ * @param p Área de datos a liberar.
+ */
+void heap_lifetime_free(heap_lifetime_t* lt, void* p);
+
+/**
+ * @brief Cambia el tamaño de un bloque dentro de su heap; una muestra conserva su edad si el bloque se mueve.
+ *
+ * @param lt Predictor.
+ * @param p Área de datos, o NULL para asignar.
+ * @param size Nuevo tamaño en bytes; 0 libera p.
+ * @param site Sitio del pedido, para cuando p es NULL.
+ * @return void* Área de datos redimensionada, o NULL si no hubo lugar o size es 0.
+ */
+void* heap_lifetime_realloc(heap_lifetime_t* lt, void* p, size_t size, const void* site);
+
+/**
+ * @brief Indica si una dirección es del heap de vida larga.
+ *
+ * @param lt Predictor.
+ * @param p Dirección.
+ * @return int 1 si p está en la región del heap de vida larga.
+ */
+int heap_lifetime_owns(const heap_lifetime_t* lt, const void* p);
+
+/**
+ * @brief Activa o detiene la segregación de malloc() sobre el heap por defecto.
+ *
+ * Detenerla solo deja de muestrear y de ubicar pedidos en el heap de vida
+ * larga: los bloques que ya están ahí se siguen liberando donde corresponde.
+ *
+ * @param period Asignaciones entre muestras, 0 para detenerla.
+ * @param threshold Edad de vida larga en bytes asignados, 0 para LIFETIME_DEFAULT_THRESHOLD.
+ * @return int 0 si se configuró, -1 si no se pudo reservar memoria.
+ */
+int malloc_lifetime(size_t period, uint64_t threshold);
@@ -0,0 +1,114 @@
+/**
+ * @file heap_map.h
+ * @brief Mapa de bloques fuera de banda: límites y estado de los bloques en mapas de bits densos.
+ *
+ * Recorrer el heap por sus encabezados salta de bloque en bloque por toda la
+ * región: cada salto es un fallo de caché y trae a la caché páginas de
+ * datos del usuario. Con el mapa activo, el heap guarda además dos bits por
+ * gránulo de HEAP_MAP_GRANULE bytes, en memoria aparte: uno marca dónde
+ * empieza cada encabezado y el otro si ese bloque está libre. Como los
+ * bloques de una región son contiguos, el tamaño de un bloque es la distancia
+ * hasta el siguiente comienzo, así que el mapa alcanza para recorrer el heap
+ * sin leer ningún encabezado.
+ *
+ * Con el mapa, las búsquedas de FIRST_FIT, BEST_FIT y WORST_FIT, heap_usage y
+ * heap_blocks recorren los mapas de a 64 gránulos por palabra y solo miran
+ * los bloques libres; los encabezados siguen siendo la fuente de verdad y se
+ * actualizan igual que sin mapa. TLSF sigue buscando en su índice.
+ *
+ * Cada mapa ocupa un bit por gránulo de toda la reserva de la región, 1/64
+ * de ella, reservado con mmap sin respaldo: solo se tocan las páginas que
+ * cubren la parte usada del heap. Solo los heaps sobre una región pueden
+ * tener mapa.
+ */
+
+#pragma once
+
+#include "heap.h"
+
+/**
+ * @struct heap_blocks
+ * @brief Bloques de un heap, contados por el mapa o por la lista.
+ *
+ * Los bloques estacionados en los fast bins cuentan como ocupados, como en
+ * la lista.
+ */
+struct heap_blocks
+{
+    size_t blocks;      /**< Bloques del heap. */
+    size_t free_blocks; /**< Bloques libres. */
+    size_t used_bytes;  /**< Bytes de datos en bloques ocupados. */
+    size_t free_bytes;  /**< Bytes de datos en bloques libres. */
+};
+
+/** Tipo del conteo de bloques. */
+typedef struct heap_blocks heap_blocks_t;
+
+/**
+ * @brief Activa, reconstruye o apaga el mapa de bloques de un heap.
+ *
+ * Al activarlo el mapa se arma recorriendo la lista una vez; si ya estaba
+ * activo se vuelve a armar, por ejemplo después de heap_rebuild.
+ *
+ * @param h Heap sobre una región.
+ * @param enable 1 para activarlo o reconstruirlo, 0 para apagarlo y liberarlo.
+ * @return int 0 si quedó como se pidió, -1 si el heap no está en una región o falló la reserva.
+ */
+int heap_map(heap_t* h, int enable);
+
+/**
+ * @brief Marca en el mapa el comienzo de un bloque y su estado.
+ *
+ * @param h Heap con el mapa activo.
+ * @param b Bloque.
+ * @param free 1 si el bloque está libre.
+ */
+void heap_map_set(heap_t* h, t_block b, int free);
+
+/**
+ * @brief Cambia en el mapa el estado de un bloque ya marcado.
+ *
+ * @param h Heap con el mapa activo.
+ * @param b Bloque.
+ * @param free 1 si el bloque quedó libre.
+ */
+void heap_map_free(heap_t* h, t_block b, int free);
+
+/**
+ * @brief Borra del mapa un bloque que fue absorbido o devuelto al sistema.
+ *
+ * @param h Heap con el mapa activo.
+ * @param b Bloque que dejó de existir.
+ */
+void heap_map_clear(heap_t* h, t_block b);
+
+/**
+ * @brief Primer bloque que empieza en una dirección o después, sin leer encabezados.
+ *
+ * @param h Heap con el mapa activo.
+ * @param from Dirección dentro de la región.
+ * @return t_block Bloque encontrado, o NULL si no hay ninguno antes del tope.
+ */
+t_block heap_map_next(heap_t* h, const void* from);
+
+/**
+ * @brief Busca un bloque libre en el mapa con la política del heap, sin leer encabezados.
+ *
+ * Devuelve el mismo bloque que la búsqueda sobre la lista: los dos recorren
+ * los bloques en orden de dirección.
+ *
+ * @param h Heap con el mapa activo.
+ * @param last Recibe el último bloque del heap, para extenderlo si no hay lugar.
+ * @param size Tamaño de datos solicitado.
+ * @param steps Bloques libres examinados.
+ * @return t_block Bloque encontrado, o NULL si no hay ninguno.
+ */
+t_block heap_map_find(heap_t* h, t_block* last, size_t size, unsigned* steps);
+
+/**
+ * @brief Cuenta los bloques de un heap y sus bytes, con el mapa si está activo o recorriendo la lista.
+ *
+ * @param h Heap.
+ * @param blocks Recibe el conteo.
+ */
+void heap_blocks(heap_t* h, heap_blocks_t* blocks);
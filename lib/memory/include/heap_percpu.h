@@ -0,0 +1,157 @@
+/**
+ * @file heap_percpu.h
+ * @brief Cachés de bloques chicos por CPU delante de un heap, con secuencias reiniciables (rseq).
+ *
+ * Un caché por hilo deja bloques retenidos en cada hilo ocioso: con muchos
+ * más hilos que núcleos, la memoria cacheada crece con los hilos. Acá el
+ * caché es de la CPU: cada una guarda, por clase de tamaño, una pila de
+ * hasta HEAP_PERCPU_DEPTH bloques, y la memoria cacheada queda acotada por
+ * las CPUs sin importar cuántos hilos haya.
+ *
+ * Con rseq, push y pop son una secuencia reiniciable de Linux: el hilo lee
+ * en qué CPU corre, compara y confirma con una sola escritura del contador
+ * de la pila. Si el kernel lo desaloja o lo migra antes de confirmar, lo
+ * manda al manejador de aborto y la operación se reintenta; así ningún otro
+ * hilo puede tocar la pila en el medio, sin instrucciones atómicas ni locks.
+ * Se usa el área rseq que glibc (2.35 o posterior) registra en cada hilo.
+ *
+ * Sin rseq (otra arquitectura, glibc vieja, kernel sin soporte o
+ * glibc.pthread.rseq=0), o si se pide con HEAP_PERCPU_LOCKED, cada caché
+ * tiene su mutex y la CPU sale de sched_getcpu: un hilo migrado en el medio
+ * solo usa el caché de otra CPU.
+ *
+ * El heap de respaldo es un heap_t propio sobre una región, protegido por un
+ * mutex: las pilas se llenan de a HEAP_PERCPU_BATCH bloques cuando están
+ * vacías y le devuelven otros tantos cuando están llenas. Los pedidos de más
+ * de HEAP_PERCPU_MAX bytes van directo al heap. Las etiquetas de heap_tags
+ * se aplican cuando el bloque sale del heap, no en cada malloc del caché.
+ */
+
+#pragma once
+
+#include "heap.h"
+#include <pthread.h>
+
+/** Mayor pedido que se sirve desde los cachés. */
+#define HEAP_PERCPU_MAX 256
+/** Ancho de cada clase de tamaño de los cachés. */
+#define HEAP_PERCPU_QUANTUM 16
+/** Clases de tamaño de cada caché: una cada HEAP_PERCPU_QUANTUM bytes hasta HEAP_PERCPU_MAX. */
+#define HEAP_PERCPU_CLASSES (HEAP_PERCPU_MAX / HEAP_PERCPU_QUANTUM)
+/** Bloques que guarda cada clase de cada CPU. */
+#define HEAP_PERCPU_DEPTH 32
+/** Bloques que se piden al heap con la pila vacía y que se le devuelven con la pila llena. */
+#define HEAP_PERCPU_BATCH (HEAP_PERCPU_DEPTH / 2)
+/**
+ * Mayor bloque que free guarda en un caché: uno de la última clase que el
+ * heap no partió porque el resto no alcanzaba para otro encabezado.
+ */
+#define HEAP_PERCPU_BLOCK_MAX (HEAP_PERCPU_MAX + BLOCK_SIZE + 16)
+/** Usa cachés con mutex aunque rseq esté disponible. */
+#define HEAP_PERCPU_LOCKED 0x1
+
+/**
+ * @struct heap_percpu_cache
+ * @brief Pilas de bloques de una CPU, en líneas de caché propias.
+ */
+struct heap_percpu_cache
+{
+    pthread_mutex_t lock;                                /**< Solo se toma sin rseq. */
+    intptr_t count[HEAP_PERCPU_CLASSES];                 /**< Bloques de cada pila; rseq confirma escribiéndolo. */
+    void* slots[HEAP_PERCPU_CLASSES][HEAP_PERCPU_DEPTH]; /**< Áreas de datos de cada pila, la cima en count - 1. */
+} __attribute__((aligned(64)));
+
+/**
+ * @struct heap_percpu
+ * @brief Heap con cachés por CPU.
+ */
+struct heap_percpu
+{
+    heap_t heap;                      /**< Heap de respaldo. */
+    pthread_mutex_t lock;             /**< Protege heap, refills y flushes. */
+    int rseq;                         /**< 1 si push y pop usan rseq, 0 si usan el mutex de cada caché. */
+    int cpus;                         /**< Cachés, uno por CPU posible. */
+    struct heap_percpu_cache* caches; /**< Cachés, reservados con mmap. */
+    uint64_t refills;                 /**< Veces que una pila vacía se llenó desde el heap. */
+    uint64_t flushes;                 /**< Veces que una pila llena devolvió bloques al heap. */
+};
+
+/** Tipo de un heap con cachés por CPU. */
+typedef struct heap_percpu heap_percpu_t;
+
+/**
+ * @struct heap_percpu_stats
+ * @brief Memoria retenida en los cachés y tráfico con el heap de respaldo.
+ */
+struct heap_percpu_stats
+{
+    size_t cached_blocks; /**< Bloques en las pilas de todas las CPUs. */
+    size_t cached_bytes;  /**< Bytes de datos de esos bloques. */
+    size_t heap_bytes;    /**< Bytes del heap de respaldo, entre el comienzo de la región y el tope. */
+    uint64_t refills;     /**< Veces que una pila vacía se llenó desde el heap. */
+    uint64_t flushes;     /**< Veces que una pila llena devolvió bloques al heap. */
+    int rseq;             /**< 1 si los cachés usan rseq. */
+};
+
+/** Tipo de las estadísticas de los cachés por CPU. */
+typedef struct heap_percpu_stats heap_percpu_stats_t;
+
+/**
+ * @brief Crea un heap con un caché por CPU posible.
+ *
+ * @param pc Heap a inicializar.
+ * @param size Espacio máximo del heap de respaldo.
+ * @param flags 0, o HEAP_PERCPU_LOCKED para no usar rseq.
+ * @return int 0 si quedó listo, -1 si falló alguna reserva.
+ */
+int heap_percpu_init(heap_percpu_t* pc, size_t size, int flags);
+
+/**
+ * @brief Libera los cachés y el heap de respaldo. Sus bloques dejan de ser válidos.
+ *
+ * @param pc Heap; ningún hilo puede estar usándolo.
+ */
+void heap_percpu_destroy(heap_percpu_t* pc);
+
+/**
+ * @brief Asigna un bloque, desde la pila de la CPU actual si el pedido es chico.
+ *
+ * @param pc Heap.
+ * @param size Tamaño en bytes.
+ * @return void* Área de datos, o NULL si el heap no tiene lugar.
+ */
+void* heap_percpu_malloc(heap_percpu_t* pc, size_t size);
+
+/**
+ * @brief Libera un bloque: los chicos van a la pila de la CPU actual, el resto al heap.
+ *
+ * Un bloque puede liberarse desde cualquier hilo y CPU, no solo desde donde
+ * se asignó.
+ *
+ * @param pc Heap.
+ * @param p Área de datos; se ignoran NULL y las direcciones que no son del heap.
+ */
+void heap_percpu_free(heap_percpu_t* pc, void* p);
+
+/**
+ * @brief Devuelve al heap los bloques de todos los cachés.
+ *
+ * Las pilas de otras CPUs no se pueden vaciar mientras sus hilos operan:
+ * solo debe llamarse sin otros hilos usando el heap.
+ *
+ * @param pc Heap.
+ */
+void heap_percpu_drain(heap_percpu_t* pc);
+
+/**
+ * @brief Mide la memoria retenida en los cachés.
+ *
+ * Toma el mutex del heap de respaldo y, sin rseq, el de cada caché. Con rseq
+ * las pilas de otras CPUs pueden cambiar mientras se leen; las entradas que
+ * ya no apuntan dentro del heap se saltean. Como heap_percpu_drain, el
+ * resultado es exacto solo si ningún otro hilo usa el heap.
+ *
+ * @param pc Heap.
+ * @param stats Recibe las estadísticas.
+ */
+void heap_percpu_stats(heap_percpu_t* pc, heap_percpu_stats_t* stats);
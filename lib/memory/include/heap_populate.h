@@ -0,0 +1,73 @@
+/**
+ * @file heap_populate.h
+ * @brief Prefault en paralelo de asignaciones grandes.
+ *
+ * Un bloque recién sacado del sistema no tiene páginas detrás: la primera
+ * pasada sobre los datos paga un page fault por página, todos en el mismo
+ * hilo. malloc_populate deja el bloque respaldado antes de devolverlo,
+ * repartiendo el rango entre varios hilos que piden las páginas con
+ * MADV_POPULATE_WRITE o, si el kernel no lo tiene, tocando una dirección por
+ * página. calloc_populate hace lo mismo con los calloc grandes, donde la
+ * puesta en cero ya toca cada página y solo falta repartirla.
+ */
+
+#pragma once
+
+#include "heap.h"
+#include <stddef.h>
+
+/** Bytes mínimos por hilo: con menos, crear el hilo cuesta más que los faults que ahorra. */
+#define HEAP_POPULATE_MIN (64 * 1024 * 1024)
+/** Hilos que se usan como máximo para un mismo rango. */
+#define HEAP_POPULATE_MAX_THREADS 64
+/** Tocar una dirección por página aunque el kernel tenga MADV_POPULATE_WRITE. */
+#define HEAP_POPULATE_TOUCH 1
+/** Poner el rango en cero en lugar de solo respaldarlo; implica tocar las páginas. */
+#define HEAP_POPULATE_ZERO 2
+/** Cantidad de hilos con que calloc pone en cero los pedidos grandes desde el arranque, "0" para uno por CPU. */
+#define HEAP_POPULATE getenv("HEAP_POPULATE")
+
+/** Hilos con que calloc respalda los pedidos grandes, 0 si calloc_populate está apagado. */
+extern unsigned heap_calloc_threads;
+
+/**
+ * @brief Respalda un rango de memoria con páginas, repartiéndolo entre hilos.
+ *
+ * El contenido se conserva salvo con HEAP_POPULATE_ZERO. Cada hilo recibe al
+ * menos HEAP_POPULATE_MIN bytes, así que los rangos chicos se respaldan en el
+ * hilo que llama. Si no se puede crear un hilo, su parte la hace el que llama.
+ *
+ * @param p Inicio del rango.
+ * @param size Tamaño del rango en bytes.
+ * @param nthreads Hilos a usar, 0 para uno por CPU en línea.
+ * @param flags Combinación de HEAP_POPULATE_TOUCH y HEAP_POPULATE_ZERO.
+ * @return int Hilos que respaldaron el rango, contando al que llama, o -1 si p es NULL.
+ */
+int heap_populate(void* p, size_t size, unsigned nthreads, int flags);
+
+/**
+ * @brief Asigna en un heap y respalda el bloque antes de devolverlo.
+ *
+ * @param h Heap.
+ * @param size Tamaño en bytes.
+ * @param nthreads Hilos a usar, 0 para uno por CPU en línea.
+ * @return void* Área de datos ya respaldada, o NULL.
+ */
+void* heap_malloc_populate(heap_t* h, size_t size, unsigned nthreads);
+
+/**
+ * @brief Como malloc, pero con el bloque ya respaldado por páginas.
+ *
+ * @param size Tamaño en bytes.
+ * @param nthreads Hilos a usar, 0 para uno por CPU en línea.
+ * @return void* Área de datos ya respaldada, o NULL.
+ */
+void* malloc_populate(size_t size, unsigned nthreads);
+
+/**
+ * @brief Activa o apaga la puesta en cero en paralelo de los calloc de al menos HEAP_POPULATE_MIN bytes.
+ *
+ * @param enable 1 para activarla, 0 para apagarla.
+ * @param nthreads Hilos a usar, 0 para uno por CPU en línea.
+ */
+void calloc_populate(int enable, unsigned nthreads);
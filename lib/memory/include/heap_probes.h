@@ -0,0 +1,52 @@
+/**
+ * @file heap_probes.h
+ * @brief Puntos de traza estáticos (USDT) en los caminos internos del asignador.
+ *
+ * Con <sys/sdt.h> disponible, memory.c deja en cada punto una instrucción nop
+ * y una nota .note.stapsdt que perf, bpftrace o SystemTap usan para engancharse
+ * sin recompilar. Sin un trazador conectado los argumentos ya están en
+ * registros y la sonda no cuesta más que el nop. Sin <sys/sdt.h>, o con
+ * MEMORY_NO_PROBES definida, las sondas no se compilan.
+ *
+ * Sondas del proveedor my_memory:
+ * - find_hit(heap, size, block, steps): malloc encontró un bloque libre
+ *   después de examinar steps bloques (o listas, en TLSF).
+ * - find_miss(heap, size, steps): ningún bloque alcanzó y el heap va a crecer.
+ * - split(block, size, rest): un bloque se partió y quedó un libre de rest bytes.
+ * - fusion(heap, block, absorbed, size): block absorbió al libre absorbed de size bytes.
+ * - extend(heap, block, size): el heap creció con un bloque nuevo al final.
+ * - shrink(heap, address, bytes): free devolvió al sistema la cola libre del heap.
+ *
+ * tools/bpftrace tiene scripts que arman histogramas con estas sondas.
+ */
+
+#pragma once
+
+#if !defined(MEMORY_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+/** 1 si las sondas USDT están compiladas. */
+#define HEAP_PROBES 1
+#endif
+#endif
+
+#ifndef HEAP_PROBES
+/** 1 si las sondas USDT están compiladas. */
+#define HEAP_PROBES 0
+#endif
+
+#if HEAP_PROBES
+/** Sonda de tres argumentos del proveedor my_memory. */
+#define HEAP_PROBE3(name, a, b, c) DTRACE_PROBE3(my_memory, name, a, b, c)
+/** Sonda de cuatro argumentos del proveedor my_memory. */
+#define HEAP_PROBE4(name, a, b, c, d) DTRACE_PROBE4(my_memory, name, a, b, c, d)
+/** Cuenta un paso de búsqueda para find_hit y find_miss. */
+#define probe_step(n) ((n)++)
+#else
+/** Sin sondas no queda nada en el código. */
+#define HEAP_PROBE3(name, a, b, c) ((void)0)
+/** Sin sondas no queda nada en el código. */
+#define HEAP_PROBE4(name, a, b, c, d) ((void)0)
+/** Sin sondas los pasos de búsqueda no se cuentan. */
+#define probe_step(n) ((void)(n))
+#endif
@@ -0,0 +1,111 @@
+/**
+ * @file heap_profile.h
+ * @brief Perfilador de heap por muestreo con atribución a sitios de asignación.
+ *
+ * Toma una muestra de Poisson cada HEAP_PROFILE_RATE bytes asignados en
+ * promedio, captura la pila con backtrace() y acumula bytes vivos y tasas de
+ * asignación por pila. El perfil se vuelca en formato de heap de pprof
+ * (heap_v2) o en formato "folded" para flame graphs, por API o por señal.
+ *
+ * Toda la memoria del perfilador se obtiene con mmap, así que nunca
+ * perturba el heap que está midiendo.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Ruta donde se vuelca el perfil al recibir la señal o al salir. */
+#define HEAP_PROFILE_PATH getenv("HEAP_PROFILE_PATH")
+/** Bytes promedio entre muestras; si está definida el perfilador arranca solo. */
+#define HEAP_PROFILE_RATE getenv("HEAP_PROFILE_RATE")
+/** Número de señal que dispara un volcado a HEAP_PROFILE_PATH. */
+#define HEAP_PROFILE_SIGNAL getenv("HEAP_PROFILE_SIGNAL")
+/** Intervalo de muestreo por defecto en bytes. */
+#define HEAP_PROFILE_DEFAULT_RATE (512 * 1024)
+/** Profundidad máxima de pila capturada. */
+#define HEAP_PROFILE_MAX_DEPTH 32
+/** Sitios de asignación distintos que se pueden registrar (potencia de 2). */
+#define HEAP_PROFILE_MAX_SITES 4096
+/** Asignaciones muestreadas vivas a la vez (potencia de 2). */
+#define HEAP_PROFILE_MAX_LIVE 65536
+/** Formato de heap de pprof (gperftools heap_v2). */
+#define HEAP_PROFILE_PPROF 0
+/** Formato "folded" (pila;pila;hoja bytes) para flamegraph.pl. */
+#define HEAP_PROFILE_FOLDED 1
+
+/** Distinto de cero mientras el perfilador está muestreando. */
+extern int heap_profile_active;
+
+/** Bytes que faltan para la próxima muestra; malloc() lo descuenta sin llamar al perfilador. */
+extern int64_t heap_profile_countdown;
+
+/** Asignaciones muestreadas que siguen vivas; free() solo las busca si hay alguna. */
+extern size_t heap_profile_sampled;
+
+/**
+ * @brief Inicia el muestreo.
+ *
+ * @param sample_rate Bytes promedio entre muestras, 0 para HEAP_PROFILE_DEFAULT_RATE.
+ * @return int 0 si el perfilador quedó activo, -1 si no se pudo reservar memoria.
+ */
+int heap_profile_start(size_t sample_rate);
+
+/**
+ * @brief Detiene el muestreo. Los datos acumulados se conservan para volcarlos.
+ */
+void heap_profile_stop(void);
+
+/**
+ * @brief Descarta todos los sitios y muestras acumulados.
+ */
+void heap_profile_reset(void);
+
+/**
+ * @brief Vuelca el perfil en un descriptor de archivo.
+ *
+ * Es async-signal-safe en formato HEAP_PROFILE_PPROF. En formato
+ * HEAP_PROFILE_FOLDED resuelve símbolos con dladdr(), que no lo es.
+ *
+ * @param fd Descriptor de destino.
+ * @param format HEAP_PROFILE_PPROF o HEAP_PROFILE_FOLDED.
+ * @return int 0 si se escribió todo, -1 en caso de error.
+ */
+int heap_profile_dump_fd(int fd, int format);
+
+/**
+ * @brief Vuelca el perfil en un archivo, reemplazando su contenido.
+ *
+ * @param path Ruta del archivo.
+ * @param format HEAP_PROFILE_PPROF o HEAP_PROFILE_FOLDED.
+ * @return int 0 si se escribió todo, -1 en caso de error.
+ */
+int heap_profile_dump(const char* path, int format);
+
+/**
+ * @brief Instala un manejador que vuelca el perfil pprof a HEAP_PROFILE_PATH.
+ *
+ * @param signo Señal a capturar, por ejemplo SIGUSR2.
+ * @return int 0 si se instaló el manejador, -1 en caso de error.
+ */
+int heap_profile_signal(int signo);
+
+/**
+ * @brief Toma una muestra; malloc() la llama cuando heap_profile_countdown llega a cero.
+ *
+ * La pila registrada empieza en caller, la dirección de retorno que recibió
+ * el punto de entrada (malloc, calloc, realloc o sus variantes heap_*).
+ *
+ * @param ptr Dirección devuelta al usuario.
+ * @param size Tamaño solicitado.
+ * @param caller Sitio de la asignación.
+ */
+void heap_profile_malloc(void* ptr, size_t size, const void* caller);
+
+/**
+ * @brief Registra una liberación; free() la llama si hay muestras vivas.
+ *
+ * @param ptr Dirección que se libera.
+ */
+void heap_profile_free(void* ptr);
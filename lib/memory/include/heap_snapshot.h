@@ -0,0 +1,100 @@
+/**
+ * @file heap_snapshot.h
+ * @brief Volcado binario de la lista de bloques de un heap, seguro dentro de un manejador de señales.
+ *
+ * Cada volcado es un encabezado heap_snapshot_header seguido de un registro
+ * heap_snapshot_record por bloque, en orden de direcciones. Los volcados se
+ * agregan al final del archivo, así un mismo archivo guarda la evolución del
+ * heap y la herramienta heap_analyze la muestra fuera de línea.
+ *
+ * El volcado solo usa write, pwrite, lseek y clock_gettime, y recorre el
+ * heap una sola vez sin pedir memoria: se puede tomar desde una señal con el
+ * proceso en marcha. Los enlaces se siguen con las mismas precauciones que
+ * heap_check, así un heap a medio modificar corta el volcado en lugar de
+ * colgarlo.
+ *
+ * Los bloques estacionados en los fast bins figuran ocupados en la lista de
+ * bloques, pero el próximo malloc de su tamaño los recibe: el volcado los
+ * marca con HEAP_SNAPSHOT_PARKED para que cuenten como espacio libre.
+ */
+
+#pragma once
+
+#include "heap.h"
+
+/** Identificador de un volcado ("HSNP"). */
+#define HEAP_SNAPSHOT_MAGIC 0x504E5348u
+/** Versión del formato del volcado. */
+#define HEAP_SNAPSHOT_VERSION 2
+/** En heap_snapshot_record::size, bit que marca un bloque libre (los tamaños son múltiplos de 8). */
+#define HEAP_SNAPSHOT_FREE 0x1
+/** En heap_snapshot_record::size, bit que marca un bloque ocupado estacionado en un fast bin. */
+#define HEAP_SNAPSHOT_PARKED 0x2
+/** Bits de heap_snapshot_record::size que no son parte del tamaño. */
+#define HEAP_SNAPSHOT_FLAGS (HEAP_SNAPSHOT_FREE | HEAP_SNAPSHOT_PARKED)
+/** El recorrido encontró un enlace inválido y el volcado no llega al tope del heap. */
+#define HEAP_SNAPSHOT_TRUNCATED 0x1
+
+/**
+ * @struct heap_snapshot_header
+ * @brief Encabezado de un volcado.
+ */
+struct heap_snapshot_header
+{
+    uint32_t magic;   /**< HEAP_SNAPSHOT_MAGIC. */
+    uint16_t version; /**< HEAP_SNAPSHOT_VERSION. */
+    uint16_t flags;   /**< Combinación de HEAP_SNAPSHOT_TRUNCATED. */
+    uint32_t arena;   /**< Heap volcado, 0 para el heap por defecto. */
+    uint32_t policy;  /**< Política del heap al momento del volcado. */
+    uint64_t time_ns; /**< CLOCK_REALTIME del volcado, en nanosegundos. */
+    uint64_t start;   /**< Dirección del primer bloque. */
+    uint64_t top;     /**< Tope del heap. */
+    uint64_t count;   /**< Registros que siguen al encabezado. */
+};
+
+/** Tipo del encabezado de un volcado. */
+typedef struct heap_snapshot_header heap_snapshot_header;
+
+/**
+ * @struct heap_snapshot_record
+ * @brief Un bloque del volcado.
+ */
+struct heap_snapshot_record
+{
+    uint64_t address; /**< Dirección del encabezado del bloque. */
+    uint64_t size;    /**< Tamaño de datos, con HEAP_SNAPSHOT_FREE o HEAP_SNAPSHOT_PARKED. */
+};
+
+/** Tipo de un registro del volcado. */
+typedef struct heap_snapshot_record heap_snapshot_record;
+
+/**
+ * @brief Agrega al archivo un volcado de la lista de bloques de un heap.
+ *
+ * Escribe los registros desde la posición actual y completa el encabezado al
+ * final con pwrite, por eso fd tiene que admitir lseek y no estar en modo
+ * O_APPEND. Es seguro en un manejador de señales.
+ *
+ * @param h Heap a volcar.
+ * @param arena Identificador del heap en el volcado.
+ * @param fd Archivo donde se escribe.
+ * @return int 0 si el volcado quedó completo, -1 si falló la escritura.
+ */
+int heap_snapshot(heap_t* h, unsigned arena, int fd);
+
+/**
+ * @brief Agrega un volcado del heap por defecto al final de un archivo.
+ *
+ * @param path Archivo, se crea si no existe.
+ * @return int 0 si el volcado quedó completo, -1 en caso de error.
+ */
+int heap_snapshot_file(const char* path);
+
+/**
+ * @brief Instala un manejador que agrega un volcado del heap por defecto cada vez que llega una señal.
+ *
+ * @param signo Señal, por ejemplo SIGUSR1.
+ * @param path Archivo de los volcados; se copia, no hace falta que siga vivo.
+ * @return int 0 si se instaló el manejador, -1 si la ruta es demasiado larga o falló sigaction.
+ */
+int heap_snapshot_on_signal(int signo, const char* path);
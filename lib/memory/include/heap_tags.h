@@ -0,0 +1,134 @@
+/**
+ * @file heap_tags.h
+ * @brief Contabilidad de asignaciones por etiqueta, con presupuestos blandos.
+ *
+ * Cada subsistema crea una etiqueta y marca lo que asigna, fijando la
+ * etiqueta actual del hilo con heap_tag_set o pidiendo con malloc_tagged.
+ * El bloque guarda su etiqueta en el encabezado, así que free la descuenta
+ * sin buscar nada, en cualquier heap y desde cualquier hilo; realloc la
+ * conserva.
+ *
+ * Los bytes vivos y las operaciones de cada etiqueta se cuentan en
+ * contadores propios de cada hilo, alineados a línea de caché para que dos
+ * hilos nunca escriban la misma línea. Cada hilo vuelca su diferencia al
+ * total compartido de la etiqueta de a lotes; al volcar se compara con el
+ * presupuesto, y la primera vez que se supera se llama al callback de la
+ * etiqueta para que el subsistema frene. El presupuesto es blando: nunca se
+ * niega un pedido, y el total puede atrasarse hasta un lote por hilo.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Etiquetas distintas, contando la 0 que marca los bloques sin etiqueta. */
+#define HEAP_TAG_MAX 64
+/** Longitud máxima del nombre de una etiqueta, con el terminador. */
+#define HEAP_TAG_NAME 32
+/** Hilos con contadores propios a la vez; los que sobran comparten uno con operaciones atómicas. */
+#define HEAP_TAG_THREADS 64
+/** Bytes de diferencia que acumula un hilo antes de volcarlos al total de la etiqueta. */
+#define HEAP_TAG_BATCH (16 * 1024)
+/** Tamaño de una línea de caché, la alineación de los contadores. */
+#define HEAP_TAG_CACHE_LINE 64
+
+/**
+ * @brief Callback de presupuesto: se llama una vez cada vez que una etiqueta pasa de estar dentro a estar sobre él.
+ *
+ * Corre en el hilo que asignó, con el bloque ya asignado: puede asignar o
+ * liberar, pero debería hacer poco.
+ *
+ * @param tag Etiqueta.
+ * @param live Bytes vivos de la etiqueta al superar el presupuesto.
+ * @param budget Presupuesto de la etiqueta.
+ * @param arg Argumento registrado con el callback.
+ */
+typedef void (*heap_tag_callback)(int tag, size_t live, size_t budget, void* arg);
+
+/**
+ * @struct heap_tag_stats
+ * @brief Estado de una etiqueta, sumado sobre todos los hilos.
+ */
+struct heap_tag_stats
+{
+    const char* name; /**< Nombre de la etiqueta. */
+    int64_t live;     /**< Bytes de bloques vivos; puede quedar negativo si se liberan bloques de antes de etiquetar. */
+    uint64_t allocs;  /**< Asignaciones hechas con la etiqueta. */
+    uint64_t frees;   /**< Liberaciones de bloques con la etiqueta. */
+    size_t budget;    /**< Presupuesto blando en bytes, 0 si no tiene. */
+    int over;         /**< 1 si el último volcado superó el presupuesto. */
+};
+
+/** Tipo del estado de una etiqueta. */
+typedef struct heap_tag_stats heap_tag_stats_t;
+
+/** Distinto de cero desde que se creó la primera etiqueta; malloc solo lee la etiqueta del hilo si lo es. */
+extern int heap_tags_active;
+
+/** Etiqueta actual del hilo, 0 si no tiene. */
+extern __thread int heap_tag_current;
+
+/**
+ * @brief Crea una etiqueta.
+ *
+ * @param name Nombre, se copia truncado a HEAP_TAG_NAME - 1 caracteres.
+ * @param budget Presupuesto blando en bytes, 0 para ninguno.
+ * @param callback Función a llamar al superar el presupuesto, o NULL.
+ * @param arg Argumento del callback.
+ * @return int Etiqueta, entre 1 y HEAP_TAG_MAX - 1, o -1 si no quedan o no se pudo reservar memoria.
+ */
+int heap_tag_create(const char* name, size_t budget, heap_tag_callback callback, void* arg);
+
+/**
+ * @brief Cambia el presupuesto y el callback de una etiqueta.
+ *
+ * @param tag Etiqueta.
+ * @param budget Presupuesto blando en bytes, 0 para ninguno.
+ * @param callback Función a llamar al superar el presupuesto, o NULL.
+ * @param arg Argumento del callback.
+ * @return int 0 si se cambió, -1 si la etiqueta no existe.
+ */
+int heap_tag_budget(int tag, size_t budget, heap_tag_callback callback, void* arg);
+
+/**
+ * @brief Fija la etiqueta con la que el hilo marca lo que asigna de ahí en más.
+ *
+ * @param tag Etiqueta, o 0 para dejar de etiquetar.
+ * @return int Etiqueta anterior del hilo, o -1 si tag no existe.
+ */
+int heap_tag_set(int tag);
+
+/**
+ * @brief Asigna con una etiqueta, sin cambiar la del hilo.
+ *
+ * @param tag Etiqueta; si no existe el bloque queda sin etiqueta.
+ * @param size Tamaño en bytes.
+ * @return void* Área de datos, o NULL.
+ */
+void* malloc_tagged(int tag, size_t size);
+
+/**
+ * @brief Estado de una etiqueta.
+ *
+ * @param tag Etiqueta.
+ * @param stats Recibe el estado.
+ * @return int 0 si la etiqueta existe, -1 si no.
+ */
+int heap_tag_stats(int tag, heap_tag_stats_t* stats);
+
+/**
+ * @brief Cantidad de etiquetas creadas; las etiquetas válidas van de 1 a este número.
+ *
+ * @return int Etiquetas creadas.
+ */
+int heap_tag_count(void);
+
+/**
+ * @brief Cuenta una operación sobre un bloque etiquetado. La llaman malloc, free y realloc.
+ *
+ * @param tag Etiqueta del bloque.
+ * @param bytes Bytes que la etiqueta gana, o pierde si es negativo.
+ * @param op 1 para una asignación, -1 para una liberación, 0 para un cambio de tamaño en el lugar.
+ */
+void heap_tag_account(int tag, int64_t bytes, int op);
@@ -23,8 +23,20 @@
  */
 #define align(x) (((((x)-1) >> 3) << 3) + 8)
 
+/**
+ * @brief Macro que calcula la cookie esperada en el encabezado de un bloque.
+ *
+ * Depende de la dirección del bloque, así que un encabezado copiado o
+ * desplazado tampoco pasa la verificación.
+ *
+ * @param b Dirección del bloque.
+ */
+#define block_cookie(b) (BLOCK_MAGIC ^ (unsigned int)((uintptr_t)(b) >> 3))
+
 /** Tamaño mínimo de un bloque de memoria. */
 #define BLOCK_SIZE 40
+/** Valor base de la cookie de los encabezados de bloque. */
+#define BLOCK_MAGIC 0x4D454D42u
 /** Tamaño de página en memoria. */
 #define PAGESIZE 4096
 /** Política de asignación First Fit. */
@@ -33,12 +45,18 @@
 #define BEST_FIT 1
 /** Política de asignación Worst Fit. */
 #define WORST_FIT 2
+/** Política TLSF (two-level segregated fit), solo en la variante my_memory_tlsf. */
+#define TLSF 3
 /** Tamaño del bloque */
 #define DATA_START 1
 /** Número máximo de operaciones de asignación y liberación de memoria. */
 #define MAX_OPERATIONS 100000
 /** Nombre del archivo de registro de operaciones. */
 #define LOG_FILE getenv("LOG_FILE_PATH")
+/** Si vale "1", el heap arranca en modo huge pages (ver malloc_hugepages). */
+#define HEAP_HUGEPAGES getenv("HEAP_HUGEPAGES")
+/** Tamaño más grande que el heap por defecto estaciona en fast bins desde el arranque (ver malloc_fastbins). */
+#define HEAP_FASTBINS getenv("HEAP_FASTBINS")
 
 /** Puntero al primer bloque de memoria. */
 extern void* base;
@@ -55,7 +73,9 @@ struct s_block
     size_t size;           /**< Tamaño del bloque de datos. */
     struct s_block* next;  /**< Puntero al siguiente bloque en la lista enlazada. */
     struct s_block* prev;  /**< Puntero al bloque anterior en la lista enlazada. */
-    int free;              /**< Indicador de si el bloque está libre (1) o ocupado (0). */
+    unsigned short free;   /**< Indicador de si el bloque está libre (1) o ocupado (0). */
+    unsigned short tag;    /**< Etiqueta de contabilidad del bloque ocupado, 0 si no tiene. */
+    unsigned int magic;    /**< Cookie del encabezado, igual a block_cookie(bloque). */
     void* ptr;             /**< Puntero a la dirección de los datos almacenados. */
     char data[DATA_START]; /**< Área donde comienzan los datos del bloque. */
 };
@@ -91,6 +111,9 @@ t_block get_block(void* p);
 /**
  * @brief Verifica si una dirección de memoria es válida.
  *
+ * Con la segregación por tiempo de vida activa también acepta los bloques
+ * del heap de vida larga, que malloc() usa como parte del heap por defecto.
+ *
  * @param p Dirección de memoria a verificar.
  * @return int Retorna 1 si la dirección es válida, 0 en caso contrario.
  */
@@ -168,16 +191,67 @@ void* calloc(size_t number, size_t size);
 /**
  * @brief Cambia el tamaño de un bloque de memoria previamente asignado.
  *
+ * Crece en el lugar siempre que puede: absorbiendo los bloques libres
+ * siguientes, extendiendo el heap si el bloque es el último, o absorbiendo
+ * el bloque libre anterior (en ese caso los datos se mueven con memmove).
+ * Solo si nada de eso alcanza asigna un bloque nuevo y copia los datos.
+ * Con size en 0 libera el bloque y devuelve NULL, como glibc.
+ *
  * @param p Puntero al área de datos a redimensionar.
  * @param size Nuevo tamaño en bytes.
- * @return void* Puntero al área de datos redimensionada.
+ * @return void* Puntero al área de datos redimensionada, NULL si no hubo lugar o size es 0.
  */
 void* realloc(void* p, size_t size);
 
 /**
- * @brief Verifica el estado del heap y detecta bloques libres consecutivos.
+ * @brief Configura la sobre-reserva geométrica de realloc para buffers que crecen.
+ *
+ * Cuando realloc tiene que extender el heap o mover un bloque para agrandarlo,
+ * reserva percent por ciento más de lo pedido, de modo que los siguientes
+ * realloc del mismo buffer se resuelvan en el lugar. Achicar un bloque solo
+ * devuelve memoria si sobra más que esa reserva.
+ *
+ * @param percent Porcentaje de sobre-reserva (0 la desactiva, 50 equivale a crecer 1.5x).
+ */
+void realloc_growth_hint(unsigned percent);
+
+/**
+ * @brief Cambia el backend del heap entre sbrk y una región alineada a huge pages.
+ *
+ * En modo huge pages el heap vive en una reserva de HUGEPAGE_RESERVE bytes
+ * alineada a HUGEPAGE_SIZE, marcada con MADV_HUGEPAGE y habilitada de a
+ * HUGEPAGE_SIZE bytes, así el kernel puede respaldar cada chunk con una
+ * transparent huge page. Si el kernel no tiene THP se usan páginas normales.
+ * Solo se puede cambiar con el heap vacío.
+ *
+ * @param enable 1 para activar el modo huge pages, 0 para volver a sbrk.
+ * @return int 1 si hay huge pages, 0 si el heap usa páginas normales, -1 si el heap no está vacío o falló la reserva.
+ */
+int malloc_hugepages(int enable);
+
+/**
+ * @brief Activa los fast bins del heap por defecto, como heap_fastbins.
+ *
+ * Con la rotación de bloques chicos del mismo tamaño, free los estaciona sin
+ * fusionarlos ni achicar el heap y malloc los reutiliza directamente; la
+ * fusión se hace después, de una vez, cuando hace falta espacio.
+ *
+ * @param max Tamaño más grande a estacionar, hasta HEAP_FASTBIN_MAX; 0 los apaga.
+ * @return int 0 si se configuró, -1 si max es demasiado grande.
+ */
+int malloc_fastbins(size_t max);
+
+/**
+ * @brief Devuelve el tope actual del heap, sea el program break o el de la región de huge pages.
+ *
+ * @return void* Primera dirección fuera del heap.
+ */
+void* heap_top(void);
+
+/**
+ * @brief Muestra el encabezado de un bloque y las inconsistencias que encuentre heap_check().
  *
- * @param data Información adicional para la verificación.
+ * @param data Área de datos del bloque a mostrar.
  */
 void check_heap(void* data);
 
@@ -0,0 +1,104 @@
+/**
+ * @file pheap.h
+ * @brief Heaps persistentes sobre un archivo mapeado, que un proceso nuevo retoma sin reconstruir.
+ *
+ * pheap_open mapea el archivo con MAP_SHARED y devuelve un heap_t que vive
+ * dentro del mismo archivo, así se usa con heap_malloc, heap_free y el resto
+ * de la API de heap.h. Las estructuras del usuario se enlazan con offsets
+ * (pheap_offset / pheap_pointer) y se cuelgan de un objeto raíz, de modo que
+ * siguen siendo válidas aunque el archivo se mapee en otra dirección.
+ *
+ * Los enlaces internos de los bloques (next, prev, los de los fast bins y
+ * los del índice de TLSF) son punteros y no offsets: todas las políticas y
+ * el verificador los siguen directamente, y el formato del encabezado es el
+ * mismo para todos los heaps. En su lugar el archivo se vuelve a mapear en
+ * la dirección donde se creó y, si está ocupada, heap_rebuild reubica el
+ * heap recorriendo sus bloques una vez por tamaño, que no depende de la
+ * dirección: rehace next, prev y el índice, y suma el desplazamiento a las
+ * pilas de los fast bins para liberar sus bloques.
+ *
+ * Los encabezados se escriben en un orden en el que el tamaño de cada bloque
+ * confirma el cambio. Si el proceso muere con el heap abierto, la próxima
+ * apertura lo repara con heap_rebuild; pheap_checkpoint hace durable en disco
+ * todo lo escrito hasta ese momento.
+ */
+
+#pragma once
+
+#include "heap.h"
+
+/** Identificador de un archivo de heap persistente ("PHEAPMEM"). */
+#define PHEAP_MAGIC 0x4D454D5041454850ull
+/** Versión del formato del archivo; la 2 agregó los fast bins y los contadores a heap_t, la 3 el mapa de bloques. */
+#define PHEAP_VERSION 3
+/** El archivo no existía o estaba vacío y se creó un heap nuevo. */
+#define PHEAP_CREATED 0x1
+/** El último proceso no cerró el heap y hubo que repararlo. */
+#define PHEAP_RECOVERED 0x2
+/** La dirección original estaba ocupada y el heap se reubicó. */
+#define PHEAP_RELOCATED 0x4
+
+/**
+ * @brief Abre o crea un heap persistente.
+ *
+ * Un mismo archivo solo puede estar abierto una vez: se bloquea con flock
+ * hasta pheap_close.
+ *
+ * @param path Archivo del heap.
+ * @param size Tamaño máximo del heap al crearlo; se ignora si el archivo ya existe.
+ * @param status Recibe una combinación de PHEAP_*, puede ser NULL.
+ * @return heap_t* Heap listo para usar, o NULL si el archivo no es un heap, está abierto o falló el mapeo.
+ */
+heap_t* pheap_open(const char* path, size_t size, unsigned* status);
+
+/**
+ * @brief Escribe en disco todo el heap y su encabezado con msync.
+ *
+ * @param h Heap devuelto por pheap_open.
+ * @return int 0 si los datos quedaron en disco, -1 en caso de error.
+ */
+int pheap_checkpoint(heap_t* h);
+
+/**
+ * @brief Hace un checkpoint, marca el heap como cerrado correctamente y lo desmapea.
+ *
+ * No se debe llamar a heap_destroy sobre un heap persistente: borraría su estado del archivo.
+ *
+ * @param h Heap devuelto por pheap_open.
+ * @return int 0 si el heap quedó cerrado y en disco, -1 si falló el checkpoint.
+ */
+int pheap_close(heap_t* h);
+
+/**
+ * @brief Publica el objeto raíz del heap con una sola escritura.
+ *
+ * @param h Heap persistente.
+ * @param p Bloque del heap, o NULL para quitar la raíz.
+ */
+void pheap_set_root(heap_t* h, void* p);
+
+/**
+ * @brief Devuelve el objeto raíz del heap.
+ *
+ * @param h Heap persistente.
+ * @return void* Raíz publicada con pheap_set_root, o NULL si no hay.
+ */
+void* pheap_root(heap_t* h);
+
+/**
+ * @brief Convierte una dirección del heap en un offset que sobrevive a un cambio de dirección.
+ *
+ * @param h Heap persistente.
+ * @param p Dirección dentro del heap, o NULL.
+ * @return uint64_t Offset desde el comienzo del archivo, 0 para NULL.
+ */
+uint64_t pheap_offset(heap_t* h, const void* p);
+
+/**
+ * @brief Convierte un offset de pheap_offset en una dirección del mapeo actual.
+ *
+ * @param h Heap persistente.
+ * @param offset Offset, 0 para NULL.
+ * @return void* Dirección dentro del heap, o NULL.
+ */
+void* pheap_pointer(heap_t* h, uint64_t offset);
@@ -0,0 +1,116 @@
+/**
+ * @file ptr_table.h
+ * @brief Tabla de direccionamiento abierto indexada por dirección, para las muestras vivas.
+ *
+ * La usan el perfilador y la segregación por tiempo de vida, cada uno con su
+ * propio tipo de entrada: cualquier estructura cuyo primer campo sea la
+ * dirección, NULL si la entrada está vacía. La capacidad es una potencia de
+ * 2 y quien inserta deja al menos un cuarto de la tabla libre, así todas las
+ * cadenas de sondeo terminan en una entrada vacía.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief Dirección guardada en una entrada.
+ *
+ * @param entries Tabla.
+ * @param stride Bytes de cada entrada.
+ * @param i Índice de la entrada.
+ * @return void* Dirección de la entrada, NULL si está vacía.
+ */
+static inline void* ptr_table_key(const void* entries, size_t stride, size_t i)
+{
+    return *(void* const*)((const char*)entries + i * stride);
+}
+
+/**
+ * @brief Dispersa una dirección para la tabla.
+ *
+ * @param p Dirección.
+ * @param capacity Entradas de la tabla.
+ * @return size_t Índice inicial de búsqueda.
+ */
+static inline size_t ptr_table_slot(const void* p, size_t capacity)
+{
+    uint64_t h = (uint64_t)(uintptr_t)p * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 32) & (capacity - 1);
+}
+
+/**
+ * @brief Busca la entrada de una dirección.
+ *
+ * @param entries Tabla.
+ * @param stride Bytes de cada entrada.
+ * @param capacity Entradas de la tabla.
+ * @param p Dirección.
+ * @return long Índice de la entrada, -1 si p no está.
+ */
+static inline long ptr_table_find(const void* entries, size_t stride, size_t capacity, const void* p)
+{
+    size_t i = ptr_table_slot(p, capacity);
+
+    while (ptr_table_key(entries, stride, i) != p)
+    {
+        if (!ptr_table_key(entries, stride, i))
+            return -1;
+        i = (i + 1) & (capacity - 1);
+    }
+    return (long)i;
+}
+
+/**
+ * @brief Entrada vacía donde guardar una dirección; quien llama la completa.
+ *
+ * @param entries Tabla.
+ * @param stride Bytes de cada entrada.
+ * @param capacity Entradas de la tabla.
+ * @param p Dirección a guardar.
+ * @return size_t Índice de la entrada.
+ */
+static inline size_t ptr_table_slot_for(const void* entries, size_t stride, size_t capacity, const void* p)
+{
+    size_t i = ptr_table_slot(p, capacity);
+
+    while (ptr_table_key(entries, stride, i))
+        i = (i + 1) & (capacity - 1);
+    return i;
+}
+
+/**
+ * @brief Vacía una entrada.
+ *
+ * Borrado por desplazamiento hacia atrás: las entradas que siguen en la
+ * cadena ocupan el hueco para no cortar las búsquedas que pasan por él.
+ *
+ * @param entries Tabla.
+ * @param stride Bytes de cada entrada.
+ * @param capacity Entradas de la tabla.
+ * @param i Índice de la entrada.
+ */
+static inline void ptr_table_remove(void* entries, size_t stride, size_t capacity, size_t i)
+{
+    char* e = entries;
+
+    for (;;)
+    {
+        size_t j = i;
+        memset(e + i * stride, 0, sizeof(void*));
+        for (;;)
+        {
+            j = (j + 1) & (capacity - 1);
+            if (!ptr_table_key(e, stride, j))
+                return;
+            size_t k = ptr_table_slot(ptr_table_key(e, stride, j), capacity);
+            if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+                continue;
+            break;
+        }
+        memcpy(e + i * stride, e + j * stride, stride);
+        i = j;
+    }
+}
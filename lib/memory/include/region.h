@@ -0,0 +1,86 @@
+/**
+ * @file region.h
+ * @brief Regiones de memoria virtual que el heap puede usar en lugar de sbrk.
+ *
+ * Una región reserva de una vez un rango de direcciones y lo va habilitando
+ * en trozos (chunks) a medida que el heap crece. Expone la misma interfaz que
+ * sbrk/brk: un tope lógico que sube y baja byte a byte, mientras que el
+ * sistema operativo solo ve cambios de a un chunk completo.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Tamaño de una huge page de x86-64 y alineación de las regiones en ese modo. */
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+/** Espacio virtual reservado por defecto para el heap en modo huge pages. */
+#define HUGEPAGE_RESERVE ((size_t)64 << 30)
+/** Pedir transparent huge pages (MADV_HUGEPAGE) para la región. */
+#define REGION_HUGEPAGES 0x1
+/** La memoria es de quien llama: nunca se cambia su protección ni se libera. */
+#define REGION_BORROWED 0x2
+
+/**
+ * @struct region
+ * @brief Rango de direcciones reservado y habilitado por chunks.
+ */
+struct region
+{
+    char* start;     /**< Comienzo de la reserva, alineado a chunk. */
+    char* top;       /**< Tope lógico, equivalente a sbrk(0). */
+    char* committed; /**< Fin de la parte habilitada para lectura y escritura. */
+    char* end;       /**< Fin de la reserva. */
+    size_t chunk;    /**< Granularidad con la que se habilita y devuelve memoria. */
+    int flags;       /**< Combinación de REGION_*. */
+    int hugepages;   /**< 1 si el kernel aceptó MADV_HUGEPAGE. */
+};
+
+/** Tipo de una región de memoria. */
+typedef struct region region_t;
+
+/**
+ * @brief Reserva el espacio de direcciones de una región sin habilitarlo.
+ *
+ * @param r Región a inicializar.
+ * @param size Bytes de espacio virtual a reservar.
+ * @param chunk Granularidad de crecimiento; se redondea a múltiplo de página.
+ * @param flags Combinación de REGION_*.
+ * @return int 0 si se reservó, -1 en caso de error.
+ */
+int region_reserve(region_t* r, size_t size, size_t chunk, int flags);
+
+/**
+ * @brief Usa como región un buffer ya habilitado, por ejemplo estático o de la pila.
+ *
+ * @param r Región a inicializar.
+ * @param buffer Comienzo del buffer.
+ * @param size Tamaño del buffer en bytes.
+ */
+void region_wrap(region_t* r, void* buffer, size_t size);
+
+/**
+ * @brief Mueve el tope de la región, como sbrk().
+ *
+ * @param r Región.
+ * @param increment Bytes a agregar (o quitar, si es negativo).
+ * @return void* Tope anterior, o (void*)-1 si la reserva se agotó.
+ */
+void* region_sbrk(region_t* r, intptr_t increment);
+
+/**
+ * @brief Fija el tope de la región, como brk(), y devuelve los chunks sobrantes.
+ *
+ * @param r Región.
+ * @param addr Nuevo tope, dentro de la región.
+ * @return int 0 si se movió el tope, -1 si addr está fuera de la región.
+ */
+int region_brk(region_t* r, void* addr);
+
+/**
+ * @brief Libera toda la región. Un buffer de REGION_BORROWED solo se olvida.
+ *
+ * @param r Región.
+ */
+void region_unmap(region_t* r);
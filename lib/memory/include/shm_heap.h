@@ -0,0 +1,194 @@
+/**
+ * @file shm_heap.h
+ * @brief Heaps compartidos entre procesos sobre memoria de shm_open o memfd.
+ *
+ * Varios procesos mapean el mismo objeto de memoria compartida, cada uno en
+ * la dirección que le toque, y asignan y liberan en él. Por eso ningún
+ * enlace del heap es un puntero: los bloques se enlazan con offsets desde el
+ * comienzo del mapeo, igual que los objetos del usuario (shm_heap_offset /
+ * shm_heap_pointer). Un bloque asignado por un proceso se le pasa a otro
+ * mandándole su offset, sin copiar los datos.
+ *
+ * Las operaciones se serializan con un mutex robusto compartido entre
+ * procesos. Si un proceso muere con el mutex tomado, el próximo que lo toma
+ * recibe EOWNERDEAD y repara el heap antes de seguir: recorre los bloques
+ * por sus tamaños, corta en el primer encabezado inválido, vuelve a fusionar
+ * los libres vecinos y rearma los enlaces y la lista de libres. Como en
+ * pheap, cada cambio se confirma con una sola escritura de un tamaño o del
+ * tope, así el recorrido siempre ve un heap coherente. Los bloques que el
+ * proceso muerto tenía asignados siguen ocupados: pudo habérselos pasado a
+ * otro.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Identificador de un heap compartido ("SHMHEAP1"). */
+#define SHM_HEAP_MAGIC 0x31504145484D4853ull
+/** Versión del formato del heap compartido. */
+#define SHM_HEAP_VERSION 1
+/** Alineación de los datos de cada bloque. */
+#define SHM_HEAP_ALIGN 16
+/** Datos mínimos de un bloque: un bloque libre guarda ahí sus enlaces de la lista de libres. */
+#define SHM_HEAP_MIN_PAYLOAD 16
+/** Bytes que se conservan por encima del tope al achicar el heap; el resto se devuelve al sistema. */
+#define SHM_HEAP_TRIM (1024 * 1024)
+/** El objeto no existía o estaba vacío y se creó un heap nuevo. */
+#define SHM_HEAP_CREATED 0x1
+
+/**
+ * @struct shm_block
+ * @brief Encabezado de un bloque del heap compartido; los enlaces son offsets desde el comienzo del mapeo.
+ */
+struct shm_block
+{
+    uint64_t size;  /**< Bytes de datos del bloque. */
+    uint64_t next;  /**< Offset del bloque siguiente, 0 si es el último. */
+    uint64_t prev;  /**< Offset del bloque anterior, 0 si es el primero. */
+    uint32_t free;  /**< 1 si el bloque está libre, 0 si está ocupado. */
+    uint32_t magic; /**< Cookie del encabezado, función de su offset. */
+};
+
+/**
+ * @struct shm_heap_stats
+ * @brief Estado de un heap compartido, igual para todos los procesos que lo mapean.
+ */
+struct shm_heap_stats
+{
+    size_t size;         /**< Bytes del objeto compartido. */
+    size_t used;         /**< Bytes entre el primer bloque y el tope. */
+    size_t allocated;    /**< Bytes de datos de los bloques ocupados. */
+    uint64_t allocs;     /**< Asignaciones hechas por todos los procesos. */
+    uint64_t frees;      /**< Liberaciones hechas por todos los procesos. */
+    uint64_t recoveries; /**< Veces que se reparó el heap tras la muerte de un proceso con el mutex tomado. */
+};
+
+/** Heap compartido; su estado vive al comienzo del mapeo. */
+typedef struct shm_heap shm_heap_t;
+
+/** Tipo del estado de un heap compartido. */
+typedef struct shm_heap_stats shm_heap_stats_t;
+
+/**
+ * @brief Abre o crea un heap compartido con nombre, o uno anónimo sobre memfd.
+ *
+ * Con nombre, el objeto se abre con shm_open y otros procesos lo abren con
+ * el mismo nombre; quien lo crea lo dimensiona e inicializa, y los demás
+ * esperan a que termine. Sin nombre, el heap vive en un memfd y solo lo
+ * comparten los procesos hijos creados con fork después de abrirlo.
+ *
+ * @param name Nombre para shm_open ("/algo"), o NULL para un heap anónimo.
+ * @param size Tamaño del heap al crearlo; se ignora si el objeto ya existe.
+ * @param status Recibe SHM_HEAP_CREATED si se creó el heap, puede ser NULL.
+ * @return shm_heap_t* Heap mapeado en este proceso, o NULL si falló o el objeto no es un heap.
+ */
+shm_heap_t* shm_heap_open(const char* name, size_t size, unsigned* status);
+
+/**
+ * @brief Mapea un heap compartido desde un descriptor, como un memfd recibido de otro proceso.
+ *
+ * Si el objeto está vacío se dimensiona a size y se crea el heap.
+ *
+ * @param fd Descriptor del objeto; se puede cerrar después.
+ * @param size Tamaño del heap si hay que crearlo.
+ * @param status Recibe SHM_HEAP_CREATED si se creó el heap, puede ser NULL.
+ * @return shm_heap_t* Heap mapeado en este proceso, o NULL si falló o el objeto no es un heap.
+ */
+shm_heap_t* shm_heap_map(int fd, size_t size, unsigned* status);
+
+/**
+ * @brief Desmapea el heap de este proceso; el heap sigue existiendo para los demás.
+ *
+ * @param h Heap.
+ * @return int 0 si se desmapeó, -1 en caso de error.
+ */
+int shm_heap_close(shm_heap_t* h);
+
+/**
+ * @brief Borra el nombre de un heap compartido; el objeto se libera cuando lo desmapea el último proceso.
+ *
+ * @param name Nombre usado en shm_heap_open.
+ * @return int 0 si se borró, -1 en caso de error.
+ */
+int shm_heap_unlink(const char* name);
+
+/**
+ * @brief Asigna un bloque en el heap compartido.
+ *
+ * @param h Heap.
+ * @param size Tamaño en bytes.
+ * @return void* Área de datos, alineada a SHM_HEAP_ALIGN, o NULL si no hay espacio.
+ */
+void* shm_heap_malloc(shm_heap_t* h, size_t size);
+
+/**
+ * @brief Libera un bloque del heap compartido, lo haya asignado este proceso u otro.
+ *
+ * @param h Heap.
+ * @param p Área de datos, o NULL.
+ * @return int 0 si se liberó, -1 si p no es un bloque ocupado del heap.
+ */
+int shm_heap_free(shm_heap_t* h, void* p);
+
+/**
+ * @brief Toma el mutex del heap para hacer varias operaciones seguidas sin que otro proceso se intercale.
+ *
+ * El mutex es recursivo: shm_heap_malloc y shm_heap_free se pueden llamar
+ * con él tomado. Si el dueño anterior murió con el mutex tomado, el heap se
+ * repara antes de volver.
+ *
+ * @param h Heap.
+ * @return int 0 si el mutex quedó tomado, -1 si el mutex ya no se puede recuperar.
+ */
+int shm_heap_lock(shm_heap_t* h);
+
+/**
+ * @brief Suelta el mutex tomado con shm_heap_lock.
+ *
+ * @param h Heap.
+ */
+void shm_heap_unlock(shm_heap_t* h);
+
+/**
+ * @brief Offset de un área del heap, válido en todos los procesos que lo mapean.
+ *
+ * @param h Heap.
+ * @param p Dirección dentro del mapeo de este proceso, o NULL.
+ * @return uint64_t Offset desde el comienzo del mapeo, 0 si p es NULL.
+ */
+uint64_t shm_heap_offset(shm_heap_t* h, const void* p);
+
+/**
+ * @brief Dirección en este proceso de un offset obtenido con shm_heap_offset, quizá en otro proceso.
+ *
+ * @param h Heap.
+ * @param offset Offset, o 0.
+ * @return void* Dirección en el mapeo de este proceso, NULL si offset es 0.
+ */
+void* shm_heap_pointer(shm_heap_t* h, uint64_t offset);
+
+/**
+ * @brief Publica el objeto raíz del heap, el punto de encuentro de los procesos.
+ *
+ * @param h Heap.
+ * @param p Bloque del heap, o NULL para quitar la raíz.
+ */
+void shm_heap_set_root(shm_heap_t* h, void* p);
+
+/**
+ * @brief Devuelve el objeto raíz del heap en el mapeo de este proceso.
+ *
+ * @param h Heap.
+ * @return void* Raíz publicada con shm_heap_set_root, o NULL si no hay.
+ */
+void* shm_heap_root(shm_heap_t* h);
+
+/**
+ * @brief Estado del heap compartido.
+ *
+ * @param h Heap.
+ * @param stats Recibe el estado.
+ */
+void shm_heap_stats(shm_heap_t* h, shm_heap_stats_t* stats);
@@ -0,0 +1,181 @@
+/**
+ * @file size_classes.h
+ * @brief Histograma de tamaños pedidos y tablas de clases de tamaño generadas a partir de él.
+ *
+ * Con el histograma activo, malloc() cuenta cada pedido del heap por defecto
+ * por su tamaño exacto. size_classes_optimize convierte ese histograma en la
+ * tabla de k clases que menos bytes desperdicia al redondear, y la
+ * herramienta size_class_gen hace lo mismo fuera de línea con un histograma
+ * guardado con size_hist_save.
+ *
+ * Con una tabla cargada, cada pedido de hasta la clase más grande se
+ * redondea a la primera clase que lo contiene en lugar de a 8 bytes: bloques
+ * de tamaños parecidos quedan iguales y se reutilizan entre sí. La tabla se
+ * lee al arrancar de SIZE_CLASSES o de SIZE_CLASSES_PATH, igual que
+ * LOG_FILE_PATH y HEAP_PROFILE_PATH se leen del entorno.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Archivo donde se guarda el histograma al salir; si está definida el histograma arranca solo. */
+#define SIZE_HIST_PATH getenv("SIZE_HIST_PATH")
+/** Tabla de clases en el entorno, tamaños separados por comas o espacios, por ejemplo "16,32,48,96". */
+#define SIZE_CLASSES getenv("SIZE_CLASSES")
+/** Archivo con la tabla de clases, en el formato que escribe size_classes_save. */
+#define SIZE_CLASSES_PATH getenv("SIZE_CLASSES_PATH")
+/** Pedidos de hasta este tamaño se cuentan byte a byte; también es la clase más grande posible. */
+#define SIZE_HIST_MAX 4096
+/** Entradas del histograma: una por tamaño de 0 a SIZE_HIST_MAX y una para los pedidos mayores. */
+#define SIZE_HIST_BUCKETS (SIZE_HIST_MAX + 2)
+/** Clases que puede tener una tabla. */
+#define SIZE_CLASSES_MAX 64
+
+/** Distinto de cero mientras malloc() registra los tamaños pedidos. */
+extern int size_hist_active;
+
+/** Clases de la tabla cargada; 0 si los pedidos solo se alinean a 8 bytes. */
+extern int size_classes_count;
+
+/**
+ * @brief Empieza a contar los tamaños pedidos al heap por defecto.
+ */
+void size_hist_start(void);
+
+/**
+ * @brief Deja de contar tamaños. Las cuentas se conservan.
+ */
+void size_hist_stop(void);
+
+/**
+ * @brief Pone el histograma en cero.
+ */
+void size_hist_reset(void);
+
+/**
+ * @brief Cuenta un pedido; malloc() la llama solo si size_hist_active.
+ *
+ * @param size Tamaño pedido.
+ */
+void size_hist_record(size_t size);
+
+/**
+ * @brief Devuelve el histograma acumulado.
+ *
+ * @return const uint64_t* SIZE_HIST_BUCKETS cuentas: la entrada i cuenta los pedidos de i bytes y la última los
+ * mayores que SIZE_HIST_MAX.
+ */
+const uint64_t* size_hist_counts(void);
+
+/**
+ * @brief Guarda el histograma como texto, una línea "tamaño cuenta" por tamaño pedido.
+ *
+ * @param path Archivo, se reemplaza.
+ * @return int 0 si se escribió, -1 en caso de error.
+ */
+int size_hist_save(const char* path);
+
+/**
+ * @brief Lee un histograma guardado con size_hist_save.
+ *
+ * @param path Archivo.
+ * @param counts Recibe SIZE_HIST_BUCKETS cuentas.
+ * @return int 0 si se leyó, -1 si no se pudo abrir o tiene líneas inválidas.
+ */
+int size_hist_load(const char* path, uint64_t* counts);
+
+/**
+ * @brief Instala una tabla de clases.
+ *
+ * Los tamaños se alinean a 8 bytes y tienen que ser crecientes y no mayores
+ * que SIZE_HIST_MAX. Solo se debe cambiar la tabla con el heap vacío o sin
+ * bloques que vayan a crecer con realloc: los bloques ya asignados conservan
+ * su tamaño.
+ *
+ * @param classes Tamaños de las clases, de menor a mayor.
+ * @param n Número de clases, 0 para volver a alinear solo a 8 bytes.
+ * @return int 0 si se instaló, -1 si la tabla es inválida.
+ */
+int size_classes_set(const size_t* classes, int n);
+
+/**
+ * @brief Copia la tabla instalada.
+ *
+ * @param classes Recibe hasta SIZE_CLASSES_MAX tamaños.
+ * @return int Número de clases.
+ */
+int size_classes_get(size_t* classes);
+
+/**
+ * @brief Instala una tabla escrita como texto: tamaños separados por comas o espacios, '#' comenta hasta fin de línea.
+ *
+ * No pide memoria, así que se puede usar antes del primer malloc().
+ *
+ * @param text Tabla.
+ * @return int 0 si se instaló, -1 si la tabla es inválida.
+ */
+int size_classes_parse(const char* text);
+
+/**
+ * @brief Instala la tabla de un archivo, en el formato de size_classes_parse.
+ *
+ * @param path Archivo.
+ * @return int 0 si se instaló, -1 si no se pudo leer o la tabla es inválida.
+ */
+int size_classes_load(const char* path);
+
+/**
+ * @brief Guarda una tabla de clases en el formato que lee size_classes_load.
+ *
+ * @param path Archivo, se reemplaza.
+ * @param classes Tamaños de las clases.
+ * @param n Número de clases.
+ * @return int 0 si se escribió, -1 en caso de error.
+ */
+int size_classes_save(const char* path, const size_t* classes, int n);
+
+/**
+ * @brief Redondea un tamaño ya alineado a su clase.
+ *
+ * @param size Tamaño alineado a 8 bytes.
+ * @return size_t Primera clase que contiene size, o size si es mayor que todas.
+ */
+size_t size_class_round(size_t size);
+
+/**
+ * @brief Calcula la tabla de hasta k clases que menos bytes desperdicia con un histograma.
+ *
+ * Programación dinámica sobre los tamaños alineados a 8 bytes: la última
+ * clase es el mayor pedido contado de hasta SIZE_HIST_MAX bytes, y cada
+ * pedido se cobra por la diferencia entre su clase y su tamaño.
+ *
+ * @param counts Histograma de SIZE_HIST_BUCKETS cuentas.
+ * @param k Clases como máximo, hasta SIZE_CLASSES_MAX.
+ * @param classes Recibe las clases, de menor a mayor.
+ * @return int Número de clases generadas, 0 si el histograma está vacío, -1 si k es inválido o falta memoria.
+ */
+int size_classes_optimize(const uint64_t* counts, int k, size_t* classes);
+
+/**
+ * @brief Tabla genérica de referencia: 8 a 32 de a 8 bytes y luego cuatro clases por cada potencia de dos.
+ *
+ * @param classes Recibe las clases.
+ * @param k Clases como máximo.
+ * @return int Número de clases generadas.
+ */
+int size_classes_generic(size_t* classes, int k);
+
+/**
+ * @brief Bytes que se desperdician al redondear los pedidos de un histograma con una tabla.
+ *
+ * Los pedidos mayores que la última clase se cobran por su alineación a 8
+ * bytes; los mayores que SIZE_HIST_MAX no se cuentan.
+ *
+ * @param counts Histograma de SIZE_HIST_BUCKETS cuentas.
+ * @param classes Tabla, puede ser NULL si n es 0.
+ * @param n Número de clases.
+ * @return uint64_t Bytes desperdiciados.
+ */
+uint64_t size_classes_waste(const uint64_t* counts, const size_t* classes, int n);
@@ -0,0 +1,440 @@
+#include "heap_check.h"
+#include "heap_map.h"
+#include <pthread.h>
+
+/**
+ * @brief Señal de largada de los hilos de heap_check_parallel().
+ */
+typedef struct
+{
+    pthread_mutex_t lock; /**< Protege go. */
+    pthread_cond_t cond;  /**< Se señala cuando go pasa a 1. */
+    int go;               /**< 1 cuando los rangos están repartidos. */
+} check_gate;
+
+/**
+ * @brief Segmento del heap que verifica un hilo de heap_check_parallel().
+ */
+typedef struct
+{
+    heap_t* heap;         /**< Heap que se verifica. */
+    char* from;           /**< Comienzo del rango de direcciones del segmento. */
+    char* to;             /**< Fin del rango, sin incluirlo. */
+    t_block start;        /**< Primer bloque que empieza en el rango, NULL si no se encontró. */
+    t_block next;         /**< Primer bloque sin verificar tras el rango, NULL al final o ante un enlace inválido. */
+    char* lo;             /**< Comienzo del heap. */
+    char* hi;             /**< Tope del heap. */
+    check_gate* gate;     /**< Largada común a todos los segmentos. */
+    pthread_t thread;     /**< Hilo que verifica el segmento. */
+    heap_report_t report; /**< Resultado del segmento. */
+} heap_segment;
+
+/**
+ * @brief Anota una inconsistencia en el reporte.
+ *
+ * @param r Reporte.
+ * @param b Bloque inconsistente.
+ * @param kind HEAP_CHECK_* encontrado.
+ */
+static void report_error(heap_report_t* r, t_block b, unsigned kind)
+{
+    if (!r->errors)
+    {
+        r->first_bad = b;
+        r->first_kind = kind;
+    }
+    r->errors++;
+    r->kinds |= kind;
+}
+
+/**
+ * @brief Indica si un encabezado completo cae dentro del heap.
+ *
+ * @param b Dirección del bloque.
+ * @param lo Comienzo del heap.
+ * @param hi Tope del heap.
+ * @return int 1 si el encabezado se puede leer.
+ */
+static int in_heap(t_block b, char* lo, char* hi)
+{
+    return (char*)b >= lo && (char*)b + BLOCK_SIZE <= hi;
+}
+
+/**
+ * @brief Verifica bloques consecutivos a partir de b.
+ *
+ * Solo sigue un enlace next si apunta dentro del heap y más adelante que el
+ * bloque actual, así un encabezado corrupto nunca provoca un acceso inválido
+ * ni un ciclo.
+ *
+ * @param b Primer bloque a verificar.
+ * @param stop Dirección desde la que ya no verifica bloques, el tope para llegar al final.
+ * @param limit Bloques a verificar como máximo.
+ * @param lo Comienzo del heap.
+ * @param hi Tope del heap.
+ * @param r Reporte donde se acumulan los resultados.
+ * @return t_block Próximo bloque sin verificar, NULL si se llegó al final o a un enlace inválido.
+ */
+static t_block check_blocks(t_block b, char* stop, size_t limit, char* lo, char* hi, heap_report_t* r)
+{
+    for (; b && (char*)b < stop && limit; limit--)
+    {
+        if (!in_heap(b, lo, hi))
+        {
+            report_error(r, b, HEAP_CHECK_BOUNDS);
+            return NULL;
+        }
+        if (((uintptr_t)b & 7) || (b->size & 7))
+            report_error(r, b, HEAP_CHECK_ALIGNMENT);
+        if (b->magic != block_cookie(b) || b->ptr != b->data)
+            report_error(r, b, HEAP_CHECK_COOKIE);
+        if (b->size > (size_t)(hi - b->data))
+            report_error(r, b, HEAP_CHECK_BOUNDS);
+
+        // lo es el primer bloque del heap, el único sin anterior
+        if (b->prev ? !in_heap(b->prev, lo, hi) || b->prev->next != b : (char*)b != lo)
+            report_error(r, b, HEAP_CHECK_LINKS);
+
+        t_block next = b->next;
+        if (next && (!in_heap(next, lo, hi) || next <= b))
+        {
+            report_error(r, b, HEAP_CHECK_LINKS);
+            next = NULL;
+        }
+        else if (next && next->prev != b)
+            report_error(r, b, HEAP_CHECK_LINKS);
+
+        // Los bloques son contiguos: cada uno empieza donde termina el anterior y el último en el tope
+        if (next ? (char*)next != b->data + b->size : !b->next && b->data + b->size != hi)
+            report_error(r, b, HEAP_CHECK_ADJACENCY);
+
+        if (b->free != 0 && b->free != 1)
+            report_error(r, b, HEAP_CHECK_FREE);
+        else if (b->free && next && next->free)
+            report_error(r, b, HEAP_CHECK_FREE);
+
+        r->blocks++;
+        if (b->free)
+        {
+            r->free_blocks++;
+            r->free_bytes += b->size;
+        }
+        else
+            r->used_bytes += b->size;
+
+        if (!next && b->next)
+            return NULL;
+        b = next;
+    }
+    return b;
+}
+
+/**
+ * @brief Compara lo recorrido en una pasada completa con el tamaño del heap.
+ *
+ * @param r Reporte de la pasada.
+ * @param lo Comienzo del heap.
+ * @param hi Tope del heap.
+ */
+static void check_totals(heap_report_t* r, char* lo, char* hi)
+{
+    if (r->used_bytes + r->free_bytes + r->blocks * BLOCK_SIZE != (size_t)(hi - lo))
+        report_error(r, (t_block)lo, HEAP_CHECK_TOTALS);
+}
+
+/**
+ * @brief Tope actual de un heap.
+ *
+ * @param h Heap.
+ * @return char* Primera dirección fuera del heap.
+ */
+static char* top_of(heap_t* h)
+{
+    return h->in_region ? h->region.top : sbrk(0);
+}
+
+/**
+ * @brief Verifica que el índice de TLSF de un heap tenga exactamente sus bloques libres.
+ *
+ * Cada lista se recorre como mucho hasta la cantidad de libres de la pasada,
+ * así un ciclo en los enlaces no la hace infinita.
+ *
+ * @param h Heap.
+ * @param r Reporte de una pasada completa.
+ * @param lo Comienzo del heap.
+ * @param hi Tope del heap.
+ */
+static void check_index(heap_t* h, heap_report_t* r, char* lo, char* hi)
+{
+#if HEAP_FREE_INDEX
+    tlsf_t* t = &h->tlsf;
+    size_t indexed = 0;
+
+    for (int fl = 0; fl < TLSF_FL_COUNT; fl++)
+    {
+        for (int sl = 0; sl < TLSF_SL_COUNT; sl++)
+        {
+            t_block b = t->lists[fl][sl];
+            t_block prev = NULL;
+            if (!b != !(t->sl_bitmap[fl] & (1u << sl)))
+                report_error(r, b, HEAP_CHECK_INDEX);
+
+            for (; b && indexed <= r->free_blocks; prev = b, b = links_of(b)->next)
+            {
+                if (!in_heap(b, lo, hi) || b->magic != block_cookie(b) || b->free != 1 || links_of(b)->prev != prev)
+                {
+                    report_error(r, b, HEAP_CHECK_INDEX);
+                    break;
+                }
+                indexed++;
+            }
+        }
+        if (!t->sl_bitmap[fl] != !(t->fl_bitmap & (1u << fl)))
+            report_error(r, NULL, HEAP_CHECK_INDEX);
+    }
+    if (indexed != r->free_blocks)
+        report_error(r, NULL, HEAP_CHECK_INDEX);
+#else
+    (void)h;
+    (void)r;
+    (void)lo;
+    (void)hi;
+#endif
+}
+
+int heap_check_heap(heap_t* h, heap_report_t* report)
+{
+    char* lo = h->base;
+    char* hi = top_of(h);
+
+    memset(report, 0, sizeof(*report));
+    if (!lo)
+        return 0;
+    check_blocks((t_block)lo, hi, SIZE_MAX, lo, hi, report);
+    report->longest = report->blocks;
+    check_totals(report, lo, hi);
+    check_index(h, report, lo, hi);
+    return report->errors ? -1 : 0;
+}
+
+int heap_check(heap_report_t* report)
+{
+    return heap_check_heap(heap_default(), report);
+}
+
+void heap_check_heap_begin(heap_cursor_t* cursor, heap_t* h)
+{
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->heap = h;
+}
+
+void heap_check_begin(heap_cursor_t* cursor)
+{
+    heap_check_heap_begin(cursor, heap_default());
+}
+
+int heap_check_step(heap_cursor_t* cursor, size_t n)
+{
+    heap_t* h = cursor->heap ? cursor->heap : heap_default();
+    char* lo = h->base;
+    char* hi = top_of(h);
+    t_block b = cursor->block;
+    size_t restarts = 0;
+    int fresh = 0;
+
+    /* Un bloque que se fusionó con su anterior deja un encabezado viejo que
+       ya no está enlazado: su prev no apunta a él, o quedó fuera del heap */
+    if (b && (!lo || !in_heap(b, lo, hi) || b->magic != block_cookie(b) || !b->prev ||
+              !in_heap(b->prev, lo, hi) || b->prev->next != b))
+    {
+        restarts = cursor->report.restarts + 1;
+        b = NULL;
+    }
+    if (!b)
+    {
+        memset(&cursor->report, 0, sizeof(cursor->report));
+        cursor->report.restarts = restarts;
+        b = (t_block)lo;
+        fresh = 1;
+    }
+
+    cursor->block = b ? check_blocks(b, hi, n, lo, hi, &cursor->report) : NULL;
+    if (cursor->block)
+        return 0;
+
+    // Solo una pasada hecha entera en esta llamada vio el heap de un mismo tamaño
+    if (fresh && lo)
+    {
+        check_totals(&cursor->report, lo, hi);
+        check_index(h, &cursor->report, lo, hi);
+    }
+    cursor->report.longest = cursor->report.blocks;
+    cursor->passes++;
+    return 1;
+}
+
+/**
+ * @brief Busca el primer bloque que empieza en el rango de un segmento.
+ *
+ * Con el mapa activo lo da el mapa. Sin él se prueban las direcciones
+ * alineadas del rango hasta dar con un encabezado con su cookie y
+ * enlazado desde su anterior; un bloque grande que cruza el corte cuesta
+ * leer sus datos de a 8 bytes, pero eso lo hace cada hilo en su rango.
+ *
+ * @param s Segmento.
+ * @return t_block Primer bloque del rango, NULL si no se encontró ninguno.
+ */
+static t_block first_in_range(heap_segment* s)
+{
+    if (s->from == s->lo)
+        return (t_block)s->lo;
+    if (s->heap->map.starts)
+    {
+        t_block b = heap_map_next(s->heap, s->from);
+        return b && (char*)b < s->to ? b : NULL;
+    }
+    for (char* p = (char*)align((size_t)s->from); p < s->to && in_heap((t_block)p, s->lo, s->hi); p += 8)
+    {
+        t_block b = (t_block)p;
+        if (b->magic == block_cookie(b) && b->ptr == b->data && b->prev < b && !((uintptr_t)b->prev & 7) &&
+            in_heap(b->prev, s->lo, s->hi) && b->prev->next == b)
+            return b;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Cuerpo de los hilos de heap_check_parallel(): espera su rango, busca su primer bloque y lo verifica.
+ *
+ * @param arg Segmento a verificar.
+ * @return void* Siempre NULL.
+ */
+static void* check_segment(void* arg)
+{
+    heap_segment* s = arg;
+
+    pthread_mutex_lock(&s->gate->lock);
+    while (!s->gate->go)
+        pthread_cond_wait(&s->gate->cond, &s->gate->lock);
+    pthread_mutex_unlock(&s->gate->lock);
+    if (s->from && (s->start = first_in_range(s)))
+        s->next = check_blocks(s->start, s->to, SIZE_MAX, s->lo, s->hi, &s->report);
+    return NULL;
+}
+
+/**
+ * @brief Larga a todos los hilos que esperan en la señal.
+ *
+ * @param gate Señal de largada.
+ */
+static void open_gate(check_gate* gate)
+{
+    pthread_mutex_lock(&gate->lock);
+    gate->go = 1;
+    pthread_cond_broadcast(&gate->cond);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+/**
+ * @brief Suma el reporte de un segmento al de toda la verificación.
+ *
+ * @param report Reporte total.
+ * @param r Reporte del segmento.
+ */
+static void merge_report(heap_report_t* report, const heap_report_t* r)
+{
+    if (r->errors && !report->errors)
+    {
+        report->first_bad = r->first_bad;
+        report->first_kind = r->first_kind;
+    }
+    report->blocks += r->blocks;
+    report->free_blocks += r->free_blocks;
+    report->used_bytes += r->used_bytes;
+    report->free_bytes += r->free_bytes;
+    report->errors += r->errors;
+    report->kinds |= r->kinds;
+}
+
+int heap_check_heap_parallel(heap_t* h, heap_report_t* report, int nthreads)
+{
+    heap_segment seg[HEAP_CHECK_MAX_THREADS];
+    check_gate gate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+    char* lo;
+    char* hi;
+    int started = 0;
+
+    if (nthreads > HEAP_CHECK_MAX_THREADS)
+        nthreads = HEAP_CHECK_MAX_THREADS;
+    if (nthreads <= 1 || !h->base)
+        return heap_check_heap(h, report);
+
+    /* Los hilos se crean antes de repartir los rangos: pthread_create puede
+       llamar a malloc y cambiar el heap que se va a recorrer */
+    memset(seg, 0, sizeof(seg));
+    for (; started < nthreads; started++)
+    {
+        seg[started].gate = &gate;
+        if (pthread_create(&seg[started].thread, NULL, check_segment, &seg[started]) != 0)
+            break;
+    }
+    if (started < nthreads)
+    {
+        // Los hilos ya creados largan sin rango
+        open_gate(&gate);
+        for (int i = 0; i < started; i++)
+            pthread_join(seg[i].thread, NULL);
+        return heap_check_heap(h, report);
+    }
+
+    /* Cada hilo recibe una parte igual de las direcciones y busca él mismo su
+       primer bloque: el hilo que llama no lee ningún encabezado antes de largar */
+    lo = h->base;
+    hi = top_of(h);
+    size_t span = align((size_t)(hi - lo) / (size_t)nthreads);
+    for (int j = 0; j < nthreads; j++)
+    {
+        seg[j].heap = h;
+        seg[j].lo = lo;
+        seg[j].hi = hi;
+        seg[j].from = lo + (size_t)j * span < hi ? lo + (size_t)j * span : hi;
+        seg[j].to = j + 1 < nthreads && lo + (size_t)(j + 1) * span < hi ? lo + (size_t)(j + 1) * span : hi;
+    }
+    open_gate(&gate);
+
+    memset(report, 0, sizeof(*report));
+    for (int j = 0; j < nthreads; j++)
+        pthread_join(seg[j].thread, NULL);
+
+    /* Los segmentos se cosen en orden: cada uno debe empezar donde se detuvo
+       el anterior. Si no (un encabezado corrupto en el corte, o un bloque que
+       cruza todo el rango) su rango se verifica de nuevo desde ahí */
+    t_block at = (t_block)lo;
+    size_t redone = 0;
+    for (int j = 0; j < nthreads; j++)
+    {
+        if (at && at != seg[j].start)
+        {
+            heap_report_t r = {0};
+            at = check_blocks(at, seg[j].to, SIZE_MAX, lo, hi, &r);
+            merge_report(report, &r);
+            redone += r.blocks;
+            continue;
+        }
+        merge_report(report, &seg[j].report);
+        if (seg[j].report.blocks > report->longest)
+            report->longest = seg[j].report.blocks;
+        at = seg[j].next;
+    }
+    // Lo rehecho corre en el hilo que llama, después de todos los demás
+    report->longest += redone;
+
+    check_totals(report, lo, hi);
+    check_index(h, report, lo, hi);
+    return report->errors ? -1 : 0;
+}
+
+int heap_check_parallel(heap_report_t* report, int nthreads)
+{
+    return heap_check_heap_parallel(heap_default(), report, nthreads);
+}
@@ -0,0 +1,280 @@
+#include "heap_lifetime.h"
+#include "ptr_table.h"
+#include <sys/mman.h>
+
+heap_lifetime_t* heap_lifetime_default = NULL;
+
+/** Predictor del heap por defecto; heap_lifetime_default apunta acá una vez activado. */
+static heap_lifetime_t default_lifetime;
+
+/**
+ * @brief Busca el sitio de una dirección de retorno.
+ *
+ * @param lt Predictor.
+ * @param site Sitio del pedido.
+ * @param create 1 para agregarlo si no está.
+ * @return long Índice del sitio, -1 si no está o la tabla está llena.
+ */
+static long find_site(heap_lifetime_t* lt, const void* site, int create)
+{
+    long i = ptr_table_find(lt->sites, sizeof(*lt->sites), LIFETIME_MAX_SITES, site);
+
+    /* Se deja un cuarto de la tabla libre para que las búsquedas sigan siendo cortas */
+    if (i >= 0 || !create || !site || lt->num_sites >= LIFETIME_MAX_SITES / 4 * 3)
+        return i;
+    i = (long)ptr_table_slot_for(lt->sites, sizeof(*lt->sites), LIFETIME_MAX_SITES, site);
+    lt->sites[i].site = site;
+    lt->num_sites++;
+    return i;
+}
+
+/**
+ * @brief Predicción de un sitio a partir de sus muestras.
+ *
+ * @param s Sitio.
+ * @return int LIFETIME_UNKNOWN, LIFETIME_SHORT o LIFETIME_LONG.
+ */
+static int site_prediction(const struct lifetime_site* s)
+{
+    if (s->shorts + s->longs < LIFETIME_MIN_SAMPLES)
+        return LIFETIME_UNKNOWN;
+    return s->longs > s->shorts ? LIFETIME_LONG : LIFETIME_SHORT;
+}
+
+/**
+ * @brief Cuenta una muestra en su sitio, dividiendo las cuentas cuando llegan a LIFETIME_DECAY.
+ *
+ * @param s Sitio.
+ * @param longer 1 si la muestra pasó el umbral.
+ */
+static void site_observe(struct lifetime_site* s, int longer)
+{
+    if (longer)
+        s->longs++;
+    else
+        s->shorts++;
+    if (s->shorts + s->longs >= LIFETIME_DECAY)
+    {
+        s->shorts /= 2;
+        s->longs /= 2;
+    }
+}
+
+/**
+ * @brief Revisa algunas muestras vivas y cuenta como de vida larga las que pasaron el umbral.
+ *
+ * @param lt Predictor.
+ */
+static void sweep_samples(heap_lifetime_t* lt)
+{
+    for (int n = 0; n < LIFETIME_SWEEP; n++)
+    {
+        struct lifetime_sample* m = &lt->samples[lt->sweep];
+        lt->sweep = (lt->sweep + 1) & (LIFETIME_MAX_SAMPLES - 1);
+        if (m->ptr && !m->counted && lt->clock - m->birth >= lt->threshold)
+        {
+            site_observe(&lt->sites[m->site], 1);
+            m->counted = 1;
+        }
+    }
+}
+
+/**
+ * @brief Anota el nacimiento de un objeto muestreado.
+ *
+ * @param lt Predictor.
+ * @param p Dirección devuelta al usuario.
+ * @param site Índice del sitio.
+ */
+static void take_sample(heap_lifetime_t* lt, void* p, long site)
+{
+    if (lt->live >= LIFETIME_MAX_SAMPLES / 4 * 3)
+        return;
+
+    size_t i = ptr_table_slot_for(lt->samples, sizeof(*lt->samples), LIFETIME_MAX_SAMPLES, p);
+    lt->samples[i].ptr = p;
+    lt->samples[i].site = (uint32_t)site;
+    lt->samples[i].counted = 0;
+    lt->samples[i].birth = lt->clock;
+    lt->live++;
+    sweep_samples(lt);
+}
+
+/**
+ * @brief Quita una muestra de la tabla.
+ *
+ * @param lt Predictor.
+ * @param i Índice de la muestra.
+ */
+static void remove_sample(heap_lifetime_t* lt, size_t i)
+{
+    lt->live--;
+    ptr_table_remove(lt->samples, sizeof(*lt->samples), LIFETIME_MAX_SAMPLES, i);
+}
+
+/**
+ * @brief Reserva una tabla con mmap para no usar los heaps que se segregan.
+ *
+ * @param size Bytes de la tabla.
+ * @return void* Tabla en cero, NULL si falla.
+ */
+static void* map_table(size_t size)
+{
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+int heap_lifetime_init(heap_lifetime_t* lt, heap_t* short_heap, size_t period, uint64_t threshold)
+{
+    memset(lt, 0, sizeof(*lt));
+    lt->sites = map_table(sizeof(struct lifetime_site) * LIFETIME_MAX_SITES);
+    lt->samples = map_table(sizeof(struct lifetime_sample) * LIFETIME_MAX_SAMPLES);
+    if (!lt->sites || !lt->samples || heap_init(&lt->long_heap, NULL, LIFETIME_RESERVE) != 0)
+    {
+        heap_lifetime_destroy(lt);
+        return -1;
+    }
+    // Los objetos longevos se ubican con la misma política que el resto
+    heap_control(&lt->long_heap, short_heap->method);
+
+    lt->short_heap = short_heap;
+    lt->period = period ? period : LIFETIME_DEFAULT_PERIOD;
+    lt->threshold = threshold ? threshold : LIFETIME_DEFAULT_THRESHOLD;
+    lt->countdown = lt->period;
+    lt->predicting = 1;
+    return 0;
+}
+
+void heap_lifetime_destroy(heap_lifetime_t* lt)
+{
+    if (lt->sites)
+        munmap(lt->sites, sizeof(struct lifetime_site) * LIFETIME_MAX_SITES);
+    if (lt->samples)
+        munmap(lt->samples, sizeof(struct lifetime_sample) * LIFETIME_MAX_SAMPLES);
+    heap_destroy(&lt->long_heap);
+    memset(lt, 0, sizeof(*lt));
+}
+
+int heap_lifetime_predict(const heap_lifetime_t* lt, const void* site)
+{
+    long i = ptr_table_find(lt->sites, sizeof(*lt->sites), LIFETIME_MAX_SITES, site);
+
+    return i >= 0 ? site_prediction(&lt->sites[i]) : LIFETIME_UNKNOWN;
+}
+
+int heap_lifetime_owns(const heap_lifetime_t* lt, const void* p)
+{
+    const region_t* r = &lt->long_heap.region;
+
+    return (const char*)p >= r->start && (const char*)p < r->top;
+}
+
+void* heap_lifetime_malloc(heap_lifetime_t* lt, size_t size, const void* site)
+{
+    if (!lt->predicting)
+        return heap_malloc_from(lt->short_heap, size, site);
+
+    long s = find_site(lt, site, 1);
+    int longer = s >= 0 && site_prediction(&lt->sites[s]) == LIFETIME_LONG;
+    void* p = heap_malloc_from(longer ? &lt->long_heap : lt->short_heap, size, site);
+
+    // Con la reserva del heap de vida larga agotada el pedido igual se atiende
+    if (!p && longer)
+    {
+        longer = 0;
+        p = heap_malloc_from(lt->short_heap, size, site);
+    }
+    if (longer)
+        lt->placed_long++;
+    else
+        lt->placed_short++;
+
+    lt->clock += size;
+    if (--lt->countdown == 0)
+    {
+        lt->countdown = lt->period;
+        if (p && s >= 0)
+            take_sample(lt, p, s);
+    }
+    return p;
+}
+
+void heap_lifetime_free(heap_lifetime_t* lt, void* p)
+{
+    if (p && lt->live)
+    {
+        long i = ptr_table_find(lt->samples, sizeof(*lt->samples), LIFETIME_MAX_SAMPLES, p);
+        if (i >= 0)
+        {
+            struct lifetime_sample* m = &lt->samples[i];
+            // El barrido ya contó como largas las que pasaron el umbral
+            if (!m->counted)
+                site_observe(&lt->sites[m->site], lt->clock - m->birth >= lt->threshold);
+            remove_sample(lt, (size_t)i);
+        }
+    }
+    heap_free(heap_lifetime_owns(lt, p) ? &lt->long_heap : lt->short_heap, p);
+}
+
+void* heap_lifetime_realloc(heap_lifetime_t* lt, void* p, size_t size, const void* site)
+{
+    if (!p)
+        return heap_lifetime_malloc(lt, size, site);
+    // realloc(p, 0) libera: la muestra de p también se cierra
+    if (!size)
+    {
+        heap_lifetime_free(lt, p);
+        return NULL;
+    }
+
+    void* newp = heap_realloc_from(heap_lifetime_owns(lt, p) ? &lt->long_heap : lt->short_heap, p, size, site);
+    if (newp && newp != p && lt->live)
+    {
+        // La muestra sigue al objeto, con su edad
+        long i = ptr_table_find(lt->samples, sizeof(*lt->samples), LIFETIME_MAX_SAMPLES, p);
+        if (i >= 0)
+        {
+            struct lifetime_sample m = lt->samples[i];
+            remove_sample(lt, (size_t)i);
+            size_t j = ptr_table_slot_for(lt->samples, sizeof(*lt->samples), LIFETIME_MAX_SAMPLES, newp);
+            m.ptr = newp;
+            lt->samples[j] = m;
+            lt->live++;
+        }
+    }
+    return newp;
+}
+
+int malloc_lifetime(size_t period, uint64_t threshold)
+{
+    heap_lifetime_t* lt = &default_lifetime;
+
+    if (!period)
+    {
+        lt->predicting = 0;
+        return 0;
+    }
+    if (!heap_lifetime_default)
+    {
+        if (heap_lifetime_init(lt, heap_default(), period, threshold) != 0)
+            return -1;
+        heap_lifetime_default = lt;
+        return 0;
+    }
+    lt->period = period;
+    lt->countdown = period;
+    lt->threshold = threshold ? threshold : LIFETIME_DEFAULT_THRESHOLD;
+    lt->predicting = 1;
+    return 0;
+}
+
+/**
+ * @brief Activa la segregación de malloc() antes de main() si HEAP_LIFETIME está definida.
+ */
+__attribute__((constructor)) static void lifetime_from_env(void)
+{
+    const char* value = HEAP_LIFETIME;
+
+    if (value)
+        malloc_lifetime(strtoul(value, NULL, 0), 0);
+}
@@ -0,0 +1,234 @@
+#include "heap_map.h"
+#include <sys/mman.h>
+
+/**
+ * @brief Gránulo del mapa en el que cae una dirección de la región.
+ *
+ * @param h Heap con el mapa activo.
+ * @param p Dirección dentro de la región.
+ * @return size_t Índice del bit.
+ */
+static inline size_t granule_of(heap_t* h, const void* p)
+{
+    return (size_t)((const char*)p - h->region.start) / HEAP_MAP_GRANULE;
+}
+
+/**
+ * @brief Bloque que empieza en un gránulo.
+ *
+ * @param h Heap con el mapa activo.
+ * @param i Índice del bit.
+ * @return t_block Bloque.
+ */
+static inline t_block block_at(heap_t* h, size_t i)
+{
+    return (t_block)(h->region.start + i * HEAP_MAP_GRANULE);
+}
+
+/**
+ * @brief Primer bit en 1 desde un índice, salteando de a 64 gránulos las palabras vacías.
+ *
+ * @param bits Mapa.
+ * @param i Primer índice a mirar.
+ * @param end Índice donde termina la búsqueda.
+ * @return size_t Índice encontrado, o end si no hay ninguno antes.
+ */
+static inline size_t next_set(const uint64_t* bits, size_t i, size_t end)
+{
+    size_t w = i >> 6;
+    uint64_t word;
+
+    if (i >= end)
+        return end;
+    word = bits[w] & (~0ULL << (i & 63));
+    while (!word)
+    {
+        if (++w << 6 >= end)
+            return end;
+        word = bits[w];
+    }
+    i = (w << 6) + (size_t)__builtin_ctzll(word);
+    return i < end ? i : end;
+}
+
+/**
+ * @brief Último bit en 1 antes de un índice.
+ *
+ * @param bits Mapa.
+ * @param i Índice donde termina la búsqueda, sin incluirlo.
+ * @return size_t Índice encontrado, o SIZE_MAX si no hay ninguno.
+ */
+static inline size_t prev_set(const uint64_t* bits, size_t i)
+{
+    size_t w;
+    uint64_t word;
+
+    if (!i--)
+        return SIZE_MAX;
+    w = i >> 6;
+    word = bits[w] & (~0ULL >> (63 - (i & 63)));
+    while (!word)
+    {
+        if (!w)
+            return SIZE_MAX;
+        word = bits[--w];
+    }
+    return (w << 6) + 63 - (size_t)__builtin_clzll(word);
+}
+
+/**
+ * @brief Tamaño de datos del bloque que empieza en un gránulo: la distancia hasta el comienzo siguiente.
+ *
+ * @param h Heap con el mapa activo.
+ * @param i Índice del comienzo del bloque.
+ * @param end Gránulo del tope del heap.
+ * @return size_t Bytes de datos del bloque.
+ */
+static inline size_t size_at(heap_t* h, size_t i, size_t end)
+{
+    return (next_set(h->map.starts, i + 1, end) - i) * HEAP_MAP_GRANULE - BLOCK_SIZE;
+}
+
+int heap_map(heap_t* h, int enable)
+{
+    size_t bytes = 2 * h->map.words * sizeof(uint64_t);
+
+    if (!enable)
+    {
+        if (h->map.starts)
+            munmap(h->map.starts, bytes);
+        memset(&h->map, 0, sizeof(h->map));
+        return 0;
+    }
+    if (!h->in_region)
+        return -1;
+
+    if (!h->map.starts)
+    {
+        // Un bit por gránulo de toda la reserva: el heap puede crecer sin que el mapa se mueva
+        size_t words = ((size_t)(h->region.end - h->region.start) / HEAP_MAP_GRANULE + 63) / 64 + 1;
+        bytes = 2 * words * sizeof(uint64_t);
+        void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            return -1;
+        h->map.starts = p;
+        h->map.frees = h->map.starts + words;
+        h->map.words = words;
+    }
+    else
+        // Las páginas descartadas vuelven en cero sin recorrer los mapas
+        madvise(h->map.starts, bytes, MADV_DONTNEED);
+    h->map.free = 0;
+
+    for (t_block b = h->base; b; b = b->next)
+        heap_map_set(h, b, b->free);
+    return 0;
+}
+
+void heap_map_set(heap_t* h, t_block b, int free)
+{
+    size_t i = granule_of(h, b);
+
+    h->map.starts[i >> 6] |= 1ULL << (i & 63);
+    heap_map_free(h, b, free);
+}
+
+void heap_map_free(heap_t* h, t_block b, int free)
+{
+    size_t i = granule_of(h, b);
+    uint64_t bit = 1ULL << (i & 63);
+    uint64_t* word = &h->map.frees[i >> 6];
+
+    if (free && !(*word & bit))
+    {
+        *word |= bit;
+        h->map.free++;
+    }
+    else if (!free && (*word & bit))
+    {
+        *word &= ~bit;
+        h->map.free--;
+    }
+}
+
+void heap_map_clear(heap_t* h, t_block b)
+{
+    size_t i = granule_of(h, b);
+
+    h->map.starts[i >> 6] &= ~(1ULL << (i & 63));
+    heap_map_free(h, b, 0);
+}
+
+t_block heap_map_next(heap_t* h, const void* from)
+{
+    size_t end = granule_of(h, h->region.top);
+    // Una dirección dentro de un gránulo empieza a buscar en el siguiente
+    size_t i = next_set(h->map.starts, ((size_t)((const char*)from - h->region.start) + HEAP_MAP_GRANULE - 1) /
+                                           HEAP_MAP_GRANULE, end);
+
+    return i < end ? block_at(h, i) : NULL;
+}
+
+t_block heap_map_find(heap_t* h, t_block* last, size_t size, unsigned* steps)
+{
+    size_t end = granule_of(h, h->region.top);
+    size_t found = SIZE_MAX;
+    // BEST_FIT solo acepta desperdicios menores que una página, como find_best_fit
+    size_t best = h->method == BEST_FIT ? PAGESIZE : 0;
+    size_t i = prev_set(h->map.starts, end);
+
+    *last = i == SIZE_MAX ? NULL : block_at(h, i);
+    if (!h->map.free)
+        return NULL;
+    for (i = next_set(h->map.frees, 0, end); i < end; i = next_set(h->map.frees, i + 1, end))
+    {
+        size_t s = size_at(h, i, end);
+        (*steps)++;
+        if (s < size)
+            continue;
+        if (h->method == FIRST_FIT || (h->method == BEST_FIT && s == size))
+            return block_at(h, i);
+        if (h->method == BEST_FIT && s - size < best)
+        {
+            found = i;
+            best = s - size;
+        }
+        else if (h->method == WORST_FIT && s > best)
+        {
+            found = i;
+            best = s;
+        }
+    }
+    return found == SIZE_MAX ? NULL : block_at(h, found);
+}
+
+void heap_blocks(heap_t* h, heap_blocks_t* blocks)
+{
+    memset(blocks, 0, sizeof(*blocks));
+    if (!h->map.starts)
+    {
+        for (t_block b = h->base; b; b = b->next)
+        {
+            blocks->blocks++;
+            if (b->free)
+            {
+                blocks->free_blocks++;
+                blocks->free_bytes += b->size;
+            }
+            else
+                blocks->used_bytes += b->size;
+        }
+        return;
+    }
+    if (!h->base)
+        return;
+
+    // Los bits por encima del tope están en cero: se cuentan palabras enteras
+    size_t end = granule_of(h, h->region.top);
+    for (size_t w = 0; w < (end + 63) / 64; w++)
+        blocks->blocks += (size_t)__builtin_popcountll(h->map.starts[w]);
+    blocks->free_blocks = h->map.free;
+    for (size_t i = next_set(h->map.frees, 0, end); i < end; i = next_set(h->map.frees, i + 1, end))
+        blocks->free_bytes += size_at(h, i, end);
+    blocks->used_bytes = (size_t)(h->region.top - (char*)h->base) - blocks->blocks * BLOCK_SIZE - blocks->free_bytes;
+}
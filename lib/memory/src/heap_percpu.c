@@ -0,0 +1,441 @@
+#define _GNU_SOURCE
+#include "heap_percpu.h"
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Las secuencias están escritas para x86-64 y usan el área que registra glibc */
+#if defined(__x86_64__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define PERCPU_RSEQ 1
+#else
+#define PERCPU_RSEQ 0
+#endif
+
+#if PERCPU_RSEQ
+/** Firma que el kernel exige justo antes del manejador de aborto, la de glibc. */
+#define PERCPU_RSEQ_SIG "0x53053053"
+
+/**
+ * Comienzo de una secuencia: el descriptor (inicio, largo hasta la
+ * confirmación y aborto) va a la sección __rseq_cs, se publica en rseq_cs y
+ * se verifica que el hilo siga en la CPU de la que leyó la pila.
+ */
+#define PERCPU_RSEQ_BEGIN                                                                                              \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                                                                               \
+    ".balign 32\n\t"                                                                                                   \
+    "3:\n\t"                                                                                                           \
+    ".long 0x0, 0x0\n\t"                                                                                               \
+    ".quad 1f, (2f - 1f), 4f\n\t"                                                                                      \
+    ".popsection\n\t"                                                                                                  \
+    "leaq 3b(%%rip), %%rax\n\t"                                                                                        \
+    "movq %%rax, %[rseq_cs]\n\t"                                                                                       \
+    "1:\n\t"                                                                                                           \
+    "cmpl %[cpu], %[cpu_id]\n\t"                                                                                       \
+    "jnz 4f\n\t"
+
+/** Fin de una secuencia, justo después de la escritura que la confirma, y su manejador de aborto. */
+#define PERCPU_RSEQ_END                                                                                                \
+    "2:\n\t"                                                                                                           \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                                                                          \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                                                                       \
+    ".long " PERCPU_RSEQ_SIG "\n\t"                                                                                    \
+    "4:\n\t"                                                                                                           \
+    "jmp %l[retry]\n\t"                                                                                                \
+    ".popsection\n\t"
+
+/**
+ * @brief Área rseq del hilo actual, registrada por glibc.
+ *
+ * @return struct rseq* Área del hilo.
+ */
+static inline struct rseq* rseq_area(void)
+{
+    return (struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+}
+
+/**
+ * @brief Saca la cima de una pila: si count y la cima siguen siendo los leídos, escribe el nuevo count.
+ *
+ * @param rs Área rseq del hilo.
+ * @param cpu CPU de la que se leyó la pila.
+ * @param count Contador de la pila.
+ * @param n Valor leído del contador.
+ * @param slot Cima de la pila.
+ * @param p Valor leído de la cima.
+ * @return int 0 si se confirmó, -1 si hubo que abortar o la pila cambió.
+ */
+static inline int rseq_pop(struct rseq* rs, int cpu, intptr_t* count, intptr_t n, void** slot, void* p)
+{
+    __asm__ __volatile__ goto(PERCPU_RSEQ_BEGIN
+                              "cmpq %[count], %[n]\n\t"
+                              "jnz %l[retry]\n\t"
+                              "cmpq %[slot], %[p]\n\t"
+                              "jnz %l[retry]\n\t"
+                              "movq %[less], %[count]\n\t" PERCPU_RSEQ_END
+                              :
+                              : [cpu] "r"(cpu), [cpu_id] "m"(rs->cpu_id), [rseq_cs] "m"(rs->rseq_cs),
+                                [count] "m"(*count), [n] "r"(n), [slot] "m"(*slot), [p] "r"(p), [less] "r"(n - 1)
+                              : "memory", "cc", "rax"
+                              : retry);
+    return 0;
+retry:
+    return -1;
+}
+
+/**
+ * @brief Apila un bloque: si count sigue siendo el leído, escribe el bloque sobre la cima y después el nuevo count.
+ *
+ * Si la secuencia aborta entre las dos escrituras, el bloque quedó por
+ * encima de la pila, donde nadie lo lee.
+ *
+ * @param rs Área rseq del hilo.
+ * @param cpu CPU de la que se leyó la pila.
+ * @param count Contador de la pila.
+ * @param n Valor leído del contador.
+ * @param slot Lugar por encima de la cima.
+ * @param p Bloque a apilar.
+ * @return int 0 si se confirmó, -1 si hubo que abortar o la pila cambió.
+ */
+static inline int rseq_push(struct rseq* rs, int cpu, intptr_t* count, intptr_t n, void** slot, void* p)
+{
+    __asm__ __volatile__ goto(PERCPU_RSEQ_BEGIN
+                              "cmpq %[count], %[n]\n\t"
+                              "jnz %l[retry]\n\t"
+                              "movq %[p], %[slot]\n\t"
+                              "movq %[more], %[count]\n\t" PERCPU_RSEQ_END
+                              :
+                              : [cpu] "r"(cpu), [cpu_id] "m"(rs->cpu_id), [rseq_cs] "m"(rs->rseq_cs),
+                                [count] "m"(*count), [n] "r"(n), [slot] "m"(*slot), [p] "r"(p), [more] "r"(n + 1)
+                              : "memory", "cc", "rax"
+                              : retry);
+    return 0;
+retry:
+    return -1;
+}
+#endif
+
+/**
+ * @brief Clase de tamaño que sirve un pedido.
+ *
+ * @param size Tamaño pedido, entre 1 y HEAP_PERCPU_MAX.
+ * @return int Clase; sus bloques tienen al menos (clase + 1) * HEAP_PERCPU_QUANTUM bytes.
+ */
+static inline int class_of(size_t size)
+{
+    return (int)((size - 1) / HEAP_PERCPU_QUANTUM);
+}
+
+/**
+ * @brief Clase en la que free guarda un bloque: la más grande a la que le alcanza su tamaño.
+ *
+ * @param size Tamaño de datos del bloque, entre HEAP_PERCPU_QUANTUM y HEAP_PERCPU_BLOCK_MAX.
+ * @return int Clase.
+ */
+static inline int class_of_block(size_t size)
+{
+    size_t c = size / HEAP_PERCPU_QUANTUM;
+    return (int)(c < HEAP_PERCPU_CLASSES ? c : HEAP_PERCPU_CLASSES) - 1;
+}
+
+/**
+ * @brief Indica si el hilo puede usar las pilas: sin rseq siempre, con rseq si glibc lo registró en el hilo.
+ *
+ * @param pc Heap.
+ * @return int 1 si puede, 0 si tiene que ir directo al heap.
+ */
+static inline int cache_usable(heap_percpu_t* pc)
+{
+#if PERCPU_RSEQ
+    if (pc->rseq)
+    {
+        int cpu = (int)__atomic_load_n(&rseq_area()->cpu_id, __ATOMIC_RELAXED);
+        return cpu >= 0 && cpu < pc->cpus;
+    }
+#endif
+    (void)pc;
+    return 1;
+}
+
+/**
+ * @brief Caché con mutex que usa el hilo.
+ *
+ * @param pc Heap sin rseq.
+ * @return struct heap_percpu_cache* Caché de la CPU en la que corre el hilo.
+ */
+static inline struct heap_percpu_cache* locked_cache(heap_percpu_t* pc)
+{
+    int cpu = sched_getcpu();
+    // Con mutex cualquier caché es correcto: la CPU solo reparte los hilos
+    return &pc->caches[cpu > 0 ? cpu % pc->cpus : 0];
+}
+
+/**
+ * @brief Saca un bloque de la pila de una clase en la CPU actual.
+ *
+ * @param pc Heap.
+ * @param c Clase.
+ * @return void* Área de datos, o NULL si la pila está vacía.
+ */
+static inline void* cache_pop(heap_percpu_t* pc, int c)
+{
+#if PERCPU_RSEQ
+    if (pc->rseq)
+    {
+        struct rseq* rs = rseq_area();
+        for (;;)
+        {
+            int cpu = (int)__atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+            if (cpu >= pc->cpus || (int)__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED) < 0)
+                return NULL;
+            struct heap_percpu_cache* cache = &pc->caches[cpu];
+            intptr_t n = __atomic_load_n(&cache->count[c], __ATOMIC_RELAXED);
+            if (!n)
+                return NULL;
+            void* p = __atomic_load_n(&cache->slots[c][n - 1], __ATOMIC_RELAXED);
+            if (rseq_pop(rs, cpu, &cache->count[c], n, &cache->slots[c][n - 1], p) == 0)
+                return p;
+        }
+    }
+#endif
+    struct heap_percpu_cache* cache = locked_cache(pc);
+    void* p = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->count[c])
+        p = cache->slots[c][--cache->count[c]];
+    pthread_mutex_unlock(&cache->lock);
+    return p;
+}
+
+/**
+ * @brief Apila un bloque en la pila de una clase en la CPU actual.
+ *
+ * @param pc Heap.
+ * @param c Clase.
+ * @param p Área de datos.
+ * @return int 0 si se apiló, -1 si la pila está llena.
+ */
+static inline int cache_push(heap_percpu_t* pc, int c, void* p)
+{
+#if PERCPU_RSEQ
+    if (pc->rseq)
+    {
+        struct rseq* rs = rseq_area();
+        for (;;)
+        {
+            int cpu = (int)__atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+            if (cpu >= pc->cpus || (int)__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED) < 0)
+                return -1;
+            struct heap_percpu_cache* cache = &pc->caches[cpu];
+            intptr_t n = __atomic_load_n(&cache->count[c], __ATOMIC_RELAXED);
+            if (n == HEAP_PERCPU_DEPTH)
+                return -1;
+            if (rseq_push(rs, cpu, &cache->count[c], n, &cache->slots[c][n], p) == 0)
+                return 0;
+        }
+    }
+#endif
+    struct heap_percpu_cache* cache = locked_cache(pc);
+    int rc = -1;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->count[c] < HEAP_PERCPU_DEPTH)
+    {
+        cache->slots[c][cache->count[c]++] = p;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return rc;
+}
+
+/**
+ * @brief Llena la pila vacía de una clase con un lote del heap y devuelve uno de sus bloques.
+ *
+ * Queda fuera de línea para que malloc no cargue con el marco del lote en el
+ * camino de la pila.
+ *
+ * @param pc Heap.
+ * @param c Clase.
+ * @return void* Área de datos, o NULL si el heap no tiene lugar.
+ */
+__attribute__((noinline)) static void* cache_refill(heap_percpu_t* pc, int c)
+{
+    void* batch[HEAP_PERCPU_BATCH];
+    size_t size = (size_t)(c + 1) * HEAP_PERCPU_QUANTUM;
+    int n = 0, i;
+
+    pthread_mutex_lock(&pc->lock);
+    while (n < HEAP_PERCPU_BATCH && (batch[n] = heap_malloc(&pc->heap, size)))
+        n++;
+    if (n)
+        pc->refills++;
+    pthread_mutex_unlock(&pc->lock);
+    if (!n)
+        return NULL;
+
+    // Se apilan al revés para que los próximos pedidos salgan en orden de dirección
+    for (i = n - 1; i > 0 && cache_push(pc, c, batch[i]) == 0; i--)
+        ;
+    if (i > 0)
+    {
+        // Otro hilo de la misma CPU llenó la pila mientras tanto
+        pthread_mutex_lock(&pc->lock);
+        for (; i > 0; i--)
+            heap_free(&pc->heap, batch[i]);
+        pthread_mutex_unlock(&pc->lock);
+    }
+    return batch[0];
+}
+
+/**
+ * @brief Devuelve al heap un bloque y un lote de la pila llena de su clase.
+ *
+ * @param pc Heap.
+ * @param c Clase.
+ * @param p Bloque que no entró en la pila.
+ */
+__attribute__((noinline)) static void cache_flush(heap_percpu_t* pc, int c, void* p)
+{
+    void* batch[HEAP_PERCPU_BATCH + 1];
+    int n = 0;
+
+    batch[n++] = p;
+    while (n <= HEAP_PERCPU_BATCH && (batch[n] = cache_pop(pc, c)))
+        n++;
+    pthread_mutex_lock(&pc->lock);
+    for (int i = 0; i < n; i++)
+        heap_free(&pc->heap, batch[i]);
+    pc->flushes++;
+    pthread_mutex_unlock(&pc->lock);
+}
+
+int heap_percpu_init(heap_percpu_t* pc, size_t size, int flags)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+    memset(pc, 0, sizeof(*pc));
+    pc->cpus = cpus > 0 ? (int)cpus : 1;
+    if (heap_init(&pc->heap, NULL, size) != 0)
+        return -1;
+    void* caches = mmap(NULL, (size_t)pc->cpus * sizeof(*pc->caches), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (caches == MAP_FAILED)
+    {
+        heap_destroy(&pc->heap);
+        return -1;
+    }
+    pc->caches = caches;
+    pthread_mutex_init(&pc->lock, NULL);
+    for (int cpu = 0; cpu < pc->cpus; cpu++)
+        pthread_mutex_init(&pc->caches[cpu].lock, NULL);
+
+#if PERCPU_RSEQ
+    // glibc deja __rseq_size en 0 si el kernel rechazó el registro o si se apagó con su tunable
+    pc->rseq = !(flags & HEAP_PERCPU_LOCKED) && __rseq_size > 0 && (int)rseq_area()->cpu_id >= 0;
+#else
+    (void)flags;
+#endif
+    return 0;
+}
+
+void heap_percpu_destroy(heap_percpu_t* pc)
+{
+    if (!pc->caches)
+        return;
+    for (int cpu = 0; cpu < pc->cpus; cpu++)
+        pthread_mutex_destroy(&pc->caches[cpu].lock);
+    munmap(pc->caches, (size_t)pc->cpus * sizeof(*pc->caches));
+    pthread_mutex_destroy(&pc->lock);
+    heap_destroy(&pc->heap);
+    memset(pc, 0, sizeof(*pc));
+}
+
+void* heap_percpu_malloc(heap_percpu_t* pc, size_t size)
+{
+    void* p;
+
+    if (size && size <= HEAP_PERCPU_MAX && cache_usable(pc))
+    {
+        int c = class_of(size);
+        p = cache_pop(pc, c);
+        return p ? p : cache_refill(pc, c);
+    }
+    pthread_mutex_lock(&pc->lock);
+    p = heap_malloc(&pc->heap, size);
+    pthread_mutex_unlock(&pc->lock);
+    return p;
+}
+
+void heap_percpu_free(heap_percpu_t* pc, void* p)
+{
+    // La reserva de la región no se mueve: se puede mirar sin el mutex
+    if (!p || (char*)p < pc->heap.region.start + BLOCK_SIZE || (char*)p >= pc->heap.region.end)
+        return;
+
+    t_block b = get_block(p);
+    if (b->magic == block_cookie(b) && !b->free && b->size >= HEAP_PERCPU_QUANTUM &&
+        b->size <= HEAP_PERCPU_BLOCK_MAX && cache_usable(pc))
+    {
+        int c = class_of_block(b->size);
+        if (cache_push(pc, c, p) != 0)
+            cache_flush(pc, c, p);
+        return;
+    }
+    pthread_mutex_lock(&pc->lock);
+    heap_free(&pc->heap, p);
+    pthread_mutex_unlock(&pc->lock);
+}
+
+void heap_percpu_drain(heap_percpu_t* pc)
+{
+    pthread_mutex_lock(&pc->lock);
+    for (int cpu = 0; cpu < pc->cpus; cpu++)
+    {
+        struct heap_percpu_cache* cache = &pc->caches[cpu];
+        for (int c = 0; c < HEAP_PERCPU_CLASSES; c++)
+        {
+            while (cache->count[c])
+                heap_free(&pc->heap, cache->slots[c][--cache->count[c]]);
+        }
+    }
+    pthread_mutex_unlock(&pc->lock);
+}
+
+void heap_percpu_stats(heap_percpu_t* pc, heap_percpu_stats_t* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    // Con el mutex del heap el tope no baja: los encabezados debajo de él se pueden leer
+    pthread_mutex_lock(&pc->lock);
+    char* lo = pc->heap.region.start + BLOCK_SIZE;
+    char* hi = pc->heap.region.top;
+    for (int cpu = 0; cpu < pc->cpus; cpu++)
+    {
+        struct heap_percpu_cache* cache = &pc->caches[cpu];
+        // Ningún camino toma el mutex del heap con el de un caché tomado: este orden no se traba
+        if (!pc->rseq)
+            pthread_mutex_lock(&cache->lock);
+        for (int c = 0; c < HEAP_PERCPU_CLASSES; c++)
+        {
+            intptr_t n = __atomic_load_n(&cache->count[c], __ATOMIC_RELAXED);
+            n = n < 0 ? 0 : n > HEAP_PERCPU_DEPTH ? HEAP_PERCPU_DEPTH : n;
+            for (intptr_t i = 0; i < n; i++)
+            {
+                // Con rseq la pila puede cambiar mientras se lee: una entrada vieja puede ser un bloque ya recortado
+                char* p = __atomic_load_n(&cache->slots[c][i], __ATOMIC_RELAXED);
+                if (p >= lo && p < hi)
+                    stats->cached_bytes += get_block(p)->size;
+            }
+            stats->cached_blocks += (size_t)n;
+        }
+        if (!pc->rseq)
+            pthread_mutex_unlock(&cache->lock);
+    }
+    stats->heap_bytes = (size_t)(hi - pc->heap.region.start);
+    stats->refills = pc->refills;
+    stats->flushes = pc->flushes;
+    pthread_mutex_unlock(&pc->lock);
+    stats->rseq = pc->rseq;
+}
@@ -0,0 +1,150 @@
+#include "heap_populate.h"
+#include "memory.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Linux 5.14; con un kernel anterior madvise falla con EINVAL y se tocan las páginas */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+unsigned heap_calloc_threads = 0;
+
+/**
+ * @struct populate_job
+ * @brief Parte de un rango que respalda un hilo.
+ */
+struct populate_job
+{
+    char* start;      /**< Inicio de la parte. */
+    size_t len;       /**< Bytes de la parte. */
+    int flags;        /**< Flags de heap_populate. */
+    pthread_t thread; /**< Hilo que la respalda. */
+};
+
+/**
+ * @brief Respalda una parte del rango en el hilo actual.
+ *
+ * @param arg populate_job a respaldar.
+ * @return void* Siempre NULL.
+ */
+static void* populate_part(void* arg)
+{
+    struct populate_job* job = arg;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    char* end = job->start + job->len;
+
+    if (job->flags & HEAP_POPULATE_ZERO)
+    {
+        memset(job->start, 0, job->len);
+        return NULL;
+    }
+
+    // madvise solo acepta páginas enteras: las puntas se tocan como en el caso general
+    char* first = (char*)(((uintptr_t)job->start + page - 1) & ~(page - 1));
+    char* last = (char*)((uintptr_t)end & ~(page - 1));
+    char* p = job->start;
+    if (!(job->flags & HEAP_POPULATE_TOUCH) && first < last &&
+        madvise(first, (size_t)(last - first), MADV_POPULATE_WRITE) == 0)
+    {
+        if (p < first)
+            __atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+        if (last < end)
+            __atomic_fetch_add(last, 0, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    // Una escritura que no cambia el dato: leer primero mapearía la página cero y costaría otro fault
+    for (; p < end; p = (char*)(((uintptr_t)p + page) & ~(page - 1)))
+        __atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int heap_populate(void* p, size_t size, unsigned nthreads, int flags)
+{
+    struct populate_job jobs[HEAP_POPULATE_MAX_THREADS];
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (!p)
+        return -1;
+
+    if (!nthreads)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (nthreads > size / HEAP_POPULATE_MIN)
+        nthreads = size / HEAP_POPULATE_MIN ? (unsigned)(size / HEAP_POPULATE_MIN) : 1;
+    if (nthreads > HEAP_POPULATE_MAX_THREADS)
+        nthreads = HEAP_POPULATE_MAX_THREADS;
+
+    // Partes de páginas enteras, así dos hilos nunca tocan la misma página
+    size_t share = (size / nthreads + page - 1) & ~(page - 1);
+    for (unsigned i = 0; i < nthreads; i++)
+    {
+        size_t offset = share * i < size ? share * i : size;
+        jobs[i].start = (char*)p + offset;
+        jobs[i].len = size - offset < share ? size - offset : share;
+        jobs[i].flags = flags;
+        jobs[i].thread = 0;
+    }
+
+    // La primera parte la hace el que llama, mientras los otros hilos hacen el resto
+    for (unsigned i = 1; i < nthreads; i++)
+    {
+        if (pthread_create(&jobs[i].thread, NULL, populate_part, &jobs[i]) != 0)
+        {
+            jobs[i].thread = 0;
+            populate_part(&jobs[i]);
+        }
+    }
+    populate_part(&jobs[0]);
+    for (unsigned i = 1; i < nthreads; i++)
+    {
+        if (jobs[i].thread)
+            pthread_join(jobs[i].thread, NULL);
+    }
+    return (int)nthreads;
+}
+
+void* heap_malloc_populate(heap_t* h, size_t size, unsigned nthreads)
+{
+    void* p = heap_malloc(h, size);
+
+    if (p)
+        heap_populate(p, size, nthreads, 0);
+    return p;
+}
+
+void* malloc_populate(size_t size, unsigned nthreads)
+{
+    void* p = malloc(size);
+
+    if (p)
+        heap_populate(p, size, nthreads, 0);
+    return p;
+}
+
+void calloc_populate(int enable, unsigned nthreads)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (enable && !nthreads)
+        nthreads = cpus > 0 ? (unsigned)cpus : 1;
+    heap_calloc_threads = enable ? nthreads : 0;
+}
+
+/**
+ * @brief Activa la puesta en cero en paralelo de calloc antes de main() si HEAP_POPULATE tiene una cantidad de hilos.
+ */
+__attribute__((constructor)) static void populate_from_env(void)
+{
+    const char* value = HEAP_POPULATE;
+
+    if (value)
+        calloc_populate(1, (unsigned)strtoul(value, NULL, 0));
+}
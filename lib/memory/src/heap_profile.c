@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include "heap_profile.h"
+#include "ptr_table.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Marcos propios en los que se busca el sitio al principio de cada pila: de
+ * heap_profile_malloc a realloc pasando por heap_malloc_from, heap_realloc_from
+ * y heap_lifetime_realloc, con margen.
+ */
+#define OWN_FRAMES 6
+/** Tamaño del buffer de escritura de los volcados. */
+#define DUMP_BUFFER 4096
+
+/**
+ * @brief Sitio de asignación: una pila distinta y sus contadores muestreados.
+ */
+typedef struct
+{
+    uint64_t hash;                        /**< Hash de la pila, 0 si la entrada está vacía. */
+    int depth;                            /**< Marcos válidos en frames. */
+    void* frames[HEAP_PROFILE_MAX_DEPTH]; /**< Direcciones de retorno, de la hoja a la raíz. */
+    uint64_t live_count;                  /**< Muestras vivas. */
+    uint64_t live_bytes;                  /**< Bytes solicitados por las muestras vivas. */
+    uint64_t alloc_count;                 /**< Muestras tomadas en total. */
+    uint64_t alloc_bytes;                 /**< Bytes solicitados por todas las muestras. */
+    uint64_t est_live_bytes;              /**< Estimación sin muestreo de los bytes vivos. */
+} heap_site;
+
+/**
+ * @brief Asignación muestreada que sigue viva.
+ */
+typedef struct
+{
+    void* ptr;     /**< Dirección de datos, NULL si la entrada está vacía. */
+    uint32_t site; /**< Índice del sitio en la tabla de sitios. */
+    size_t size;   /**< Tamaño solicitado. */
+    uint64_t est;  /**< Bytes que representa la muestra. */
+} heap_sample;
+
+/**
+ * @brief Escritura con buffer que solo usa llamadas async-signal-safe.
+ */
+typedef struct
+{
+    int fd;                /**< Descriptor de destino. */
+    int error;             /**< Distinto de cero si falló alguna escritura. */
+    size_t len;            /**< Bytes pendientes en buf. */
+    char buf[DUMP_BUFFER]; /**< Datos pendientes. */
+} dump_writer;
+
+int heap_profile_active = 0;
+int64_t heap_profile_countdown = 0;
+size_t heap_profile_sampled = 0;
+
+/** Tabla de sitios, direccionamiento abierto por hash de pila. */
+static heap_site* sites = NULL;
+/** Tabla de muestras vivas, direccionamiento abierto por dirección. */
+static heap_sample* live = NULL;
+/** Sitios ocupados. */
+static size_t num_sites = 0;
+/** Bytes promedio entre muestras. */
+static size_t rate = HEAP_PROFILE_DEFAULT_RATE;
+/** Estado del generador xorshift de los intervalos. */
+static uint64_t rng = 0;
+/** Evita muestrear las asignaciones que haga backtrace() mientras se toma una muestra. */
+static __thread int in_profiler = 0;
+/** Copia de HEAP_PROFILE_PATH para el manejador de señal. */
+static char signal_path[4096];
+
+/**
+ * @brief Reserva una tabla con mmap para no usar el heap que se perfila.
+ *
+ * @param size Bytes de la tabla.
+ * @return void* Tabla en cero, NULL si falla.
+ */
+static void* map_table(size_t size)
+{
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/**
+ * @brief Próximo intervalo de muestreo, exponencial con media rate.
+ *
+ * @return int64_t Bytes hasta la próxima muestra.
+ */
+static int64_t next_interval(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    double u = (double)((rng * 0x2545F4914F6CDD1Dull) >> 11) / (double)(1ull << 53);
+    double interval = -log(1.0 - u) * (double)rate;
+    return interval < 1.0 ? 1 : (int64_t)interval;
+}
+
+/**
+ * @brief Busca o crea el sitio de una pila.
+ *
+ * @param frames Pila capturada.
+ * @param depth Marcos en la pila.
+ * @return long Índice del sitio, -1 si la tabla está llena.
+ */
+static long find_site(void** frames, int depth)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < depth; i++)
+        hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 0x100000001b3ull;
+    hash |= 1;
+
+    size_t i = (size_t)hash & (HEAP_PROFILE_MAX_SITES - 1);
+    for (;;)
+    {
+        heap_site* s = &sites[i];
+        if (s->hash == 0)
+            break;
+        if (s->hash == hash && s->depth == depth && memcmp(s->frames, frames, sizeof(void*) * depth) == 0)
+            return (long)i;
+        i = (i + 1) & (HEAP_PROFILE_MAX_SITES - 1);
+    }
+
+    /* Se deja un cuarto de la tabla libre para que las búsquedas sigan siendo cortas */
+    if (num_sites >= HEAP_PROFILE_MAX_SITES / 4 * 3)
+        return -1;
+    sites[i].hash = hash;
+    sites[i].depth = depth;
+    memcpy(sites[i].frames, frames, sizeof(void*) * depth);
+    num_sites++;
+    return (long)i;
+}
+
+int heap_profile_start(size_t sample_rate)
+{
+    if (!sites)
+        sites = map_table(sizeof(heap_site) * HEAP_PROFILE_MAX_SITES);
+    if (!live)
+        live = map_table(sizeof(heap_sample) * HEAP_PROFILE_MAX_LIVE);
+    if (!sites || !live)
+        return -1;
+
+    /* La primera llamada a backtrace() carga libgcc_s y asigna memoria; se hace acá y no en malloc */
+    void* warmup[OWN_FRAMES];
+    in_profiler = 1;
+    backtrace(warmup, OWN_FRAMES);
+    in_profiler = 0;
+
+    rate = sample_rate ? sample_rate : HEAP_PROFILE_DEFAULT_RATE;
+    if (!rng)
+        rng = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid() ^ 0x9E3779B97F4A7C15ull;
+    heap_profile_countdown = next_interval();
+    heap_profile_active = 1;
+    return 0;
+}
+
+void heap_profile_stop(void)
+{
+    heap_profile_active = 0;
+}
+
+void heap_profile_reset(void)
+{
+    if (sites)
+        madvise(sites, sizeof(heap_site) * HEAP_PROFILE_MAX_SITES, MADV_DONTNEED);
+    if (live)
+        madvise(live, sizeof(heap_sample) * HEAP_PROFILE_MAX_LIVE, MADV_DONTNEED);
+    num_sites = 0;
+    heap_profile_sampled = 0;
+}
+
+void heap_profile_malloc(void* ptr, size_t size, const void* caller)
+{
+    if (in_profiler || !ptr)
+        return;
+
+    in_profiler = 1;
+    heap_profile_countdown = next_interval();
+
+    /* La pila empieza en el sitio que pasó el punto de entrada; los marcos propios que lo preceden se descartan */
+    void* frames[HEAP_PROFILE_MAX_DEPTH + OWN_FRAMES];
+    int total = backtrace(frames, HEAP_PROFILE_MAX_DEPTH + OWN_FRAMES);
+    int top = 0;
+    while (top < total && top < OWN_FRAMES && frames[top] != caller)
+        top++;
+    /* Sin encontrarlo (un marco sin información de unwind, por ejemplo) la pila es solo el sitio */
+    if (top == total || frames[top] != caller)
+    {
+        top = 0;
+        total = 1;
+        frames[0] = (void*)caller;
+    }
+    int depth = total - top < HEAP_PROFILE_MAX_DEPTH ? total - top : HEAP_PROFILE_MAX_DEPTH;
+    long site = find_site(frames + top, depth);
+
+    if (site >= 0 && heap_profile_sampled < HEAP_PROFILE_MAX_LIVE / 4 * 3)
+    {
+        /* Una muestra de size bytes con intervalo medio rate representa size / (1 - e^(-size/rate)) bytes */
+        double est = (double)size / (1.0 - exp(-(double)size / (double)rate));
+        heap_site* s = &sites[site];
+        size_t i = ptr_table_slot_for(live, sizeof(*live), HEAP_PROFILE_MAX_LIVE, ptr);
+
+        live[i].ptr = ptr;
+        live[i].site = (uint32_t)site;
+        live[i].size = size;
+        live[i].est = (uint64_t)est;
+        heap_profile_sampled++;
+
+        s->live_count++;
+        s->live_bytes += size;
+        s->alloc_count++;
+        s->alloc_bytes += size;
+        s->est_live_bytes += live[i].est;
+    }
+    in_profiler = 0;
+}
+
+void heap_profile_free(void* ptr)
+{
+    long i = ptr_table_find(live, sizeof(*live), HEAP_PROFILE_MAX_LIVE, ptr);
+
+    if (i < 0)
+        return;
+    heap_site* s = &sites[live[i].site];
+    s->live_count--;
+    s->live_bytes -= live[i].size;
+    s->est_live_bytes -= live[i].est;
+    heap_profile_sampled--;
+    ptr_table_remove(live, sizeof(*live), HEAP_PROFILE_MAX_LIVE, (size_t)i);
+}
+
+/**
+ * @brief Envía al descriptor los datos pendientes del buffer.
+ *
+ * @param w Escritor.
+ */
+static void dump_flush(dump_writer* w)
+{
+    size_t off = 0;
+    while (off < w->len && !w->error)
+    {
+        ssize_t n = write(w->fd, w->buf + off, w->len - off);
+        if (n <= 0)
+            w->error = 1;
+        else
+            off += (size_t)n;
+    }
+    w->len = 0;
+}
+
+/**
+ * @brief Agrega bytes al buffer de escritura.
+ *
+ * @param w Escritor.
+ * @param s Datos.
+ * @param n Cantidad de bytes.
+ */
+static void dump_bytes(dump_writer* w, const char* s, size_t n)
+{
+    while (n)
+    {
+        if (w->len == DUMP_BUFFER)
+            dump_flush(w);
+        size_t chunk = DUMP_BUFFER - w->len < n ? DUMP_BUFFER - w->len : n;
+        memcpy(w->buf + w->len, s, chunk);
+        w->len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+/**
+ * @brief Agrega una cadena al buffer de escritura.
+ *
+ * @param w Escritor.
+ * @param s Cadena terminada en NUL.
+ */
+static void dump_str(dump_writer* w, const char* s)
+{
+    dump_bytes(w, s, strlen(s));
+}
+
+/**
+ * @brief Agrega un número en la base indicada, sin usar printf.
+ *
+ * @param w Escritor.
+ * @param v Valor.
+ * @param base 10 o 16; en base 16 se antepone 0x.
+ */
+static void dump_num(dump_writer* w, uint64_t v, unsigned base)
+{
+    char tmp[24];
+    int n = 0;
+    do
+    {
+        tmp[n++] = "0123456789abcdef"[v % base];
+        v /= base;
+    } while (v);
+    if (base == 16)
+        dump_str(w, "0x");
+    while (n)
+        dump_bytes(w, &tmp[--n], 1);
+}
+
+/**
+ * @brief Escribe los contadores de un sitio en el formato de pprof.
+ *
+ * @param w Escritor.
+ * @param live_count Muestras vivas.
+ * @param live_bytes Bytes vivos.
+ * @param alloc_count Muestras totales.
+ * @param alloc_bytes Bytes totales.
+ */
+static void dump_counts(dump_writer* w, uint64_t live_count, uint64_t live_bytes, uint64_t alloc_count,
+                        uint64_t alloc_bytes)
+{
+    dump_num(w, live_count, 10);
+    dump_str(w, ": ");
+    dump_num(w, live_bytes, 10);
+    dump_str(w, " [");
+    dump_num(w, alloc_count, 10);
+    dump_str(w, ": ");
+    dump_num(w, alloc_bytes, 10);
+    dump_str(w, "] @");
+}
+
+/**
+ * @brief Vuelca el perfil en el formato de heap de gperftools que lee pprof.
+ *
+ * @param w Escritor.
+ */
+static void dump_pprof(dump_writer* w)
+{
+    uint64_t lc = 0, lb = 0, ac = 0, ab = 0;
+    for (size_t i = 0; sites && i < HEAP_PROFILE_MAX_SITES; i++)
+    {
+        lc += sites[i].live_count;
+        lb += sites[i].live_bytes;
+        ac += sites[i].alloc_count;
+        ab += sites[i].alloc_bytes;
+    }
+
+    dump_str(w, "heap profile: ");
+    dump_counts(w, lc, lb, ac, ab);
+    dump_str(w, " heap_v2/");
+    dump_num(w, rate, 10);
+    dump_str(w, "\n");
+
+    for (size_t i = 0; sites && i < HEAP_PROFILE_MAX_SITES; i++)
+    {
+        if (!sites[i].alloc_count)
+            continue;
+        dump_counts(w, sites[i].live_count, sites[i].live_bytes, sites[i].alloc_count, sites[i].alloc_bytes);
+        for (int f = 0; f < sites[i].depth; f++)
+        {
+            dump_str(w, " ");
+            dump_num(w, (uint64_t)(uintptr_t)sites[i].frames[f], 16);
+        }
+        dump_str(w, "\n");
+    }
+
+    /* pprof necesita el mapa de memoria para simbolizar las direcciones */
+    dump_str(w, "\nMAPPED_LIBRARIES:\n");
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0)
+    {
+        char buf[1024];
+        ssize_t n;
+        while ((n = read(maps, buf, sizeof(buf))) > 0)
+            dump_bytes(w, buf, (size_t)n);
+        close(maps);
+    }
+}
+
+/**
+ * @brief Vuelca los bytes vivos estimados por pila en formato folded.
+ *
+ * @param w Escritor.
+ */
+static void dump_folded(dump_writer* w)
+{
+    for (size_t i = 0; sites && i < HEAP_PROFILE_MAX_SITES; i++)
+    {
+        if (!sites[i].est_live_bytes)
+            continue;
+        /* Las pilas folded van de la raíz a la hoja */
+        for (int f = sites[i].depth - 1; f >= 0; f--)
+        {
+            Dl_info info;
+            if (dladdr(sites[i].frames[f], &info) && info.dli_sname)
+                dump_str(w, info.dli_sname);
+            else
+                dump_num(w, (uint64_t)(uintptr_t)sites[i].frames[f], 16);
+            dump_str(w, f ? ";" : " ");
+        }
+        dump_num(w, sites[i].est_live_bytes, 10);
+        dump_str(w, "\n");
+    }
+}
+
+int heap_profile_dump_fd(int fd, int format)
+{
+    dump_writer w;
+    w.fd = fd;
+    w.error = 0;
+    w.len = 0;
+
+    in_profiler++;
+    if (format == HEAP_PROFILE_FOLDED)
+        dump_folded(&w);
+    else
+        dump_pprof(&w);
+    dump_flush(&w);
+    in_profiler--;
+    return w.error ? -1 : 0;
+}
+
+int heap_profile_dump(const char* path, int format)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    int ret = heap_profile_dump_fd(fd, format);
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief Manejador de señal: vuelca el perfil pprof a HEAP_PROFILE_PATH.
+ *
+ * @param signo Señal recibida.
+ */
+static void dump_on_signal(int signo)
+{
+    (void)signo;
+    int saved = errno;
+    heap_profile_dump(signal_path, HEAP_PROFILE_PPROF);
+    errno = saved;
+}
+
+int heap_profile_signal(int signo)
+{
+    const char* path = HEAP_PROFILE_PATH;
+    if (path == NULL || strlen(path) >= sizeof(signal_path))
+        return -1;
+    strcpy(signal_path, path);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(signo, &sa, NULL);
+}
+
+/**
+ * @brief Vuelca el perfil a HEAP_PROFILE_PATH cuando termina el proceso.
+ */
+static void dump_at_exit(void)
+{
+    heap_profile_dump(HEAP_PROFILE_PATH, HEAP_PROFILE_PPROF);
+}
+
+/**
+ * @brief Arranca el perfilador al cargar la biblioteca si así lo piden las variables de entorno.
+ */
+__attribute__((constructor)) static void heap_profile_init(void)
+{
+    if (HEAP_PROFILE_RATE && heap_profile_start(strtoull(HEAP_PROFILE_RATE, NULL, 10)) == 0 && HEAP_PROFILE_PATH)
+        atexit(dump_at_exit);
+    if (HEAP_PROFILE_SIGNAL)
+        heap_profile_signal(atoi(HEAP_PROFILE_SIGNAL));
+}
@@ -0,0 +1,180 @@
+#include "heap_snapshot.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+
+/** Registros que se juntan en la pila antes de cada write. */
+#define SNAPSHOT_BATCH 256
+
+/** Archivo que usa el manejador instalado con heap_snapshot_on_signal(). */
+static char signal_path[PATH_MAX];
+
+/**
+ * @brief Escribe un buffer completo, reintentando escrituras parciales o interrumpidas.
+ *
+ * @param fd Archivo.
+ * @param buf Datos.
+ * @param len Bytes a escribir.
+ * @return int 0 si se escribió todo, -1 si falló write.
+ */
+static int write_all(int fd, const void* buf, size_t len)
+{
+    const char* p = buf;
+
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Marca los registros de un lote cuyos bloques están estacionados en los fast bins.
+ *
+ * Los bins se recorren por cada lote en lugar de guardar sus bloques, que
+ * pueden ser miles, en la pila del manejador de señales. Un enlace fuera del
+ * heap, a un bloque de otro tamaño o con la cookie rota corta ese bin.
+ *
+ * @param h Heap.
+ * @param batch Registros en orden de direcciones.
+ * @param n Registros del lote, al menos uno.
+ * @param lo Comienzo del heap.
+ * @param hi Tope del heap.
+ */
+static void mark_parked(heap_t* h, heap_snapshot_record* batch, size_t n, char* lo, char* hi)
+{
+    uintptr_t first = (uintptr_t)batch[0].address;
+    uintptr_t last = (uintptr_t)batch[n - 1].address;
+
+    for (size_t i = 0; i < HEAP_FASTBIN_COUNT; i++)
+    {
+        // Ningún bin pasa del umbral de consolidación con bloques de 8 bytes o más: más pasos son un ciclo
+        size_t steps = (HEAP_FASTBIN_THRESHOLD + HEAP_FASTBIN_MAX) / 8;
+        for (t_block b = h->fastbins[i]; b && steps--; b = fast_next(b))
+        {
+            if ((char*)b < lo || b->data + sizeof(t_block) > hi || b->size != i << 3 || b->magic != block_cookie(b))
+                break;
+            if ((uintptr_t)b < first || (uintptr_t)b > last)
+                continue;
+            size_t l = 0, r = n;
+            while (l < r)
+            {
+                size_t mid = l + (r - l) / 2;
+                if (batch[mid].address < (uintptr_t)b)
+                    l = mid + 1;
+                else
+                    r = mid;
+            }
+            if (l < n && batch[l].address == (uintptr_t)b)
+                batch[l].size |= HEAP_SNAPSHOT_PARKED;
+        }
+    }
+}
+
+int heap_snapshot(heap_t* h, unsigned arena, int fd)
+{
+    heap_snapshot_record batch[SNAPSHOT_BATCH];
+    heap_snapshot_header hd;
+    struct timespec now;
+    size_t n = 0;
+    char* lo = h->base;
+    char* hi = h->in_region ? h->region.top : sbrk(0);
+
+    off_t at = lseek(fd, 0, SEEK_CUR);
+    if (at < 0)
+        return -1;
+
+    // Un encabezado en cero marca el volcado como incompleto hasta el pwrite final
+    memset(&hd, 0, sizeof(hd));
+    if (write_all(fd, &hd, sizeof(hd)) != 0)
+        return -1;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    hd.magic = HEAP_SNAPSHOT_MAGIC;
+    hd.version = HEAP_SNAPSHOT_VERSION;
+    hd.arena = arena;
+    hd.policy = (uint32_t)h->method;
+    hd.time_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    hd.start = (uintptr_t)lo;
+    hd.top = (uintptr_t)hi;
+
+    /* Igual que heap_check: solo se sigue un next dentro del heap y más
+       adelante, así una señal en medio de un malloc no provoca un ciclo */
+    for (t_block b = h->base; b; b = b->next)
+    {
+        if ((char*)b < lo || (char*)b + BLOCK_SIZE > hi || b->size > (size_t)(hi - b->data) ||
+            (b->next && b->next <= b))
+        {
+            hd.flags |= HEAP_SNAPSHOT_TRUNCATED;
+            break;
+        }
+        batch[n].address = (uintptr_t)b;
+        batch[n].size = b->size | (b->free ? HEAP_SNAPSHOT_FREE : 0);
+        hd.count++;
+        if (++n == SNAPSHOT_BATCH)
+        {
+            if (h->fast_bytes)
+                mark_parked(h, batch, n, lo, hi);
+            if (write_all(fd, batch, sizeof(batch)) != 0)
+                return -1;
+            n = 0;
+        }
+    }
+    if (n && h->fast_bytes)
+        mark_parked(h, batch, n, lo, hi);
+    if (n && write_all(fd, batch, n * sizeof(batch[0])) != 0)
+        return -1;
+
+    return pwrite(fd, &hd, sizeof(hd), at) == (ssize_t)sizeof(hd) ? 0 : -1;
+}
+
+int heap_snapshot_file(const char* path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+
+    int status = lseek(fd, 0, SEEK_END) < 0 ? -1 : heap_snapshot(heap_default(), 0, fd);
+    close(fd);
+    return status;
+}
+
+/**
+ * @brief Manejador de la señal de heap_snapshot_on_signal(); no modifica errno del código interrumpido.
+ *
+ * @param signo Señal recibida.
+ */
+static void snapshot_handler(int signo)
+{
+    int saved = errno;
+
+    (void)signo;
+    heap_snapshot_file(signal_path);
+    errno = saved;
+}
+
+int heap_snapshot_on_signal(int signo, const char* path)
+{
+    struct sigaction sa;
+    size_t len = strlen(path);
+
+    if (len >= sizeof(signal_path))
+        return -1;
+    memcpy(signal_path, path, len + 1);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = snapshot_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(signo, &sa, NULL);
+}
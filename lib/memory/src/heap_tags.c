@@ -0,0 +1,266 @@
+#include "heap_tags.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+int heap_tags_active = 0;
+__thread int heap_tag_current = 0;
+
+/**
+ * @struct tag_counter
+ * @brief Lo que un hilo contó de una etiqueta.
+ */
+struct tag_counter
+{
+    int64_t live;    /**< Bytes asignados menos liberados por el hilo. */
+    uint64_t allocs; /**< Asignaciones. */
+    uint64_t frees;  /**< Liberaciones. */
+    int64_t pending; /**< Diferencia todavía no volcada al total de la etiqueta. */
+};
+
+/**
+ * @struct tag_thread
+ * @brief Contadores de un hilo, en líneas de caché propias.
+ */
+struct tag_thread
+{
+    struct tag_counter tags[HEAP_TAG_MAX]; /**< Un contador por etiqueta. */
+} __attribute__((aligned(HEAP_TAG_CACHE_LINE)));
+
+/**
+ * @struct tag
+ * @brief Configuración y total compartido de una etiqueta, en su propia línea de caché.
+ */
+struct tag
+{
+    char name[HEAP_TAG_NAME];   /**< Nombre. */
+    size_t budget;              /**< Presupuesto blando, 0 si no tiene. */
+    int64_t batch;              /**< Diferencia que un hilo acumula antes de volcarla. */
+    heap_tag_callback callback; /**< Aviso al superar el presupuesto. */
+    void* arg;                  /**< Argumento del callback. */
+    int64_t live;               /**< Suma de lo volcado por todos los hilos. */
+    int over;                   /**< 1 mientras el total supera el presupuesto. */
+} __attribute__((aligned(HEAP_TAG_CACHE_LINE)));
+
+/** Etiquetas creadas; la 0 no se usa. */
+static struct tag tags[HEAP_TAG_MAX];
+/** Cantidad de etiquetas creadas. */
+static int num_tags = 0;
+
+/**
+ * Contadores de los hilos, reservados con mmap. El 0 acumula lo de los hilos
+ * que terminaron y lo de los que no consiguieron uno propio, siempre con
+ * operaciones atómicas.
+ */
+static struct tag_thread* threads = NULL;
+/** 1 para cada contador de hilo en uso. */
+static int thread_used[HEAP_TAG_THREADS];
+/** Contadores del hilo actual. */
+static __thread struct tag_thread* thread_counters = NULL;
+/** Clave cuyo destructor devuelve los contadores de un hilo que termina. */
+static pthread_key_t thread_key;
+/** Protege la creación de etiquetas. */
+static pthread_mutex_t tags_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Vuelca la diferencia pendiente de un contador al total y revisa el presupuesto.
+ *
+ * @param tag Etiqueta.
+ * @param c Contador.
+ * @param shared 1 si el contador es el compartido.
+ */
+static void flush(int tag, struct tag_counter* c, int shared)
+{
+    struct tag* t = &tags[tag];
+    int64_t pending = shared ? __atomic_exchange_n(&c->pending, 0, __ATOMIC_RELAXED) : c->pending;
+    int64_t total = __atomic_add_fetch(&t->live, pending, __ATOMIC_RELAXED);
+
+    // El compartido ya quedó en cero con el intercambio: escribirlo perdería lo que otros hilos sumaron
+    if (!shared)
+        c->pending = 0;
+    if (t->budget && total > (int64_t)t->budget)
+    {
+        // Solo el hilo que hace el cruce avisa
+        if (!__atomic_exchange_n(&t->over, 1, __ATOMIC_RELAXED) && t->callback)
+            t->callback(tag, (size_t)total, t->budget, t->arg);
+    }
+    else if (t->over)
+        __atomic_store_n(&t->over, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Devuelve los contadores de un hilo que termina, sumándolos a los compartidos.
+ *
+ * @param arg Contadores del hilo.
+ */
+static void thread_exit(void* arg)
+{
+    struct tag_thread* mine = arg;
+    struct tag_counter* shared = threads->tags;
+
+    for (int i = 1; i <= num_tags; i++)
+    {
+        struct tag_counter* c = &mine->tags[i];
+        if (c->pending)
+            flush(i, c, 0);
+        __atomic_add_fetch(&shared[i].live, c->live, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shared[i].allocs, c->allocs, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shared[i].frees, c->frees, __ATOMIC_RELAXED);
+    }
+    memset(mine, 0, sizeof(*mine));
+    __atomic_store_n(&thread_used[mine - threads], 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Toma un contador libre para el hilo actual, o el compartido si no queda ninguno.
+ *
+ * @return struct tag_thread* Contadores del hilo.
+ */
+static struct tag_thread* thread_attach(void)
+{
+    for (int i = 1; i < HEAP_TAG_THREADS; i++)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&thread_used[i], &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            thread_counters = &threads[i];
+            pthread_setspecific(thread_key, thread_counters);
+            return thread_counters;
+        }
+    }
+    thread_counters = &threads[0];
+    return thread_counters;
+}
+
+void heap_tag_account(int tag, int64_t bytes, int op)
+{
+    if (tag <= 0 || tag > num_tags)
+        return;
+
+    struct tag_thread* mine = thread_counters ? thread_counters : thread_attach();
+    struct tag_counter* c = &mine->tags[tag];
+    int64_t batch = tags[tag].batch;
+
+    if (mine == threads)
+    {
+        __atomic_add_fetch(&c->live, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(op > 0 ? &c->allocs : &c->frees, op ? 1 : 0, __ATOMIC_RELAXED);
+        int64_t pending = __atomic_add_fetch(&c->pending, bytes, __ATOMIC_RELAXED);
+        if (pending >= batch || pending <= -batch)
+            flush(tag, c, 1);
+        return;
+    }
+
+    c->live += bytes;
+    if (op > 0)
+        c->allocs++;
+    else if (op < 0)
+        c->frees++;
+    c->pending += bytes;
+    if (c->pending >= batch || c->pending <= -batch)
+        flush(tag, c, 0);
+}
+
+/**
+ * @brief Lote de volcado de una etiqueta: con presupuesto, lo bastante chico para que el atraso no lo tape.
+ *
+ * @param budget Presupuesto.
+ * @return int64_t Bytes por lote.
+ */
+static int64_t batch_for(size_t budget)
+{
+    if (!budget || budget / HEAP_TAG_THREADS >= HEAP_TAG_BATCH)
+        return HEAP_TAG_BATCH;
+    return budget / HEAP_TAG_THREADS ? (int64_t)(budget / HEAP_TAG_THREADS) : 1;
+}
+
+int heap_tag_create(const char* name, size_t budget, heap_tag_callback callback, void* arg)
+{
+    int tag = -1;
+
+    pthread_mutex_lock(&tags_lock);
+    if (!threads)
+    {
+        void* p = mmap(NULL, sizeof(struct tag_thread) * HEAP_TAG_THREADS, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED && pthread_key_create(&thread_key, thread_exit) == 0)
+            threads = p;
+        else if (p != MAP_FAILED)
+            munmap(p, sizeof(struct tag_thread) * HEAP_TAG_THREADS);
+    }
+    if (threads && num_tags < HEAP_TAG_MAX - 1)
+    {
+        tag = num_tags + 1;
+        struct tag* t = &tags[tag];
+        strncpy(t->name, name ? name : "", HEAP_TAG_NAME - 1);
+        t->budget = budget;
+        t->batch = batch_for(budget);
+        t->callback = callback;
+        t->arg = arg;
+        // La etiqueta queda completa antes de que otro hilo pueda verla
+        __atomic_store_n(&num_tags, tag, __ATOMIC_RELEASE);
+        heap_tags_active = 1;
+    }
+    pthread_mutex_unlock(&tags_lock);
+    return tag;
+}
+
+int heap_tag_budget(int tag, size_t budget, heap_tag_callback callback, void* arg)
+{
+    if (tag <= 0 || tag > num_tags)
+        return -1;
+
+    struct tag* t = &tags[tag];
+    t->callback = callback;
+    t->arg = arg;
+    t->budget = budget;
+    t->batch = batch_for(budget);
+    t->over = budget && __atomic_load_n(&t->live, __ATOMIC_RELAXED) > (int64_t)budget;
+    return 0;
+}
+
+int heap_tag_set(int tag)
+{
+    int previous = heap_tag_current;
+
+    if (tag < 0 || tag > num_tags)
+        return -1;
+    heap_tag_current = tag;
+    return previous;
+}
+
+void* malloc_tagged(int tag, size_t size)
+{
+    int previous = heap_tag_current;
+
+    heap_tag_current = tag > 0 && tag <= num_tags ? tag : 0;
+    void* p = malloc(size);
+    heap_tag_current = previous;
+    return p;
+}
+
+int heap_tag_stats(int tag, heap_tag_stats_t* stats)
+{
+    if (tag <= 0 || tag > num_tags)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    // Lecturas sin sincronizar: cada contador es consistente, la suma es una foto aproximada
+    for (int i = 0; i < HEAP_TAG_THREADS; i++)
+    {
+        const struct tag_counter* c = &threads[i].tags[tag];
+        stats->live += __atomic_load_n(&c->live, __ATOMIC_RELAXED);
+        stats->allocs += __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+    }
+    stats->name = tags[tag].name;
+    stats->budget = tags[tag].budget;
+    stats->over = tags[tag].over;
+    return 0;
+}
+
+int heap_tag_count(void)
+{
+    return __atomic_load_n(&num_tags, __ATOMIC_ACQUIRE);
+}
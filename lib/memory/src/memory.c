@@ -1,75 +1,426 @@
 #include "memory.h"
+#include "heap.h"
+#include "heap_check.h"
+#include "heap_lifetime.h"
+#include "heap_map.h"
+#include "heap_populate.h"
+#include "heap_probes.h"
+#include "heap_profile.h"
+#include "heap_tags.h"
+#include "region.h"
+#include "size_classes.h"
 #include <sys/mman.h>
 
 typedef struct s_block* t_block;
 void* base = NULL;
 int method = 0;
+/** Heap por defecto: el que usan malloc, free, calloc y realloc, sobre el program break. */
+static heap_t default_heap;
 
-t_block find_block(t_block* last, size_t size)
+/**
+ * @brief Tope actual de un heap, equivalente a sbrk(0).
+ *
+ * @param h Heap.
+ * @return void* Primera dirección fuera del heap.
+ */
+static void* top_of(heap_t* h)
+{
+    return h->in_region ? (void*)h->region.top : sbrk(0);
+}
+
+/**
+ * @brief Mueve el tope de un heap en su backend.
+ *
+ * @param h Heap.
+ * @param increment Bytes a agregar.
+ * @return void* Tope anterior, o (void*)-1 si no hay memoria.
+ */
+static void* heap_sbrk(heap_t* h, intptr_t increment)
 {
-    t_block b = base;
+    return h->in_region ? region_sbrk(&h->region, increment) : sbrk(increment);
+}
 
-    if (method == FIRST_FIT)
+/**
+ * @brief Fija el tope de un heap en su backend.
+ *
+ * @param h Heap.
+ * @param addr Nuevo tope.
+ * @return int 0 si se movió el tope, -1 en caso de error.
+ */
+static int heap_brk(heap_t* h, void* addr)
+{
+    return h->in_region ? region_brk(&h->region, addr) : brk(addr);
+}
+
+/**
+ * @brief Cambia el primer bloque de un heap; el del heap por defecto también se publica en base.
+ *
+ * @param h Heap.
+ * @param b Nuevo primer bloque, NULL si el heap quedó vacío.
+ */
+static void set_base(heap_t* h, void* b)
+{
+    h->base = b;
+    if (h == &default_heap)
+        base = b;
+}
+
+/**
+ * @brief Indica si un heap es de malloc(): el por defecto o el de vida larga en el que segrega.
+ *
+ * @param h Heap.
+ * @return int 1 si el perfilador, el histograma y valid_addr() lo cubren.
+ */
+static int malloc_heap(heap_t* h)
+{
+    return h == &default_heap || (heap_lifetime_default && h == &heap_lifetime_default->long_heap);
+}
+
+void* heap_top(void)
+{
+    return top_of(&default_heap);
+}
+
+/**
+ * @brief Verifica si una dirección es el área de datos de un bloque del heap.
+ *
+ * @param h Heap.
+ * @param p Dirección a verificar.
+ * @return int 1 si la dirección es válida, 0 en caso contrario.
+ */
+static int heap_valid_addr(heap_t* h, void* p)
+{
+    if (h->base)
     {
-        while (b && !(b->free && b->size >= size))
-        {
-            *last = b;
-            b = b->next;
-        }
-        return (b);
+        if (p > h->base && p < top_of(h))
+            return (p == &((get_block(p))->data));
     }
-    else if (method == BEST_FIT)
+
+    return (0);
+}
+
+#ifdef MEMORY_POLICY
+/** Política del heap: en una variante es una constante y el compilador descarta las demás búsquedas. */
+#define POLICY(h) MEMORY_POLICY
+#else
+/** Política del heap, elegida en ejecución con heap_control. */
+#define POLICY(h) ((h)->method)
+#endif
+
+#if HEAP_FREE_INDEX
+/** Tamaño mínimo de datos de un bloque: un bloque libre guarda ahí sus enlaces de TLSF. */
+#define MIN_PAYLOAD 16
+#else
+/** Tamaño mínimo de datos de un bloque. */
+#define MIN_PAYLOAD 8
+#endif
+
+/** Marca el comienzo de un bloque en el mapa, si el heap lo tiene. */
+#define map_set(h, b, f) ((h)->map.starts ? heap_map_set(h, b, f) : (void)0)
+/** Cambia el estado de un bloque en el mapa, si el heap lo tiene. */
+#define map_free(h, b, f) ((h)->map.starts ? heap_map_free(h, b, f) : (void)0)
+/** Borra del mapa un bloque que dejó de existir, si el heap lo tiene. */
+#define map_clear(h, b) ((h)->map.starts ? heap_map_clear(h, b) : (void)0)
+
+#ifdef MEMORY_DEBUG
+/** Registra una operación en LOG_FILE. */
+#define debug_log(op, size, ptr) log_operation(op, size, ptr)
+/** Bloques que verifica el chequeo incremental en cada operación sobre el heap por defecto. */
+#define DEBUG_CHECK_STEP 16
+
+/**
+ * @brief Avanza el chequeo incremental del heap por defecto y avisa al terminar una pasada con errores.
+ *
+ * @param h Heap sobre el que se operó; los demás heaps no se verifican.
+ */
+static void debug_check(heap_t* h)
+{
+    static heap_cursor_t cursor;
+
+    if (h != &default_heap)
+        return;
+    if (heap_check_step(&cursor, DEBUG_CHECK_STEP) && cursor.report.errors)
+        fprintf(stderr, "heap check: %zu errors (kinds 0x%x), first at %p (kind 0x%x)\n", cursor.report.errors,
+                cursor.report.kinds, cursor.report.first_bad, cursor.report.first_kind);
+}
+#else
+/** Sin MEMORY_DEBUG el registro de operaciones no se compila. */
+#define debug_log(op, size, ptr) ((void)0)
+/** Sin MEMORY_DEBUG el heap no se verifica en cada operación. */
+#define debug_check(h) ((void)0)
+#endif
+
+/**
+ * @brief Tamaño real de un bloque para un pedido: alineado, redondeado a su clase si hay tabla y nunca menor que
+ * MIN_PAYLOAD.
+ *
+ * @param size Tamaño solicitado.
+ * @return size_t Tamaño del bloque, 0 si size es 0.
+ */
+static size_t fit_size(size_t size)
+{
+    size_t s = align(size);
+
+    if (size_classes_count)
+        s = size_class_round(s);
+
+    return s && s < MIN_PAYLOAD ? MIN_PAYLOAD : s;
+}
+
+/**
+ * @brief Busca el primer bloque libre de tamaño suficiente.
+ *
+ * @param h Heap.
+ * @param last Último bloque recorrido, para extender el heap si no hay lugar.
+ * @param size Tamaño solicitado.
+ * @param steps Bloques examinados; solo se cuentan con las sondas compiladas.
+ * @return t_block Bloque encontrado, o NULL si no hay ninguno.
+ */
+static t_block find_first_fit(heap_t* h, t_block* last, size_t size, unsigned* steps)
+{
+    t_block b = h->base;
+
+    while (b && !(b->free && b->size >= size))
     {
-        size_t dif = PAGESIZE;
-        t_block best = NULL;
+        probe_step(*steps);
+        *last = b;
+        b = b->next;
+    }
+    return (b);
+}
 
-        while (b)
+/**
+ * @brief Busca el bloque libre que menos espacio desperdicia.
+ *
+ * @param h Heap.
+ * @param last Último bloque recorrido, para extender el heap si no hay lugar.
+ * @param size Tamaño solicitado.
+ * @param steps Bloques examinados; solo se cuentan con las sondas compiladas.
+ * @return t_block Bloque encontrado, o NULL si no hay ninguno.
+ */
+static t_block find_best_fit(heap_t* h, t_block* last, size_t size, unsigned* steps)
+{
+    t_block b = h->base;
+    size_t dif = PAGESIZE;
+    t_block best = NULL;
+
+    while (b)
+    {
+        probe_step(*steps);
+        if (b->free)
         {
-            if (b->free)
+            if (b->size == size)
+            {
+                return b;
+            }
+            if (b->size > size && (b->size - size) < dif)
             {
-                if (b->size == size)
-                {
-                    return b;
-                }
-                if (b->size > size && (b->size - size) < dif)
-                {
-                    dif = b->size - size;
-                    best = b;
-                }
+                dif = b->size - size;
+                best = b;
             }
-            *last = b;
-            b = b->next;
         }
-        return best;
+        *last = b;
+        b = b->next;
     }
-    else if (method == WORST_FIT)
-    {
-        size_t max_size = 0;
-        t_block worst = NULL;
+    return best;
+}
 
-        while (b)
+/**
+ * @brief Busca el bloque libre más grande que alcance.
+ *
+ * @param h Heap.
+ * @param last Último bloque recorrido, para extender el heap si no hay lugar.
+ * @param size Tamaño solicitado.
+ * @param steps Bloques examinados; solo se cuentan con las sondas compiladas.
+ * @return t_block Bloque encontrado, o NULL si no hay ninguno.
+ */
+static t_block find_worst_fit(heap_t* h, t_block* last, size_t size, unsigned* steps)
+{
+    t_block b = h->base;
+    size_t max_size = 0;
+    t_block worst = NULL;
+
+    while (b)
+    {
+        probe_step(*steps);
+        if (b->free && b->size >= size && b->size > max_size)
         {
-            if (b->free && b->size >= size && b->size > max_size)
-            {
-                max_size = b->size;
-                worst = b;
-            }
-            *last = b;
-            b = b->next;
+            max_size = b->size;
+            worst = b;
         }
-        return worst;
+        *last = b;
+        b = b->next;
+    }
+    return worst;
+}
+
+#if HEAP_FREE_INDEX
+/**
+ * @brief Calcula la lista de TLSF que corresponde a un tamaño.
+ *
+ * @param size Tamaño de un bloque.
+ * @param fl Primer nivel: la potencia de dos del tamaño.
+ * @param sl Segundo nivel: la subdivisión lineal dentro de esa potencia.
+ */
+static void tlsf_mapping(size_t size, int* fl, int* sl)
+{
+    if (size < TLSF_SMALL)
+    {
+        *fl = 0;
+        *sl = (int)(size / (TLSF_SMALL / TLSF_SL_COUNT));
+        return;
+    }
+
+    int bit = 63 - __builtin_clzll(size);
+    *sl = (int)(size >> (bit - TLSF_SL_LOG)) ^ TLSF_SL_COUNT;
+    *fl = bit - TLSF_SL_LOG - 2;
+    if (*fl >= TLSF_FL_COUNT)
+    {
+        *fl = TLSF_FL_COUNT - 1;
+        *sl = TLSF_SL_COUNT - 1;
+    }
+}
+
+/**
+ * @brief Agrega un bloque libre a la cabeza de su lista.
+ *
+ * @param h Heap del bloque.
+ * @param b Bloque libre que no está en el índice.
+ */
+static void index_insert(heap_t* h, t_block b)
+{
+    int fl, sl;
+    tlsf_mapping(b->size, &fl, &sl);
+    t_block head = h->tlsf.lists[fl][sl];
+
+    links_of(b)->next = head;
+    links_of(b)->prev = NULL;
+    if (head)
+        links_of(head)->prev = b;
+    h->tlsf.lists[fl][sl] = b;
+    h->tlsf.fl_bitmap |= 1u << fl;
+    h->tlsf.sl_bitmap[fl] |= 1u << sl;
+}
+
+/**
+ * @brief Quita un bloque libre de su lista.
+ *
+ * @param h Heap del bloque.
+ * @param b Bloque libre que está en el índice.
+ */
+static void index_remove(heap_t* h, t_block b)
+{
+    int fl, sl;
+    tlsf_mapping(b->size, &fl, &sl);
+    tlsf_links* l = links_of(b);
+
+    if (l->prev)
+        links_of(l->prev)->next = l->next;
+    else
+        h->tlsf.lists[fl][sl] = l->next;
+    if (l->next)
+        links_of(l->next)->prev = l->prev;
+
+    if (!h->tlsf.lists[fl][sl])
+    {
+        h->tlsf.sl_bitmap[fl] &= ~(1u << sl);
+        if (!h->tlsf.sl_bitmap[fl])
+            h->tlsf.fl_bitmap &= ~(1u << fl);
+    }
+}
+
+/** Anota el último bloque del heap, que TLSF no puede encontrar recorriendo la lista. */
+#define set_last(h, b) ((h)->tlsf.last = (b))
+
+/**
+ * @brief Busca en el índice un bloque libre de tamaño suficiente en tiempo constante.
+ *
+ * El pedido se redondea al comienzo de la clase siguiente, así cualquier
+ * bloque de la primera lista no vacía alcanza sin recorrerla.
+ *
+ * @param h Heap.
+ * @param last Recibe el último bloque del heap, para extenderlo si no hay lugar.
+ * @param size Tamaño solicitado.
+ * @param steps Bloques examinados en la lista elegida; solo se cuentan con las sondas compiladas.
+ * @return t_block Bloque encontrado, todavía en el índice, o NULL si no hay ninguno.
+ */
+static t_block find_tlsf(heap_t* h, t_block* last, size_t size, unsigned* steps)
+{
+    size_t rounded = size;
+    int fl, sl;
+
+    *last = h->tlsf.last;
+    if (size >= TLSF_SMALL)
+        rounded += ((size_t)1 << (63 - __builtin_clzll(size) - TLSF_SL_LOG)) - 1;
+    tlsf_mapping(rounded, &fl, &sl);
+
+    unsigned sl_map = h->tlsf.sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map)
+    {
+        unsigned fl_map = fl + 1 < TLSF_FL_COUNT ? h->tlsf.fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (!fl_map)
+            return NULL;
+        fl = __builtin_ctz(fl_map);
+        sl_map = h->tlsf.sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+
+    // Solo la última lista mezcla tamaños que pueden no alcanzar
+    t_block b = h->tlsf.lists[fl][sl];
+    probe_step(*steps);
+    while (b && b->size < size)
+    {
+        probe_step(*steps);
+        b = links_of(b)->next;
+    }
+    return b;
+}
+#else
+/** Sin índice de bloques libres no hay nada que agregar. */
+#define index_insert(h, b) ((void)0)
+/** Sin índice de bloques libres no hay nada que quitar. */
+#define index_remove(h, b) ((void)0)
+/** Sin índice no hace falta recordar el último bloque: las búsquedas recorren la lista. */
+#define set_last(h, b) ((void)0)
+#endif
+
+/**
+ * @brief Busca un bloque libre según la política del heap.
+ *
+ * En una variante POLICY es constante y solo queda la llamada a su búsqueda.
+ *
+ * @param h Heap.
+ * @param last Último bloque recorrido, para extender el heap si no hay lugar.
+ * @param size Tamaño solicitado.
+ * @param steps Largo de la búsqueda, para las sondas find_hit y find_miss.
+ * @return t_block Bloque encontrado, o NULL si no hay ninguno.
+ */
+static inline t_block heap_find_block(heap_t* h, t_block* last, size_t size, unsigned* steps)
+{
+#if !HEAP_FREE_INDEX
+    // Con el mapa la búsqueda no lee encabezados; TLSF ya busca en su índice
+    if (h->map.starts)
+        return heap_map_find(h, last, size, steps);
+#endif
+    switch (POLICY(h))
+    {
+    case FIRST_FIT:
+        return find_first_fit(h, last, size, steps);
+    case BEST_FIT:
+        return find_best_fit(h, last, size, steps);
+    case WORST_FIT:
+        return find_worst_fit(h, last, size, steps);
+#if HEAP_FREE_INDEX
+    case TLSF:
+        return find_tlsf(h, last, size, steps);
+#endif
     }
     return NULL;
 }
 
 void copy_block(t_block src, t_block dst)
 {
-    int *sdata, *ddata;
-    size_t i;
-    sdata = src->ptr;
-    ddata = dst->ptr;
-    for (i = 0; i * 4 < src->size && i * 4 < dst->size; i++)
-        ddata[i] = sdata[i];
+    memcpy(dst->ptr, src->ptr, src->size < dst->size ? src->size : dst->size);
 }
 
 t_block get_block(void* p)
@@ -80,17 +431,27 @@ t_block get_block(void* p)
     return (t_block)(tmp -= BLOCK_SIZE);
 }
 
-int valid_addr(void* p)
+t_block find_block(t_block* last, size_t size)
 {
-    if (base)
-    {
-        if (p > base && p < sbrk(0))
-            return (p == &((get_block(p))->data));
-    }
+    unsigned steps = 0;
 
-    return (0);
+    return heap_find_block(&default_heap, last, size, &steps);
+}
+
+int valid_addr(void* p)
+{
+    return heap_valid_addr(&default_heap, p) ||
+           (heap_lifetime_default && heap_valid_addr(&heap_lifetime_default->long_heap, p));
 }
 
+/**
+ * Impide que el compilador mueva escrituras de encabezados de un lado al otro.
+ * El tamaño de un bloque es lo que confirma un cambio: heap_rebuild() recorre
+ * los bloques por tamaño, así que un encabezado nuevo tiene que estar completo
+ * antes de que un tamaño lo alcance.
+ */
+#define commit_barrier() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+
 void split_block(t_block b, size_t s)
 {
     t_block new;
@@ -99,18 +460,35 @@ void split_block(t_block b, size_t s)
     new->next = b->next;
     new->prev = b;
     new->free = 1;
+    new->magic = block_cookie(new);
     new->ptr = new->data;
+    commit_barrier();
     b->size = s;
     b->next = new;
 
     if (new->next)
         new->next->prev = new;
+    HEAP_PROBE3(split, b, s, new->size);
 }
 
-t_block fusion(t_block b)
+/**
+ * @brief Fusiona un bloque con los siguientes libres y devuelve al sistema una cola libre.
+ *
+ * El bloque recibido no puede estar en el índice de libres; si queda libre y
+ * no se devolvió, se agrega.
+ *
+ * @param h Heap del bloque.
+ * @param b Bloque a fusionar.
+ * @return t_block Bloque fusionado.
+ */
+static t_block heap_fusion(heap_t* h, t_block b)
 {
     while (b->next && b->next->free)
     {
+        HEAP_PROBE4(fusion, h, b, b->next, b->next->size);
+        h->counters.fusions++;
+        index_remove(h, b->next);
+        map_clear(h, b->next);
         b->size += BLOCK_SIZE + b->next->size;
         b->next = b->next->next;
         if (b->next)
@@ -119,26 +497,49 @@ t_block fusion(t_block b)
         }
     }
     if (!b->next)
+        set_last(h, b);
+    /* Only a free tail can be returned to the system, realloc fuses blocks in use */
+    if (!b->next && b->free)
     {
+        HEAP_PROBE3(shrink, h, b, BLOCK_SIZE + b->size);
+        h->counters.shrinks++;
         if (b->prev)
             b->prev->next = NULL;
         else
-            base = NULL;
-        brk(b);
+            set_base(h, NULL);
+        set_last(h, b->prev);
+        map_clear(h, b);
+        heap_brk(h, b);
     }
+    else if (b->free)
+        index_insert(h, b);
     return b;
 }
 
-t_block extend_heap(t_block last, size_t s)
+t_block fusion(t_block b)
+{
+    return heap_fusion(&default_heap, b);
+}
+
+/**
+ * @brief Expande un heap con un bloque nuevo al final.
+ *
+ * @param h Heap.
+ * @param last Último bloque del heap.
+ * @param s Tamaño del nuevo bloque.
+ * @return t_block Bloque creado, o NULL si no hay memoria.
+ */
+static t_block heap_extend(heap_t* h, t_block last, size_t s)
 {
     t_block b;
 
-    b = sbrk(0);
+    b = top_of(h);
 
-    if (sbrk(BLOCK_SIZE + (long int)s) == (void*)-1)
+    if (heap_sbrk(h, BLOCK_SIZE + (long int)s) == (void*)-1)
         return (NULL);
 
     b->ptr = b->data;
+    b->magic = block_cookie(b);
     b->size = s;
     b->prev = last;
     b->next = NULL;
@@ -147,17 +548,27 @@ t_block extend_heap(t_block last, size_t s)
         last->next = b;
 
     b->free = 0;
+    map_set(h, b, 0);
+    set_last(h, b);
+    h->counters.extends++;
+    HEAP_PROBE3(extend, h, b, s);
     return (b);
 }
 
+t_block extend_heap(t_block last, size_t s)
+{
+    return heap_extend(&default_heap, last, s);
+}
+
 void get_method(int m)
 {
     method = m;
+    default_heap.method = m;
 }
 
 void malloc_control(int m)
 {
-    if (m == FIRST_FIT || m == BEST_FIT || m == WORST_FIT)
+    if (heap_control(&default_heap, m) == 0)
     {
         method = m;
     }
@@ -167,138 +578,565 @@ void malloc_control(int m)
     }
 }
 
-void* malloc(size_t size)
+int heap_control(heap_t* h, int policy)
 {
-    t_block b;
-    t_block last;
-    size_t s;
+#ifdef MEMORY_POLICY
+    // La variante solo tiene compilada la búsqueda de su política
+    if (policy != MEMORY_POLICY)
+        return -1;
+#else
+    if (policy != FIRST_FIT && policy != BEST_FIT && policy != WORST_FIT)
+        return -1;
+#endif
+    h->method = policy;
+    return 0;
+}
 
-    s = align(size);
+int heap_init(heap_t* h, void* buffer, size_t size)
+{
+    memset(h, 0, sizeof(*h));
+#ifdef MEMORY_POLICY
+    h->method = MEMORY_POLICY;
+#else
+    h->method = FIRST_FIT;
+#endif
 
-    if (!s)
+    if (buffer)
+    {
+        // Los bloques tienen que quedar alineados a 8 bytes como los del program break
+        char* start = (char*)align((uintptr_t)buffer);
+        char* end = (char*)(((uintptr_t)buffer + size) & ~(uintptr_t)7);
+        if (end <= start || (size_t)(end - start) < BLOCK_SIZE + 8)
+            return -1;
+        region_wrap(&h->region, start, (size_t)(end - start));
+    }
+    else if (region_reserve(&h->region, size, HEAP_CHUNK, 0) != 0)
+        return -1;
+
+    h->in_region = 1;
+    return 0;
+}
+
+void heap_destroy(heap_t* h)
+{
+    // El heap por defecto vive en el program break y no se puede desarmar
+    if (h == &default_heap)
+        return;
+    // Los bloques que siguen vivos dejan de contar para su etiqueta
+    for (t_block b = heap_tags_active ? h->base : NULL; b; b = b->next)
+    {
+        if (!b->free && b->tag)
+            heap_tag_account(b->tag, -(int64_t)b->size, -1);
+    }
+    heap_map(h, 0);
+    if (h->in_region)
+        region_unmap(&h->region);
+    memset(h, 0, sizeof(*h));
+}
+
+heap_t* heap_default(void)
+{
+    return &default_heap;
+}
+
+/**
+ * @brief Saca un bloque del fast bin de su tamaño.
+ *
+ * @param h Heap.
+ * @param s Tamaño del bloque, ya ajustado con fit_size.
+ * @return t_block Último bloque estacionado de ese tamaño, o NULL si el bin está vacío o apagado.
+ */
+static t_block fastbin_pop(heap_t* h, size_t s)
+{
+    t_block b;
+
+    if (s > h->fast_max || !(b = h->fastbins[s >> 3]))
         return NULL;
+    h->fastbins[s >> 3] = fast_next(b);
+    h->fast_bytes -= s;
+    return b;
+}
+
+/**
+ * @brief Busca un bloque libre con la política del heap y lo parte, o extiende el heap si ninguno alcanza.
+ *
+ * @param h Heap.
+ * @param s Tamaño del bloque, ya ajustado con fit_size.
+ * @return t_block Bloque ocupado, o NULL si el heap no puede crecer.
+ */
+static t_block heap_place(heap_t* h, size_t s)
+{
+    t_block b;
+    t_block last;
+    unsigned steps = 0;
 
-    if (base)
+    if (!h->base)
     {
-        /* First find a block */
-        last = base;
-        b = find_block(&last, s);
+        /* First time */
+        b = heap_extend(h, NULL, s);
         if (b)
-        {
-            /* Can we split */
-            if ((b->size - s) >= (BLOCK_SIZE + 4))
-                split_block(b, s);
+            set_base(h, b);
+        return b;
+    }
 
-            b->free = 0;
-        }
-        else
+    /* First find a block */
+    last = h->base;
+    b = heap_find_block(h, &last, s, &steps);
+    if (b)
+    {
+        HEAP_PROBE4(find_hit, h, s, b, steps);
+        index_remove(h, b);
+        /* Can we split */
+        if ((b->size - s) >= (BLOCK_SIZE + MIN_PAYLOAD))
         {
-            /* No fitting block, extend the heap */
-            b = extend_heap(last, s);
-            if (!b)
-                return NULL;
+            split_block(b, s);
+            map_set(h, b->next, 1);
+            index_insert(h, b->next);
+            if (!b->next->next)
+                set_last(h, b->next);
         }
+
+        b->free = 0;
+        map_free(h, b, 0);
+        return b;
     }
-    else
+
+    // Antes de crecer por un pedido que los fast bins no atienden, se fusiona lo estacionado
+    if (s > h->fast_max && h->fast_bytes)
     {
-        /* First time */
-        b = extend_heap(NULL, s);
-        if (!b)
-            return NULL;
-        base = b;
+        heap_consolidate(h);
+        return heap_place(h, s);
     }
 
-    // log_operation("malloc", size, b->data);
+    HEAP_PROBE3(find_miss, h, s, steps);
+    /* No fitting block, extend the heap */
+    return heap_extend(h, last, s);
+}
+
+void* heap_malloc_from(heap_t* h, size_t size, const void* site)
+{
+    t_block b;
+    size_t s;
+
+    s = fit_size(size);
+
+    if (!s)
+        return NULL;
+
+    if (size_hist_active && malloc_heap(h))
+        size_hist_record(size);
+
+    b = fastbin_pop(h, s);
+    if (!b)
+        b = heap_place(h, s);
+    // Sin memoria para crecer, los bloques estacionados pueden alcanzar una vez fusionados
+    if (!b && h->fast_bytes)
+    {
+        heap_consolidate(h);
+        b = heap_place(h, s);
+    }
+    if (!b)
+        return NULL;
+
+    // Sin etiquetas creadas no se lee la del hilo
+    b->tag = heap_tags_active ? (unsigned short)heap_tag_current : 0;
+    if (b->tag)
+        heap_tag_account(b->tag, (int64_t)b->size, 1);
+
+    // El perfilador solo mide los heaps de malloc(): sus tablas no son de un heap en particular
+    if (heap_profile_active && malloc_heap(h) && (heap_profile_countdown -= (int64_t)size) <= 0)
+        heap_profile_malloc(b->data, size, site);
+
+    debug_check(h);
+    debug_log("malloc", size, b->data);
     return b->data;
 }
 
-void free(void* p)
+/* Los puntos de entrada no se inlinean: su dirección de retorno es el sitio de la asignación */
+__attribute__((noinline)) void* heap_malloc(heap_t* h, size_t size)
+{
+    return heap_malloc_from(h, size, __builtin_return_address(0));
+}
+
+__attribute__((noinline)) void* malloc(size_t size)
+{
+    if (heap_lifetime_default)
+        return heap_lifetime_malloc(heap_lifetime_default, size, __builtin_return_address(0));
+    return heap_malloc_from(&default_heap, size, __builtin_return_address(0));
+}
+
+/**
+ * @brief Libera un bloque ocupado: lo fusiona con sus vecinos libres y devuelve la cola libre al sistema.
+ *
+ * @param h Heap del bloque.
+ * @param b Bloque ocupado; si termina el heap deja de ser válido.
+ */
+static void heap_release(heap_t* h, t_block b)
+{
+    b->free = 1;
+    map_free(h, b, 1);
+    if (b->prev && b->prev->free)
+    {
+        // fusion quita del índice los libres que absorbe, así que el liberado tiene que estar
+        index_insert(h, b);
+        b = b->prev;
+        index_remove(h, b);
+    }
+    /* fusion() also returns the block to the system when it ends the heap,
+       so b must not be touched afterwards */
+    heap_fusion(h, b);
+}
+
+void heap_free(heap_t* h, void* p)
 {
     t_block b;
-    if (valid_addr(p))
+    if (heap_valid_addr(h, p))
     {
+        if (heap_profile_sampled && malloc_heap(h))
+            heap_profile_free(p);
+
         b = get_block(p);
-        b->free = 1;
-        if (b->prev && b->prev->free)
+#ifdef MEMORY_DEBUG
+        // Un bloque estacionado sigue ocupado: solo se detecta liberarlo dos veces seguidas
+        if (b->magic != block_cookie(b) || b->free || (b->size <= h->fast_max && h->fastbins[b->size >> 3] == b))
         {
-            b = fusion(b->prev);
+            fprintf(stderr, "free(%p): corrupted header or double free\n", p);
+            return;
         }
-        if (b->next)
+#endif
+        // Un bloque estacionado sigue ocupado, pero ya no es de nadie
+        if (b->tag)
+            heap_tag_account(b->tag, -(int64_t)b->size, -1);
+        b->tag = 0;
+        if (b->size <= h->fast_max)
         {
-            fusion(b);
+            fast_next(b) = h->fastbins[b->size >> 3];
+            h->fastbins[b->size >> 3] = b;
+            h->fast_bytes += b->size;
+            if (h->fast_bytes > HEAP_FASTBIN_THRESHOLD)
+                heap_consolidate(h);
         }
         else
+            heap_release(h, b);
+        debug_check(h);
+        debug_log("free", 0, p);
+    }
+}
+
+void heap_consolidate(heap_t* h)
+{
+    if (!h->fast_bytes)
+        return;
+
+    h->counters.consolidations++;
+    for (int i = 0; i < HEAP_FASTBIN_COUNT; i++)
+    {
+        t_block b = h->fastbins[i];
+        h->fastbins[i] = NULL;
+        while (b)
         {
-            if (b->prev)
-                b->prev->next = NULL;
-            else
-                base = NULL;
-            brk(b);
+            // El enlace se lee antes: al liberarse, el bloque puede quedar absorbido o fuera del heap
+            t_block next = fast_next(b);
+            heap_release(h, b);
+            b = next;
         }
-        // log_operation("free", 0, p);
     }
+    h->fast_bytes = 0;
+}
+
+int heap_fastbins(heap_t* h, size_t max)
+{
+    if (max > HEAP_FASTBIN_MAX)
+        return -1;
+
+    // Lo estacionado con el límite anterior vuelve a la lista de libres
+    heap_consolidate(h);
+    h->fast_max = max ? align(max) : 0;
+    return 0;
+}
+
+int malloc_fastbins(size_t max)
+{
+    return heap_fastbins(&default_heap, max);
+}
+
+void free(void* p)
+{
+    if (heap_lifetime_default)
+        heap_lifetime_free(heap_lifetime_default, p);
+    else
+        heap_free(&default_heap, p);
+}
+
+/**
+ * @brief Pone en cero el área de un calloc, repartiéndola entre hilos si calloc_populate está activo y es grande.
+ *
+ * @param ptr Área de datos.
+ * @param size Bytes a poner en cero.
+ */
+static void zero_fill(void* ptr, size_t size)
+{
+    if (heap_calloc_threads > 1 && size >= 2 * (size_t)HEAP_POPULATE_MIN)
+        heap_populate(ptr, size, heap_calloc_threads, HEAP_POPULATE_ZERO);
+    else
+        memset(ptr, 0, size);
 }
 
-void* calloc(size_t number, size_t size)
+/**
+ * @brief Asigna un bloque inicializado en cero a nombre de un sitio de llamada.
+ *
+ * @param h Heap.
+ * @param total_size Tamaño en bytes.
+ * @param site Dirección de retorno del llamador del punto de entrada.
+ * @return void* Área de datos, o NULL si el heap no tiene lugar.
+ */
+static void* heap_calloc_from(heap_t* h, size_t total_size, const void* site)
 {
-    size_t total_size = number * size;
-    void* ptr = malloc(total_size);
+    void* ptr = heap_malloc_from(h, total_size, site);
     if (ptr)
     {
-        memset(ptr, 0, total_size);
-        // log_operation("calloc", total_size, ptr);
+        zero_fill(ptr, total_size);
+        debug_log("calloc", total_size, ptr);
     }
     return ptr;
 }
 
-void* realloc(void* p, size_t size)
+__attribute__((noinline)) void* heap_calloc(heap_t* h, size_t number, size_t size)
 {
-    size_t s;
-    t_block b, new;
+    return heap_calloc_from(h, number * size, __builtin_return_address(0));
+}
+
+__attribute__((noinline)) void* calloc(size_t number, size_t size)
+{
+    if (heap_lifetime_default)
+    {
+        void* ptr = heap_lifetime_malloc(heap_lifetime_default, number * size, __builtin_return_address(0));
+        if (ptr)
+            zero_fill(ptr, number * size);
+        return ptr;
+    }
+    return heap_calloc_from(&default_heap, number * size, __builtin_return_address(0));
+}
+
+/**
+ * @brief Agranda en el lugar el último bloque del heap pidiendo solo los bytes que faltan.
+ *
+ * @param h Heap del bloque.
+ * @param b Último bloque del heap.
+ * @param s Nuevo tamaño del bloque.
+ * @return int 1 si el bloque creció, 0 si el heap no se pudo extender.
+ */
+static int grow_tail(heap_t* h, t_block b, size_t s)
+{
+    // Alguien más movió el break: el bloque ya no termina en el tope del heap
+    if (top_of(h) != (void*)(b->data + b->size))
+        return 0;
+    if (heap_sbrk(h, (intptr_t)(s - b->size)) == (void*)-1)
+        return 0;
+    h->counters.extends++;
+    b->size = s;
+    return 1;
+}
+
+/**
+ * @brief Absorbe el bloque libre anterior y mueve los datos al comienzo.
+ *
+ * @param b Bloque en uso cuyo anterior está libre.
+ * @return t_block Bloque resultante, que empieza donde empezaba el anterior.
+ */
+static t_block absorb_prev(t_block b)
+{
+    t_block prev = b->prev;
+    size_t used = b->size;
+
+    // Ocupado antes de crecer: un corte en el medio pierde el bloque libre, no los datos de b
+    prev->free = 0;
+    commit_barrier();
+    prev->size += BLOCK_SIZE + b->size;
+    prev->next = b->next;
+    if (prev->next)
+        prev->next->prev = prev;
+
+    // Las regiones se superponen: el encabezado de b queda pisado por los datos
+    memmove(prev->data, b->data, used);
+    return prev;
+}
+
+void realloc_growth_hint(unsigned percent)
+{
+    default_heap.growth_hint = percent;
+}
+
+int malloc_hugepages(int enable)
+{
+    heap_t* h = &default_heap;
+
+    // Los bloques de ambos backends no pueden convivir en la misma lista
+    if (h->base)
+        return -1;
+
+    if (!enable)
+    {
+        heap_map(h, 0);
+        if (h->in_region)
+            region_unmap(&h->region);
+        h->in_region = 0;
+        return 0;
+    }
+
+    if (!h->in_region)
+    {
+        if (region_reserve(&h->region, HUGEPAGE_RESERVE, HUGEPAGE_SIZE, REGION_HUGEPAGES) != 0)
+            return -1;
+        h->in_region = 1;
+    }
+    return h->region.hugepages;
+}
+
+/**
+ * @brief Activa el modo huge pages antes de main() si HEAP_HUGEPAGES vale 1.
+ */
+__attribute__((constructor)) static void hugepages_from_env(void)
+{
+    const char* value = HEAP_HUGEPAGES;
+
+    if (value && strcmp(value, "1") == 0)
+        malloc_hugepages(1);
+}
+
+/**
+ * @brief Activa los fast bins del heap por defecto antes de main() si HEAP_FASTBINS tiene un tamaño.
+ */
+__attribute__((constructor)) static void fastbins_from_env(void)
+{
+    const char* value = HEAP_FASTBINS;
+
+    if (value)
+        malloc_fastbins(strtoul(value, NULL, 0));
+}
+
+/**
+ * @brief Cambia la etiqueta de un bloque ocupado, pasando sus bytes de una a otra.
+ *
+ * @param b Bloque ocupado.
+ * @param tag Etiqueta nueva, 0 para ninguna.
+ */
+static void retag(t_block b, unsigned short tag)
+{
+    if (b->tag)
+        heap_tag_account(b->tag, -(int64_t)b->size, -1);
+    b->tag = tag;
+    if (tag)
+        heap_tag_account(tag, (int64_t)b->size, 1);
+}
+
+void* heap_realloc_from(heap_t* h, void* p, size_t size, const void* site)
+{
+    size_t s, want, old;
+    unsigned short tag;
+    t_block b;
     void* newp;
 
     if (!p)
-        return malloc(size);
+        return heap_malloc_from(h, size, site);
+    // Achicar a 0 bytes dejaría el encabezado del resto justo en p: se libera, como en glibc
+    if (!size)
+    {
+        heap_free(h, p);
+        return NULL;
+    }
 
-    if (valid_addr(p))
+    if (heap_valid_addr(h, p))
     {
-        s = align(size);
+        s = fit_size(size);
+        // Con sobre-reserva, un bloque que crece pide más de lo necesario para el próximo realloc
+        want = h->growth_hint ? align(s + s * h->growth_hint / 100) : s;
         b = get_block(p);
-        if (b->size >= s)
+        tag = b->tag;
+        old = b->size;
+        if (b->size < s)
         {
-            if (b->size - s >= (BLOCK_SIZE + 4))
-                split_block(b, s);
-        }
-        else
-        {
-            // Fusionamos con el siguiente si es posible
-            if (b->next && b->next->free && (b->size + BLOCK_SIZE + b->next->size) >= s)
+            // Fusionamos con los siguientes si están libres
+            if (b->next && b->next->free)
+                heap_fusion(h, b);
+
+            if (b->size >= s)
             {
-                fusion(b);
-                if (b->size - s >= (BLOCK_SIZE + 4))
-                    split_block(b, s);
+                // El bloque ya alcanza
+            }
+            else if (!b->next && grow_tail(h, b, want))
+            {
+                // Era el último bloque: solo se extendió el heap, sin copiar
+            }
+            else if (b->prev && b->prev->free && b->prev->size + BLOCK_SIZE + b->size >= s)
+            {
+                index_remove(h, b->prev);
+                map_clear(h, b);
+                b = absorb_prev(b);
+                map_free(h, b, 0);
+                h->counters.fusions++;
+                if (!b->next)
+                    set_last(h, b);
             }
             else
             {
                 // No hay bloques libres de espacio suficiente, malloc y luego free
-                newp = malloc(s);
+                newp = heap_malloc_from(h, want, site);
                 if (!newp)
                     return NULL;
-                new = get_block(newp);
+                // El bloque nuevo es del mismo subsistema que el viejo, no del hilo que lo mueve
+                if (get_block(newp)->tag != tag)
+                    retag(get_block(newp), tag);
                 // Copiamos los datos
-                copy_block(b, new);
+                copy_block(b, get_block(newp));
                 // Liberamos el bloque anterior
-                free(p);
-                // log_operation("realloc", size, newp);
+                heap_free(h, p);
+                debug_log("realloc", size, newp);
                 return (newp);
             }
         }
-        // log_operation("realloc", size, p);
-        return (p);
+
+        /* Un bloque que creció conserva la sobre-reserva; uno que se achica devuelve el resto */
+        if (b->size >= want && b->size - want >= (BLOCK_SIZE + MIN_PAYLOAD))
+        {
+            split_block(b, want);
+            map_set(h, b->next, 1);
+            heap_fusion(h, b->next);
+        }
+
+        // absorb_prev movió el encabezado: la etiqueta viaja con los datos
+        b->tag = tag;
+        if (tag && b->size != old)
+            heap_tag_account(tag, (int64_t)b->size - (int64_t)old, 0);
+
+        /* El bloque cambió de tamaño en el lugar: para el perfilador es una nueva asignación */
+        if (malloc_heap(h))
+        {
+            if (heap_profile_sampled)
+                heap_profile_free(p);
+            if (heap_profile_active && (heap_profile_countdown -= (int64_t)size) <= 0)
+                heap_profile_malloc(b->data, size, site);
+        }
+
+        debug_check(h);
+        debug_log("realloc", size, b->data);
+        return b->data;
     }
     return NULL;
 }
 
+__attribute__((noinline)) void* heap_realloc(heap_t* h, void* p, size_t size)
+{
+    return heap_realloc_from(h, p, size, __builtin_return_address(0));
+}
+
+__attribute__((noinline)) void* realloc(void* p, size_t size)
+{
+    if (heap_lifetime_default)
+        return heap_lifetime_realloc(heap_lifetime_default, p, size, __builtin_return_address(0));
+    return heap_realloc_from(&default_heap, p, size, __builtin_return_address(0));
+}
+
 void check_heap(void* data)
 {
     if (data == NULL)
@@ -348,47 +1186,139 @@ void check_heap(void* data)
         printf("Data address: NULL\n");
     }
 
-    printf("Heap address: %p\n", sbrk(0));
+    printf("Heap address: %p\n", heap_top());
 
     // Checks adicionales para detectar inconsistencias
-    t_block current = base;
-    while (current)
+    heap_report_t report;
+    if (heap_check(&report) != 0)
     {
-        // Verificamos que los bloques libres adyacentes estén fusionados
-        if (current->free && current->next && current->next->free)
-        {
-            printf("\033[1;31mInconsistency detected: Adjacent free blocks not used at %p and %p\033[0m\n",
-                   (void*)current, (void*)(current->next));
-        }
+        printf("\033[1;31mInconsistency detected: %zu errors (kinds 0x%x), first at %p (kind 0x%x)\033[0m\n",
+               report.errors, report.kinds, report.first_bad, report.first_kind);
+    }
+}
 
-        // Verificamos que el tamaño del bloque sea válido
-        if (current->size <= 0)
+/**
+ * @brief Libera los bloques que quedaron estacionados en los fast bins de un heap reconstruido.
+ *
+ * Las pilas son del mapeo anterior y un proceso que murió pudo dejarlas a
+ * medio escribir: cada enlace se reubica y se sigue solo mientras lleve a un
+ * bloque ocupado de la lista reconstruida, con el tamaño de su pila. Un
+ * bloque liberado deja de estar ocupado, así que un ciclo se corta solo.
+ *
+ * @param h Heap con la lista y el índice ya reconstruidos.
+ * @param heads Pilas de los fast bins tal como quedaron en el heap.
+ * @param moved Bytes que se movió la región desde que se escribieron los enlaces.
+ * @return int 1 si se liberó algún bloque.
+ */
+static int release_parked(heap_t* h, t_block* heads, ptrdiff_t moved)
+{
+    int released = 0;
+
+    for (int i = 0; i < HEAP_FASTBIN_COUNT; i++)
+    {
+        t_block b = heads[i] ? (t_block)((char*)heads[i] + moved) : NULL;
+        while (b && (char*)b >= h->region.start && (char*)b + BLOCK_SIZE <= h->region.top && !((uintptr_t)b & 7) &&
+               b->magic == block_cookie(b) && !b->free && b->size >> 3 == (size_t)i &&
+               (b->prev ? b->prev < b && (char*)b->prev >= h->region.start && b->prev->next == b : b == h->base))
         {
-            printf("\033[1;31mInconsistency detected: Invalid block size at %p\033[0m\n", (void*)current);
+            // El enlace se lee antes: al liberarse, el bloque puede quedar absorbido o fuera del heap
+            t_block next = fast_next(b) ? (t_block)((char*)fast_next(b) + moved) : NULL;
+            heap_release(h, b);
+            released = 1;
+            b = next;
         }
-
-        current = current->next;
     }
+    return released;
 }
 
-void memory_usage(size_t* allocated, size_t* free)
+int heap_rebuild(heap_t* h, ptrdiff_t moved)
 {
-    t_block b = base;
-    *allocated = 0;
-    *free = 0;
+    t_block parked[HEAP_FASTBIN_COUNT];
+    t_block prev = NULL;
+    t_block b;
+    int repaired = 0;
 
-    while (b)
+    if (!h->in_region)
+        return -1;
+
+    memset(&h->tlsf, 0, sizeof(h->tlsf));
+    // Los bloques estacionados siguen ocupados en sus encabezados: se liberan con la lista ya armada
+    memcpy(parked, h->fastbins, sizeof(parked));
+    memset(h->fastbins, 0, sizeof(h->fastbins));
+    h->fast_bytes = 0;
+    set_base(h, NULL);
+    for (b = (t_block)h->region.start; (char*)b < h->region.top; b = (t_block)(b->data + b->size))
     {
-        if (b->free)
+        // Un encabezado que no se terminó de escribir corta el heap ahí
+        if ((char*)b + BLOCK_SIZE > h->region.top || b->magic != block_cookie((char*)b - moved) || (b->size & 7) ||
+            b->size > (size_t)(h->region.top - b->data) || (b->free != 0 && b->free != 1))
         {
-            *free += b->size;
+            repaired = 1;
+            break;
         }
-        else
+        b->magic = block_cookie(b);
+        b->ptr = b->data;
+        // Las etiquetas son del proceso que las creó
+        b->tag = 0;
+
+        // Un free interrumpido antes de fusionar
+        if (prev && prev->free && b->free)
         {
-            *allocated += b->size;
+            prev->size += BLOCK_SIZE + b->size;
+            b = prev;
+            repaired = 1;
+            continue;
         }
-        b = b->next;
+        b->prev = prev;
+        b->next = NULL;
+        if (prev)
+            prev->next = b;
+        else
+            set_base(h, b);
+        prev = b;
+    }
+    if ((char*)b != h->region.top)
+        heap_brk(h, b);
+
+    // La cola libre vuelve al sistema, como en heap_fusion()
+    if (prev && prev->free)
+    {
+        if (prev->prev)
+            prev->prev->next = NULL;
+        else
+            set_base(h, NULL);
+        heap_brk(h, prev);
+        prev = prev->prev;
+    }
+    set_last(h, prev);
+    for (b = h->base; b; b = b->next)
+    {
+        if (b->free)
+            index_insert(h, b);
     }
+    if (release_parked(h, parked, moved))
+        repaired = 1;
+    if (h->map.starts)
+        heap_map(h, 1);
+    return repaired;
+}
+
+void heap_usage(heap_t* h, size_t* allocated, size_t* free)
+{
+    heap_blocks_t blocks;
+
+    // Con el mapa no se lee ningún encabezado
+    heap_blocks(h, &blocks);
+    *allocated = blocks.used_bytes;
+    *free = blocks.free_bytes;
+    // Los estacionados en los fast bins figuran ocupados en la lista pero están libres
+    *allocated -= h->fast_bytes;
+    *free += h->fast_bytes;
+}
+
+void memory_usage(size_t* allocated, size_t* free)
+{
+    heap_usage(&default_heap, allocated, free);
 }
 
 void log_operation(const char* operation, size_t size, void* ptr)
@@ -422,7 +1352,7 @@ void log_operation(const char* operation, size_t size, void* ptr)
 
 void clear_all_blocks()
 {
-    t_block b = base;
+    t_block b = default_heap.base;
     t_block next;
 
     while (b)
@@ -432,5 +1362,10 @@ void clear_all_blocks()
         b = next;
     }
 
-    base = NULL; // Reinicia la base
+    set_base(&default_heap, NULL); // Reinicia la base
+    memset(&default_heap.tlsf, 0, sizeof(default_heap.tlsf));
+    memset(default_heap.fastbins, 0, sizeof(default_heap.fastbins));
+    default_heap.fast_bytes = 0;
+    if (default_heap.map.starts)
+        heap_map(&default_heap, 1);
 }
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include "heap_map.h"
+#include "pheap.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Encabezado al comienzo del archivo; el heap ocupa el resto desde la página siguiente.
+ */
+typedef struct
+{
+    uint64_t magic;   /**< PHEAP_MAGIC. */
+    uint32_t version; /**< PHEAP_VERSION. */
+    uint32_t dirty;   /**< 1 mientras un proceso tiene el heap abierto. */
+    uint64_t size;    /**< Tamaño del archivo y del mapeo. */
+    uint64_t address; /**< Dirección del mapeo para la que valen los enlaces de los bloques. */
+    uint64_t root;    /**< Offset del objeto raíz, 0 si no hay. */
+    int fd;           /**< Descriptor del archivo en el proceso que lo tiene abierto. */
+    heap_t heap;      /**< Estado del heap. */
+} pheap_header;
+
+/**
+ * @brief Encabezado de un heap persistente a partir de su heap_t.
+ *
+ * @param h Heap devuelto por pheap_open.
+ * @return pheap_header* Comienzo del mapeo.
+ */
+static pheap_header* header_of(heap_t* h)
+{
+    return (pheap_header*)((char*)h - offsetof(pheap_header, heap));
+}
+
+/**
+ * @brief Bytes del archivo que ocupa el encabezado, redondeados a página.
+ *
+ * @return size_t Offset del comienzo del heap.
+ */
+static size_t data_offset(void)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    return (sizeof(pheap_header) + page - 1) / page * page;
+}
+
+/**
+ * @brief Mapea el archivo, en la dirección pedida si está libre.
+ *
+ * @param fd Archivo.
+ * @param size Bytes a mapear.
+ * @param want Dirección preferida, NULL para cualquiera.
+ * @return char* Mapeo, o NULL si falló.
+ */
+static char* map_file(int fd, size_t size, void* want)
+{
+    char* map = MAP_FAILED;
+
+    // MAP_FIXED_NOREPLACE falla en lugar de pisar otro mapeo que ocupe esa dirección
+    if (want)
+        map = mmap(want, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (map == MAP_FAILED)
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+heap_t* pheap_open(const char* path, size_t size, unsigned* status)
+{
+    pheap_header old;
+    struct stat st;
+    unsigned flags = 0;
+    int rebuild = 0;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return NULL;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if (st.st_size == 0)
+    {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size = (size + page - 1) / page * page;
+        // El archivo queda disperso: los bloques ocupan disco a medida que se escriben
+        if (size <= data_offset() || ftruncate(fd, (off_t)size) != 0)
+        {
+            close(fd);
+            return NULL;
+        }
+        memset(&old, 0, sizeof(old));
+        flags |= PHEAP_CREATED;
+    }
+    else if (pread(fd, &old, sizeof(old), 0) != (ssize_t)sizeof(old) || old.magic != PHEAP_MAGIC ||
+             old.version != PHEAP_VERSION || (uint64_t)st.st_size < old.size)
+    {
+        close(fd);
+        return NULL;
+    }
+    else
+        size = old.size;
+
+    char* map = map_file(fd, size, (void*)(uintptr_t)old.address);
+    if (map == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    pheap_header* hd = (pheap_header*)map;
+    heap_t* h = &hd->heap;
+
+    if (flags & PHEAP_CREATED)
+    {
+        if (heap_init(h, map + data_offset(), size - data_offset()) != 0)
+        {
+            munmap(map, size);
+            ftruncate(fd, 0);
+            close(fd);
+            return NULL;
+        }
+        hd->magic = PHEAP_MAGIC;
+        hd->version = PHEAP_VERSION;
+        hd->size = size;
+        hd->address = (uintptr_t)map;
+    }
+
+    // El mapa de bloques es memoria del proceso que lo activó
+    memset(&h->map, 0, sizeof(h->map));
+
+    /* Los enlaces de los bloques y la región son punteros del mapeo anterior */
+    ptrdiff_t moved = map - (char*)(uintptr_t)hd->address;
+    if (moved)
+    {
+        h->region.start += moved;
+        h->region.top += moved;
+        h->region.committed += moved;
+        h->region.end += moved;
+        hd->address = (uintptr_t)map;
+        flags |= PHEAP_RELOCATED;
+        rebuild = 1;
+    }
+    if (hd->dirty)
+    {
+        flags |= PHEAP_RECOVERED;
+        rebuild = 1;
+    }
+
+    // Otra variante de la biblioteca no mantuvo el índice de libres que usa esta
+#ifdef MEMORY_POLICY
+    if (h->method != MEMORY_POLICY)
+    {
+        h->method = MEMORY_POLICY;
+        rebuild = 1;
+    }
+#else
+    if (heap_control(h, h->method) != 0)
+        h->method = FIRST_FIT;
+#endif
+
+    if (rebuild)
+        heap_rebuild(h, moved);
+
+    /* dirty llega al disco antes que cualquier cambio del heap: si el sistema
+       cae, la próxima apertura sabe que tiene que reparar */
+    hd->dirty = 1;
+    hd->fd = fd;
+    msync(hd, data_offset(), MS_SYNC);
+
+    if (status)
+        *status = flags;
+    return h;
+}
+
+int pheap_checkpoint(heap_t* h)
+{
+    pheap_header* hd = header_of(h);
+
+    return msync(hd, (size_t)(h->region.top - (char*)hd), MS_SYNC);
+}
+
+int pheap_close(heap_t* h)
+{
+    pheap_header* hd = header_of(h);
+    int fd = hd->fd;
+
+    // Un bloque estacionado en un fast bin quedaría ocupado para siempre en el archivo
+    heap_consolidate(h);
+    int status = pheap_checkpoint(h);
+
+    // Solo un heap que llegó entero al disco se marca como cerrado
+    if (status == 0)
+    {
+        hd->dirty = 0;
+        status = msync(hd, data_offset(), MS_SYNC);
+    }
+    heap_map(h, 0);
+    munmap(hd, hd->size);
+    close(fd);
+    return status;
+}
+
+void pheap_set_root(heap_t* h, void* p)
+{
+    header_of(h)->root = pheap_offset(h, p);
+}
+
+void* pheap_root(heap_t* h)
+{
+    return pheap_pointer(h, header_of(h)->root);
+}
+
+uint64_t pheap_offset(heap_t* h, const void* p)
+{
+    return p ? (uint64_t)((const char*)p - (char*)header_of(h)) : 0;
+}
+
+void* pheap_pointer(heap_t* h, uint64_t offset)
+{
+    return offset ? (char*)header_of(h) + offset : NULL;
+}
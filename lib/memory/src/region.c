@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include "region.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * @brief Redondea hacia arriba a un múltiplo de una potencia de dos.
+ *
+ * @param x Valor a redondear.
+ * @param a Alineación, potencia de dos.
+ * @return uintptr_t Múltiplo de a mayor o igual que x.
+ */
+static uintptr_t round_up(uintptr_t x, size_t a)
+{
+    return (x + a - 1) & ~(uintptr_t)(a - 1);
+}
+
+int region_reserve(region_t* r, size_t size, size_t chunk, int flags)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    chunk = round_up(chunk ? chunk : page, page);
+    // La alineación por chunk solo es posible con potencias de dos
+    if (chunk & (chunk - 1))
+        return -1;
+    size = round_up(size, chunk);
+
+    // Se reserva un chunk de más para poder recortar el comienzo hasta la alineación
+    char* raw = mmap(NULL, size + chunk, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED)
+        return -1;
+
+    char* start = (char*)round_up((uintptr_t)raw, chunk);
+    if (start > raw)
+        munmap(raw, (size_t)(start - raw));
+    if (raw + chunk > start)
+        munmap(start + size, (size_t)(raw + chunk - start));
+
+    r->start = start;
+    r->top = start;
+    r->committed = start;
+    r->end = start + size;
+    r->chunk = chunk;
+    r->flags = flags;
+    r->hugepages = 0;
+
+    /* Sin THP en el kernel madvise falla y la región sigue funcionando con páginas normales */
+    if ((flags & REGION_HUGEPAGES) && madvise(start, size, MADV_HUGEPAGE) == 0)
+        r->hugepages = 1;
+    return 0;
+}
+
+void region_wrap(region_t* r, void* buffer, size_t size)
+{
+    r->start = buffer;
+    r->top = buffer;
+    r->committed = r->start + size;
+    r->end = r->committed;
+    r->chunk = size;
+    r->flags = REGION_BORROWED;
+    r->hugepages = 0;
+}
+
+void* region_sbrk(region_t* r, intptr_t increment)
+{
+    char* old = r->top;
+
+    if (increment > 0 && (uintptr_t)increment > (uintptr_t)(r->end - r->top))
+        return (void*)-1;
+    if (increment < 0 && (uintptr_t)-increment > (uintptr_t)(r->top - r->start))
+        return (void*)-1;
+
+    if (increment > 0 && old + increment > r->committed)
+    {
+        // El sistema operativo solo ve crecimientos de a chunks completos
+        char* upto = (char*)round_up((uintptr_t)(old + increment), r->chunk);
+        if (mprotect(r->committed, (size_t)(upto - r->committed), PROT_READ | PROT_WRITE) != 0)
+            return (void*)-1;
+        r->committed = upto;
+    }
+    r->top = old + increment;
+
+    if (increment < 0)
+        region_brk(r, r->top);
+    return old;
+}
+
+int region_brk(region_t* r, void* addr)
+{
+    char* top = addr;
+
+    if (top < r->start || top > r->end)
+        return -1;
+    if (top > r->committed)
+        return region_sbrk(r, top - r->top) == (void*)-1 ? -1 : 0;
+
+    r->top = top;
+    if (r->flags & REGION_BORROWED)
+        return 0;
+
+    /* Se conserva un chunk habilitado por encima del tope para no devolver y volver
+       a pedir memoria cuando el heap oscila alrededor de un borde */
+    char* keep = (char*)round_up((uintptr_t)top, r->chunk) + r->chunk;
+    if (keep < r->committed)
+    {
+        size_t len = (size_t)(r->committed - keep);
+        madvise(keep, len, MADV_DONTNEED);
+        mprotect(keep, len, PROT_NONE);
+        r->committed = keep;
+    }
+    return 0;
+}
+
+void region_unmap(region_t* r)
+{
+    if (r->start && !(r->flags & REGION_BORROWED))
+        munmap(r->start, (size_t)(r->end - r->start));
+    r->start = r->top = r->committed = r->end = NULL;
+}
@@ -0,0 +1,521 @@
+#define _GNU_SOURCE
+#include "shm_heap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Bytes del encabezado de un bloque; los datos empiezan justo después. */
+#define SHM_BLOCK_SIZE sizeof(struct shm_block)
+/** Milisegundos que un proceso espera a que otro termine de crear el heap que abre. */
+#define SHM_HEAP_CREATE_WAIT 1000
+
+/**
+ * @struct shm_heap
+ * @brief Estado del heap, al comienzo del mapeo; los bloques empiezan en first.
+ */
+struct shm_heap
+{
+    uint64_t magic;       /**< SHM_HEAP_MAGIC, escrito al final de la creación. */
+    uint32_t version;     /**< SHM_HEAP_VERSION. */
+    uint32_t reserved;    /**< Sin uso. */
+    uint64_t size;        /**< Bytes del objeto y del mapeo. */
+    uint64_t first;       /**< Offset del primer bloque. */
+    uint64_t top;         /**< Offset del final del último bloque: confirma las extensiones. */
+    uint64_t last;        /**< Offset del último bloque, 0 si no hay bloques. */
+    uint64_t free_head;   /**< Offset del primer bloque de la lista de libres, 0 si está vacía. */
+    uint64_t root;        /**< Offset del objeto raíz, 0 si no hay. */
+    uint64_t allocated;   /**< Bytes de datos de los bloques ocupados. */
+    uint64_t allocs;      /**< Asignaciones. */
+    uint64_t frees;       /**< Liberaciones. */
+    uint64_t recoveries;  /**< Reparaciones tras la muerte de un proceso con el mutex tomado. */
+    pthread_mutex_t lock; /**< Mutex robusto, recursivo y compartido entre procesos. */
+};
+
+/**
+ * @struct shm_links
+ * @brief Enlaces de un bloque libre en la lista de libres, guardados en sus datos.
+ */
+struct shm_links
+{
+    uint64_t next; /**< Offset del siguiente libre, 0 si es el último. */
+    uint64_t prev; /**< Offset del anterior libre, 0 si es el primero. */
+};
+
+/**
+ * @brief Bloque en un offset del heap.
+ *
+ * @param h Heap.
+ * @param off Offset del encabezado.
+ * @return struct shm_block* Encabezado en el mapeo de este proceso.
+ */
+static inline struct shm_block* block_at(shm_heap_t* h, uint64_t off)
+{
+    return (struct shm_block*)((char*)h + off);
+}
+
+/**
+ * @brief Enlaces de la lista de libres de un bloque libre.
+ *
+ * @param h Heap.
+ * @param off Offset del bloque.
+ * @return struct shm_links* Enlaces, en los datos del bloque.
+ */
+static inline struct shm_links* links_at(shm_heap_t* h, uint64_t off)
+{
+    return (struct shm_links*)((char*)h + off + SHM_BLOCK_SIZE);
+}
+
+/**
+ * @brief Cookie del encabezado de un bloque. Depende del offset y no de la dirección, igual en todos los procesos.
+ *
+ * @param off Offset del bloque.
+ * @return uint32_t Cookie.
+ */
+static inline uint32_t shm_cookie(uint64_t off)
+{
+    return (uint32_t)((off * 0x9E3779B97F4A7C15ull) >> 32) ^ 0x5348u;
+}
+
+/**
+ * @brief Redondea un tamaño a SHM_HEAP_ALIGN.
+ *
+ * @param x Tamaño.
+ * @return uint64_t Tamaño alineado.
+ */
+static inline uint64_t shm_align(uint64_t x)
+{
+    return (x + SHM_HEAP_ALIGN - 1) & ~(uint64_t)(SHM_HEAP_ALIGN - 1);
+}
+
+/**
+ * @brief Agrega un bloque al comienzo de la lista de libres.
+ *
+ * @param h Heap.
+ * @param off Offset del bloque.
+ */
+static void free_list_push(shm_heap_t* h, uint64_t off)
+{
+    struct shm_links* l = links_at(h, off);
+
+    l->prev = 0;
+    l->next = h->free_head;
+    if (h->free_head)
+        links_at(h, h->free_head)->prev = off;
+    h->free_head = off;
+}
+
+/**
+ * @brief Saca un bloque de la lista de libres.
+ *
+ * @param h Heap.
+ * @param off Offset del bloque.
+ */
+static void free_list_remove(shm_heap_t* h, uint64_t off)
+{
+    struct shm_links* l = links_at(h, off);
+
+    if (l->prev)
+        links_at(h, l->prev)->next = l->next;
+    else
+        h->free_head = l->next;
+    if (l->next)
+        links_at(h, l->next)->prev = l->prev;
+}
+
+/**
+ * @brief Devuelve al sistema las páginas enteras por encima del tope, si son bastantes.
+ *
+ * Se conservan SHM_HEAP_TRIM bytes por encima del tope: un heap que sube y
+ * baja por un bloque grande, como una cola de buffers, no vuelve a fallar
+ * sus páginas en cada vuelta.
+ *
+ * @param h Heap.
+ * @param old_top Tope antes de achicar el heap.
+ */
+static void trim(shm_heap_t* h, uint64_t old_top)
+{
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = (h->top + SHM_HEAP_TRIM + page - 1) & ~(page - 1);
+    uint64_t end = (old_top + page - 1) & ~(page - 1);
+
+    // MADV_REMOVE libera las páginas del objeto, no solo las de este mapeo
+    if (end > start && end - start >= SHM_HEAP_TRIM)
+        madvise((char*)h + start, end - start, MADV_REMOVE);
+}
+
+/**
+ * @brief Rearma el heap desde los tamaños de sus bloques tras la muerte de un proceso con el mutex tomado.
+ *
+ * Los enlaces y la lista de libres pudieron quedar a medio escribir; los
+ * tamaños y el tope no, porque cada operación los cambia con una escritura
+ * al final. El recorrido corta el heap en el primer encabezado inválido.
+ *
+ * @param h Heap, con el mutex tomado.
+ */
+static void repair(shm_heap_t* h)
+{
+    uint64_t prev = 0;
+    uint64_t off = h->first;
+
+    h->free_head = 0;
+    h->allocated = 0;
+    while (off < h->top)
+    {
+        struct shm_block* b = block_at(h, off);
+        if (off + SHM_BLOCK_SIZE > h->top || b->magic != shm_cookie(off) || b->size % SHM_HEAP_ALIGN ||
+            b->size > h->top - off - SHM_BLOCK_SIZE || b->free > 1)
+            break;
+
+        // Un free interrumpido antes de fusionar
+        if (prev && block_at(h, prev)->free && b->free)
+        {
+            block_at(h, prev)->size += SHM_BLOCK_SIZE + b->size;
+            off = prev + SHM_BLOCK_SIZE + block_at(h, prev)->size;
+            continue;
+        }
+        b->prev = prev;
+        b->next = 0;
+        if (prev)
+            block_at(h, prev)->next = off;
+        prev = off;
+        off += SHM_BLOCK_SIZE + b->size;
+    }
+    h->top = off;
+    h->last = prev;
+
+    // La cola libre se devuelve, como en shm_heap_free
+    if (prev && block_at(h, prev)->free)
+    {
+        h->top = prev;
+        h->last = block_at(h, prev)->prev;
+        if (h->last)
+            block_at(h, h->last)->next = 0;
+    }
+    for (off = h->last ? h->first : 0; off && off < h->top; off = block_at(h, off)->next)
+    {
+        if (block_at(h, off)->free)
+            free_list_push(h, off);
+        else
+            h->allocated += block_at(h, off)->size;
+    }
+    h->recoveries++;
+}
+
+int shm_heap_lock(shm_heap_t* h)
+{
+    int rc = pthread_mutex_lock(&h->lock);
+
+    if (rc == EOWNERDEAD)
+    {
+        repair(h);
+        rc = pthread_mutex_consistent(&h->lock);
+    }
+    return rc == 0 ? 0 : -1;
+}
+
+void shm_heap_unlock(shm_heap_t* h)
+{
+    pthread_mutex_unlock(&h->lock);
+}
+
+/**
+ * @brief Inicializa un heap vacío sobre un mapeo nuevo.
+ *
+ * @param h Comienzo del mapeo.
+ * @param size Bytes del mapeo.
+ * @return int 0 si quedó listo, -1 si no se pudo crear el mutex.
+ */
+static int init_heap(shm_heap_t* h, size_t size)
+{
+    pthread_mutexattr_t attr;
+
+    h->version = SHM_HEAP_VERSION;
+    h->size = size;
+    h->first = (sizeof(*h) + 63) & ~(uint64_t)63;
+    h->top = h->first;
+    h->last = 0;
+    h->free_head = 0;
+    h->root = 0;
+    h->allocated = h->allocs = h->frees = h->recoveries = 0;
+
+    if (pthread_mutexattr_init(&attr) != 0)
+        return -1;
+    int rc = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    rc = rc ? rc : pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    rc = rc ? rc : pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    rc = rc ? rc : pthread_mutex_init(&h->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0)
+        return -1;
+
+    // Los que esperan la creación solo usan el heap después de ver el magic
+    __atomic_store_n(&h->magic, SHM_HEAP_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief Espera a que el proceso que creó el objeto termine de inicializar el heap.
+ *
+ * @param h Comienzo del mapeo.
+ * @return int 0 si el heap está listo, -1 si el objeto no es un heap compartido.
+ */
+static int wait_created(shm_heap_t* h)
+{
+    struct timespec pause = {0, 1000000};
+
+    for (int waited = 0; __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_HEAP_MAGIC; waited++)
+    {
+        if (waited >= SHM_HEAP_CREATE_WAIT)
+            return -1;
+        nanosleep(&pause, NULL);
+    }
+    return h->version == SHM_HEAP_VERSION ? 0 : -1;
+}
+
+shm_heap_t* shm_heap_map(int fd, size_t size, unsigned* status)
+{
+    struct stat st;
+    int created = 0;
+
+    if (status)
+        *status = 0;
+    if (fstat(fd, &st) != 0)
+        return NULL;
+    if (st.st_size == 0)
+    {
+        if (size < sizeof(shm_heap_t) + SHM_BLOCK_SIZE + SHM_HEAP_MIN_PAYLOAD || ftruncate(fd, (off_t)size) != 0)
+            return NULL;
+        created = 1;
+    }
+    else
+        size = (size_t)st.st_size;
+
+    shm_heap_t* h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED)
+        return NULL;
+    if ((created && init_heap(h, size) != 0) || (!created && (wait_created(h) != 0 || h->size != size)))
+    {
+        munmap(h, size);
+        return NULL;
+    }
+    if (status && created)
+        *status = SHM_HEAP_CREATED;
+    return h;
+}
+
+shm_heap_t* shm_heap_open(const char* name, size_t size, unsigned* status)
+{
+    shm_heap_t* h = NULL;
+    int creator = 1;
+    int fd;
+
+    if (name)
+    {
+        // Solo quien crea el nombre dimensiona el objeto; los demás esperan a verlo dimensionado
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST)
+        {
+            fd = shm_open(name, O_RDWR, 0600);
+            creator = 0;
+        }
+    }
+    else
+        fd = memfd_create("shm_heap", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (creator)
+        h = shm_heap_map(fd, size, status);
+    else
+    {
+        struct timespec pause = {0, 1000000};
+        struct stat st;
+        for (int waited = 0; !h && waited < SHM_HEAP_CREATE_WAIT; waited++)
+        {
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+                h = shm_heap_map(fd, 0, status);
+            else
+                nanosleep(&pause, NULL);
+        }
+    }
+    close(fd);
+    if (!h && creator && name)
+        shm_unlink(name);
+    return h;
+}
+
+int shm_heap_close(shm_heap_t* h)
+{
+    return munmap(h, h->size);
+}
+
+int shm_heap_unlink(const char* name)
+{
+    return shm_unlink(name);
+}
+
+void* shm_heap_malloc(shm_heap_t* h, size_t size)
+{
+    uint64_t s = shm_align(size < SHM_HEAP_MIN_PAYLOAD ? SHM_HEAP_MIN_PAYLOAD : size);
+    uint64_t off;
+
+    if (size > h->size || shm_heap_lock(h) != 0)
+        return NULL;
+
+    // First fit sobre la lista de libres
+    for (off = h->free_head; off; off = links_at(h, off)->next)
+    {
+        if (block_at(h, off)->size >= s)
+            break;
+    }
+
+    if (off)
+    {
+        struct shm_block* b = block_at(h, off);
+        free_list_remove(h, off);
+        if (b->size - s >= SHM_BLOCK_SIZE + SHM_HEAP_MIN_PAYLOAD)
+        {
+            // El resto queda completo antes de que el tamaño del bloque lo confirme
+            uint64_t rest = off + SHM_BLOCK_SIZE + s;
+            struct shm_block* r = block_at(h, rest);
+            r->size = b->size - s - SHM_BLOCK_SIZE;
+            r->next = b->next;
+            r->prev = off;
+            r->free = 1;
+            r->magic = shm_cookie(rest);
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            b->size = s;
+            b->next = rest;
+            if (r->next)
+                block_at(h, r->next)->prev = rest;
+            else
+                h->last = rest;
+            free_list_push(h, rest);
+        }
+        b->free = 0;
+    }
+    else
+    {
+        // Sin libre que alcance, el bloque se agrega en el tope
+        if (h->top + SHM_BLOCK_SIZE + s > h->size)
+        {
+            shm_heap_unlock(h);
+            return NULL;
+        }
+        off = h->top;
+        struct shm_block* b = block_at(h, off);
+        b->size = s;
+        b->next = 0;
+        b->prev = h->last;
+        b->free = 0;
+        b->magic = shm_cookie(off);
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        h->top = off + SHM_BLOCK_SIZE + s;
+        if (h->last)
+            block_at(h, h->last)->next = off;
+        h->last = off;
+    }
+    h->allocated += block_at(h, off)->size;
+    h->allocs++;
+    shm_heap_unlock(h);
+    return (char*)h + off + SHM_BLOCK_SIZE;
+}
+
+int shm_heap_free(shm_heap_t* h, void* p)
+{
+    if (!p)
+        return 0;
+
+    uint64_t off = (uint64_t)((char*)p - (char*)h) - SHM_BLOCK_SIZE;
+    if ((char*)p < (char*)h + h->first + SHM_BLOCK_SIZE || shm_heap_lock(h) != 0)
+        return -1;
+
+    struct shm_block* b = block_at(h, off);
+    if (off >= h->top || b->magic != shm_cookie(off) || b->free)
+    {
+        shm_heap_unlock(h);
+        return -1;
+    }
+    h->allocated -= b->size;
+    h->frees++;
+    b->free = 1;
+
+    // Fusión con el siguiente: el tamaño del bloque confirma que lo absorbió
+    if (b->next && block_at(h, b->next)->free)
+    {
+        struct shm_block* n = block_at(h, b->next);
+        free_list_remove(h, b->next);
+        b->size += SHM_BLOCK_SIZE + n->size;
+        b->next = n->next;
+        if (b->next)
+            block_at(h, b->next)->prev = off;
+        else
+            h->last = off;
+    }
+    // Y con el anterior, que absorbe a este
+    if (b->prev && block_at(h, b->prev)->free)
+    {
+        uint64_t prev = b->prev;
+        struct shm_block* pb = block_at(h, prev);
+        free_list_remove(h, prev);
+        pb->size += SHM_BLOCK_SIZE + b->size;
+        pb->next = b->next;
+        if (pb->next)
+            block_at(h, pb->next)->prev = prev;
+        else
+            h->last = prev;
+        off = prev;
+        b = pb;
+    }
+
+    if (!b->next)
+    {
+        // La cola libre se devuelve bajando el tope
+        uint64_t old_top = h->top;
+        h->top = off;
+        h->last = b->prev;
+        if (h->last)
+            block_at(h, h->last)->next = 0;
+        trim(h, old_top);
+    }
+    else
+        free_list_push(h, off);
+    shm_heap_unlock(h);
+    return 0;
+}
+
+uint64_t shm_heap_offset(shm_heap_t* h, const void* p)
+{
+    return p ? (uint64_t)((const char*)p - (const char*)h) : 0;
+}
+
+void* shm_heap_pointer(shm_heap_t* h, uint64_t offset)
+{
+    return offset ? (char*)h + offset : NULL;
+}
+
+void shm_heap_set_root(shm_heap_t* h, void* p)
+{
+    __atomic_store_n(&h->root, shm_heap_offset(h, p), __ATOMIC_RELEASE);
+}
+
+void* shm_heap_root(shm_heap_t* h)
+{
+    return shm_heap_pointer(h, __atomic_load_n(&h->root, __ATOMIC_ACQUIRE));
+}
+
+void shm_heap_stats(shm_heap_t* h, shm_heap_stats_t* stats)
+{
+    shm_heap_lock(h);
+    stats->size = h->size;
+    stats->used = h->top - h->first;
+    stats->allocated = h->allocated;
+    stats->allocs = h->allocs;
+    stats->frees = h->frees;
+    stats->recoveries = h->recoveries;
+    shm_heap_unlock(h);
+}
@@ -0,0 +1,325 @@
+#include "size_classes.h"
+#include "memory.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+int size_hist_active = 0;
+int size_classes_count = 0;
+
+/** Pedidos contados por tamaño exacto; la última entrada acumula los mayores que SIZE_HIST_MAX. */
+static uint64_t hist[SIZE_HIST_BUCKETS];
+
+/** Tabla instalada, de menor a mayor. */
+static size_t classes_table[SIZE_CLASSES_MAX];
+
+/** Clase de cada tamaño alineado hasta SIZE_HIST_MAX, indexada por tamaño / 8. */
+static uint16_t class_lut[SIZE_HIST_MAX / 8 + 1];
+
+void size_hist_start(void)
+{
+    size_hist_active = 1;
+}
+
+void size_hist_stop(void)
+{
+    size_hist_active = 0;
+}
+
+void size_hist_reset(void)
+{
+    memset(hist, 0, sizeof(hist));
+}
+
+void size_hist_record(size_t size)
+{
+    hist[size <= SIZE_HIST_MAX ? size : SIZE_HIST_MAX + 1]++;
+}
+
+const uint64_t* size_hist_counts(void)
+{
+    return hist;
+}
+
+int size_hist_save(const char* path)
+{
+    // El archivo no se cuenta a sí mismo: fopen también pide memoria
+    int active = size_hist_active;
+    size_hist_active = 0;
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        size_hist_active = active;
+        return -1;
+    }
+    fprintf(file, "# my_memory request size histogram\n# size count\n");
+    for (size_t i = 1; i <= SIZE_HIST_MAX; i++)
+    {
+        if (hist[i])
+            fprintf(file, "%zu %llu\n", i, (unsigned long long)hist[i]);
+    }
+    if (hist[SIZE_HIST_MAX + 1])
+        fprintf(file, "large %llu\n", (unsigned long long)hist[SIZE_HIST_MAX + 1]);
+
+    int status = fclose(file) == 0 ? 0 : -1;
+    size_hist_active = active;
+    return status;
+}
+
+int size_hist_load(const char* path, uint64_t* counts)
+{
+    char line[128];
+    int status = 0;
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+
+    memset(counts, 0, SIZE_HIST_BUCKETS * sizeof(uint64_t));
+    while (status == 0 && fgets(line, sizeof(line), file))
+    {
+        unsigned long long size, count;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "large %llu", &count) == 1)
+            counts[SIZE_HIST_MAX + 1] += count;
+        else if (sscanf(line, "%llu %llu", &size, &count) == 2 && size <= SIZE_HIST_MAX)
+            counts[size] += count;
+        else
+            status = -1;
+    }
+    fclose(file);
+    return status;
+}
+
+int size_classes_set(const size_t* classes, int n)
+{
+    size_t aligned[SIZE_CLASSES_MAX];
+
+    if (n < 0 || n > SIZE_CLASSES_MAX)
+        return -1;
+    for (int i = 0; i < n; i++)
+    {
+        aligned[i] = classes[i] ? align(classes[i]) : 0;
+        if (!aligned[i] || aligned[i] > SIZE_HIST_MAX || (i && aligned[i] <= aligned[i - 1]))
+            return -1;
+    }
+
+    // Mientras se arma la tabla malloc sigue alineando solo a 8 bytes
+    size_classes_count = 0;
+    memcpy(classes_table, aligned, (size_t)n * sizeof(size_t));
+    for (int i = 0, c = 0; i < n && c <= SIZE_HIST_MAX / 8; c++)
+    {
+        class_lut[c] = (uint16_t)aligned[i];
+        if ((size_t)c * 8 == aligned[i])
+            i++;
+    }
+    size_classes_count = n;
+    return 0;
+}
+
+int size_classes_get(size_t* classes)
+{
+    memcpy(classes, classes_table, (size_t)size_classes_count * sizeof(size_t));
+    return size_classes_count;
+}
+
+int size_classes_parse(const char* text)
+{
+    size_t classes[SIZE_CLASSES_MAX];
+    int n = 0;
+
+    for (const char* p = text; *p;)
+    {
+        if (*p == '#')
+        {
+            while (*p && *p != '\n')
+                p++;
+        }
+        else if (*p >= '0' && *p <= '9')
+        {
+            size_t value = 0;
+            while (*p >= '0' && *p <= '9' && value <= SIZE_HIST_MAX)
+                value = value * 10 + (size_t)(*p++ - '0');
+            if (n == SIZE_CLASSES_MAX || (*p >= '0' && *p <= '9'))
+                return -1;
+            classes[n++] = value;
+        }
+        else if (*p == ',' || *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+            p++;
+        else
+            return -1;
+    }
+    return size_classes_set(classes, n);
+}
+
+int size_classes_load(const char* path)
+{
+    char text[4096];
+    size_t len = 0;
+    ssize_t n;
+
+    // Solo open y read: la tabla se carga antes de que malloc se use por primera vez
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    while (len < sizeof(text) - 1 && (n = read(fd, text + len, sizeof(text) - 1 - len)) > 0)
+        len += (size_t)n;
+    close(fd);
+    if (len == sizeof(text) - 1)
+        return -1;
+    text[len] = '\0';
+    return size_classes_parse(text);
+}
+
+int size_classes_save(const char* path, const size_t* classes, int n)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+
+    fprintf(file, "# my_memory size classes\n");
+    for (int i = 0; i < n; i++)
+        fprintf(file, "%zu%s", classes[i], i + 1 < n ? (i % 16 == 15 ? ",\n" : ",") : "\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+size_t size_class_round(size_t size)
+{
+    if (!size_classes_count || size > classes_table[size_classes_count - 1])
+        return size;
+    return class_lut[size >> 3];
+}
+
+int size_classes_optimize(const uint64_t* counts, int k, size_t* classes)
+{
+    int m = 0;
+
+    if (k <= 0 || k > SIZE_CLASSES_MAX)
+        return -1;
+    for (int size = SIZE_HIST_MAX; size > 0 && !m; size--)
+    {
+        if (counts[size])
+            m = (int)(align((size_t)size) / 8);
+    }
+    if (!m)
+        return 0;
+    if (k > m)
+        k = m;
+
+    /* Candidata j = clase de 8 * j bytes. cnt y sum son acumulados de los
+       pedidos de hasta 8 * j bytes, así el desperdicio de una clase que cubre
+       (8p, 8j] es 8j * (cnt[j] - cnt[p]) - (sum[j] - sum[p]) */
+    size_t cols = (size_t)m + 1;
+    size_t bytes = 2 * cols * sizeof(uint64_t) + (size_t)(k + 1) * cols * (sizeof(uint64_t) + sizeof(uint16_t));
+    // La tabla de programación dinámica no sale del heap que se está afinando
+    char* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return -1;
+    uint64_t* cnt = (uint64_t*)mem;
+    uint64_t* sum = cnt + cols;
+    uint64_t* cost = sum + cols;
+    uint16_t* from = (uint16_t*)(cost + (size_t)(k + 1) * cols);
+
+    for (int j = 1; j <= m; j++)
+    {
+        cnt[j] = cnt[j - 1];
+        sum[j] = sum[j - 1];
+        for (int size = 8 * (j - 1) + 1; size <= 8 * j; size++)
+        {
+            cnt[j] += counts[size];
+            sum[j] += counts[size] * (uint64_t)size;
+        }
+    }
+
+    // cost[c][j]: menor desperdicio cubriendo hasta 8j con c clases, la última de 8j bytes
+    for (int j = 1; j <= m; j++)
+        cost[cols + j] = 8 * (uint64_t)j * cnt[j] - sum[j];
+    for (int c = 2; c <= k; c++)
+    {
+        for (int j = c; j <= m; j++)
+        {
+            uint64_t best = UINT64_MAX;
+            for (int p = c - 1; p < j; p++)
+            {
+                uint64_t w = cost[(size_t)(c - 1) * cols + p] + 8 * (uint64_t)j * (cnt[j] - cnt[p]) - (sum[j] - sum[p]);
+                if (w < best)
+                {
+                    best = w;
+                    from[(size_t)c * cols + j] = (uint16_t)p;
+                }
+            }
+            cost[(size_t)c * cols + j] = best;
+        }
+    }
+
+    // Menos clases si las que sobran no ahorran nada
+    int used = 1;
+    for (int c = 2; c <= k; c++)
+    {
+        if (cost[(size_t)c * cols + m] < cost[(size_t)used * cols + m])
+            used = c;
+    }
+    for (int c = used, j = m; c >= 1; c--)
+    {
+        classes[c - 1] = 8 * (size_t)j;
+        j = from[(size_t)c * cols + j];
+    }
+
+    munmap(mem, bytes);
+    return used;
+}
+
+int size_classes_generic(size_t* classes, int k)
+{
+    int n = 0;
+
+    for (size_t size = 8; size <= 32 && n < k; size += 8)
+        classes[n++] = size;
+    for (size_t base = 32; base < SIZE_HIST_MAX; base *= 2)
+    {
+        for (size_t size = base + base / 4; size <= 2 * base && n < k; size += base / 4)
+            classes[n++] = size;
+    }
+    return n;
+}
+
+uint64_t size_classes_waste(const uint64_t* counts, const size_t* classes, int n)
+{
+    uint64_t waste = 0;
+    int c = 0;
+
+    for (size_t size = 1; size <= SIZE_HIST_MAX; size++)
+    {
+        size_t s = align(size);
+        while (c < n && classes[c] < s)
+            c++;
+        waste += counts[size] * ((c < n ? classes[c] : s) - size);
+    }
+    return waste;
+}
+
+/**
+ * @brief Guarda el histograma en SIZE_HIST_PATH cuando termina el proceso.
+ */
+static void save_at_exit(void)
+{
+    size_hist_save(SIZE_HIST_PATH);
+}
+
+/**
+ * @brief Arranca el histograma y carga la tabla de clases del entorno antes de main().
+ */
+__attribute__((constructor)) static void size_classes_init(void)
+{
+    if (SIZE_HIST_PATH)
+    {
+        size_hist_start();
+        atexit(save_at_exit);
+    }
+    if (SIZE_CLASSES)
+        size_classes_parse(SIZE_CLASSES);
+    else if (SIZE_CLASSES_PATH)
+        size_classes_load(SIZE_CLASSES_PATH);
+}
@@ -0,0 +1,145 @@
+#include "heap.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Space reserved for the heaps of the tests */
+#define HEAP_SPACE (4 << 20)
+
+/** Largest size parked by the heaps of the tests */
+#define FAST_MAX 128
+
+/** Heap of each test, with fast bins enabled */
+static heap_t heap;
+
+void setUp(void)
+{
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, NULL, HEAP_SPACE));
+    TEST_ASSERT_EQUAL_INT(0, heap_fastbins(&heap, FAST_MAX));
+}
+
+void tearDown(void)
+{
+    heap_destroy(&heap);
+}
+
+void test_free_parks_small_blocks()
+{
+    printf("Testing that small blocks are parked without fusion...\n");
+    char* a = heap_malloc(&heap, 64);
+    char* b = heap_malloc(&heap, 64);
+    char* top = heap.region.top;
+
+    // Without fast bins freeing the tail would give it back and fuse a into it
+    heap_free(&heap, b);
+    heap_free(&heap, a);
+    TEST_ASSERT_EQUAL_PTR(top, heap.region.top);
+    TEST_ASSERT_EQUAL_INT(0, heap.counters.fusions);
+    TEST_ASSERT_EQUAL_INT(0, heap.counters.shrinks);
+    TEST_ASSERT_EQUAL_INT(128, heap.fast_bytes);
+
+    size_t allocated, free_bytes;
+    heap_usage(&heap, &allocated, &free_bytes);
+    TEST_ASSERT_EQUAL_INT(0, allocated);
+    TEST_ASSERT_EQUAL_INT(128, free_bytes);
+
+    // Same size requests pop the bin in LIFO order without growing the heap
+    TEST_ASSERT_EQUAL_PTR(a, heap_malloc(&heap, 60));
+    TEST_ASSERT_EQUAL_PTR(b, heap_malloc(&heap, 64));
+    TEST_ASSERT_EQUAL_INT(2, heap.counters.extends);
+    TEST_ASSERT_EQUAL_INT(0, heap.fast_bytes);
+
+    // Larger blocks are still freed right away
+    char* c = heap_malloc(&heap, FAST_MAX + 8);
+    heap_free(&heap, c);
+    TEST_ASSERT_EQUAL_INT(1, heap.counters.shrinks);
+    TEST_ASSERT_EQUAL_PTR(top, heap.region.top);
+    printf("Parked blocks reused without fusion or brk\n\n");
+}
+
+void test_large_request_consolidates()
+{
+    printf("Testing consolidation before the heap grows...\n");
+    char* p[4];
+    for (int i = 0; i < 4; i++)
+        p[i] = heap_malloc(&heap, 64);
+    char* guard = heap_malloc(&heap, 512);
+
+    for (int i = 0; i < 4; i++)
+        heap_free(&heap, p[i]);
+    TEST_ASSERT_EQUAL_INT(0, heap.counters.fusions);
+
+    // Nothing free fits 300 bytes until the four parked blocks are fused
+    char* q = heap_malloc(&heap, 300);
+    TEST_ASSERT_EQUAL_PTR(p[0], q);
+    TEST_ASSERT_EQUAL_INT(1, heap.counters.consolidations);
+    TEST_ASSERT_EQUAL_INT(3, heap.counters.fusions);
+    TEST_ASSERT_EQUAL_INT(0, heap.fast_bytes);
+    // The fused block holds 4 * 64 + 3 * BLOCK_SIZE bytes and the rest is split off
+    TEST_ASSERT_EQUAL_INT(304, get_block(q)->size);
+    TEST_ASSERT_EQUAL_INT(4 * 64 + 3 * BLOCK_SIZE - 304 - BLOCK_SIZE, get_block(q)->next->size);
+    TEST_ASSERT_TRUE(get_block(q)->next->free);
+
+    heap_free(&heap, q);
+    heap_free(&heap, guard);
+    TEST_ASSERT_NULL(heap.base);
+    printf("Parked blocks fused into a 300 byte request\n\n");
+}
+
+void test_threshold_consolidates()
+{
+    printf("Testing the fast bin threshold...\n");
+    int n = HEAP_FASTBIN_THRESHOLD / FAST_MAX + 1;
+    char** p = heap_malloc(&heap, (size_t)n * sizeof(char*));
+
+    for (int i = 0; i < n; i++)
+        p[i] = heap_malloc(&heap, FAST_MAX);
+    for (int i = 0; i < n - 1; i++)
+        heap_free(&heap, p[i]);
+    TEST_ASSERT_EQUAL_INT(0, heap.counters.consolidations);
+    TEST_ASSERT_EQUAL_INT(HEAP_FASTBIN_THRESHOLD, heap.fast_bytes);
+
+    // One more byte over the threshold fuses everything, and the free tail goes back
+    char* top = heap.region.top;
+    heap_free(&heap, p[n - 1]);
+    TEST_ASSERT_EQUAL_INT(1, heap.counters.consolidations);
+    TEST_ASSERT_EQUAL_INT(0, heap.fast_bytes);
+    TEST_ASSERT_TRUE(heap.region.top < top);
+
+    heap_free(&heap, p);
+    TEST_ASSERT_NULL(heap.base);
+    printf("Consolidated after %d parked blocks\n\n", n);
+}
+
+void test_fastbins_control()
+{
+    printf("Testing fast bin configuration...\n");
+    TEST_ASSERT_EQUAL_INT(-1, heap_fastbins(&heap, HEAP_FASTBIN_MAX + 1));
+
+    // Disabling the bins fuses what they hold
+    heap_free(&heap, heap_malloc(&heap, 32));
+    TEST_ASSERT_NOT_NULL(heap.base);
+    TEST_ASSERT_EQUAL_INT(0, heap_fastbins(&heap, 0));
+    TEST_ASSERT_NULL(heap.base);
+    TEST_ASSERT_EQUAL_INT(0, heap.fast_max);
+
+    // The default heap parks blocks too
+    TEST_ASSERT_EQUAL_INT(0, malloc_fastbins(100));
+    void* a = malloc(100);
+    free(a);
+    TEST_ASSERT_EQUAL_PTR(a, malloc(97));
+    free(a);
+    TEST_ASSERT_EQUAL_INT(0, malloc_fastbins(0));
+    TEST_ASSERT_EQUAL_INT(0, heap_default()->fast_bytes);
+    printf("Fast bins enabled and disabled\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_free_parks_small_blocks);
+    RUN_TEST(test_large_request_consolidates);
+    RUN_TEST(test_threshold_consolidates);
+    RUN_TEST(test_fastbins_control);
+    return UNITY_END();
+}
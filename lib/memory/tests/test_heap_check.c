@@ -0,0 +1,242 @@
+#include "heap_check.h"
+#include "heap.h"
+#include "heap_map.h"
+#include "memory.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Number of blocks allocated by each test */
+#define NUM_BLOCKS 64
+
+/** Blocks allocated by the current test */
+static void* ptrs[NUM_BLOCKS];
+
+void setUp(void)
+{
+    // Every other block is freed so the heap mixes used and free blocks
+    for (int i = 0; i < NUM_BLOCKS; i++)
+        ptrs[i] = malloc((size_t)(i + 1) * 24);
+    for (int i = 0; i < NUM_BLOCKS; i += 2)
+    {
+        free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+}
+
+void tearDown(void)
+{
+    for (int i = 0; i < NUM_BLOCKS; i++)
+    {
+        free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+}
+
+void test_check_consistent_heap()
+{
+    printf("Testing heap check on a consistent heap...\n");
+    heap_report_t report;
+    size_t allocated, available;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+    memory_usage(&allocated, &available);
+    printf("Blocks: %zu (%zu free), used: %zu, free: %zu\n\n", report.blocks, report.free_blocks, report.used_bytes,
+           report.free_bytes);
+    TEST_ASSERT_EQUAL_INT(0, report.errors);
+    TEST_ASSERT_GREATER_OR_EQUAL(NUM_BLOCKS / 2, report.free_blocks);
+    TEST_ASSERT_EQUAL_INT(allocated, report.used_bytes);
+    TEST_ASSERT_EQUAL_INT(available, report.free_bytes);
+}
+
+void test_check_detects_corruption()
+{
+    printf("Testing heap check on a corrupted heap...\n");
+    heap_report_t report;
+    t_block b = get_block(ptrs[9]);
+
+    // A header overwritten by a buffer overflow
+    unsigned int magic = b->magic;
+    b->magic = 0;
+    TEST_ASSERT_EQUAL_INT(-1, heap_check(&report));
+    TEST_ASSERT_EQUAL_PTR(b, report.first_bad);
+    TEST_ASSERT_EQUAL_INT(HEAP_CHECK_COOKIE, report.first_kind);
+    b->magic = magic;
+
+    // A broken back link
+    t_block prev = b->prev;
+    b->prev = b;
+    TEST_ASSERT_EQUAL_INT(-1, heap_check(&report));
+    TEST_ASSERT_TRUE(report.kinds & HEAP_CHECK_LINKS);
+    b->prev = prev;
+
+    // A size that no longer reaches the next block
+    b->size -= 8;
+    TEST_ASSERT_EQUAL_INT(-1, heap_check(&report));
+    TEST_ASSERT_TRUE(report.kinds & HEAP_CHECK_ADJACENCY);
+    TEST_ASSERT_TRUE(report.kinds & HEAP_CHECK_TOTALS);
+    b->size += 8;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+    printf("Cookie, link and adjacency errors detected\n\n");
+}
+
+void test_check_incremental()
+{
+    printf("Testing incremental heap check...\n");
+    heap_report_t full;
+    heap_cursor_t cursor;
+    int steps = 0;
+
+    heap_check(&full);
+    heap_check_begin(&cursor);
+    while (!heap_check_step(&cursor, 8))
+        steps++;
+    printf("Pass finished after %d steps, %zu blocks\n", steps, cursor.report.blocks);
+    TEST_ASSERT_EQUAL_INT(full.blocks, cursor.report.blocks);
+    TEST_ASSERT_EQUAL_INT(0, cursor.report.errors);
+
+    // The block under the cursor merges with its free neighbour between two steps
+    int i = NUM_BLOCKS;
+    heap_check_begin(&cursor);
+    while (i == NUM_BLOCKS && !heap_check_step(&cursor, 1))
+    {
+        for (i = 0; i < NUM_BLOCKS; i++)
+        {
+            if (ptrs[i] && get_block(ptrs[i]) == cursor.block && cursor.block->prev->free)
+                break;
+        }
+    }
+    TEST_ASSERT_TRUE(i < NUM_BLOCKS);
+    free(ptrs[i]);
+    ptrs[i] = NULL;
+
+    while (!heap_check_step(&cursor, 8))
+        ;
+    printf("Restarts after the cursor block was merged: %zu\n\n", cursor.report.restarts);
+    TEST_ASSERT_EQUAL_INT(1, cursor.report.restarts);
+    TEST_ASSERT_EQUAL_INT(0, cursor.report.errors);
+    TEST_ASSERT_EQUAL_INT(1, cursor.passes);
+}
+
+void test_check_parallel()
+{
+    printf("Testing parallel heap check...\n");
+    heap_report_t report;
+
+    // Creating the threads may allocate, the totals check covers the heap as the threads saw it
+    TEST_ASSERT_EQUAL_INT(0, heap_check_parallel(&report, 4));
+    printf("Parallel check: %zu blocks, used: %zu, free: %zu\n\n", report.blocks, report.used_bytes,
+           report.free_bytes);
+    TEST_ASSERT_GREATER_OR_EQUAL(NUM_BLOCKS, report.blocks);
+
+    t_block b = get_block(ptrs[NUM_BLOCKS - 1]);
+    b->free = 7;
+    TEST_ASSERT_EQUAL_INT(-1, heap_check_parallel(&report, 4));
+    TEST_ASSERT_TRUE(report.kinds & HEAP_CHECK_FREE);
+    b->free = 0;
+}
+
+void test_check_other_heap()
+{
+    printf("Testing heap check on a heap of its own...\n");
+    heap_t h;
+    heap_report_t report;
+    heap_cursor_t cursor;
+    void* p[NUM_BLOCKS];
+
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&h, NULL, 1 << 20));
+    for (int i = 0; i < NUM_BLOCKS; i++)
+        TEST_ASSERT_NOT_NULL(p[i] = heap_malloc(&h, (size_t)(i + 1) * 16));
+    for (int i = 0; i < NUM_BLOCKS; i += 2)
+        heap_free(&h, p[i]);
+
+    // Every variant walks the given heap, not the default one
+    TEST_ASSERT_EQUAL_INT(0, heap_check_heap(&h, &report));
+    printf("Blocks: %zu (%zu free)\n", report.blocks, report.free_blocks);
+    TEST_ASSERT_EQUAL_INT(NUM_BLOCKS, report.blocks);
+    TEST_ASSERT_EQUAL_INT(NUM_BLOCKS / 2, report.free_blocks);
+    heap_check_heap_begin(&cursor, &h);
+    while (!heap_check_step(&cursor, 8))
+        ;
+    TEST_ASSERT_EQUAL_INT(NUM_BLOCKS, cursor.report.blocks);
+    TEST_ASSERT_EQUAL_INT(0, cursor.report.errors);
+    TEST_ASSERT_EQUAL_INT(0, heap_check_heap_parallel(&h, &report, 4));
+    TEST_ASSERT_EQUAL_INT(NUM_BLOCKS, report.blocks);
+
+    t_block b = get_block(p[NUM_BLOCKS - 1]);
+    b->magic = 0;
+    TEST_ASSERT_EQUAL_INT(-1, heap_check_heap(&h, &report));
+    TEST_ASSERT_EQUAL_PTR(b, report.first_bad);
+    TEST_ASSERT_EQUAL_INT(-1, heap_check_heap_parallel(&h, &report, 4));
+    TEST_ASSERT_EQUAL_INT(HEAP_CHECK_COOKIE, report.first_kind);
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+    b->magic = block_cookie(b);
+    printf("Corrupted header found in its heap only\n\n");
+
+    heap_destroy(&h);
+}
+
+void test_check_parallel_cuts()
+{
+    printf("Testing parallel heap check across the range cuts...\n");
+    heap_t h;
+    heap_report_t report;
+    t_block cut[3];
+    void* p[NUM_BLOCKS];
+
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&h, NULL, 1 << 20));
+    for (int i = 0; i < NUM_BLOCKS; i++)
+        TEST_ASSERT_NOT_NULL(p[i] = heap_malloc(&h, (size_t)(i % 8 + 1) * 16));
+    // The last block stays in use: a free tail would be given back
+    for (int i = 0; i + 1 < NUM_BLOCKS; i += 3)
+        heap_free(&h, p[i]);
+
+    // Each thread starts on its own range: none walks the whole heap
+    TEST_ASSERT_EQUAL_INT(0, heap_check_heap_parallel(&h, &report, 4));
+    printf("Blocks: %zu, busiest thread: %zu\n", report.blocks, report.longest);
+    TEST_ASSERT_EQUAL_INT(NUM_BLOCKS, report.blocks);
+    TEST_ASSERT_LESS_THAN(NUM_BLOCKS / 2, report.longest);
+
+    // The first header of every range but the first one, where the threads cut the heap
+    size_t span = align((size_t)(h.region.top - (char*)h.base) / 4);
+    t_block b = h.base;
+    for (int k = 0; k < 3; k++)
+    {
+        while ((char*)b < (char*)h.base + (size_t)(k + 1) * span)
+            b = b->next;
+        cut[k] = b;
+    }
+
+    // A corrupted header at a cut is not found by the thread of that range, the caller checks it
+    for (int map = 0; map < 2; map++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, heap_map(&h, map));
+        for (int k = 0; k < 3; k++)
+            cut[k]->magic = 0;
+        TEST_ASSERT_EQUAL_INT(-1, heap_check_heap_parallel(&h, &report, 4));
+        TEST_ASSERT_EQUAL_PTR(cut[0], report.first_bad);
+        TEST_ASSERT_EQUAL_INT(HEAP_CHECK_COOKIE, report.first_kind);
+        TEST_ASSERT_EQUAL_INT(3, report.errors);
+        TEST_ASSERT_EQUAL_INT(NUM_BLOCKS, report.blocks);
+        for (int k = 0; k < 3; k++)
+            cut[k]->magic = block_cookie(cut[k]);
+        TEST_ASSERT_EQUAL_INT(0, heap_check_heap_parallel(&h, &report, 4));
+        TEST_ASSERT_EQUAL_INT(NUM_BLOCKS, report.blocks);
+    }
+    printf("Corrupted headers at the cuts found with and without the block map\n\n");
+
+    heap_destroy(&h);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_check_consistent_heap);
+    RUN_TEST(test_check_detects_corruption);
+    RUN_TEST(test_check_incremental);
+    RUN_TEST(test_check_parallel);
+    RUN_TEST(test_check_other_heap);
+    RUN_TEST(test_check_parallel_cuts);
+    return UNITY_END();
+}
@@ -0,0 +1,143 @@
+#include "heap_lifetime.h"
+#include "heap_profile.h"
+#include "memory.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Space reserved for the short-lived heap of the tests */
+#define HEAP_SPACE (4 << 20)
+
+/** Age in allocated bytes that makes an object long-lived in the tests */
+#define THRESHOLD 4096
+
+/** Stand-ins for the return addresses of two allocation sites */
+static char long_site, short_site;
+
+/** Short-lived heap of each test */
+static heap_t heap;
+
+/** Predictor of each test, sampling every allocation */
+static heap_lifetime_t lifetime;
+
+void setUp(void)
+{
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, NULL, HEAP_SPACE));
+    TEST_ASSERT_EQUAL_INT(0, heap_lifetime_init(&lifetime, &heap, 1, THRESHOLD));
+}
+
+void tearDown(void)
+{
+    heap_lifetime_destroy(&lifetime);
+    heap_destroy(&heap);
+}
+
+/**
+ * @brief Teach the predictor that long_site keeps its objects and short_site frees them right away.
+ */
+static void train(void)
+{
+    void* kept[8];
+
+    for (int i = 0; i < 8; i++)
+        kept[i] = heap_lifetime_malloc(&lifetime, 256, &long_site);
+    for (int i = 0; i < 200; i++)
+        heap_lifetime_free(&lifetime, heap_lifetime_malloc(&lifetime, 64, &short_site));
+    for (int i = 0; i < 8; i++)
+        heap_lifetime_free(&lifetime, kept[i]);
+}
+
+void test_sites_learn_their_lifetime()
+{
+    printf("Testing lifetime prediction per allocation site...\n");
+    TEST_ASSERT_EQUAL_INT(LIFETIME_UNKNOWN, heap_lifetime_predict(&lifetime, &long_site));
+
+    train();
+    TEST_ASSERT_EQUAL_INT(LIFETIME_LONG, heap_lifetime_predict(&lifetime, &long_site));
+    TEST_ASSERT_EQUAL_INT(LIFETIME_SHORT, heap_lifetime_predict(&lifetime, &short_site));
+    TEST_ASSERT_EQUAL_INT(0, lifetime.live);
+    TEST_ASSERT_EQUAL_INT(2, lifetime.num_sites);
+    printf("Long and short sites told apart\n\n");
+}
+
+void test_long_lived_objects_are_segregated()
+{
+    printf("Testing placement in the long-lived heap...\n");
+    train();
+    TEST_ASSERT_EQUAL_INT(0, lifetime.placed_long);
+
+    char* l = heap_lifetime_malloc(&lifetime, 256, &long_site);
+    char* s = heap_lifetime_malloc(&lifetime, 64, &short_site);
+    TEST_ASSERT_TRUE(heap_lifetime_owns(&lifetime, l));
+    TEST_ASSERT_FALSE(heap_lifetime_owns(&lifetime, s));
+    TEST_ASSERT_EQUAL_INT(1, lifetime.placed_long);
+
+    // Growing a sampled block keeps it in its heap and its sample follows it
+    char* m = heap_lifetime_malloc(&lifetime, 256, &long_site);
+    size_t live = lifetime.live;
+    char* g = heap_lifetime_realloc(&lifetime, l, 4096, &long_site);
+    TEST_ASSERT_TRUE(heap_lifetime_owns(&lifetime, g));
+    TEST_ASSERT_TRUE(g != l);
+    TEST_ASSERT_EQUAL_INT(live, lifetime.live);
+
+    // Freeing routes each block back to its own heap, which gives the memory back
+    heap_lifetime_free(&lifetime, s);
+    TEST_ASSERT_NULL(heap.base);
+    heap_lifetime_free(&lifetime, m);
+    heap_lifetime_free(&lifetime, g);
+    TEST_ASSERT_NULL(lifetime.long_heap.base);
+    printf("Long-lived objects placed apart and freed\n\n");
+}
+
+/**
+ * @brief Long-lived allocation site of the default heap tests.
+ */
+__attribute__((noinline)) static void* session_alloc(void)
+{
+    return malloc(256);
+}
+
+void test_malloc_lifetime()
+{
+    printf("Testing segregation of the default heap...\n");
+    TEST_ASSERT_EQUAL_INT(0, malloc_lifetime(1, THRESHOLD));
+    TEST_ASSERT_NOT_NULL(heap_lifetime_default);
+
+    void* kept[8];
+    for (int i = 0; i < 8; i++)
+        kept[i] = session_alloc();
+    for (int i = 0; i < 200; i++)
+        free(malloc(64));
+    for (int i = 0; i < 8; i++)
+        free(kept[i]);
+
+    // The predictor keys the sites of malloc by the return address of its caller
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_start(1));
+    size_t sampled = heap_profile_sampled;
+    void* p = session_alloc();
+    TEST_ASSERT_TRUE(heap_lifetime_owns(heap_lifetime_default, p));
+
+    // The long-lived heap is part of malloc's heap for the profiler and the address checks
+    TEST_ASSERT_EQUAL_INT(sampled + 1, heap_profile_sampled);
+    TEST_ASSERT_TRUE(valid_addr(p));
+
+    // Once stopped, new requests go to the default heap but old blocks still go back to theirs
+    TEST_ASSERT_EQUAL_INT(0, malloc_lifetime(0, 0));
+    void* q = session_alloc();
+    TEST_ASSERT_FALSE(heap_lifetime_owns(heap_lifetime_default, q));
+    free(p);
+    free(q);
+    TEST_ASSERT_EQUAL_INT(sampled, heap_profile_sampled);
+    heap_profile_stop();
+    TEST_ASSERT_NULL(heap_lifetime_default->long_heap.base);
+    printf("malloc segregated and stopped\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_sites_learn_their_lifetime);
+    RUN_TEST(test_long_lived_objects_are_segregated);
+    RUN_TEST(test_malloc_lifetime);
+    return UNITY_END();
+}
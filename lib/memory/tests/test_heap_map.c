@@ -0,0 +1,164 @@
+#include "heap_map.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Space reserved for the heaps of the tests */
+#define HEAP_SPACE (16 << 20)
+
+/** Live slots of the random workload */
+#define SLOTS 512
+
+/** Heap with the block map and the same heap without it */
+static heap_t mapped, plain;
+
+void setUp(void)
+{
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&mapped, NULL, HEAP_SPACE));
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&plain, NULL, HEAP_SPACE));
+    TEST_ASSERT_EQUAL_INT(0, heap_map(&mapped, 1));
+}
+
+void tearDown(void)
+{
+    heap_destroy(&mapped);
+    heap_destroy(&plain);
+}
+
+/**
+ * @brief Check that the map counts the same blocks and bytes as a walk of the headers.
+ */
+static void assert_same_blocks(heap_t* h)
+{
+    heap_blocks_t by_map, by_list;
+    heap_map_t map = h->map;
+
+    heap_blocks(h, &by_map);
+    h->map.starts = NULL;
+    heap_blocks(h, &by_list);
+    h->map = map;
+    TEST_ASSERT_EQUAL_INT(by_list.blocks, by_map.blocks);
+    TEST_ASSERT_EQUAL_INT(by_list.free_blocks, by_map.free_blocks);
+    TEST_ASSERT_EQUAL_INT(by_list.used_bytes, by_map.used_bytes);
+    TEST_ASSERT_EQUAL_INT(by_list.free_bytes, by_map.free_bytes);
+}
+
+/**
+ * @brief Run the same random mallocs, frees and reallocs on both heaps and check they place every block alike.
+ */
+static void run_policy(int policy)
+{
+    char* a[SLOTS] = {0};
+    char* b[SLOTS] = {0};
+    unsigned seed = 42;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_control(&mapped, policy));
+    TEST_ASSERT_EQUAL_INT(0, heap_control(&plain, policy));
+    for (int i = 0; i < 20000; i++)
+    {
+        int slot = rand_r(&seed) % SLOTS;
+        size_t size = (size_t)(rand_r(&seed) % 2048) + 1;
+        if (i % 7 == 0 && a[slot])
+        {
+            a[slot] = heap_realloc(&mapped, a[slot], size);
+            b[slot] = heap_realloc(&plain, b[slot], size);
+        }
+        else if (a[slot])
+        {
+            heap_free(&mapped, a[slot]);
+            heap_free(&plain, b[slot]);
+            a[slot] = b[slot] = NULL;
+        }
+        else
+        {
+            a[slot] = heap_malloc(&mapped, size);
+            b[slot] = heap_malloc(&plain, size);
+        }
+        TEST_ASSERT_EQUAL_INT(b[slot] ? b[slot] - plain.region.start : -1,
+                              a[slot] ? a[slot] - mapped.region.start : -1);
+        if (i % 1000 == 0)
+            assert_same_blocks(&mapped);
+    }
+    assert_same_blocks(&mapped);
+    for (int slot = 0; slot < SLOTS; slot++)
+    {
+        heap_free(&mapped, a[slot]);
+        heap_free(&plain, b[slot]);
+    }
+    heap_consolidate(&mapped);
+    heap_consolidate(&plain);
+    TEST_ASSERT_NULL(mapped.base);
+    assert_same_blocks(&mapped);
+}
+
+void test_first_fit_places_blocks_like_the_list()
+{
+    printf("Testing first fit over the block map...\n");
+    run_policy(FIRST_FIT);
+    printf("Same placement as the header walk\n\n");
+}
+
+void test_best_and_worst_fit_place_blocks_like_the_list()
+{
+    printf("Testing best and worst fit over the block map...\n");
+    run_policy(BEST_FIT);
+    run_policy(WORST_FIT);
+    printf("Same placement as the header walk\n\n");
+}
+
+void test_fast_bins_and_usage()
+{
+    printf("Testing the block map with fast bins...\n");
+    TEST_ASSERT_EQUAL_INT(0, heap_fastbins(&mapped, 128));
+    TEST_ASSERT_EQUAL_INT(0, heap_fastbins(&plain, 128));
+    run_policy(FIRST_FIT);
+
+    // Parked blocks stay occupied in the map and free for heap_usage
+    char* p = heap_malloc(&mapped, 64);
+    heap_malloc(&mapped, 64);
+    heap_free(&mapped, p);
+    heap_blocks_t blocks;
+    heap_blocks(&mapped, &blocks);
+    TEST_ASSERT_EQUAL_INT(0, blocks.free_blocks);
+    size_t allocated, free_bytes;
+    heap_usage(&mapped, &allocated, &free_bytes);
+    TEST_ASSERT_EQUAL_INT(64, allocated);
+    TEST_ASSERT_EQUAL_INT(64, free_bytes);
+    printf("Parked blocks counted as in the list\n\n");
+}
+
+void test_enable_late_rebuild_and_disable()
+{
+    printf("Testing enabling, rebuilding and disabling the map...\n");
+    char* p[64];
+    for (int i = 0; i < 64; i++)
+        p[i] = heap_malloc(&plain, (size_t)(i + 1) * 24);
+    for (int i = 0; i < 64; i += 2)
+        heap_free(&plain, p[i]);
+
+    // Built from the list of a heap already in use
+    TEST_ASSERT_EQUAL_INT(0, heap_map(&plain, 1));
+    assert_same_blocks(&plain);
+
+    // A block torn in the middle of an extension is dropped by the rebuild, and by the map
+    char* torn = heap_malloc(&plain, 4000);
+    get_block(torn)->magic = 0;
+    TEST_ASSERT_EQUAL_INT(1, heap_rebuild(&plain, 0));
+    assert_same_blocks(&plain);
+    TEST_ASSERT_EQUAL_PTR(torn, heap_malloc(&plain, 4000));
+
+    TEST_ASSERT_EQUAL_INT(0, heap_map(&plain, 0));
+    TEST_ASSERT_NULL(plain.map.starts);
+    TEST_ASSERT_EQUAL_INT(-1, heap_map(heap_default(), 1));
+    printf("Map rebuilt with the heap\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_first_fit_places_blocks_like_the_list);
+    RUN_TEST(test_best_and_worst_fit_place_blocks_like_the_list);
+    RUN_TEST(test_fast_bins_and_usage);
+    RUN_TEST(test_enable_late_rebuild_and_disable);
+    return UNITY_END();
+}
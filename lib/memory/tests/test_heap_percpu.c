@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include "heap_percpu.h"
+#include "unity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Space reserved for the heaps of the tests */
+#define HEAP_SPACE (64 << 20)
+
+/** Threads of the concurrent test, many more than the CPUs of a test machine */
+#define THREADS 16
+
+/** Live slots of each thread in the concurrent test */
+#define SLOTS 64
+
+/** Operations of each thread in the concurrent test */
+#define OPS 20000
+
+/** Both kinds of caches: rseq when the system has it, and the mutex fallback */
+static const int modes[] = {0, HEAP_PERCPU_LOCKED};
+
+static heap_percpu_t pc;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+    heap_percpu_destroy(&pc);
+}
+
+/**
+ * @brief Keep the calling thread on the CPU it runs on, so consecutive operations see the same stacks.
+ */
+static void pin_to_cpu(void)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(sched_getcpu(), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+/**
+ * @brief Allow the calling thread on every CPU again.
+ */
+static void unpin(void)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+/**
+ * @brief Bytes still allocated in the backing heap.
+ */
+static size_t allocated_in_heap(void)
+{
+    size_t allocated, free_bytes;
+    heap_usage(&pc.heap, &allocated, &free_bytes);
+    return allocated;
+}
+
+void test_small_blocks_come_back_from_the_cache_of_the_cpu()
+{
+    printf("Testing per-CPU stacks...\n");
+    pin_to_cpu();
+    for (size_t m = 0; m < sizeof(modes) / sizeof(*modes); m++)
+    {
+        heap_percpu_stats_t stats;
+        TEST_ASSERT_EQUAL_INT(0, heap_percpu_init(&pc, HEAP_SPACE, modes[m]));
+        heap_percpu_stats(&pc, &stats);
+        if (modes[m] == HEAP_PERCPU_LOCKED)
+            TEST_ASSERT_EQUAL_INT(0, stats.rseq);
+        printf("  %s caches\n", stats.rseq ? "rseq" : "locked");
+
+        // The first request fills the stack of its class with a batch
+        char* p = heap_percpu_malloc(&pc, 100);
+        TEST_ASSERT_NOT_NULL(p);
+        memset(p, 0xab, 100);
+        heap_percpu_stats(&pc, &stats);
+        TEST_ASSERT_EQUAL_INT(1, stats.refills);
+        TEST_ASSERT_EQUAL_INT(HEAP_PERCPU_BATCH - 1, stats.cached_blocks);
+        TEST_ASSERT_EQUAL_INT(HEAP_PERCPU_BATCH * 112, allocated_in_heap());
+
+        // Freed onto the stack of this CPU and handed out again first
+        heap_percpu_free(&pc, p);
+        TEST_ASSERT_EQUAL_PTR(p, heap_percpu_malloc(&pc, 97));
+        heap_percpu_free(&pc, p);
+
+        // Large blocks go straight back to the heap
+        char* big = heap_percpu_malloc(&pc, 4096);
+        TEST_ASSERT_NOT_NULL(big);
+        heap_percpu_free(&pc, big);
+        heap_percpu_stats(&pc, &stats);
+        TEST_ASSERT_EQUAL_INT(HEAP_PERCPU_BATCH, stats.cached_blocks);
+        TEST_ASSERT_EQUAL_INT(1, stats.refills);
+        TEST_ASSERT_NULL(heap_percpu_malloc(&pc, 0));
+        heap_percpu_free(&pc, NULL);
+        heap_percpu_free(&pc, &stats);
+
+        heap_percpu_drain(&pc);
+        TEST_ASSERT_EQUAL_INT(0, allocated_in_heap());
+        heap_percpu_destroy(&pc);
+    }
+    unpin();
+    printf("Blocks reused from the stacks\n\n");
+}
+
+void test_full_stacks_flush_to_the_heap()
+{
+    printf("Testing full stacks...\n");
+    pin_to_cpu();
+    for (size_t m = 0; m < sizeof(modes) / sizeof(*modes); m++)
+    {
+        void* p[HEAP_PERCPU_DEPTH * 3];
+        heap_percpu_stats_t stats;
+
+        TEST_ASSERT_EQUAL_INT(0, heap_percpu_init(&pc, HEAP_SPACE, modes[m]));
+        for (int i = 0; i < HEAP_PERCPU_DEPTH * 3; i++)
+            TEST_ASSERT_NOT_NULL(p[i] = heap_percpu_malloc(&pc, 64));
+        for (int i = 0; i < HEAP_PERCPU_DEPTH * 3; i++)
+            heap_percpu_free(&pc, p[i]);
+
+        // One class of one CPU never holds more than a stack
+        heap_percpu_stats(&pc, &stats);
+        TEST_ASSERT_TRUE(stats.flushes > 0);
+        TEST_ASSERT_TRUE(stats.cached_blocks <= HEAP_PERCPU_DEPTH);
+        TEST_ASSERT_EQUAL_INT(stats.cached_bytes, allocated_in_heap());
+
+        // Drained, every block is free and the heap gives its tail back
+        heap_percpu_drain(&pc);
+        heap_percpu_stats(&pc, &stats);
+        TEST_ASSERT_EQUAL_INT(0, stats.cached_blocks);
+        TEST_ASSERT_EQUAL_INT(0, stats.cached_bytes);
+        TEST_ASSERT_EQUAL_INT(0, allocated_in_heap());
+        TEST_ASSERT_NULL(pc.heap.base);
+        heap_percpu_destroy(&pc);
+    }
+    unpin();
+    printf("Full stacks flushed\n\n");
+}
+
+/**
+ * @brief A thread of the concurrent test: random small and large blocks, each filled with its slot and thread
+ * and checked before it is freed.
+ */
+static void* churn(void* arg)
+{
+    unsigned id = (unsigned)(uintptr_t)arg;
+    unsigned seed = id;
+    unsigned char* live[SLOTS] = {0};
+    size_t sizes[SLOTS] = {0};
+    long broken = 0;
+
+    for (int i = 0; i < OPS; i++)
+    {
+        int slot = rand_r(&seed) % SLOTS;
+        if (live[slot])
+        {
+            for (size_t j = 0; j < sizes[slot]; j++)
+                broken += live[slot][j] != (unsigned char)(slot + id);
+            heap_percpu_free(&pc, live[slot]);
+            live[slot] = NULL;
+        }
+        else
+        {
+            // One in sixteen is larger than the caches serve
+            sizes[slot] = (size_t)(rand_r(&seed) % (i % 16 ? HEAP_PERCPU_MAX : 2048)) + 1;
+            live[slot] = heap_percpu_malloc(&pc, sizes[slot]);
+            if (!live[slot])
+                return (void*)-1;
+            memset(live[slot], (unsigned char)(slot + id), sizes[slot]);
+        }
+    }
+    for (int slot = 0; slot < SLOTS; slot++)
+        heap_percpu_free(&pc, live[slot]);
+    return (void*)broken;
+}
+
+void test_threads_share_the_caches()
+{
+    printf("Testing %d threads over the caches...\n", THREADS);
+    for (size_t m = 0; m < sizeof(modes) / sizeof(*modes); m++)
+    {
+        pthread_t threads[THREADS];
+        heap_percpu_stats_t stats;
+
+        TEST_ASSERT_EQUAL_INT(0, heap_percpu_init(&pc, HEAP_SPACE, modes[m]));
+        for (int t = 0; t < THREADS; t++)
+            TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[t], NULL, churn, (void*)(uintptr_t)(t + 1)));
+        // Reading the stacks while they change, and while the heap trims its top, never faults
+        for (int i = 0; i < OPS / 100; i++)
+            heap_percpu_stats(&pc, &stats);
+        for (int t = 0; t < THREADS; t++)
+        {
+            void* broken;
+            pthread_join(threads[t], &broken);
+            TEST_ASSERT_NULL(broken);
+        }
+
+        // What stays cached depends on the CPUs, not on the threads
+        heap_percpu_stats(&pc, &stats);
+        TEST_ASSERT_TRUE(stats.cached_blocks <= (size_t)pc.cpus * HEAP_PERCPU_CLASSES * HEAP_PERCPU_DEPTH);
+        TEST_ASSERT_EQUAL_INT(stats.cached_bytes, allocated_in_heap());
+        heap_percpu_drain(&pc);
+        TEST_ASSERT_EQUAL_INT(0, allocated_in_heap());
+        heap_percpu_destroy(&pc);
+    }
+    printf("No block handed out twice\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_small_blocks_come_back_from_the_cache_of_the_cpu);
+    RUN_TEST(test_full_stacks_flush_to_the_heap);
+    RUN_TEST(test_threads_share_the_caches);
+    return UNITY_END();
+}
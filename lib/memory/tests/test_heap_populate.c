@@ -0,0 +1,107 @@
+#include "heap_populate.h"
+#include "memory.h"
+#include "unity.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/** Space reserved for the heap of the tests */
+#define HEAP_SPACE (1UL << 30)
+
+/** Size of the buffers: large enough for three populating threads */
+#define BUFFER_SIZE (3UL * HEAP_POPULATE_MIN)
+
+/** Heap of each test */
+static heap_t heap;
+
+void setUp(void)
+{
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, NULL, HEAP_SPACE));
+}
+
+void tearDown(void)
+{
+    heap_destroy(&heap);
+    calloc_populate(0, 0);
+}
+
+/**
+ * @brief Count the resident pages of a range.
+ */
+static size_t resident_pages(void* p, size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char* start = (char*)((uintptr_t)p & ~(page - 1));
+    size_t pages = ((char*)p + size - start + page - 1) / page;
+    unsigned char* vec = malloc(pages);
+    size_t resident = 0;
+
+    TEST_ASSERT_EQUAL_INT(0, mincore(start, pages * page, vec));
+    for (size_t i = 0; i < pages; i++)
+        resident += vec[i] & 1;
+    free(vec);
+    return resident;
+}
+
+void test_malloc_populate_backs_every_page()
+{
+    printf("Testing prefaulted allocations...\n");
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    // A fresh block has no pages behind it until it is touched
+    char* lazy = heap_malloc(&heap, BUFFER_SIZE);
+    TEST_ASSERT_NOT_NULL(lazy);
+    TEST_ASSERT_TRUE(resident_pages(lazy, BUFFER_SIZE) < BUFFER_SIZE / page / 2);
+    heap_free(&heap, lazy);
+
+    char* ready = heap_malloc_populate(&heap, BUFFER_SIZE, 8);
+    TEST_ASSERT_NOT_NULL(ready);
+    TEST_ASSERT_TRUE(resident_pages(ready, BUFFER_SIZE) >= BUFFER_SIZE / page);
+
+    // Touching by hand gives the same result, and both keep the data
+    ready[0] = 'a';
+    ready[BUFFER_SIZE / 2] = 'b';
+    ready[BUFFER_SIZE - 1] = 'c';
+    TEST_ASSERT_EQUAL_INT(3, heap_populate(ready, BUFFER_SIZE, 8, HEAP_POPULATE_TOUCH));
+    TEST_ASSERT_EQUAL_INT(1, heap_populate(ready, HEAP_POPULATE_MIN, 8, 0));
+    TEST_ASSERT_EQUAL_INT('a', ready[0]);
+    TEST_ASSERT_EQUAL_INT('b', ready[BUFFER_SIZE / 2]);
+    TEST_ASSERT_EQUAL_INT('c', ready[BUFFER_SIZE - 1]);
+    TEST_ASSERT_EQUAL_INT(-1, heap_populate(NULL, BUFFER_SIZE, 8, 0));
+    heap_free(&heap, ready);
+    printf("Every page backed before use\n\n");
+}
+
+void test_calloc_populate_zeroes_in_parallel()
+{
+    printf("Testing parallel zeroing in calloc...\n");
+    char* dirty = heap_malloc(&heap, BUFFER_SIZE);
+    void* wall = heap_malloc(&heap, 64);
+    memset(dirty, 0xff, BUFFER_SIZE);
+    heap_free(&heap, dirty);
+
+    // The recycled block must come back zeroed, not just backed
+    calloc_populate(1, 3);
+    TEST_ASSERT_EQUAL_INT(3, heap_calloc_threads);
+    char* zeroed = heap_calloc(&heap, BUFFER_SIZE / 8, 8);
+    TEST_ASSERT_EQUAL_PTR(dirty, zeroed);
+    for (size_t i = 0; i < BUFFER_SIZE; i += 4093)
+        TEST_ASSERT_EQUAL_INT(0, zeroed[i]);
+    TEST_ASSERT_EQUAL_INT(0, zeroed[BUFFER_SIZE - 1]);
+
+    calloc_populate(0, 3);
+    TEST_ASSERT_EQUAL_INT(0, heap_calloc_threads);
+    heap_free(&heap, zeroed);
+    heap_free(&heap, wall);
+    printf("calloc zeroed by several threads\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_malloc_populate_backs_every_page);
+    RUN_TEST(test_calloc_populate_zeroes_in_parallel);
+    return UNITY_END();
+}
@@ -0,0 +1,174 @@
+#include "heap_profile.h"
+#include "memory.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of allocations made while profiling */
+#define NUM_ALLOCATIONS 100
+
+/** Path of the profile written by the tests */
+#define PROFILE_PATH "heap_profile_test.prof"
+
+void setUp(void)
+{
+    heap_profile_reset();
+}
+
+void tearDown(void)
+{
+    heap_profile_stop();
+    remove(PROFILE_PATH);
+}
+
+/**
+ * @brief Reads the header line of the dumped profile
+ *
+ * @param live_count Sampled live allocations
+ * @param live_bytes Sampled live bytes
+ * @param alloc_count Sampled allocations
+ * @return int Number of fields parsed
+ */
+static int read_header(unsigned long* live_count, unsigned long* live_bytes, unsigned long* alloc_count)
+{
+    FILE* file = fopen(PROFILE_PATH, "r");
+    if (file == NULL)
+        return 0;
+    int n = fscanf(file, "heap profile: %lu: %lu [%lu:", live_count, live_bytes, alloc_count);
+    fclose(file);
+    return n;
+}
+
+void test_profile_samples_live_allocations()
+{
+    printf("Testing heap profile sampling...\n");
+    void* ptrs[NUM_ALLOCATIONS];
+    unsigned long live_count = 0, live_bytes = 0, alloc_count = 0;
+
+    // A one byte interval samples every allocation
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_start(1));
+    for (int i = 0; i < NUM_ALLOCATIONS; i++)
+    {
+        ptrs[i] = malloc(64);
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_dump(PROFILE_PATH, HEAP_PROFILE_PPROF));
+    TEST_ASSERT_EQUAL_INT(3, read_header(&live_count, &live_bytes, &alloc_count));
+    printf("Live samples: %lu (%lu bytes), total samples: %lu\n", live_count, live_bytes, alloc_count);
+    TEST_ASSERT_EQUAL_INT(NUM_ALLOCATIONS, live_count);
+    TEST_ASSERT_EQUAL_INT(NUM_ALLOCATIONS * 64, live_bytes);
+
+    for (int i = 0; i < NUM_ALLOCATIONS; i++)
+    {
+        free(ptrs[i]);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_dump(PROFILE_PATH, HEAP_PROFILE_PPROF));
+    TEST_ASSERT_EQUAL_INT(3, read_header(&live_count, &live_bytes, &alloc_count));
+    printf("After free: %lu live samples, %lu total samples\n\n", live_count, alloc_count);
+    TEST_ASSERT_EQUAL_INT(0, live_count);
+    TEST_ASSERT_EQUAL_INT(0, live_bytes);
+    TEST_ASSERT_GREATER_OR_EQUAL(NUM_ALLOCATIONS, alloc_count);
+}
+
+void test_profile_folded_output()
+{
+    printf("Testing folded heap profile...\n");
+    char line[4096];
+
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_start(1));
+    void* ptr = malloc(4096);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_dump(PROFILE_PATH, HEAP_PROFILE_FOLDED));
+
+    FILE* file = fopen(PROFILE_PATH, "r");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line), file));
+    fclose(file);
+    printf("Folded stack: %s\n", line);
+
+    // Every line ends with the estimated live bytes of the stack
+    char* bytes = strrchr(line, ' ');
+    TEST_ASSERT_NOT_NULL(bytes);
+    TEST_ASSERT_GREATER_OR_EQUAL(4096, strtoul(bytes + 1, NULL, 10));
+
+    free(ptr);
+}
+
+/**
+ * @brief Allocation site the profile must name as the leaf of its stack
+ *
+ * @param size Bytes to allocate
+ * @return void* The allocation
+ */
+__attribute__((noinline)) void* profiled_site(size_t size)
+{
+    void* ptr = malloc(size);
+    // Keeps the call to malloc from becoming a tail jump that leaves no frame here
+    __asm__ volatile("" ::: "memory");
+    return ptr;
+}
+
+void test_profile_names_the_calling_function()
+{
+    printf("Testing heap profile attribution...\n");
+    char line[4096];
+    int found = 0;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_start(1));
+    void* ptr = profiled_site(8192);
+    void* zeroed = calloc(1, 8192);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_NOT_NULL(zeroed);
+    heap_profile_stop();
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_dump(PROFILE_PATH, HEAP_PROFILE_FOLDED));
+
+    FILE* file = fopen(PROFILE_PATH, "r");
+    TEST_ASSERT_NOT_NULL(file);
+    while (fgets(line, sizeof(line), file))
+    {
+        // The leaf is the last frame, between the last ';' and the byte count
+        *strrchr(line, ' ') = '\0';
+        char* leaf = strrchr(line, ';');
+        leaf = leaf ? leaf + 1 : line;
+        printf("Leaf frame: %s\n", leaf);
+        TEST_ASSERT_NULL(strstr(leaf, "malloc"));
+        TEST_ASSERT_NULL(strstr(leaf, "calloc"));
+        found += strcmp(leaf, "profiled_site") == 0;
+    }
+    fclose(file);
+    TEST_ASSERT_EQUAL_INT(1, found);
+    printf("Samples attributed to their caller\n\n");
+
+    free(ptr);
+    free(zeroed);
+}
+
+void test_profile_stopped_does_not_sample()
+{
+    printf("Testing stopped heap profile...\n");
+    unsigned long live_count = 0, live_bytes = 0, alloc_count = 0;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_start(1));
+    heap_profile_stop();
+    void* ptr = malloc(128);
+    TEST_ASSERT_NOT_NULL(ptr);
+
+    TEST_ASSERT_EQUAL_INT(0, heap_profile_dump(PROFILE_PATH, HEAP_PROFILE_PPROF));
+    TEST_ASSERT_EQUAL_INT(3, read_header(&live_count, &live_bytes, &alloc_count));
+    TEST_ASSERT_EQUAL_INT(0, alloc_count);
+    free(ptr);
+    printf("No samples taken while stopped\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_profile_samples_live_allocations);
+    RUN_TEST(test_profile_folded_output);
+    RUN_TEST(test_profile_names_the_calling_function);
+    RUN_TEST(test_profile_stopped_does_not_sample);
+    return UNITY_END();
+}
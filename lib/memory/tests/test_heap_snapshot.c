@@ -0,0 +1,216 @@
+#include "heap_snapshot.h"
+#include "unity.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** File the snapshots of the tests are written to */
+#define SNAPSHOT_PATH "test_heap_snapshot.bin"
+
+/** Blocks allocated in the heap of the tests */
+#define NUM_BLOCKS 600
+
+/** Maximum records read back from a snapshot */
+#define MAX_RECORDS 4096
+
+void setUp(void)
+{
+    unlink(SNAPSHOT_PATH);
+}
+
+void tearDown(void)
+{
+    unlink(SNAPSHOT_PATH);
+}
+
+/**
+ * @brief Reads one snapshot from the current position of a file
+ *
+ * @param fd File with snapshots
+ * @param hd Receives the header
+ * @param records Receives up to MAX_RECORDS records
+ * @return int 1 if a snapshot was read, 0 at end of file
+ */
+static int read_snapshot(int fd, heap_snapshot_header* hd, heap_snapshot_record* records)
+{
+    ssize_t n = read(fd, hd, sizeof(*hd));
+    if (n == 0)
+        return 0;
+    TEST_ASSERT_EQUAL_INT(sizeof(*hd), n);
+    TEST_ASSERT_EQUAL_INT(HEAP_SNAPSHOT_MAGIC, hd->magic);
+    TEST_ASSERT_EQUAL_INT(HEAP_SNAPSHOT_VERSION, hd->version);
+    TEST_ASSERT_TRUE(hd->count <= MAX_RECORDS);
+    TEST_ASSERT_EQUAL_INT(hd->count * sizeof(*records), read(fd, records, hd->count * sizeof(*records)));
+    return 1;
+}
+
+/**
+ * @brief Checks that a snapshot lists the blocks of a heap in order
+ *
+ * @param h Heap
+ * @param hd Header of the snapshot
+ * @param records Records of the snapshot
+ */
+static void check_matches(heap_t* h, heap_snapshot_header* hd, heap_snapshot_record* records)
+{
+    size_t i = 0;
+
+    TEST_ASSERT_EQUAL_INT(0, hd->flags);
+    TEST_ASSERT_EQUAL_PTR(h->base, (void*)(uintptr_t)hd->start);
+    for (t_block b = h->base; b; b = b->next, i++)
+    {
+        TEST_ASSERT_TRUE(i < hd->count);
+        TEST_ASSERT_EQUAL_PTR(b, (void*)(uintptr_t)records[i].address);
+        TEST_ASSERT_EQUAL_INT(b->size, records[i].size & ~(uint64_t)HEAP_SNAPSHOT_FLAGS);
+        TEST_ASSERT_EQUAL_INT(b->free, records[i].size & HEAP_SNAPSHOT_FREE);
+    }
+    TEST_ASSERT_EQUAL_INT(hd->count, i);
+}
+
+void test_snapshot_lists_blocks()
+{
+    printf("Testing heap snapshot of a heap...\n");
+    static heap_snapshot_record records[MAX_RECORDS];
+    static void* blocks[NUM_BLOCKS];
+    heap_snapshot_header hd;
+    heap_t heap;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, NULL, 1 << 22));
+    TEST_ASSERT_EQUAL_INT(0, heap_control(&heap, BEST_FIT));
+    for (int i = 0; i < NUM_BLOCKS; i++)
+        blocks[i] = heap_malloc(&heap, (size_t)(i % 7 + 1) * 24);
+    for (int i = 0; i < NUM_BLOCKS; i += 3)
+        heap_free(&heap, blocks[i]);
+
+    int fd = open(SNAPSHOT_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(0, heap_snapshot(&heap, 3, fd));
+    TEST_ASSERT_EQUAL_INT(0, lseek(fd, 0, SEEK_SET));
+    TEST_ASSERT_EQUAL_INT(1, read_snapshot(fd, &hd, records));
+    TEST_ASSERT_EQUAL_INT(0, read_snapshot(fd, &hd, records));
+    close(fd);
+
+    TEST_ASSERT_EQUAL_INT(3, hd.arena);
+    TEST_ASSERT_EQUAL_INT(BEST_FIT, hd.policy);
+    TEST_ASSERT_EQUAL_PTR(heap.region.top, (void*)(uintptr_t)hd.top);
+    check_matches(&heap, &hd, records);
+    heap_destroy(&heap);
+    printf("%zu blocks in the snapshot\n\n", (size_t)hd.count);
+}
+
+void test_snapshot_marks_parked_blocks()
+{
+    printf("Testing heap snapshot of parked blocks...\n");
+    static heap_snapshot_record records[MAX_RECORDS];
+    static void* blocks[NUM_BLOCKS];
+    heap_snapshot_header hd;
+    heap_t heap;
+    size_t parked = 0;
+
+    // More blocks than one batch of the snapshot, so parked blocks fall in several batches
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, NULL, 1 << 22));
+    TEST_ASSERT_EQUAL_INT(0, heap_fastbins(&heap, 64));
+    for (int i = 0; i < NUM_BLOCKS; i++)
+        blocks[i] = heap_malloc(&heap, (size_t)(i % 4 + 1) * 24);
+    for (int i = 0; i < NUM_BLOCKS; i += 5)
+    {
+        heap_free(&heap, blocks[i]);
+        blocks[i] = NULL;
+    }
+
+    int fd = open(SNAPSHOT_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(0, heap_snapshot(&heap, 0, fd));
+    TEST_ASSERT_EQUAL_INT(0, lseek(fd, 0, SEEK_SET));
+    TEST_ASSERT_EQUAL_INT(1, read_snapshot(fd, &hd, records));
+    close(fd);
+    check_matches(&heap, &hd, records);
+
+    // Exactly the blocks in the fast bins are marked: still in use in the list, but free to the next malloc
+    for (size_t i = 0; i < hd.count; i++)
+    {
+        t_block b = (t_block)(uintptr_t)records[i].address;
+        int in_bin = 0;
+        for (t_block f = b->size <= heap.fast_max ? heap.fastbins[b->size >> 3] : NULL; f; f = fast_next(f))
+            in_bin |= f == b;
+        TEST_ASSERT_EQUAL_INT(in_bin, (records[i].size & HEAP_SNAPSHOT_PARKED) != 0);
+        parked += in_bin;
+    }
+    printf("%zu parked blocks out of %zu\n\n", parked, (size_t)hd.count);
+    TEST_ASSERT_EQUAL_INT(NUM_BLOCKS / 5 / 2, parked);
+
+    for (int i = 0; i < NUM_BLOCKS; i++)
+        heap_free(&heap, blocks[i]);
+    heap_destroy(&heap);
+}
+
+void test_snapshot_appends_on_signal()
+{
+    printf("Testing heap snapshots triggered by a signal...\n");
+    static heap_snapshot_record records[MAX_RECORDS];
+    heap_snapshot_header first, second;
+
+    void* a = malloc(100);
+    void* b = malloc(200);
+    void* c = malloc(300);
+    free(b);
+    TEST_ASSERT_EQUAL_INT(0, heap_snapshot_on_signal(SIGUSR1, SNAPSHOT_PATH));
+    raise(SIGUSR1);
+    free(a);
+    raise(SIGUSR1);
+
+    // Each signal appends a snapshot, the last one matches the heap as it is now
+    int fd = open(SNAPSHOT_PATH, O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(1, read_snapshot(fd, &first, records));
+    TEST_ASSERT_EQUAL_INT(1, read_snapshot(fd, &second, records));
+    TEST_ASSERT_EQUAL_INT(0, read_snapshot(fd, &second, records));
+    close(fd);
+    TEST_ASSERT_TRUE(second.time_ns >= first.time_ns);
+    TEST_ASSERT_EQUAL_INT(0, second.arena);
+    check_matches(heap_default(), &second, records);
+
+    signal(SIGUSR1, SIG_DFL);
+    free(c);
+    printf("Two snapshots appended\n\n");
+}
+
+void test_snapshot_stops_at_bad_link()
+{
+    printf("Testing heap snapshot of a corrupted list...\n");
+    static heap_snapshot_record records[MAX_RECORDS];
+    heap_snapshot_header hd;
+    heap_t heap;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, NULL, 1 << 20));
+    void* p[4];
+    for (int i = 0; i < 4; i++)
+        p[i] = heap_malloc(&heap, 64);
+
+    // A link that points backwards would make the walk loop forever
+    t_block b = get_block(p[2]);
+    t_block next = b->next;
+    b->next = get_block(p[0]);
+    int fd = open(SNAPSHOT_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT_EQUAL_INT(0, heap_snapshot(&heap, 0, fd));
+    b->next = next;
+
+    TEST_ASSERT_EQUAL_INT(0, lseek(fd, 0, SEEK_SET));
+    TEST_ASSERT_EQUAL_INT(1, read_snapshot(fd, &hd, records));
+    close(fd);
+    TEST_ASSERT_EQUAL_INT(HEAP_SNAPSHOT_TRUNCATED, hd.flags);
+    TEST_ASSERT_EQUAL_INT(2, hd.count);
+    heap_destroy(&heap);
+    printf("Walk stopped before the bad block\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_snapshot_lists_blocks);
+    RUN_TEST(test_snapshot_marks_parked_blocks);
+    RUN_TEST(test_snapshot_appends_on_signal);
+    RUN_TEST(test_snapshot_stops_at_bad_link);
+    return UNITY_END();
+}
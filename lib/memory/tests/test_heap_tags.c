@@ -0,0 +1,269 @@
+#include "heap.h"
+#include "heap_tags.h"
+#include "memory.h"
+#include "unity.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Threads of the concurrent test */
+#define THREADS 4
+
+/** Blocks each thread allocates in the concurrent test */
+#define PER_THREAD 1000
+
+/** Threads of the shared counter test: more than the per-thread counters, so some must share one */
+#define SHARED_THREADS (HEAP_TAG_THREADS + 8)
+
+/** Allocation and free pairs each thread accounts in the shared counter test */
+#define SHARED_ROUNDS 20000
+
+/** Space reserved for the heap of each thread */
+#define HEAP_SPACE (1 << 20)
+
+/**
+ * @brief A thread of the concurrent test: the default heap is not thread safe, so each one has its own
+ */
+typedef struct
+{
+    heap_t heap;              /**< Heap of the thread */
+    int tag;                  /**< Tag the thread allocates with */
+    void* blocks[PER_THREAD]; /**< Blocks allocated by the thread */
+} Worker;
+
+/** Budget crossings seen by budget_exceeded */
+static int crossings;
+
+void setUp(void)
+{
+    crossings = 0;
+    heap_tag_set(0);
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * @brief Budget callback of the tests: counts the crossings.
+ */
+static void budget_exceeded(int tag, size_t live, size_t budget, void* arg)
+{
+    (void)tag;
+    (void)arg;
+    TEST_ASSERT_TRUE(live > budget);
+    crossings++;
+}
+
+/**
+ * @brief Live bytes of a tag.
+ */
+static int64_t live_of(int tag)
+{
+    heap_tag_stats_t stats;
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_stats(tag, &stats));
+    return stats.live;
+}
+
+void test_blocks_are_charged_to_their_tag()
+{
+    printf("Testing per-tag accounting...\n");
+    int parser = heap_tag_create("parser", 0, NULL, NULL);
+    int cache = heap_tag_create("cache", 0, NULL, NULL);
+    TEST_ASSERT_TRUE(parser > 0);
+    TEST_ASSERT_TRUE(cache > parser);
+    TEST_ASSERT_EQUAL_INT(-1, heap_tag_set(HEAP_TAG_MAX));
+
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_set(parser));
+    void* a = malloc(100);
+    void* b = malloc(200);
+    TEST_ASSERT_EQUAL_INT(parser, heap_tag_set(0));
+    void* c = malloc_tagged(cache, 1000);
+    void* untagged = malloc(50);
+
+    heap_tag_stats_t stats;
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_stats(parser, &stats));
+    TEST_ASSERT_EQUAL_STRING("parser", stats.name);
+    TEST_ASSERT_EQUAL_INT(104 + 200, stats.live);
+    TEST_ASSERT_EQUAL_INT(2, stats.allocs);
+    TEST_ASSERT_EQUAL_INT(1000, live_of(cache));
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_current);
+
+    // Whoever frees the block, the bytes go back to the tag that allocated it
+    heap_tag_set(cache);
+    free(a);
+    free(b);
+    free(c);
+    free(untagged);
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_stats(parser, &stats));
+    TEST_ASSERT_EQUAL_INT(0, stats.live);
+    TEST_ASSERT_EQUAL_INT(2, stats.frees);
+    TEST_ASSERT_EQUAL_INT(0, live_of(cache));
+    printf("Blocks charged to their tags\n\n");
+}
+
+void test_realloc_keeps_the_tag()
+{
+    printf("Testing realloc of tagged blocks...\n");
+    int buffers = heap_tag_create("buffers", 0, NULL, NULL);
+
+    char* p = malloc_tagged(buffers, 64);
+    void* wall = malloc(64);
+    // Another thread tag must not take the block over when it grows or moves
+    heap_tag_set(heap_tag_create("other", 0, NULL, NULL));
+    p = realloc(p, 4096);
+    TEST_ASSERT_EQUAL_INT(4096, live_of(buffers));
+    p = realloc(p, 128);
+    TEST_ASSERT_EQUAL_INT(128, live_of(buffers));
+    free(p);
+    free(wall);
+    TEST_ASSERT_EQUAL_INT(0, live_of(buffers));
+    printf("realloc kept the tag\n\n");
+}
+
+void test_budget_callback_once_per_crossing()
+{
+    printf("Testing soft budgets...\n");
+    int tag = heap_tag_create("budgeted", 1024, budget_exceeded, NULL);
+    void* blocks[16];
+    heap_tag_stats_t stats;
+
+    heap_tag_set(tag);
+    for (int i = 0; i < 16; i++)
+        blocks[i] = malloc(128);
+    heap_tag_set(0);
+
+    // Allocations are never refused, and the callback fires only on the crossing
+    TEST_ASSERT_EQUAL_INT(1, crossings);
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_stats(tag, &stats));
+    TEST_ASSERT_TRUE(stats.over);
+    TEST_ASSERT_EQUAL_INT(16 * 128, stats.live);
+
+    // Going back under the budget re-arms it
+    for (int i = 0; i < 16; i++)
+        free(blocks[i]);
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_stats(tag, &stats));
+    TEST_ASSERT_FALSE(stats.over);
+    for (int i = 0; i < 16; i++)
+        blocks[i] = malloc_tagged(tag, 128);
+    TEST_ASSERT_EQUAL_INT(2, crossings);
+    for (int i = 0; i < 16; i++)
+        free(blocks[i]);
+    printf("Budget crossings reported\n\n");
+}
+
+/**
+ * @brief Allocates PER_THREAD blocks in the heap of the Worker in arg, with its tag.
+ */
+static void* tagged_worker(void* arg)
+{
+    Worker* w = arg;
+
+    heap_tag_set(w->tag);
+    for (int i = 0; i < PER_THREAD; i++)
+        w->blocks[i] = heap_malloc(&w->heap, 32);
+    heap_tag_set(0);
+    return NULL;
+}
+
+void test_threads_count_on_their_own()
+{
+    printf("Testing tag counters across threads...\n");
+    int tag = heap_tag_create("workers", 0, NULL, NULL);
+    pthread_t threads[THREADS];
+    static Worker workers[THREADS];
+
+    for (int i = 0; i < THREADS; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, heap_init(&workers[i].heap, NULL, HEAP_SPACE));
+        workers[i].tag = tag;
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, tagged_worker, &workers[i]));
+    }
+    for (int i = 0; i < THREADS; i++)
+        TEST_ASSERT_EQUAL_INT(0, pthread_join(threads[i], NULL));
+
+    // The counters of the threads that ended are folded into the shared ones
+    TEST_ASSERT_EQUAL_INT(THREADS * PER_THREAD * 32, live_of(tag));
+    for (int i = 0; i < THREADS; i++)
+    {
+        for (int j = 0; j < PER_THREAD; j++)
+            heap_free(&workers[i].heap, workers[i].blocks[j]);
+        heap_destroy(&workers[i].heap);
+    }
+    heap_tag_stats_t stats;
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_stats(tag, &stats));
+    TEST_ASSERT_EQUAL_INT(0, stats.live);
+    TEST_ASSERT_EQUAL_INT(THREADS * PER_THREAD, stats.allocs);
+    TEST_ASSERT_EQUAL_INT(THREADS * PER_THREAD, stats.frees);
+    printf("Thread counters added up\n\n");
+}
+
+/** Total the last budget callback of the shared counter test saw */
+static size_t last_total;
+
+/** Holds every thread of the shared counter test until all of them took a counter */
+static pthread_barrier_t attached;
+
+/**
+ * @brief Budget callback of the shared counter test: keeps the total it was given.
+ */
+static void record_total(int tag, size_t live, size_t budget, void* arg)
+{
+    (void)tag;
+    (void)budget;
+    (void)arg;
+    __atomic_store_n(&last_total, live, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Accounts allocation and free pairs that cancel out, on whichever counter the thread got.
+ */
+static void* sharing_worker(void* arg)
+{
+    int tag = *(int*)arg;
+
+    // Accounting nothing still takes a counter; the threads that find none left use the shared one
+    heap_tag_account(tag, 0, 0);
+    pthread_barrier_wait(&attached);
+    for (int i = 0; i < SHARED_ROUNDS; i++)
+    {
+        heap_tag_account(tag, 16, 1);
+        heap_tag_account(tag, -16, -1);
+    }
+    return NULL;
+}
+
+void test_shared_counter_keeps_the_exact_total()
+{
+    printf("Testing the counter shared by threads without their own...\n");
+    // A budget this small flushes every change, the shared counter included
+    int tag = heap_tag_create("shared", 64, record_total, NULL);
+    static pthread_t threads[SHARED_THREADS];
+
+    TEST_ASSERT_EQUAL_INT(0, pthread_barrier_init(&attached, NULL, SHARED_THREADS));
+    for (int i = 0; i < SHARED_THREADS; i++)
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, sharing_worker, &tag));
+    for (int i = 0; i < SHARED_THREADS; i++)
+        TEST_ASSERT_EQUAL_INT(0, pthread_join(threads[i], NULL));
+    pthread_barrier_destroy(&attached);
+    TEST_ASSERT_EQUAL_INT(0, live_of(tag));
+
+    // The total the budget checks must be back at zero: a lost update would show up in the next crossing
+    TEST_ASSERT_EQUAL_INT(0, heap_tag_budget(tag, 64, record_total, NULL));
+    last_total = 0;
+    heap_tag_account(tag, 100, 1);
+    printf("Total after %d threads: %zu\n\n", SHARED_THREADS, last_total - 100);
+    TEST_ASSERT_EQUAL_INT(100, last_total);
+    heap_tag_account(tag, -100, -1);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_blocks_are_charged_to_their_tag);
+    RUN_TEST(test_realloc_keeps_the_tag);
+    RUN_TEST(test_budget_callback_once_per_crossing);
+    RUN_TEST(test_threads_count_on_their_own);
+    RUN_TEST(test_shared_counter_keeps_the_exact_total);
+    return UNITY_END();
+}
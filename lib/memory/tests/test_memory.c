@@ -1,4 +1,7 @@
+#include "heap.h"
+#include "heap_check.h"
 #include "memory.h"
+#include "region.h"
 #include "unity.h"
 #include <assert.h>
 #include <stdio.h>
@@ -115,6 +118,204 @@ void test_realloc_and_free()
     printf("Memory freed at: %p and %p\n\n", ptr1, ptr2);
 }
 
+void test_realloc_grows_tail_in_place()
+{
+    printf("Testing realloc at the end of the heap...\n");
+    // Larger than any hole left by the previous tests, so it ends the heap
+    char* ptr = malloc(100000);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_NULL(get_block(ptr)->next);
+    memset(ptr, 'a', 100000);
+
+    char* grown = realloc(ptr, 200000);
+    printf("Memory reallocated from %p to %p\n", (void*)ptr, (void*)grown);
+    TEST_ASSERT_EQUAL_PTR(ptr, grown);
+    TEST_ASSERT_GREATER_OR_EQUAL(200000, get_block(grown)->size);
+    TEST_ASSERT_EQUAL_INT('a', grown[99999]);
+    free(grown);
+    printf("Memory freed at: %p\n\n", (void*)grown);
+}
+
+void test_realloc_absorbs_previous_block()
+{
+    printf("Testing realloc into the previous free block...\n");
+    char* prev = malloc(100000);
+    char* ptr = malloc(100000);
+    char* guard = malloc(100000);
+    TEST_ASSERT_NOT_NULL(prev);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_NOT_NULL(guard);
+    for (int i = 0; i < 100000; i++)
+    {
+        ptr[i] = (char)i;
+    }
+    free(prev);
+
+    // Neither the next block nor the end of the heap are available, only the free predecessor
+    char* grown = realloc(ptr, 150000);
+    printf("Memory reallocated from %p to %p\n", (void*)ptr, (void*)grown);
+    TEST_ASSERT_EQUAL_PTR(prev, grown);
+    for (int i = 0; i < 100000; i++)
+    {
+        TEST_ASSERT_EQUAL_INT((char)i, grown[i]);
+    }
+    free(grown);
+    free(guard);
+    printf("Memory freed at: %p and %p\n\n", (void*)grown, (void*)guard);
+}
+
+void test_realloc_growth_hint()
+{
+    printf("Testing realloc growth hint...\n");
+    char* ptr = malloc(1000);
+    char* guard = malloc(100000);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_NOT_NULL(guard);
+
+    // The block has to move; with the hint it keeps room for the next growth
+    realloc_growth_hint(50);
+    ptr = realloc(ptr, 200000);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_GREATER_OR_EQUAL(300000, get_block(ptr)->size);
+    char* again = realloc(ptr, 250000);
+    TEST_ASSERT_EQUAL_PTR(ptr, again);
+    realloc_growth_hint(0);
+
+    free(again);
+    free(guard);
+    printf("Memory freed at: %p and %p\n\n", (void*)again, (void*)guard);
+}
+
+void test_realloc_to_zero_frees()
+{
+    printf("Testing realloc to zero bytes...\n");
+    heap_t h;
+    heap_report_t report;
+    size_t allocated, available;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&h, NULL, 1 << 20));
+    char* ptr = heap_malloc(&h, 200);
+    char* guard = heap_malloc(&h, 64);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_NOT_NULL(guard);
+
+    // Shrinking in place would leave the header of the rest right where ptr points
+    TEST_ASSERT_NULL(heap_realloc(&h, ptr, 0));
+    TEST_ASSERT_EQUAL_INT(1, get_block(ptr)->free);
+    heap_usage(&h, &allocated, &available);
+    TEST_ASSERT_EQUAL_INT(get_block(guard)->size, allocated);
+    TEST_ASSERT_EQUAL_INT(0, heap_check_heap(&h, &report));
+    heap_destroy(&h);
+
+    char* p = malloc(100);
+    TEST_ASSERT_NOT_NULL(p);
+    TEST_ASSERT_NULL(realloc(p, 0));
+    printf("realloc(p, 0) freed the block\n\n");
+}
+
+void test_region_commits_by_chunks()
+{
+    printf("Testing region growth by chunks...\n");
+    region_t region;
+    TEST_ASSERT_EQUAL_INT(0, region_reserve(&region, 64 * HUGEPAGE_SIZE, HUGEPAGE_SIZE, REGION_HUGEPAGES));
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t)region.start % HUGEPAGE_SIZE);
+
+    // A small request enables a whole chunk but moves the top by the requested bytes only
+    char* start = region_sbrk(&region, 100);
+    TEST_ASSERT_EQUAL_PTR(region.start, start);
+    TEST_ASSERT_EQUAL_PTR(start + 100, region.top);
+    TEST_ASSERT_EQUAL_PTR(start + HUGEPAGE_SIZE, region.committed);
+    memset(start, 0xAB, HUGEPAGE_SIZE);
+
+    TEST_ASSERT_EQUAL_PTR(start + 100, region_sbrk(&region, 3 * HUGEPAGE_SIZE));
+    TEST_ASSERT_EQUAL_PTR(start + 4 * HUGEPAGE_SIZE, region.committed);
+
+    // Shrinking keeps one spare chunk above the top
+    TEST_ASSERT_EQUAL_INT(0, region_brk(&region, start + 10));
+    TEST_ASSERT_EQUAL_PTR(start + 2 * HUGEPAGE_SIZE, region.committed);
+    TEST_ASSERT_EQUAL_INT(-1, region_brk(&region, start - 1));
+    TEST_ASSERT_EQUAL_PTR((void*)-1, region_sbrk(&region, 64 * HUGEPAGE_SIZE));
+
+    printf("Huge pages: %s\n\n", region.hugepages ? "yes" : "no");
+    region_unmap(&region);
+}
+
+void test_hugepages_needs_empty_heap()
+{
+    printf("Testing huge page mode switch...\n");
+    void* ptr = malloc(100);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_INT(-1, malloc_hugepages(1));
+    free(ptr);
+    printf("Heap backend kept while blocks are in use\n\n");
+}
+
+void test_heap_over_buffer()
+{
+    printf("Testing heap over a caller buffer...\n");
+    static char buffer[64 * 1024];
+    heap_t heap;
+    void* ptrs[64];
+    size_t allocated, available;
+    int n = 0;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, buffer, sizeof(buffer)));
+    while (n < 64 && (ptrs[n] = heap_malloc(&heap, 4000)) != NULL)
+    {
+        TEST_ASSERT_TRUE((char*)ptrs[n] >= buffer && (char*)ptrs[n] + 4000 <= buffer + sizeof(buffer));
+        n++;
+    }
+    printf("Blocks that fit in the buffer: %d\n", n);
+    TEST_ASSERT_EQUAL_INT(sizeof(buffer) / (4000 + BLOCK_SIZE), n);
+
+    // The default heap ignores blocks of another heap
+    free(ptrs[0]);
+    heap_usage(&heap, &allocated, &available);
+    TEST_ASSERT_EQUAL_INT(n * 4000, allocated);
+
+    ptrs[0] = heap_realloc(&heap, ptrs[0], 100);
+    TEST_ASSERT_NOT_NULL(ptrs[0]);
+    for (int i = 0; i < n; i++)
+        heap_free(&heap, ptrs[i]);
+    TEST_ASSERT_NULL(heap.base);
+    heap_destroy(&heap);
+    printf("Heap emptied and destroyed\n\n");
+}
+
+void test_heaps_are_isolated()
+{
+    printf("Testing isolated heaps...\n");
+    heap_t first, worst;
+    size_t allocated, available;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&first, NULL, 1 << 20));
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&worst, NULL, 1 << 20));
+    TEST_ASSERT_EQUAL_INT(0, heap_control(&worst, WORST_FIT));
+    TEST_ASSERT_EQUAL_INT(-1, heap_control(&worst, 42));
+
+    // Same sequence in both heaps: a small hole followed by a large one
+    char* a[2][4];
+    heap_t* heaps[2] = {&first, &worst};
+    for (int h = 0; h < 2; h++)
+    {
+        a[h][0] = heap_malloc(heaps[h], 64);
+        a[h][1] = heap_malloc(heaps[h], 16);
+        a[h][2] = heap_malloc(heaps[h], 512);
+        a[h][3] = heap_malloc(heaps[h], 16);
+        heap_free(heaps[h], a[h][0]);
+        heap_free(heaps[h], a[h][2]);
+    }
+    TEST_ASSERT_EQUAL_PTR(a[0][0], heap_malloc(&first, 32));
+    TEST_ASSERT_EQUAL_PTR(a[1][2], heap_malloc(&worst, 32));
+    TEST_ASSERT_EQUAL_PTR(heap_default(), heap_default());
+    TEST_ASSERT_NOT_EQUAL(worst.method, heap_default()->method);
+
+    heap_usage(&first, &allocated, &available);
+    printf("First fit heap: %zu allocated, %zu free\n\n", allocated, available);
+    heap_destroy(&first);
+    heap_destroy(&worst);
+}
+
 int main()
 {
     UNITY_BEGIN();
@@ -126,6 +327,14 @@ int main()
     RUN_TEST(test_malloc_and_free);
     RUN_TEST(test_calloc_and_free);
     RUN_TEST(test_realloc_and_free);
+    RUN_TEST(test_realloc_grows_tail_in_place);
+    RUN_TEST(test_realloc_absorbs_previous_block);
+    RUN_TEST(test_realloc_growth_hint);
+    RUN_TEST(test_realloc_to_zero_frees);
+    RUN_TEST(test_region_commits_by_chunks);
+    RUN_TEST(test_hugepages_needs_empty_heap);
+    RUN_TEST(test_heap_over_buffer);
+    RUN_TEST(test_heaps_are_isolated);
     printf("All tests passed!\n");
     return UNITY_END();
 }
@@ -0,0 +1,137 @@
+#include "memory_resource.hpp"
+#include "unity.h"
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/** Space reserved for the heaps of the tests */
+#define HEAP_SPACE (4 << 20)
+
+/** Over-aligned type, allocated through the aligned operator new */
+struct alignas(64) Line
+{
+    char bytes[64];
+};
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+/**
+ * @brief Whether an address is a multiple of an alignment.
+ */
+static bool aligned_to(const void* p, std::size_t alignment)
+{
+    return reinterpret_cast<std::uintptr_t>(p) % alignment == 0;
+}
+
+void test_new_delete()
+{
+    printf("Testing the global operator new and delete...\n");
+    std::size_t allocated, free_bytes, before;
+    memory_usage(&before, &free_bytes);
+
+    // Requests of 16 bytes or more get the default new alignment, smaller ones the malloc one
+    char* small = new char[4];
+    TEST_ASSERT_TRUE(aligned_to(small, my_memory::malloc_alignment));
+    for (std::size_t size = 16; size < 256; size += 8)
+    {
+        char* p = new char[size];
+        TEST_ASSERT_TRUE(aligned_to(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__));
+        delete[] p;
+    }
+
+    Line* line = new Line();
+    TEST_ASSERT_TRUE(aligned_to(line, alignof(Line)));
+    Line* lines = new Line[3];
+    TEST_ASSERT_TRUE(aligned_to(lines, alignof(Line)));
+    int* value = new (std::nothrow) int(7);
+    TEST_ASSERT_EQUAL_INT(7, *value);
+
+    delete value;
+    delete[] lines;
+    delete line;
+    delete[] small;
+
+    // Everything went back to the default heap, aligned blocks included
+    memory_usage(&allocated, &free_bytes);
+    TEST_ASSERT_EQUAL_INT(before, allocated);
+    printf("new and delete served by the default heap\n\n");
+}
+
+void test_heap_resource()
+{
+    printf("Testing a memory resource over a heap...\n");
+    {
+        my_memory::heap_resource resource(HEAP_SPACE);
+        heap_t* heap = resource.heap();
+        std::pmr::vector<int> v(&resource);
+        std::pmr::list<int> l(&resource);
+
+        for (int i = 0; i < 1000; i++)
+        {
+            v.push_back(i);
+            l.push_back(i);
+        }
+        TEST_ASSERT_TRUE(reinterpret_cast<char*>(v.data()) >= heap->region.start);
+        TEST_ASSERT_TRUE(reinterpret_cast<char*>(v.data()) < heap->region.top);
+
+        void* p = resource.allocate(100, 64);
+        TEST_ASSERT_TRUE(aligned_to(p, 64));
+        resource.deallocate(p, 100, 64);
+
+        // Resources over the same heap free each other's memory
+        my_memory::heap_resource alias(heap);
+        my_memory::heap_resource standard;
+        TEST_ASSERT_TRUE(resource == alias);
+        TEST_ASSERT_FALSE(resource == standard);
+        TEST_ASSERT_EQUAL_PTR(heap_default(), standard.heap());
+
+        v.clear();
+        v.shrink_to_fit();
+        l.clear();
+        TEST_ASSERT_NULL(heap->base);
+    }
+    printf("Containers allocated and freed in their own heap\n\n");
+}
+
+void test_monotonic_resource()
+{
+    printf("Testing the monotonic resource...\n");
+    my_memory::monotonic_resource resource;
+    {
+        std::pmr::unordered_map<int, int> m(&resource);
+        for (int i = 0; i < 10000; i++)
+            m[i] = i;
+        TEST_ASSERT_EQUAL_INT(10000, m.size());
+    }
+    TEST_ASSERT_TRUE(resource.used() > 10000 * 2 * sizeof(int));
+
+    void* p = resource.allocate(1, 1);
+    void* q = resource.allocate(8, 256);
+    TEST_ASSERT_TRUE(aligned_to(q, 256));
+    TEST_ASSERT_TRUE(q > p);
+
+    // One release gives everything back, and the resource can be used again
+    resource.release();
+    TEST_ASSERT_EQUAL_INT(0, resource.used());
+    void* r = resource.allocate(8, 8);
+    TEST_ASSERT_NOT_NULL(r);
+    TEST_ASSERT_EQUAL_INT(8, resource.used());
+    printf("Monotonic resource released in bulk\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_new_delete);
+    RUN_TEST(test_heap_resource);
+    RUN_TEST(test_monotonic_resource);
+    return UNITY_END();
+}
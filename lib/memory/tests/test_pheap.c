@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include "pheap.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/** File backing the persistent heap of the tests */
+#define PHEAP_PATH "test_pheap.heap"
+
+/** Maximum size of the persistent heap of the tests */
+#define PHEAP_SIZE (16 * 1024 * 1024)
+
+/** Nodes of the list stored in the heap */
+#define NUM_NODES 1000
+
+/**
+ * @brief Node of a list that lives in the persistent heap, linked by offsets
+ */
+typedef struct
+{
+    uint64_t next; /**< Offset of the next node, 0 for the last one */
+    uint64_t key;  /**< Stored value */
+} Node;
+
+void setUp(void)
+{
+    unlink(PHEAP_PATH);
+}
+
+void tearDown(void)
+{
+    unlink(PHEAP_PATH);
+}
+
+/**
+ * @brief Builds a list of NUM_NODES nodes and publishes it as the root
+ *
+ * @param h Persistent heap
+ */
+static void build_list(heap_t* h)
+{
+    uint64_t head = 0;
+
+    for (uint64_t i = 0; i < NUM_NODES; i++)
+    {
+        Node* n = heap_malloc(h, sizeof(Node));
+        TEST_ASSERT_NOT_NULL(n);
+        n->key = i;
+        n->next = head;
+        head = pheap_offset(h, n);
+    }
+    pheap_set_root(h, pheap_pointer(h, head));
+}
+
+/**
+ * @brief Checks the list published by build_list
+ *
+ * @param h Persistent heap
+ */
+static void check_list(heap_t* h)
+{
+    uint64_t expected = NUM_NODES;
+
+    for (Node* n = pheap_root(h); n; n = pheap_pointer(h, n->next))
+        TEST_ASSERT_EQUAL_INT(--expected, n->key);
+    TEST_ASSERT_EQUAL_INT(0, expected);
+}
+
+/**
+ * @brief Checks that the blocks of a heap are linked, contiguous and coalesced
+ *
+ * @param h Heap on a region
+ */
+static void check_blocks(heap_t* h)
+{
+    t_block prev = NULL;
+
+    for (t_block b = h->base; b; prev = b, b = b->next)
+    {
+        TEST_ASSERT_EQUAL_PTR(prev, b->prev);
+        TEST_ASSERT_EQUAL_INT(block_cookie(b), b->magic);
+        TEST_ASSERT_FALSE(prev && prev->free && b->free);
+        TEST_ASSERT_EQUAL_PTR(b->next ? (char*)b->next : h->region.top, b->data + b->size);
+    }
+}
+
+void test_pheap_reload()
+{
+    printf("Testing persistent heap reload...\n");
+    unsigned status;
+    size_t allocated, available, reloaded, reloaded_free;
+
+    heap_t* h = pheap_open(PHEAP_PATH, PHEAP_SIZE, &status);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL_INT(PHEAP_CREATED, status);
+    build_list(h);
+    heap_usage(h, &allocated, &available);
+
+    // The file is locked while it is open
+    TEST_ASSERT_NULL(pheap_open(PHEAP_PATH, PHEAP_SIZE, NULL));
+    TEST_ASSERT_EQUAL_INT(0, pheap_close(h));
+
+    h = pheap_open(PHEAP_PATH, 0, &status);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL_INT(0, status);
+    check_list(h);
+    check_blocks(h);
+    heap_usage(h, &reloaded, &reloaded_free);
+    TEST_ASSERT_EQUAL_INT(allocated, reloaded);
+    TEST_ASSERT_EQUAL_INT(available, reloaded_free);
+
+    // The reopened heap keeps allocating where it left off
+    void* p = heap_malloc(h, 100);
+    TEST_ASSERT_NOT_NULL(p);
+    heap_free(h, p);
+    TEST_ASSERT_EQUAL_INT(0, pheap_close(h));
+    printf("%d nodes reloaded, %zu bytes allocated\n\n", NUM_NODES, reloaded);
+}
+
+void test_pheap_recovers_after_crash()
+{
+    printf("Testing persistent heap recovery...\n");
+    unsigned status;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        heap_t* h = pheap_open(PHEAP_PATH, PHEAP_SIZE, NULL);
+        if (h == NULL)
+            _exit(1);
+        build_list(h);
+
+        // The process dies in a free before fusion and in a heap extension before its header is written
+        void* a = heap_malloc(h, 64);
+        void* b = heap_malloc(h, 64);
+        heap_malloc(h, 64);
+        get_block(a)->free = 1;
+        get_block(b)->free = 1;
+        memset(h->region.top, 0xAB, 128);
+        h->region.top += 128;
+        _exit(0);
+    }
+    int wstatus;
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &wstatus, 0));
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(wstatus));
+
+    heap_t* h = pheap_open(PHEAP_PATH, 0, &status);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL_INT(PHEAP_RECOVERED, status);
+    check_list(h);
+    check_blocks(h);
+    TEST_ASSERT_EQUAL_INT(0, pheap_close(h));
+
+    h = pheap_open(PHEAP_PATH, 0, &status);
+    TEST_ASSERT_EQUAL_INT(0, status);
+    TEST_ASSERT_EQUAL_INT(0, pheap_close(h));
+    printf("Half-finished free and extension repaired\n\n");
+}
+
+/**
+ * @brief What the crashing child of test_pheap_frees_parked_blocks reports to the parent
+ */
+typedef struct
+{
+    char* where;      /**< Address of the mapping */
+    size_t allocated; /**< Bytes in use, the parked blocks count as free */
+    size_t available; /**< Free bytes, including the parked blocks */
+} CrashReport;
+
+void test_pheap_frees_parked_blocks()
+{
+    printf("Testing parked blocks after a crash...\n");
+    unsigned status;
+    int fds[2];
+    CrashReport sent, got;
+
+    TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        heap_t* h = pheap_open(PHEAP_PATH, PHEAP_SIZE, NULL);
+        if (h == NULL || heap_fastbins(h, 64) != 0)
+            _exit(1);
+        build_list(h);
+
+        // Parked between used blocks, so they can only go back to the free list through their stacks
+        void* parked[8];
+        for (int i = 0; i < 8; i++)
+            parked[i] = heap_malloc(h, 32 + (size_t)(i % 2) * 16);
+        heap_malloc(h, 64);
+        for (int i = 0; i < 8; i += 2)
+            heap_free(h, parked[i]);
+        heap_free(h, parked[7]);
+
+        // The process dies without pheap_close, which would have consolidated them
+        sent.where = (char*)pheap_root(h) - pheap_offset(h, pheap_root(h));
+        heap_usage(h, &sent.allocated, &sent.available);
+        _exit(h->fast_bytes && write(fds[1], &sent, sizeof(sent)) == (ssize_t)sizeof(sent) ? 0 : 1);
+    }
+    int wstatus;
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &wstatus, 0));
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(wstatus));
+    TEST_ASSERT_EQUAL_INT(sizeof(got), read(fds[0], &got, sizeof(got)));
+    close(fds[0]);
+    close(fds[1]);
+
+    // The stacks also have to be relocated
+    void* squatter = mmap(got.where, PHEAP_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    TEST_ASSERT_EQUAL_PTR(got.where, squatter);
+
+    heap_t* h = pheap_open(PHEAP_PATH, 0, &status);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL_INT(PHEAP_RECOVERED | PHEAP_RELOCATED, status);
+    check_list(h);
+    check_blocks(h);
+    size_t allocated, available;
+    heap_usage(h, &allocated, &available);
+    printf("Free bytes before the crash: %zu, after recovery: %zu\n", got.available, available);
+    TEST_ASSERT_EQUAL_INT(0, h->fast_bytes);
+    TEST_ASSERT_EQUAL_INT(got.allocated, allocated);
+    // The last two parked blocks are neighbours and fuse: the header between them becomes free bytes
+    TEST_ASSERT_EQUAL_INT(got.available + BLOCK_SIZE, available);
+    TEST_ASSERT_EQUAL_INT(0, pheap_close(h));
+    munmap(squatter, PHEAP_SIZE);
+    printf("Parked blocks back in the free list\n\n");
+}
+
+void test_pheap_relocates()
+{
+    printf("Testing persistent heap relocation...\n");
+    unsigned status;
+
+    heap_t* h = pheap_open(PHEAP_PATH, PHEAP_SIZE, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    build_list(h);
+    char* where = (char*)pheap_root(h) - pheap_offset(h, pheap_root(h));
+    TEST_ASSERT_EQUAL_INT(0, pheap_close(h));
+
+    // Something else now lives where the heap was created
+    void* squatter = mmap(where, PHEAP_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    TEST_ASSERT_EQUAL_PTR(where, squatter);
+
+    h = pheap_open(PHEAP_PATH, 0, &status);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL_INT(PHEAP_RELOCATED, status);
+    check_list(h);
+    check_blocks(h);
+    void* p = heap_malloc(h, 4096);
+    TEST_ASSERT_NOT_NULL(p);
+    heap_free(h, p);
+    TEST_ASSERT_EQUAL_INT(0, pheap_close(h));
+    munmap(squatter, PHEAP_SIZE);
+    printf("Heap moved and relinked, offsets still valid\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_pheap_reload);
+    RUN_TEST(test_pheap_recovers_after_crash);
+    RUN_TEST(test_pheap_relocates);
+    RUN_TEST(test_pheap_frees_parked_blocks);
+    return UNITY_END();
+}
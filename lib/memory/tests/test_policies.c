@@ -1,3 +1,4 @@
+#include "heap.h"
 #include "memory.h"
 #include "unity.h"
 #include <stdio.h>
@@ -116,10 +117,23 @@ void test_policies()
     test_policy(WORST_FIT, "Worst Fit");
 }
 
+void test_tlsf_needs_variant()
+{
+    printf("Testing TLSF in the generic build...\n");
+    heap_t* h = heap_default();
+    int policy = h->method;
+
+    // Only my_memory_tlsf keeps the free index that TLSF searches
+    TEST_ASSERT_EQUAL_INT(-1, heap_control(h, TLSF));
+    TEST_ASSERT_EQUAL_INT(policy, h->method);
+    TEST_ASSERT_EQUAL_INT(0, heap_control(h, FIRST_FIT));
+}
+
 int main()
 {
     UNITY_BEGIN();
     RUN_TEST(test_policies);
+    RUN_TEST(test_tlsf_needs_variant);
     printf("\nMemory Policies Test Completed:\n");
     printf("    Check the log file for more details\n\n");
     return UNITY_END();
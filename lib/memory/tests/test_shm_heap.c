@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include "shm_heap.h"
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** Size of the shared heaps of the tests */
+#define HEAP_SPACE (1 << 20)
+
+/** Name of the named heap, made unique per process */
+static char name[64];
+
+void setUp(void)
+{
+    snprintf(name, sizeof(name), "/my_memory_test_%d", (int)getpid());
+}
+
+void tearDown(void)
+{
+    shm_heap_unlink(name);
+}
+
+/**
+ * @brief Wait for a child and check that it exited with status 0.
+ */
+static void wait_child(pid_t pid)
+{
+    int status = 0;
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(status));
+}
+
+void test_blocks_are_reused_and_coalesced()
+{
+    printf("Testing allocation in a shared heap...\n");
+    unsigned status = 0;
+    shm_heap_t* h = shm_heap_open(NULL, HEAP_SPACE, &status);
+    shm_heap_stats_t stats;
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL_INT(SHM_HEAP_CREATED, status);
+
+    char* a = shm_heap_malloc(h, 100);
+    char* b = shm_heap_malloc(h, 200);
+    char* c = shm_heap_malloc(h, 300);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t)a % SHM_HEAP_ALIGN);
+    TEST_ASSERT_EQUAL_INT(0, shm_heap_free(h, b));
+    TEST_ASSERT_EQUAL_INT(-1, shm_heap_free(h, b));
+    TEST_ASSERT_EQUAL_PTR(b, shm_heap_malloc(h, 150));
+    TEST_ASSERT_NULL(shm_heap_malloc(h, HEAP_SPACE));
+
+    // Freeing everything coalesces the blocks and lowers the top back to the start
+    shm_heap_free(h, a);
+    shm_heap_free(h, b);
+    shm_heap_free(h, c);
+    shm_heap_stats(h, &stats);
+    TEST_ASSERT_EQUAL_INT(0, stats.used);
+    TEST_ASSERT_EQUAL_INT(0, stats.allocated);
+    TEST_ASSERT_EQUAL_INT(4, stats.allocs);
+    TEST_ASSERT_EQUAL_INT(4, stats.frees);
+    TEST_ASSERT_EQUAL_INT(0, shm_heap_close(h));
+    printf("Blocks reused and coalesced\n\n");
+}
+
+void test_processes_hand_off_blocks_by_offset()
+{
+    printf("Testing handoff between processes...\n");
+    unsigned status = 0;
+    shm_heap_t* h = shm_heap_open(name, HEAP_SPACE, &status);
+    TEST_ASSERT_NOT_NULL(h);
+    TEST_ASSERT_EQUAL_INT(SHM_HEAP_CREATED, status);
+
+    // The child maps the heap on its own, at another address, and publishes a block
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        shm_heap_t* mine = shm_heap_open(name, 0, &status);
+        char* msg = mine && status == 0 ? shm_heap_malloc(mine, 64) : NULL;
+        if (!msg)
+            _exit(1);
+        strcpy(msg, "from the child");
+        shm_heap_set_root(mine, msg);
+        _exit(shm_heap_close(mine) == 0 ? 0 : 1);
+    }
+    wait_child(pid);
+
+    shm_heap_t* other = shm_heap_open(name, 0, &status);
+    TEST_ASSERT_NOT_NULL(other);
+    TEST_ASSERT_TRUE(other != h);
+    char* msg = shm_heap_root(h);
+    TEST_ASSERT_EQUAL_STRING("from the child", msg);
+    TEST_ASSERT_EQUAL_STRING("from the child", shm_heap_pointer(other, shm_heap_offset(h, msg)));
+
+    // Any mapping can free it
+    shm_heap_set_root(other, NULL);
+    TEST_ASSERT_EQUAL_INT(0, shm_heap_free(other, shm_heap_pointer(other, shm_heap_offset(h, msg))));
+    shm_heap_stats_t stats;
+    shm_heap_stats(h, &stats);
+    TEST_ASSERT_EQUAL_INT(1, stats.frees);
+    TEST_ASSERT_EQUAL_INT(0, stats.used);
+    shm_heap_close(other);
+    shm_heap_close(h);
+    printf("Block handed off without copying\n\n");
+}
+
+void test_recovery_after_the_lock_owner_dies()
+{
+    printf("Testing recovery after a process dies holding the lock...\n");
+    shm_heap_t* h = shm_heap_open(NULL, HEAP_SPACE, NULL);
+    TEST_ASSERT_NOT_NULL(h);
+    char* kept = shm_heap_malloc(h, 64);
+    char* torn = shm_heap_malloc(h, 64);
+    shm_heap_free(h, torn);
+
+    // The child dies in the middle of an extension, with a header half written
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        shm_heap_lock(h);
+        char* p = shm_heap_malloc(h, 64);
+        ((struct shm_block*)p - 1)->magic = 0;
+        _exit(0);
+    }
+    wait_child(pid);
+
+    // The next operation repairs the heap: it ends before the torn block
+    shm_heap_stats_t stats;
+    shm_heap_stats(h, &stats);
+    TEST_ASSERT_EQUAL_INT(1, stats.recoveries);
+    TEST_ASSERT_EQUAL_INT(64 + sizeof(struct shm_block), stats.used);
+    TEST_ASSERT_EQUAL_INT(64, stats.allocated);
+    TEST_ASSERT_EQUAL_PTR(torn, shm_heap_malloc(h, 64));
+    TEST_ASSERT_EQUAL_INT(0, shm_heap_free(h, kept));
+    shm_heap_close(h);
+    printf("Heap repaired\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_blocks_are_reused_and_coalesced);
+    RUN_TEST(test_processes_hand_off_blocks_by_offset);
+    RUN_TEST(test_recovery_after_the_lock_owner_dies);
+    return UNITY_END();
+}
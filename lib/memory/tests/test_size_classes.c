@@ -0,0 +1,135 @@
+#include "heap.h"
+#include "size_classes.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** File the histogram of the tests is saved to */
+#define HIST_PATH "test_size_hist.txt"
+
+/** File the size-class table of the tests is saved to */
+#define TABLE_PATH "test_size_classes.txt"
+
+void setUp(void)
+{
+    size_classes_set(NULL, 0);
+    size_hist_reset();
+}
+
+void tearDown(void)
+{
+    size_classes_set(NULL, 0);
+    unlink(HIST_PATH);
+    unlink(TABLE_PATH);
+}
+
+void test_histogram_records_requests()
+{
+    printf("Testing the request size histogram...\n");
+    static uint64_t loaded[SIZE_HIST_BUCKETS];
+    void* p[5];
+
+    size_hist_start();
+    p[0] = malloc(24);
+    p[1] = malloc(24);
+    p[2] = malloc(24);
+    p[3] = malloc(100);
+    p[4] = malloc(SIZE_HIST_MAX + 1);
+    size_hist_stop();
+    for (int i = 0; i < 5; i++)
+        free(p[i]);
+
+    // Requests are counted by their exact size, not by the size of the block
+    const uint64_t* counts = size_hist_counts();
+    TEST_ASSERT_EQUAL_INT(3, counts[24]);
+    TEST_ASSERT_EQUAL_INT(1, counts[100]);
+    TEST_ASSERT_EQUAL_INT(0, counts[104]);
+    TEST_ASSERT_EQUAL_INT(1, counts[SIZE_HIST_MAX + 1]);
+
+    TEST_ASSERT_EQUAL_INT(0, size_hist_save(HIST_PATH));
+    TEST_ASSERT_EQUAL_INT(0, size_hist_load(HIST_PATH, loaded));
+    TEST_ASSERT_EQUAL_INT(0, memcmp(counts, loaded, sizeof(loaded)));
+    printf("Histogram saved and loaded back\n\n");
+}
+
+void test_optimize_minimizes_waste()
+{
+    printf("Testing the size-class optimizer...\n");
+    static uint64_t counts[SIZE_HIST_BUCKETS];
+    size_t classes[SIZE_CLASSES_MAX];
+
+    counts[20] = 100;
+    counts[24] = 100;
+    counts[100] = 50;
+    counts[120] = 50;
+
+    TEST_ASSERT_EQUAL_INT(2, size_classes_optimize(counts, 2, classes));
+    TEST_ASSERT_EQUAL_INT(24, classes[0]);
+    TEST_ASSERT_EQUAL_INT(120, classes[1]);
+    TEST_ASSERT_EQUAL_INT(100 * 4 + 50 * 20, size_classes_waste(counts, classes, 2));
+
+    TEST_ASSERT_EQUAL_INT(1, size_classes_optimize(counts, 1, classes));
+    TEST_ASSERT_EQUAL_INT(120, classes[0]);
+
+    // Extra classes that cannot save anything are dropped; 100 still pays for its 8 byte alignment
+    int n = size_classes_optimize(counts, 32, classes);
+    TEST_ASSERT_EQUAL_INT(3, n);
+    TEST_ASSERT_EQUAL_INT(100 * 4 + 50 * 4, size_classes_waste(counts, classes, n));
+
+    // A generated table never wastes more than the generic one of the same size
+    size_t generic[SIZE_CLASSES_MAX];
+    int g = size_classes_generic(generic, 8);
+    n = size_classes_optimize(counts, 8, classes);
+    TEST_ASSERT_TRUE(size_classes_waste(counts, classes, n) <= size_classes_waste(counts, generic, g));
+    TEST_ASSERT_EQUAL_INT(-1, size_classes_optimize(counts, SIZE_CLASSES_MAX + 1, classes));
+    printf("%d classes, %llu bytes wasted\n\n", n, (unsigned long long)size_classes_waste(counts, classes, n));
+}
+
+void test_classes_round_requests()
+{
+    printf("Testing allocation with a size-class table...\n");
+    size_t classes[] = {16, 48, 128};
+    size_t loaded[SIZE_CLASSES_MAX];
+
+    TEST_ASSERT_EQUAL_INT(0, size_classes_set(classes, 3));
+    void* p = malloc(20);
+    void* q = malloc(200);
+    TEST_ASSERT_EQUAL_INT(48, get_block(p)->size);
+    TEST_ASSERT_EQUAL_INT(200, get_block(q)->size);
+    free(p);
+    free(q);
+
+    // Heaps other than the default one round with the same table
+    heap_t heap;
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, NULL, 1 << 20));
+    TEST_ASSERT_EQUAL_INT(128, get_block(heap_malloc(&heap, 100))->size);
+    heap_destroy(&heap);
+
+    TEST_ASSERT_EQUAL_INT(0, size_classes_save(TABLE_PATH, classes, 3));
+    TEST_ASSERT_EQUAL_INT(0, size_classes_set(NULL, 0));
+    TEST_ASSERT_EQUAL_INT(0, size_classes_load(TABLE_PATH));
+    TEST_ASSERT_EQUAL_INT(3, size_classes_get(loaded));
+    TEST_ASSERT_EQUAL_INT(48, loaded[1]);
+
+    TEST_ASSERT_EQUAL_INT(0, size_classes_parse("24, 40 # comment\n100"));
+    TEST_ASSERT_EQUAL_INT(104, size_class_round(96));
+    TEST_ASSERT_EQUAL_INT(112, size_class_round(112));
+    TEST_ASSERT_EQUAL_INT(-1, size_classes_parse("16,8"));
+    TEST_ASSERT_EQUAL_INT(-1, size_classes_parse("16;32"));
+    TEST_ASSERT_EQUAL_INT(-1, size_classes_parse("99999"));
+
+    // An invalid table leaves the previous one installed
+    TEST_ASSERT_EQUAL_INT(3, size_classes_count);
+    printf("Requests rounded to their class\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_histogram_records_requests);
+    RUN_TEST(test_optimize_minimizes_waste);
+    RUN_TEST(test_classes_round_requests);
+    return UNITY_END();
+}
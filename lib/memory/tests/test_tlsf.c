@@ -0,0 +1,163 @@
+#include "heap.h"
+#include "heap_check.h"
+#include "memory.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Live blocks kept by the random workload */
+#define NUM_SLOTS 512
+
+/** Operations performed by the random workload */
+#define NUM_OPERATIONS 20000
+
+void setUp(void)
+{
+    // Set up code if needed
+}
+
+void tearDown(void)
+{
+    // Tear down code if needed
+}
+
+void test_tlsf_policy_is_fixed()
+{
+    printf("Testing the policy of the TLSF build...\n");
+    heap_t heap;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_init(&heap, NULL, 1 << 20));
+    TEST_ASSERT_EQUAL_INT(TLSF, heap.method);
+    TEST_ASSERT_EQUAL_INT(-1, heap_control(&heap, FIRST_FIT));
+    TEST_ASSERT_EQUAL_INT(-1, heap_control(&heap, BEST_FIT));
+    TEST_ASSERT_EQUAL_INT(0, heap_control(&heap, TLSF));
+
+    // Free blocks keep their list links in the data area, so no block is smaller than two pointers
+    void* p = heap_malloc(&heap, 1);
+    TEST_ASSERT_NOT_NULL(p);
+    TEST_ASSERT_EQUAL_INT(16, get_block(p)->size);
+    heap_free(&heap, p);
+    TEST_ASSERT_NULL(heap.base);
+    heap_destroy(&heap);
+    printf("Only TLSF accepted, minimum block of 16 bytes\n\n");
+}
+
+void test_tlsf_reuses_free_blocks()
+{
+    printf("Testing TLSF reuse of free blocks...\n");
+    heap_report_t report;
+
+    void* small = malloc(64);
+    void* guard1 = malloc(16);
+    void* large = malloc(4096);
+    void* guard2 = malloc(16);
+    free(small);
+    free(large);
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+
+    // The first free block of a class that is large enough, without walking the heap
+    void* p = malloc(2000);
+    TEST_ASSERT_EQUAL_PTR(large, p);
+    void* q = malloc(60);
+    TEST_ASSERT_EQUAL_PTR(small, q);
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+    printf("Blocks: %zu (%zu free)\n\n", report.blocks, report.free_blocks);
+
+    free(q);
+    free(p);
+    free(guard1);
+    free(guard2);
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+}
+
+void test_tlsf_random_operations()
+{
+    printf("Testing TLSF under random operations...\n");
+    static void* slots[NUM_SLOTS];
+    static size_t sizes[NUM_SLOTS];
+    heap_report_t report;
+    unsigned seed = 42;
+
+    for (int i = 0; i < NUM_OPERATIONS; i++)
+    {
+        int k = rand_r(&seed) % NUM_SLOTS;
+        size_t size = (size_t)(rand_r(&seed) % 2048) + 1;
+
+        if (!slots[k])
+        {
+            slots[k] = malloc(size);
+            TEST_ASSERT_NOT_NULL(slots[k]);
+            memset(slots[k], k & 0xFF, size);
+            sizes[k] = size;
+        }
+        else if (rand_r(&seed) % 3 == 0)
+        {
+            slots[k] = realloc(slots[k], size);
+            TEST_ASSERT_NOT_NULL(slots[k]);
+            memset(slots[k], k & 0xFF, size);
+            sizes[k] = size;
+        }
+        else
+        {
+            // The data survives until the block is freed
+            TEST_ASSERT_EQUAL_INT(k & 0xFF, ((unsigned char*)slots[k])[sizes[k] - 1]);
+            free(slots[k]);
+            slots[k] = NULL;
+        }
+
+        if (i % 1000 == 0)
+            TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+    }
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+    printf("Blocks: %zu (%zu free) after %d operations\n\n", report.blocks, report.free_blocks, NUM_OPERATIONS);
+
+    for (int k = 0; k < NUM_SLOTS; k++)
+    {
+        free(slots[k]);
+        slots[k] = NULL;
+    }
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+}
+
+void test_check_detects_index_corruption()
+{
+    printf("Testing heap check of the TLSF index...\n");
+    heap_report_t report;
+    tlsf_t* t = &heap_default()->tlsf;
+
+    void* p = malloc(300);
+    void* guard = malloc(16);
+    free(p);
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+
+    // A free block that fell out of its list
+    t_block b = get_block(p);
+    int fl = 0, sl = 0;
+    while (t->lists[fl][sl] != b)
+    {
+        if (++sl == TLSF_SL_COUNT)
+        {
+            sl = 0;
+            fl++;
+        }
+        TEST_ASSERT_TRUE(fl < TLSF_FL_COUNT);
+    }
+    t->lists[fl][sl] = links_of(b)->next;
+    TEST_ASSERT_EQUAL_INT(-1, heap_check(&report));
+    TEST_ASSERT_TRUE(report.kinds & HEAP_CHECK_INDEX);
+    t->lists[fl][sl] = b;
+
+    TEST_ASSERT_EQUAL_INT(0, heap_check(&report));
+    free(guard);
+    printf("Unindexed free block detected\n\n");
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_tlsf_policy_is_fixed);
+    RUN_TEST(test_tlsf_reuses_free_blocks);
+    RUN_TEST(test_tlsf_random_operations);
+    RUN_TEST(test_check_detects_index_corruption);
+    return UNITY_END();
+}
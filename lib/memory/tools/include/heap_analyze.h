@@ -0,0 +1,227 @@
+/**
+ * @file heap_analyze.h
+ * @brief Offline analyzer for the heap snapshots written by heap_snapshot()
+ *
+ * Reads one or more snapshot files and renders, as text, a summary of every
+ * snapshot, the trend of the largest hole, the free space histogram and the
+ * occupancy map of one snapshot, and what each policy would make of that
+ * snapshot if its live blocks were placed again from the top of the heap down.
+ */
+
+#include "heap_snapshot.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Default width of the bars and of the occupancy map, in characters
+ *
+ */
+#define DEFAULT_WIDTH 64
+
+/**
+ * @brief Default maximum number of rows of the occupancy map
+ *
+ */
+#define DEFAULT_ROWS 16
+
+/**
+ * @brief Buckets of the free space histogram, one per power of two
+ *
+ */
+#define HIST_BUCKETS 64
+
+/**
+ * @brief Policies replayed by the what-if re-fit
+ *
+ */
+#define NUM_POLICIES 4
+
+/**
+ * @brief A snapshot loaded in memory
+ *
+ */
+typedef struct
+{
+    heap_snapshot_header header;   /**< Header as written by heap_snapshot() */
+    heap_snapshot_record* records; /**< header.count blocks in address order */
+    const char* file;              /**< File the snapshot was read from */
+    size_t index;                  /**< Position among all the snapshots loaded */
+} Snapshot;
+
+/**
+ * @brief Totals of a snapshot or of a re-fitted heap
+ *
+ */
+typedef struct
+{
+    size_t blocks;         /**< Blocks in the heap */
+    size_t holes;          /**< Free blocks */
+    uint64_t used_bytes;   /**< Payload of the blocks in use */
+    uint64_t free_bytes;   /**< Payload of the free blocks */
+    uint64_t largest_hole; /**< Largest free block */
+    uint64_t extent;       /**< Bytes from the first block to the top of the heap */
+    double fragmentation;  /**< Percentage of free bytes outside the largest hole */
+} HeapStats;
+
+/**
+ * @brief A block of the heap model used by the what-if re-fit
+ *
+ */
+typedef struct
+{
+    uint64_t address; /**< Offset of the header from the start of the heap */
+    uint64_t size;    /**< Payload size */
+    int free;         /**< 1 if the block is free */
+    int prev;         /**< Previous block by address, -1 for the first */
+    int next;         /**< Next block by address, -1 for the last */
+    int free_prev;    /**< Previous block in the free list */
+    int free_next;    /**< Next block in the free list */
+} ModelBlock;
+
+/**
+ * @brief A heap rebuilt from a snapshot that follows the allocator rules
+ *
+ * Splits keep a remainder of at least BLOCK_SIZE + min_payload bytes, freed
+ * blocks merge with their free neighbours and a free block at the top is
+ * released, as in memory.c.
+ */
+typedef struct
+{
+    ModelBlock* blocks;   /**< Every block ever created, linked by index */
+    int count;            /**< Blocks used in the array */
+    int head;             /**< First block by address, -1 if the heap is empty */
+    int tail;             /**< Last block by address */
+    int free_head;        /**< Free list, in no particular order */
+    uint64_t top;         /**< Offset of the top of the heap */
+    uint64_t min_payload; /**< Smallest payload of a block */
+} HeapModel;
+
+/**
+ * @brief Result of re-fitting a snapshot with one policy
+ *
+ */
+typedef struct
+{
+    int policy;      /**< Policy replayed */
+    size_t moved;    /**< Live blocks that ended at another address */
+    HeapStats stats; /**< Heap after the re-fit */
+} RefitResult;
+
+/**
+ * @brief Name of a policy
+ *
+ * @param policy FIRST_FIT, BEST_FIT, WORST_FIT or TLSF
+ * @return const char* Name, or "?" for an unknown policy
+ */
+const char* policy_name(unsigned policy);
+
+/**
+ * @brief Appends every complete snapshot of a file to an array
+ *
+ * @param path Snapshot file
+ * @param snapshots Array, grown as needed
+ * @param count Snapshots in the array
+ * @return int 0 if the file was read to the end, -1 if it could not be opened or is corrupted
+ */
+int load_snapshots(const char* path, Snapshot** snapshots, size_t* count);
+
+/**
+ * @brief Computes the totals of a snapshot
+ *
+ * @param s Snapshot
+ * @param stats Receives the totals
+ */
+void snapshot_stats(const Snapshot* s, HeapStats* stats);
+
+/**
+ * @brief Prints one line per snapshot with its totals
+ *
+ * @param snapshots Snapshots
+ * @param count Number of snapshots
+ */
+void print_summary(const Snapshot* snapshots, size_t count);
+
+/**
+ * @brief Prints the largest hole of every snapshot as a bar
+ *
+ * @param snapshots Snapshots
+ * @param count Number of snapshots
+ * @param width Width of the longest bar
+ */
+void print_hole_trend(const Snapshot* snapshots, size_t count, int width);
+
+/**
+ * @brief Prints the free blocks of a snapshot grouped by power of two
+ *
+ * @param s Snapshot
+ * @param width Width of the longest bar
+ */
+void print_histogram(const Snapshot* s, int width);
+
+/**
+ * @brief Prints the heap as a grid where each cell shows how much of its bytes are in use
+ *
+ * @param s Snapshot
+ * @param width Cells per row
+ * @param rows Maximum number of rows
+ */
+void print_occupancy(const Snapshot* s, int width, int rows);
+
+/**
+ * @brief Builds the heap model of a snapshot
+ *
+ * Blocks parked in a fast bin start free, merged with their free neighbours as a consolidation would merge them.
+ *
+ * @param m Model to fill
+ * @param s Snapshot
+ * @param min_payload Smallest payload of a block
+ * @return int 0 on success, -1 if there is no memory for the model
+ */
+int model_load(HeapModel* m, const Snapshot* s, uint64_t min_payload);
+
+/**
+ * @brief Frees a block of the model, merging it and releasing the top
+ *
+ * @param m Model
+ * @param i Block in use
+ */
+void model_free(HeapModel* m, int i);
+
+/**
+ * @brief Allocates a block in the model with a policy, extending the heap if nothing fits
+ *
+ * @param m Model
+ * @param size Payload size, already aligned
+ * @param policy FIRST_FIT, BEST_FIT, WORST_FIT or TLSF
+ * @return int Block allocated
+ */
+int model_malloc(HeapModel* m, uint64_t size, int policy);
+
+/**
+ * @brief Computes the totals of the model
+ *
+ * @param m Model
+ * @param stats Receives the totals
+ */
+void model_stats(const HeapModel* m, HeapStats* stats);
+
+/**
+ * @brief Frees and allocates again the live blocks of a snapshot, from the top of the heap down
+ *
+ * @param s Snapshot
+ * @param policy Policy used for the allocations
+ * @param limit Live blocks to re-fit, 0 for all of them
+ * @param result Receives the outcome
+ * @return int 0 on success, -1 if there is no memory for the model
+ */
+int refit(const Snapshot* s, int policy, size_t limit, RefitResult* result);
+
+/**
+ * @brief Prints the what-if re-fit of a snapshot under every policy
+ *
+ * @param s Snapshot
+ * @param limit Live blocks to re-fit, 0 for all of them
+ */
+void print_refits(const Snapshot* s, size_t limit);
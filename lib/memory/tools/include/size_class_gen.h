@@ -0,0 +1,42 @@
+/**
+ * @file size_class_gen.h
+ * @brief Offline generator of size-class tables from recorded request-size histograms
+ *
+ * Sums one or more histograms written by size_hist_save (SIZE_HIST_PATH),
+ * computes the table of at most k classes that wastes the fewest bytes on
+ * those requests and compares it with plain 8 byte alignment and with the
+ * generic table of the same size. The table is written in the format that
+ * SIZE_CLASSES_PATH loads at startup.
+ */
+
+#include "size_classes.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Default number of classes of the generated table
+ *
+ */
+#define DEFAULT_CLASSES 32
+
+/**
+ * @brief Prints the waste of a table over a histogram as one row of the report
+ *
+ * @param name Name of the table
+ * @param counts Histogram
+ * @param classes Table
+ * @param n Number of classes
+ * @param requested Bytes requested by the histogram, up to SIZE_HIST_MAX
+ */
+void print_waste(const char* name, const uint64_t* counts, const size_t* classes, int n, uint64_t requested);
+
+/**
+ * @brief Prints every class of a table with the requests it serves and the bytes it wastes
+ *
+ * @param counts Histogram
+ * @param classes Table
+ * @param n Number of classes
+ */
+void print_classes(const uint64_t* counts, const size_t* classes, int n);
@@ -0,0 +1,665 @@
+#include "heap_analyze.h"
+
+int main(int argc, char* argv[])
+{
+    Snapshot* snapshots = NULL;
+    size_t count = 0;
+    int width = DEFAULT_WIDTH;
+    int rows = DEFAULT_ROWS;
+    long index = -1;
+    size_t limit = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:r:n:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            width = atoi(optarg);
+            break;
+        case 'r':
+            rows = atoi(optarg);
+            break;
+        case 'n':
+            index = atol(optarg);
+            break;
+        case 'm':
+            limit = (size_t)atol(optarg);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc || width <= 0 || rows <= 0)
+    {
+        fprintf(stderr, "usage: %s [-w width] [-r rows] [-n snapshot] [-m max_refit] snapshot_file...\n", argv[0]);
+        return 2;
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (load_snapshots(argv[i], &snapshots, &count) != 0)
+            fprintf(stderr, "%s: unreadable or truncated snapshot file\n", argv[i]);
+    }
+    if (count == 0)
+    {
+        fprintf(stderr, "no snapshots found\n");
+        return 1;
+    }
+    // By default the detailed views show the last snapshot
+    if (index < 0 || (size_t)index >= count)
+        index = (long)count - 1;
+
+    print_summary(snapshots, count);
+    print_hole_trend(snapshots, count, width);
+    print_histogram(&snapshots[index], width);
+    print_occupancy(&snapshots[index], width, rows);
+    print_refits(&snapshots[index], limit);
+
+    for (size_t i = 0; i < count; i++)
+        free(snapshots[i].records);
+    free(snapshots);
+    return 0;
+}
+
+const char* policy_name(unsigned policy)
+{
+    static const char* names[NUM_POLICIES] = {"FIRST_FIT", "BEST_FIT", "WORST_FIT", "TLSF"};
+
+    return policy < NUM_POLICIES ? names[policy] : "?";
+}
+
+int load_snapshots(const char* path, Snapshot** snapshots, size_t* count)
+{
+    heap_snapshot_header hd;
+    int status = 0;
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+
+    while (fread(&hd, sizeof(hd), 1, file) == 1)
+    {
+        // A header still in zeros is a snapshot that was never completed
+        if (hd.magic != HEAP_SNAPSHOT_MAGIC || hd.version != HEAP_SNAPSHOT_VERSION)
+        {
+            status = -1;
+            break;
+        }
+        heap_snapshot_record* records = malloc(hd.count * sizeof(*records) + 1);
+        Snapshot* grown = realloc(*snapshots, (*count + 1) * sizeof(Snapshot));
+        if (records == NULL || grown == NULL || fread(records, sizeof(*records), hd.count, file) != hd.count)
+        {
+            free(records);
+            if (grown)
+                *snapshots = grown;
+            status = -1;
+            break;
+        }
+        *snapshots = grown;
+        grown[*count].header = hd;
+        grown[*count].records = records;
+        grown[*count].file = path;
+        grown[*count].index = *count;
+        (*count)++;
+    }
+    fclose(file);
+    return status;
+}
+
+/**
+ * @brief Percentage of the free bytes that lie outside the largest hole
+ *
+ * @param stats Totals with free_bytes and largest_hole filled in
+ */
+static void set_fragmentation(HeapStats* stats)
+{
+    stats->fragmentation =
+        stats->free_bytes ? 100.0 * (double)(stats->free_bytes - stats->largest_hole) / (double)stats->free_bytes : 0;
+}
+
+/**
+ * @brief Payload size of a record, without its flags
+ *
+ * @param r Record
+ * @return uint64_t Payload size
+ */
+static uint64_t record_size(const heap_snapshot_record* r)
+{
+    return r->size & ~(uint64_t)HEAP_SNAPSHOT_FLAGS;
+}
+
+/**
+ * @brief Whether a record is space the heap can hand out: a free block, or one parked in a fast bin
+ *
+ * @param r Record
+ * @return int 1 if the block counts as free
+ */
+static int record_free(const heap_snapshot_record* r)
+{
+    return (r->size & HEAP_SNAPSHOT_FLAGS) != 0;
+}
+
+void snapshot_stats(const Snapshot* s, HeapStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->blocks = s->header.count;
+    stats->extent = s->header.top - s->header.start;
+    for (uint64_t i = 0; i < s->header.count; i++)
+    {
+        uint64_t size = record_size(&s->records[i]);
+        if (record_free(&s->records[i]))
+        {
+            stats->holes++;
+            stats->free_bytes += size;
+            if (size > stats->largest_hole)
+                stats->largest_hole = size;
+        }
+        else
+            stats->used_bytes += size;
+    }
+    set_fragmentation(stats);
+}
+
+void print_summary(const Snapshot* snapshots, size_t count)
+{
+    HeapStats stats;
+
+    printf("== Snapshots ==\n");
+    printf("%4s %10s %5s %-9s %9s %8s %12s %12s %12s %7s\n", "#", "time(s)", "arena", "policy", "blocks", "holes",
+           "used", "free", "largest hole", "frag%");
+    for (size_t i = 0; i < count; i++)
+    {
+        const heap_snapshot_header* hd = &snapshots[i].header;
+        snapshot_stats(&snapshots[i], &stats);
+        printf("%4zu %10.3f %5u %-9s %9zu %8zu %12llu %12llu %12llu %7.2f%s\n", i,
+               (double)(hd->time_ns - snapshots[0].header.time_ns) / 1e9, hd->arena, policy_name(hd->policy),
+               stats.blocks, stats.holes, (unsigned long long)stats.used_bytes, (unsigned long long)stats.free_bytes,
+               (unsigned long long)stats.largest_hole, stats.fragmentation,
+               hd->flags & HEAP_SNAPSHOT_TRUNCATED ? " (truncated)" : "");
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Prints a bar of a length proportional to a value
+ *
+ * @param value Value of the bar
+ * @param max Value of a bar of full width
+ * @param width Full width
+ */
+static void print_bar(uint64_t value, uint64_t max, int width)
+{
+    int len = max ? (int)((double)value / (double)max * width + 0.5) : 0;
+
+    if (value && !len)
+        len = 1;
+    for (int i = 0; i < width; i++)
+        putchar(i < len ? '#' : ' ');
+}
+
+void print_hole_trend(const Snapshot* snapshots, size_t count, int width)
+{
+    HeapStats stats;
+    uint64_t max = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        snapshot_stats(&snapshots[i], &stats);
+        if (stats.largest_hole > max)
+            max = stats.largest_hole;
+    }
+
+    printf("== Largest hole trend ==\n");
+    for (size_t i = 0; i < count; i++)
+    {
+        snapshot_stats(&snapshots[i], &stats);
+        printf("%4zu |", i);
+        print_bar(stats.largest_hole, max, width);
+        printf("| %llu\n", (unsigned long long)stats.largest_hole);
+    }
+    printf("\n");
+}
+
+void print_histogram(const Snapshot* s, int width)
+{
+    uint64_t holes[HIST_BUCKETS] = {0};
+    uint64_t bytes[HIST_BUCKETS] = {0};
+    uint64_t max = 0;
+    int lo = HIST_BUCKETS, hi = -1;
+
+    for (uint64_t i = 0; i < s->header.count; i++)
+    {
+        uint64_t size = record_size(&s->records[i]);
+        if (!record_free(&s->records[i]) || !size)
+            continue;
+        int bucket = 63 - __builtin_clzll(size);
+        holes[bucket]++;
+        bytes[bucket] += size;
+        if (bytes[bucket] > max)
+            max = bytes[bucket];
+        if (bucket < lo)
+            lo = bucket;
+        if (bucket > hi)
+            hi = bucket;
+    }
+
+    printf("== Free space histogram (snapshot %zu) ==\n", s->index);
+    if (hi < 0)
+        printf("no free blocks\n");
+    for (int b = lo; b <= hi; b++)
+    {
+        printf("[2^%-2d, 2^%-2d) %8llu holes %12llu bytes |", b, b + 1, (unsigned long long)holes[b],
+               (unsigned long long)bytes[b]);
+        print_bar(bytes[b], max, width);
+        printf("|\n");
+    }
+    printf("\n");
+}
+
+void print_occupancy(const Snapshot* s, int width, int rows)
+{
+    uint64_t start = s->header.start;
+    uint64_t extent = s->header.top - start;
+    uint64_t cells = (uint64_t)width * (uint64_t)rows;
+
+    printf("== Occupancy map (snapshot %zu) ==\n", s->index);
+    if (!extent)
+    {
+        printf("empty heap\n\n");
+        return;
+    }
+
+    uint64_t cell = align((extent + cells - 1) / cells);
+    cells = (extent + cell - 1) / cell;
+    uint64_t* used = calloc(cells, sizeof(*used));
+    if (used == NULL)
+        return;
+
+    // Headers count as used: they are bytes the heap cannot hand out
+    for (uint64_t i = 0; i < s->header.count; i++)
+    {
+        const heap_snapshot_record* r = &s->records[i];
+        uint64_t from = r->address - start;
+        uint64_t to = from + BLOCK_SIZE + (record_free(r) ? 0 : record_size(r));
+        if (to > extent)
+            to = extent;
+        while (from < to)
+        {
+            uint64_t c = from / cell;
+            uint64_t end = (c + 1) * cell < to ? (c + 1) * cell : to;
+            used[c] += end - from;
+            from = end;
+        }
+    }
+
+    printf("one cell = %llu bytes; '#' in use, '+' over half, '-' under half, '.' free\n", (unsigned long long)cell);
+    for (uint64_t c = 0; c < cells; c++)
+    {
+        if (c % (uint64_t)width == 0)
+            printf("%s+0x%010llx |", c ? "|\n" : "", (unsigned long long)(c * cell));
+        uint64_t span = (c + 1) * cell <= extent ? cell : extent - c * cell;
+        putchar(used[c] >= span ? '#' : used[c] * 2 > span ? '+' : used[c] ? '-' : '.');
+    }
+    printf("|\n\n");
+    free(used);
+}
+
+int model_load(HeapModel* m, const Snapshot* s, uint64_t min_payload)
+{
+    uint64_t n = s->header.count;
+
+    memset(m, 0, sizeof(*m));
+    // Every allocation splits at most one block, so the model needs one extra entry per block
+    m->blocks = malloc((2 * n + 1) * sizeof(ModelBlock));
+    if (m->blocks == NULL)
+        return -1;
+    m->head = m->tail = m->free_head = -1;
+    m->top = s->header.top - s->header.start;
+    m->min_payload = min_payload;
+
+    for (uint64_t i = 0; i < n; i++)
+    {
+        ModelBlock* b = &m->blocks[m->count];
+        b->address = s->records[i].address - s->header.start;
+        b->size = record_size(&s->records[i]);
+        b->free = (int)(s->records[i].size & HEAP_SNAPSHOT_FREE);
+        b->prev = m->tail;
+        b->next = -1;
+        b->free_prev = -1;
+        b->free_next = -1;
+        if (m->tail >= 0)
+            m->blocks[m->tail].next = m->count;
+        else
+            m->head = m->count;
+        m->tail = m->count;
+        if (b->free)
+        {
+            b->free_next = m->free_head;
+            if (m->free_head >= 0)
+                m->blocks[m->free_head].free_prev = m->count;
+            m->free_head = m->count;
+        }
+        m->count++;
+    }
+    // A truncated snapshot ends at its last block
+    if (s->header.flags & HEAP_SNAPSHOT_TRUNCATED)
+        m->top = m->tail >= 0 ? m->blocks[m->tail].address + BLOCK_SIZE + m->blocks[m->tail].size : 0;
+
+    // Parked blocks are freed as heap_consolidate() would, merging with their free neighbours
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (s->records[i].size & HEAP_SNAPSHOT_PARKED)
+            model_free(m, (int)i);
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds a free block to the free list of the model
+ *
+ * @param m Model
+ * @param i Free block
+ */
+static void free_list_push(HeapModel* m, int i)
+{
+    m->blocks[i].free_prev = -1;
+    m->blocks[i].free_next = m->free_head;
+    if (m->free_head >= 0)
+        m->blocks[m->free_head].free_prev = i;
+    m->free_head = i;
+}
+
+/**
+ * @brief Removes a free block from the free list of the model
+ *
+ * @param m Model
+ * @param i Free block
+ */
+static void free_list_remove(HeapModel* m, int i)
+{
+    ModelBlock* b = &m->blocks[i];
+
+    if (b->free_prev >= 0)
+        m->blocks[b->free_prev].free_next = b->free_next;
+    else
+        m->free_head = b->free_next;
+    if (b->free_next >= 0)
+        m->blocks[b->free_next].free_prev = b->free_prev;
+}
+
+/**
+ * @brief Unlinks a block from the address list of the model
+ *
+ * @param m Model
+ * @param i Block
+ */
+static void unlink_block(HeapModel* m, int i)
+{
+    ModelBlock* b = &m->blocks[i];
+
+    if (b->prev >= 0)
+        m->blocks[b->prev].next = b->next;
+    else
+        m->head = b->next;
+    if (b->next >= 0)
+        m->blocks[b->next].prev = b->prev;
+    else
+        m->tail = b->prev;
+}
+
+void model_free(HeapModel* m, int i)
+{
+    m->blocks[i].free = 1;
+    if (m->blocks[i].prev >= 0 && m->blocks[m->blocks[i].prev].free)
+    {
+        int p = m->blocks[i].prev;
+        free_list_remove(m, p);
+        m->blocks[p].size += BLOCK_SIZE + m->blocks[i].size;
+        unlink_block(m, i);
+        i = p;
+    }
+    while (m->blocks[i].next >= 0 && m->blocks[m->blocks[i].next].free)
+    {
+        int n = m->blocks[i].next;
+        free_list_remove(m, n);
+        m->blocks[i].size += BLOCK_SIZE + m->blocks[n].size;
+        unlink_block(m, n);
+    }
+
+    // As in heap_fusion(), a free block at the top goes back to the system
+    if (i == m->tail)
+    {
+        m->top = m->blocks[i].address;
+        unlink_block(m, i);
+    }
+    else
+        free_list_push(m, i);
+}
+
+/**
+ * @brief TLSF class of a size, with the mapping of memory.c flattened to one number
+ *
+ * @param size Block size
+ * @return int Class, larger for larger sizes
+ */
+static int tlsf_class(uint64_t size)
+{
+    if (size < TLSF_SMALL)
+        return (int)(size / (TLSF_SMALL / TLSF_SL_COUNT));
+
+    int bit = 63 - __builtin_clzll(size);
+    int fl = bit - TLSF_SL_LOG - 2;
+    int sl = (int)(size >> (bit - TLSF_SL_LOG)) ^ TLSF_SL_COUNT;
+    if (fl >= TLSF_FL_COUNT)
+        return TLSF_FL_COUNT * TLSF_SL_COUNT - 1;
+    return fl * TLSF_SL_COUNT + sl;
+}
+
+/**
+ * @brief Best fit walked as find_best_fit() in memory.c walks it
+ *
+ * Blocks are visited in address order and an exact fit ends the search. A block that would leave a page or more
+ * unused is never taken, so such a request extends the heap instead.
+ *
+ * @param m Model
+ * @param size Payload size, already aligned
+ * @return int Free block chosen, -1 if none qualifies
+ */
+static int model_best_fit(const HeapModel* m, uint64_t size)
+{
+    uint64_t dif = PAGESIZE;
+    int best = -1;
+
+    for (int i = m->head; i >= 0; i = m->blocks[i].next)
+    {
+        const ModelBlock* b = &m->blocks[i];
+        if (!b->free)
+            continue;
+        if (b->size == size)
+            return i;
+        if (b->size > size && b->size - size < dif)
+        {
+            dif = b->size - size;
+            best = i;
+        }
+    }
+    return best;
+}
+
+int model_malloc(HeapModel* m, uint64_t size, int policy)
+{
+    uint64_t rounded = size;
+    int found = -1;
+
+    if (size >= TLSF_SMALL)
+        rounded += ((uint64_t)1 << (63 - __builtin_clzll(size) - TLSF_SL_LOG)) - 1;
+    int wanted = tlsf_class(rounded);
+
+    if (policy == BEST_FIT)
+        found = model_best_fit(m, size);
+    else
+    {
+        for (int i = m->free_head; i >= 0; i = m->blocks[i].free_next)
+        {
+            const ModelBlock* b = &m->blocks[i];
+            // TLSF never looks below the class of the rounded request, even for a block that would fit
+            if (b->size < size || (policy == TLSF && tlsf_class(b->size) < wanted))
+                continue;
+            if (found < 0)
+            {
+                found = i;
+                continue;
+            }
+            const ModelBlock* f = &m->blocks[found];
+            int better;
+            switch (policy)
+            {
+            case WORST_FIT:
+                better = b->size > f->size || (b->size == f->size && b->address < f->address);
+                break;
+            case TLSF:
+                // The first non-empty class, any block within it
+                better = tlsf_class(b->size) < tlsf_class(f->size) ||
+                         (tlsf_class(b->size) == tlsf_class(f->size) && b->address < f->address);
+                break;
+            default:
+                better = b->address < f->address;
+                break;
+            }
+            if (better)
+                found = i;
+        }
+    }
+
+    if (found < 0)
+    {
+        // Nothing fits: a new block at the top
+        found = m->count++;
+        ModelBlock* b = &m->blocks[found];
+        b->address = m->top;
+        b->size = size;
+        b->free = 0;
+        b->prev = m->tail;
+        b->next = -1;
+        if (m->tail >= 0)
+            m->blocks[m->tail].next = found;
+        else
+            m->head = found;
+        m->tail = found;
+        m->top += BLOCK_SIZE + size;
+        return found;
+    }
+
+    free_list_remove(m, found);
+    m->blocks[found].free = 0;
+    if (m->blocks[found].size - size >= BLOCK_SIZE + m->min_payload)
+    {
+        int r = m->count++;
+        ModelBlock* b = &m->blocks[found];
+        ModelBlock* rest = &m->blocks[r];
+        rest->address = b->address + BLOCK_SIZE + size;
+        rest->size = b->size - size - BLOCK_SIZE;
+        rest->free = 1;
+        rest->prev = found;
+        rest->next = b->next;
+        if (b->next >= 0)
+            m->blocks[b->next].prev = r;
+        else
+            m->tail = r;
+        b->next = r;
+        b->size = size;
+        free_list_push(m, r);
+    }
+    return found;
+}
+
+void model_stats(const HeapModel* m, HeapStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->extent = m->top;
+    for (int i = m->head; i >= 0; i = m->blocks[i].next)
+    {
+        const ModelBlock* b = &m->blocks[i];
+        stats->blocks++;
+        if (b->free)
+        {
+            stats->holes++;
+            stats->free_bytes += b->size;
+            if (b->size > stats->largest_hole)
+                stats->largest_hole = b->size;
+        }
+        else
+            stats->used_bytes += b->size;
+    }
+    set_fragmentation(stats);
+}
+
+int refit(const Snapshot* s, int policy, size_t limit, RefitResult* result)
+{
+    HeapModel m;
+    uint64_t min_payload = policy == TLSF ? 2 * sizeof(uint64_t) : 8;
+
+    if (model_load(&m, s, min_payload) != 0)
+        return -1;
+    int* live = malloc((s->header.count + 1) * sizeof(int));
+    if (live == NULL)
+    {
+        free(m.blocks);
+        return -1;
+    }
+
+    // The blocks nearest to the top are the ones whose move can shrink the heap
+    size_t n = 0;
+    for (int i = m.tail; i >= 0 && (!limit || n < limit); i = m.blocks[i].prev)
+    {
+        if (!m.blocks[i].free)
+            live[n++] = i;
+    }
+
+    result->policy = policy;
+    result->moved = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+        uint64_t address = m.blocks[live[k]].address;
+        uint64_t size = m.blocks[live[k]].size;
+        model_free(&m, live[k]);
+        int j = model_malloc(&m, size < min_payload ? min_payload : size, policy);
+        if (m.blocks[j].address != address)
+            result->moved++;
+    }
+    model_stats(&m, &result->stats);
+
+    free(live);
+    free(m.blocks);
+    return 0;
+}
+
+void print_refits(const Snapshot* s, size_t limit)
+{
+    HeapStats stats;
+    RefitResult result;
+
+    snapshot_stats(s, &stats);
+    printf("== What-if re-fit (snapshot %zu, %s live blocks from the top down) ==\n", s->index,
+           limit ? "some" : "all");
+    printf("%-9s %9s %12s %8s %12s %12s %7s\n", "policy", "moved", "extent", "holes", "free", "largest hole",
+           "frag%");
+    printf("%-9s %9s %12llu %8zu %12llu %12llu %7.2f\n", "snapshot", "-", (unsigned long long)stats.extent,
+           stats.holes, (unsigned long long)stats.free_bytes, (unsigned long long)stats.largest_hole,
+           stats.fragmentation);
+    for (int p = 0; p < NUM_POLICIES; p++)
+    {
+        if (refit(s, p, limit, &result) != 0)
+        {
+            fprintf(stderr, "out of memory re-fitting with %s\n", policy_name((unsigned)p));
+            continue;
+        }
+        printf("%-9s %9zu %12llu %8zu %12llu %12llu %7.2f\n", policy_name((unsigned)p), result.moved,
+               (unsigned long long)result.stats.extent, result.stats.holes,
+               (unsigned long long)result.stats.free_bytes, (unsigned long long)result.stats.largest_hole,
+               result.stats.fragmentation);
+    }
+    printf("\n");
+}
@@ -0,0 +1,104 @@
+#include "size_class_gen.h"
+
+int main(int argc, char* argv[])
+{
+    static uint64_t counts[SIZE_HIST_BUCKETS];
+    static uint64_t file_counts[SIZE_HIST_BUCKETS];
+    size_t generated[SIZE_CLASSES_MAX], generic[SIZE_CLASSES_MAX];
+    const char* output = NULL;
+    int k = DEFAULT_CLASSES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            k = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc || k <= 0 || k > SIZE_CLASSES_MAX)
+    {
+        fprintf(stderr, "usage: %s [-k classes (1-%d)] [-o table_file] histogram_file...\n", argv[0],
+                SIZE_CLASSES_MAX);
+        return 2;
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (size_hist_load(argv[i], file_counts) != 0)
+        {
+            fprintf(stderr, "%s: cannot read the histogram\n", argv[i]);
+            return 1;
+        }
+        for (int s = 0; s < SIZE_HIST_BUCKETS; s++)
+            counts[s] += file_counts[s];
+    }
+
+    uint64_t requests = 0, requested = 0;
+    for (size_t s = 1; s <= SIZE_HIST_MAX; s++)
+    {
+        requests += counts[s];
+        requested += counts[s] * s;
+    }
+    int n = size_classes_optimize(counts, k, generated);
+    if (n <= 0)
+    {
+        fprintf(stderr, "no requests of up to %d bytes in the histograms\n", SIZE_HIST_MAX);
+        return 1;
+    }
+    int g = size_classes_generic(generic, k);
+
+    printf("%llu requests of up to %d bytes (%llu bytes), %llu larger\n\n", (unsigned long long)requests,
+           SIZE_HIST_MAX, (unsigned long long)requested, (unsigned long long)counts[SIZE_HIST_MAX + 1]);
+    printf("%-24s %14s %8s\n", "table", "wasted bytes", "waste%");
+    print_waste("8 byte alignment", counts, NULL, 0, requested);
+    print_waste("generic", counts, generic, g, requested);
+    print_waste("generated", counts, generated, n, requested);
+    printf("\n");
+    print_classes(counts, generated, n);
+
+    if (output && size_classes_save(output, generated, n) != 0)
+    {
+        perror(output);
+        return 1;
+    }
+    return 0;
+}
+
+void print_waste(const char* name, const uint64_t* counts, const size_t* classes, int n, uint64_t requested)
+{
+    char label[64];
+    uint64_t waste = size_classes_waste(counts, classes, n);
+
+    if (n)
+        snprintf(label, sizeof(label), "%s (%d classes)", name, n);
+    else
+        snprintf(label, sizeof(label), "%s", name);
+    printf("%-24s %14llu %8.2f\n", label, (unsigned long long)waste,
+           requested ? 100.0 * (double)waste / (double)requested : 0);
+}
+
+void print_classes(const uint64_t* counts, const size_t* classes, int n)
+{
+    size_t size = 1;
+
+    printf("%8s %12s %14s\n", "class", "requests", "wasted bytes");
+    for (int c = 0; c < n; c++)
+    {
+        uint64_t requests = 0, waste = 0;
+        for (; size <= classes[c]; size++)
+        {
+            requests += counts[size];
+            waste += counts[size] * (classes[c] - size);
+        }
+        printf("%8zu %12llu %14llu\n", classes[c], (unsigned long long)requests, (unsigned long long)waste);
+    }
+}